@@ -0,0 +1,204 @@
+#include <atomic>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include "Async.h"
+#include "BoundedQueue.h"
+#include "Model.h"
+#include "Stats.h"
+#include "Timer.h"
+#include "Trace.h"
+
+using namespace std;
+
+struct InferenceState
+{
+    InferenceState() : future(result.get_future().share()), done(false) {}
+
+    promise<vector<double> > result;
+    shared_future<vector<double> > future;
+    mutex lock;
+    bool done;
+    vector<function<void()> > continuations;
+
+    //the value or exception is set before the continuations are taken
+    void finish()
+    {
+        vector<function<void()> > pending;
+        {
+            lock_guard<mutex> guard(lock);
+            done = true;
+            pending.swap(continuations);
+        }
+        for (size_t c = 0; c < pending.size(); c++)
+            pending[c]();
+    }
+};
+
+//------------------------------------------------------------------ Inference
+
+Inference::Inference(){}
+
+Inference::Inference(shared_ptr<InferenceState> const &state) : state(state) {}
+
+bool Inference::valid() const
+{
+    return (bool) state;
+}
+
+bool Inference::ready() const
+{
+    lock_guard<mutex> guard(state->lock);
+    return state->done;
+}
+
+vector<double> Inference::get() const
+{
+    return state->future.get();
+}
+
+shared_future<vector<double> > Inference::future() const
+{
+    return state->future;
+}
+
+void Inference::then(function<void()> continuation) const
+{
+    {
+        lock_guard<mutex> guard(state->lock);
+        if (!state->done) {
+            state->continuations.push_back(continuation);
+            return;
+        }
+    }
+    continuation();
+}
+
+//----------------------------------------------------------------- Dispatcher
+
+struct Submission
+{
+    Model const* model;
+    vector<double> planes;
+    shared_ptr<InferenceState> state;
+    unsigned long long submitted;
+};
+
+//one thread for the process, started on the first submit; runs of
+//submissions for the same model become one forward batch
+class Dispatcher
+{
+public:
+    Dispatcher() : queue(Async::QUEUE_DEPTH), images(0), batches(0)
+    {
+        worker = thread(&Dispatcher::run, this);
+    }
+
+    ~Dispatcher()
+    {
+        queue.close();
+        worker.join();
+    }
+
+    void submit(Submission* submission)
+    {
+        Stats::enqueued();
+        queue.push(submission);
+    }
+
+    BoundedQueue<Submission*> queue;
+    atomic<unsigned long long> images;
+    atomic<unsigned long long> batches;
+
+private:
+    thread worker;
+
+    void run()
+    {
+        vector<Submission*> pending;
+        Submission* submission;
+
+        while (queue.pop(submission)) {
+            pending.assign(1, submission);
+            while ((int)pending.size() < Async::MAX_BATCH && queue.tryPop(submission))
+                pending.push_back(submission);
+            for (size_t p = 0; p < pending.size(); p++)
+                Stats::dequeued();
+
+            size_t first = 0;
+            while (first < pending.size()) {
+                size_t last = first + 1;
+                while (last < pending.size() && pending[last]->model == pending[first]->model)
+                    last++;
+                runBatch(pending.data() + first, last - first);
+                first = last;
+            }
+        }
+    }
+
+    void runBatch(Submission** batch, size_t count)
+    {
+        Model const &model = *batch[0]->model;
+        vector<const double*> inputs(count);
+        vector<double*> outputs(count);
+        vector<vector<double> > results(count, vector<double>(model.outputSize()));
+        for (size_t i = 0; i < count; i++) {
+            inputs[i] = batch[i]->planes.data();
+            outputs[i] = results[i].data();
+        }
+
+        exception_ptr failure;
+        try {
+            TRACE_SCOPE("async", "batch");
+            model.forward(inputs.data(), outputs.data(), count);
+        } catch (...) {
+            failure = current_exception();
+        }
+
+        //counted before anyone is woken, so a caller that saw its result sees it counted
+        images += count;
+        batches++;
+
+        for (size_t i = 0; i < count; i++) {
+            Stats::page().requests.latency.record(Timer::rdtsc() - batch[i]->submitted);
+            if (failure)
+                batch[i]->state->result.set_exception(failure);
+            else
+                batch[i]->state->result.set_value(move(results[i]));
+            batch[i]->state->finish();
+            delete batch[i];
+        }
+    }
+};
+
+static Dispatcher& dispatcher()
+{
+    static Dispatcher instance;
+    return instance;
+}
+
+namespace Async
+{
+    Inference submit(Model const &model, vector<double> planes)
+    {
+        if ((long)planes.size() != model.inputSize())
+            throw logic_error("Invalid: the model takes " + to_string(model.inputSize()) + " doubles per image.");
+
+        shared_ptr<InferenceState> state = make_shared<InferenceState>();
+        Submission* submission = new Submission();
+        submission->model = &model;
+        submission->planes.swap(planes);
+        submission->state = state;
+        submission->submitted = Timer::rdtsc();
+
+        dispatcher().submit(submission);
+        return Inference(state);
+    }
+
+    void counts(unsigned long long &images, unsigned long long &batches)
+    {
+        images = dispatcher().images;
+        batches = dispatcher().batches;
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef DEF_ASYNC
+#define DEF_ASYNC
+
+#include <functional>
+#include <future>
+#include <memory>
+#include <vector>
+#if __cplusplus >= 202002L
+#include <coroutine>
+#endif
+
+class Model;
+
+//Non-blocking inference: Model::submit queues an image for the process-wide
+//dispatcher thread and returns an Inference at once. The dispatcher takes
+//whatever is queued, up to Async::MAX_BATCH images, and runs each model's
+//share as one Model::forward batch, one image per OpenMP thread. Many
+//inferences can be in flight with no thread per request.
+//
+//An Inference is a shared_future in every build. Under C++20 it can also be
+//co_await'ed: the coroutine resumes on the dispatcher thread that finished
+//it, so hand heavy work on from there.
+//
+//  Inference scores = model.submit(planes);           //C++11
+//  use(scores.get());
+//
+//  std::vector<double> scores = co_await model.submit(planes); //C++20
+//
+//The Model must outlive the inferences submitted to it.
+struct InferenceState;
+
+class Inference
+{
+public:
+	Inference();
+	explicit Inference(std::shared_ptr<InferenceState> const &state);
+
+	bool valid() const;
+	bool ready() const;
+	//waits for the result; rethrows what the forward pass threw
+	std::vector<double> get() const;
+	std::shared_future<std::vector<double> > future() const;
+	//runs once the result is in, on the dispatcher thread (or now, if it already is)
+	void then(std::function<void()> continuation) const;
+
+#if __cplusplus >= 202002L
+	bool await_ready() const { return ready(); }
+	void await_suspend(std::coroutine_handle<> handle) const { then([handle]() { handle.resume(); }); }
+	std::vector<double> await_resume() const { return get(); }
+#endif
+
+private:
+	std::shared_ptr<InferenceState> state;
+};
+
+namespace Async
+{
+	//queued submissions beyond this make submit() wait
+	const int QUEUE_DEPTH = 1024;
+	//most images the dispatcher runs in one pass
+	const int MAX_BATCH = 16;
+
+	//planes must hold model.inputSize() doubles, logic_error otherwise
+	Inference submit(Model const &model, std::vector<double> planes);
+	//images and batches the dispatcher has run so far
+	void counts(unsigned long long &images, unsigned long long &batches);
+}
+
+#endif
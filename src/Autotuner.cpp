@@ -0,0 +1,306 @@
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <omp.h>
+#include "Autotuner.h"
+#include "Jit.h"
+#include "Kernels.h"
+
+using namespace std;
+
+#define TUNING_CACHE_ENV "FASTCODE_TUNING_CACHE"
+#define TUNING_CACHE_DEFAULT "fastcode_tuning.cache"
+#define TUNING_REPETITIONS 3
+
+string ConvSignature::key() const
+{
+    ostringstream out;
+    out << height << ' ' << width << ' ' << inputChannels << ' ' << outputChannels << ' '
+        << Fh << ' ' << Fw << ' ' << strideY << ' ' << strideX << ' ' << padY << ' ' << padX << ' '
+        << dilationY << ' ' << dilationX << ' ' << groups << ' ' << batch << ' ' << threads;
+    return out.str();
+}
+
+Autotuner::Autotuner()
+{
+    const char* path = getenv(TUNING_CACHE_ENV);
+    this->cacheFile = (path != NULL) ? path : TUNING_CACHE_DEFAULT;
+    this->cpu = cpuModel() + " [" + Kernels::active().name + "]";
+    load();
+}
+
+Autotuner::Autotuner(string cacheFile)
+{
+    this->cacheFile = cacheFile;
+    this->cpu = cpuModel() + " [" + Kernels::active().name + "]";
+    load();
+}
+
+string Autotuner::getCacheFile() const
+{
+    return cacheFile;
+}
+
+string Autotuner::cpuModel()
+{
+    ifstream cpuinfo("/proc/cpuinfo");
+    string line;
+
+    while (getline(cpuinfo, line)) {
+        if (line.compare(0, 10, "model name") == 0) {
+            size_t colon = line.find(':');
+            if (colon != string::npos && colon + 2 <= line.size())
+                return line.substr(colon + 2);
+        }
+    }
+
+    return "unknown";
+}
+
+string Autotuner::engineName(ConvEngine engine)
+{
+    switch (engine) {
+        case ENGINE_NAIVE: return "naive";
+        case ENGINE_BASELINE: return "baseline";
+        case ENGINE_SIMD: return "simd";
+        case ENGINE_SIMD_OPENMP: return "simd_openmp";
+        case ENGINE_JIT: return "jit";
+        case ENGINE_GEMM: return "gemm";
+    }
+    return "unknown";
+}
+
+static bool engineFromName(string const &name, ConvEngine &engine)
+{
+    ConvEngine engines[] = {ENGINE_NAIVE, ENGINE_BASELINE, ENGINE_SIMD, ENGINE_SIMD_OPENMP, ENGINE_JIT, ENGINE_GEMM};
+
+    for (ConvEngine candidate : engines) {
+        if (Autotuner::engineName(candidate) == name) {
+            engine = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+ConvSignature Autotuner::signatureOf(Tensor const &input, Filters const &setOfFilters, ConvParams const &params, int batch)
+{
+    return signatureOf(input.getHeight(), input.getWidth(), input.getDepth(), setOfFilters.getNumberOfFilters(),
+                       setOfFilters.getHeight(), setOfFilters.getWidth(), params, batch);
+}
+
+ConvSignature Autotuner::signatureOf(int height, int width, int inputChannels, int outputChannels, int Fh, int Fw,
+                                     ConvParams const &params, int batch)
+{
+    ConvSignature signature;
+    signature.height = height;
+    signature.width = width;
+    signature.inputChannels = inputChannels;
+    signature.outputChannels = outputChannels;
+    signature.Fh = Fh;
+    signature.Fw = Fw;
+    signature.strideY = params.strideY;
+    signature.strideX = params.strideX;
+    signature.padY = params.padY;
+    signature.padX = params.padX;
+    signature.dilationY = params.dilationY;
+    signature.dilationX = params.dilationX;
+    signature.groups = params.groups;
+    signature.batch = batch;
+    signature.threads = omp_get_max_threads();
+    return signature;
+}
+
+bool Autotuner::supports(ConvPlan plan, ConvSignature const &signature)
+{
+    switch (plan.engine) {
+        case ENGINE_NAIVE:
+        case ENGINE_BASELINE:
+        case ENGINE_SIMD:
+        case ENGINE_SIMD_OPENMP:
+            //the SIMD row kernels mask the stores of a partial last filter group
+            return true;
+        case ENGINE_JIT:
+            //shape-specialised code with masked stores for the last filter group
+            return Jit::isAvailable();
+        case ENGINE_GEMM:
+            //the planar input is the GEMM operand only for unpadded 1x1 filters
+            //(a 1x1 filter has no taps for a dilation to spread)
+            return signature.Fh == 1 && signature.Fw == 1 && signature.padY == 0 && signature.padX == 0
+                   && signature.dilationY == 1 && signature.dilationX == 1;
+    }
+    return false;
+}
+
+void Autotuner::load()
+{
+    ifstream input(cacheFile);
+    string line;
+
+    //one record per line: cpu model [isa], signature key, engine, xBlock, seconds (tab separated)
+    while (getline(input, line)) {
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        vector<string> fields;
+        istringstream buffer(line);
+        string field;
+        while (getline(buffer, field, '\t'))
+            fields.push_back(field);
+
+        if (fields.size() < 4 || fields[0] != cpu)
+            continue;
+
+        ConvPlan plan;
+        if (!engineFromName(fields[2], plan.engine))
+            continue;
+        plan.xBlock = atoi(fields[3].c_str());
+
+        //later records win, so a re-tune simply appends
+        plans[fields[1]] = plan;
+    }
+}
+
+void Autotuner::save(ConvSignature const &signature, ConvPlan plan, double seconds)
+{
+    ofstream output(cacheFile, ios::app);
+
+    if (!output) {
+        cerr << "Autotuner: cannot write tuning cache " << cacheFile << endl;
+        return;
+    }
+
+    output << cpu << '\t' << signature.key() << '\t' << engineName(plan.engine) << '\t'
+           << plan.xBlock << '\t' << seconds << '\n';
+}
+
+bool Autotuner::hasPlan(ConvSignature const &signature) const
+{
+    return plans.count(signature.key()) > 0;
+}
+
+ConvPlan Autotuner::getPlan(ConvSignature const &signature) const
+{
+    map<string, ConvPlan>::const_iterator it = plans.find(signature.key());
+
+    if (it == plans.end())
+        throw logic_error("Invalid: No tuned plan for layer signature.");
+
+    return it->second;
+}
+
+//a batch runs one image per thread as in Model::forward, where the engines'
+//own parallel regions get a team of one, so it is timed the same way
+static double timeConv(Tensor &input, Filters const &setOfFilters, ConvParams const &params, int bias, ConvPlan plan,
+                       int batch)
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    if (batch == 1) {
+        input.fwdConv(setOfFilters, params, bias, plan);
+    } else {
+        //exceptions cannot leave the parallel loop, the first one is rethrown after it
+        vector<string> errors(batch);
+
+        #pragma omp parallel for schedule(dynamic, 1)
+        for (int i = 0; i < batch; i++) {
+            try {
+                input.fwdConv(setOfFilters, params, bias, plan);
+            } catch (exception const &error) {
+                errors[i] = error.what();
+            }
+        }
+
+        for (int i = 0; i < batch; i++) {
+            if (!errors[i].empty())
+                throw runtime_error(errors[i]);
+        }
+    }
+    chrono::steady_clock::time_point end = chrono::steady_clock::now();
+
+    return chrono::duration<double>(end - start).count();
+}
+
+ConvPlan Autotuner::tune(Tensor &input, Filters const &setOfFilters, int stride, int bias, int padding)
+{
+    return tune(input, setOfFilters, convParams(stride, padding), bias, 1);
+}
+
+ConvPlan Autotuner::tune(Tensor &input, Filters const &setOfFilters, int stride, int bias, int padding, int batch)
+{
+    return tune(input, setOfFilters, convParams(stride, padding), bias, batch);
+}
+
+ConvPlan Autotuner::tune(Tensor &input, Filters const &setOfFilters, ConvParams const &params, int bias, int batch)
+{
+    if (batch < 1)
+        throw logic_error("Invalid: the batch must be at least 1.");
+
+    ConvSignature signature = signatureOf(input, setOfFilters, params, batch);
+
+    if (hasPlan(signature))
+        return getPlan(signature);
+
+    //fastest-looking candidates first so slow ones can be cut off early
+    vector<ConvPlan> candidates;
+    ConvPlan gemm = {ENGINE_GEMM, 1};
+    candidates.push_back(gemm);
+    ConvPlan jit = {ENGINE_JIT, 1};
+    candidates.push_back(jit);
+    int xBlocks[] = {1, 2, 4, 8};
+    for (int xBlock : xBlocks) {
+        ConvPlan plan = {ENGINE_SIMD_OPENMP, xBlock};
+        candidates.push_back(plan);
+    }
+    for (int xBlock : xBlocks) {
+        ConvPlan plan = {ENGINE_SIMD, xBlock};
+        candidates.push_back(plan);
+    }
+    ConvPlan baseline = {ENGINE_BASELINE, 1};
+    candidates.push_back(baseline);
+
+    vector<ConvPlan> supported;
+    for (ConvPlan plan : candidates) {
+        if (supports(plan, signature))
+            supported.push_back(plan);
+    }
+
+    //the naive engine allocates per window and is only worth running when nothing else can
+    if (supported.empty()) {
+        ConvPlan naive = {ENGINE_NAIVE, 1};
+        supported.push_back(naive);
+    }
+
+    ConvPlan best = supported[0];
+    double bestSeconds = -1;
+
+    for (ConvPlan plan : supported) {
+        //warm-up run, which also lets clearly slower candidates drop out
+        double seconds = timeConv(input, setOfFilters, params, bias, plan, batch);
+        if (bestSeconds >= 0 && seconds > 4 * bestSeconds)
+            continue;
+
+        for (int r = 0; r < TUNING_REPETITIONS; r++) {
+            double repetition = timeConv(input, setOfFilters, params, bias, plan, batch);
+            if (repetition < seconds)
+                seconds = repetition;
+        }
+
+        if (bestSeconds < 0 || seconds < bestSeconds) {
+            best = plan;
+            bestSeconds = seconds;
+        }
+    }
+
+    plans[signature.key()] = best;
+    save(signature, best, bestSeconds);
+
+    return best;
+}
+
+Tensor Autotuner::fwdConv(Tensor &input, Filters const &setOfFilters, int stride, int bias, int padding)
+{
+    ConvPlan plan = tune(input, setOfFilters, stride, bias, padding);
+    return input.fwdConv(setOfFilters, stride, bias, padding, plan);
+}
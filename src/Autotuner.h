@@ -0,0 +1,65 @@
+#ifndef DEF_AUTOTUNER
+#define DEF_AUTOTUNER
+
+#include <map>
+#include <string>
+#include "Tensor.h"
+#include "Filters.h"
+
+//everything that decides which engine is fastest for a convolution layer
+struct ConvSignature
+{
+	int height;
+	int width;
+	int inputChannels;
+	int outputChannels;
+	int Fh;
+	int Fw;
+	int strideY;
+	int strideX;
+	int padY;
+	int padX;
+	int dilationY;
+	int dilationX;
+	int groups;
+	int batch;
+	int threads;
+
+	std::string key() const;
+};
+
+class Autotuner
+{
+public:
+	Autotuner();
+	Autotuner(std::string cacheFile);
+
+	//returns the cached plan for the layer, benchmarking every candidate on a miss;
+	//with a batch the candidates are timed on that many inputs at once, one
+	//per thread, as Model::forward runs a batch
+	ConvPlan tune(Tensor &input, Filters const &setOfFilters, int stride, int bias, int padding);
+	ConvPlan tune(Tensor &input, Filters const &setOfFilters, int stride, int bias, int padding, int batch);
+	ConvPlan tune(Tensor &input, Filters const &setOfFilters, ConvParams const &params, int bias, int batch);
+	Tensor fwdConv(Tensor &input, Filters const &setOfFilters, int stride, int bias, int padding);
+
+	bool hasPlan(ConvSignature const &signature) const;
+	ConvPlan getPlan(ConvSignature const &signature) const;
+	std::string getCacheFile() const;
+
+	static ConvSignature signatureOf(Tensor const &input, Filters const &setOfFilters, ConvParams const &params, int batch);
+	static ConvSignature signatureOf(int height, int width, int inputChannels, int outputChannels, int Fh, int Fw,
+	                                 ConvParams const &params, int batch);
+	static bool supports(ConvPlan plan, ConvSignature const &signature);
+	static std::string cpuModel();
+	static std::string engineName(ConvEngine engine);
+
+private:
+	std::string cacheFile;
+	std::string cpu;
+	std::map<std::string, ConvPlan> plans;
+
+	void load();
+	void save(ConvSignature const &signature, ConvPlan plan, double seconds);
+};
+
+#endif
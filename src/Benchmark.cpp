@@ -0,0 +1,373 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include "Autotuner.h"
+#include "Benchmark.h"
+#include "Jit.h"
+#include "Kernels.h"
+#include "PerfCounters.h"
+#include "TensorFile.h"
+#include "Timer.h"
+#include "Utility.h"
+
+using namespace std;
+
+namespace Benchmark
+{
+    Settings defaults()
+    {
+        Settings settings;
+        settings.engines.push_back("baseline");
+        settings.engines.push_back("simd");
+        settings.engines.push_back("simd_openmp");
+        settings.engines.push_back("jit");
+        settings.engines.push_back("gemm");
+        settings.layersDir = "layers";
+        settings.warmup = 1;
+        settings.reps = 5;
+        settings.xBlock = 1;
+        settings.endToEnd = false;
+        settings.counters = false;
+        settings.maxWeightsMb = 1024;
+        return settings;
+    }
+
+    vector<string> split(string const &text, char separator)
+    {
+        vector<string> fields;
+        istringstream buffer(text);
+        string field;
+        while (getline(buffer, field, separator)) {
+            if (!field.empty())
+                fields.push_back(field);
+        }
+        return fields;
+    }
+
+    bool parseOptions(int argc, char* argv[], Options &options, function<bool(string const &arg, int &i)> extra)
+    {
+        for (int i = 1; i < argc; i++) {
+            string arg = argv[i];
+            bool hasValue = i + 1 < argc;
+
+            if (!hasValue) {
+                if (!extra(arg, i))
+                    return false;
+            } else if (arg == "--inputs") {
+                options.inputs.clear();
+                vector<string> sizes = split(argv[++i], ',');
+                for (size_t s = 0; s < sizes.size(); s++)
+                    options.inputs.push_back(atoi(sizes[s].c_str()));
+            } else if (arg == "--engines") {
+                options.settings.engines = split(argv[++i], ',');
+            } else if (arg == "--layers") {
+                options.layerFilter = argv[++i];
+            } else if (arg == "--layers-dir") {
+                options.settings.layersDir = argv[++i];
+            } else if (arg == "--json") {
+                options.json = argv[++i];
+            } else if (arg == "--warmup") {
+                options.settings.warmup = atoi(argv[++i]);
+            } else if (arg == "--reps") {
+                options.settings.reps = atoi(argv[++i]);
+            } else if (arg == "--xblock") {
+                options.settings.xBlock = atoi(argv[++i]);
+            } else if (arg == "--max-weights-mb") {
+                options.settings.maxWeightsMb = atof(argv[++i]);
+            } else if (!extra(arg, i)) {
+                return false;
+            }
+        }
+
+        return options.settings.reps >= 1 && options.settings.warmup >= 0 && options.settings.xBlock >= 1;
+    }
+
+    //nearest-rank percentiles over the timed repetitions
+    Stats summarize(vector<double> samples)
+    {
+        sort(samples.begin(), samples.end());
+        size_t n = samples.size();
+
+        Stats stats;
+        stats.min = samples[0];
+        stats.median = (n % 2) ? samples[n/2] : 0.5*(samples[n/2-1] + samples[n/2]);
+        stats.p99 = samples[(size_t)ceil(0.99*n) - 1];
+        stats.mean = 0;
+        for (size_t i = 0; i < n; i++)
+            stats.mean += samples[i];
+        stats.mean /= n;
+
+        return stats;
+    }
+
+    //with settings.counters the timed repetitions are attributed to layer/engine
+    Stats measure(function<double()> run, Settings const &settings, string const &layer, string const &engine)
+    {
+        for (int w = 0; w < settings.warmup; w++)
+            run();
+
+        unique_ptr<PerfCounters::Scope> counters;
+        if (settings.counters)
+            counters.reset(new PerfCounters::Scope(layer, engine));
+
+        vector<double> samples;
+        for (int r = 0; r < settings.reps; r++)
+            samples.push_back(run());
+
+        counters.reset();
+        return summarize(samples);
+    }
+
+    double timed(function<void()> run)
+    {
+        unsigned long long t0 = Timer::rdtsc();
+        run();
+        return Timer::seconds(Timer::rdtsc() - t0);
+    }
+
+    static double* alignedRandom(long count)
+    {
+        double* buffer;
+        if (posix_memalign((void**) &buffer, 64, count*sizeof(double)) != 0)
+            throw runtime_error("Benchmark: out of memory");
+        for (long i = 0; i < count; i++)
+            buffer[i] = (rand() % 9) - 4;
+        return buffer;
+    }
+
+    Tensor inputFor(LayerShape const &shape, bool first, string const &layersDir)
+    {
+        if (first && shape.height == shape.width) {
+            ostringstream path;
+            path << layersDir << "/input_layer_" << shape.width << "x" << shape.width;
+
+            //the binary copy (make tensors) maps without parsing
+            if (ifstream((path.str() + ".tensor").c_str())) {
+                TensorView view(path.str() + ".tensor");
+                if (view.getHeight() == shape.height && view.getWidth() == shape.width && view.getDepth() == shape.depth)
+                    return view.toTensor();
+            }
+
+            if (ifstream(path.str().c_str())) {
+                Tensor input = Tensor(shape.height, shape.width);
+                for (int k = 0; k < shape.depth; k++)
+                    input.addLayer(Utility::createMatrixFromFile(path.str()));
+                return input;
+            }
+        }
+
+        Tensor input = Tensor(shape.height, shape.width, shape.depth);
+        input.randomValueInit(-4, 4);
+        return input;
+    }
+
+    bool engineFromName(string const &name, int xBlock, ConvPlan &plan)
+    {
+        ConvEngine engines[] = {ENGINE_NAIVE, ENGINE_BASELINE, ENGINE_SIMD, ENGINE_SIMD_OPENMP, ENGINE_JIT, ENGINE_GEMM};
+
+        for (ConvEngine engine : engines) {
+            if (Autotuner::engineName(engine) == name) {
+                plan.engine = engine;
+                plan.xBlock = (engine == ENGINE_SIMD || engine == ENGINE_SIMD_OPENMP) ? xBlock : 1;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static string convSkipReason(ConvPlan plan, LayerSpec const &layer)
+    {
+        if (plan.engine == ENGINE_JIT && !Jit::isAvailable())
+            return "JIT needs AVX2";
+        if (plan.engine == ENGINE_GEMM && (layer.F != 1 || layer.padding != 0))
+            return "gemm needs a 1x1 layer without padding";
+        return "";
+    }
+
+    static Stats benchConvKernel(Tensor &input, Filters &filters, LayerSpec const &layer, LayerShape const &out,
+                                 ConvPlan plan, Settings const &settings, string const &name)
+    {
+        Kernels::ConvShape shape = input.convShape(filters, convParams(layer.stride, layer.padding));
+        int numberOfFilters = shape.numberOfFilters;
+        int groups = (numberOfFilters+3)/4;
+
+        double* A;
+        double* B;
+        double* C;
+        posix_memalign((void**) &A, 64, (long)input.getDepth()*shape.paddedHeight*shape.paddedWidth*sizeof(double));
+        posix_memalign((void**) &B, 64, (long)groups*4*input.getDepth()*shape.Fh*shape.Fw*sizeof(double));
+        posix_memalign((void**) &C, 64, (long)shape.outHeight*shape.outWidth*numberOfFilters*sizeof(double));
+
+        //the GEMM engine reads the planes as they are, subsampled when strided
+        if (plan.engine == ENGINE_GEMM)
+            input.pack_planes(A, layer.stride, layer.stride);
+        else
+            input.pack_inputs(A, layer.padding, layer.padding);
+        if (plan.engine == ENGINE_BASELINE)
+            input.pack_filters_flat(B, filters, numberOfFilters);
+        else
+            input.pack_filters(B, filters, numberOfFilters);
+
+        function<double()> run;
+        switch (plan.engine) {
+            case ENGINE_BASELINE:
+                run = [&]() { return input.kernel(C, A, B, shape); };
+                break;
+            case ENGINE_SIMD:
+                run = [&]() { return plan.xBlock > 1
+                    ? input.kernel_simd_blocked(C, A, B, shape, plan.xBlock)
+                    : input.kernel_simd(C, A, B, shape); };
+                break;
+            case ENGINE_SIMD_OPENMP:
+                run = [&]() { return input.kernel_simd_openmp(C, A, B, shape, plan.xBlock); };
+                break;
+            case ENGINE_JIT:
+                run = [&]() { return input.kernel_jit(C, A, B, shape); };
+                break;
+            case ENGINE_GEMM:
+                run = [&]() {
+                    Kernels::GemmShape gemm = {shape.outHeight*shape.outWidth, input.getDepth(), numberOfFilters};
+                    return input.kernel_gemm(C, A, B, gemm, 0);
+                };
+                break;
+            default:
+                break;
+        }
+
+        Stats stats = measure(run, settings, name, Autotuner::engineName(plan.engine));
+
+        free(A);
+        free(B);
+        free(C);
+
+        return stats;
+    }
+
+    void runLayer(int inputSize, LayerSpec const &layer, LayerShape const &in, bool first,
+                           Settings const &settings, vector<Record> &records)
+    {
+        LayerShape out = Network::outputShape(layer, in);
+
+        Record base;
+        base.input = inputSize;
+        base.layer = layer.name;
+        base.in = in;
+        base.out = out;
+        base.F = layer.F;
+        base.stride = layer.stride;
+        base.padding = layer.padding;
+        base.flops = Network::flops(layer, in);
+        base.hasEndToEnd = false;
+
+        //counter rows are per input size and layer
+        ostringstream scopeName;
+        scopeName << inputSize << "/" << layer.name;
+        string name = scopeName.str();
+
+        double weightBytes = 8.0*Network::weightCount(layer, in);
+        double outputBytes = 8.0*out.height*out.width*out.depth;
+
+        if (weightBytes > settings.maxWeightsMb*1024*1024) {
+            base.type = layer.type == LAYER_CONV ? "conv" : "fc";
+            base.engine = "-";
+            base.bytes = 0;
+            base.skipped = "weights exceed --max-weights-mb";
+            records.push_back(base);
+            return;
+        }
+
+        if (layer.type == LAYER_CONV) {
+            base.type = "conv";
+            double paddedWidth = in.width + 2*layer.padding;
+            base.bytes = 8.0*in.depth*paddedWidth*(in.height + 2*layer.padding) + weightBytes + outputBytes;
+
+            Tensor input = inputFor(in, first, settings.layersDir);
+            Filters filters = Filters(layer.F, layer.F, in.depth, layer.outputs);
+
+            for (size_t e = 0; e < settings.engines.size(); e++) {
+                Record record = base;
+                record.engine = settings.engines[e];
+
+                ConvPlan plan;
+                if (!engineFromName(record.engine, settings.xBlock, plan))
+                    throw logic_error("Invalid: unknown engine " + record.engine);
+
+                record.skipped = convSkipReason(plan, layer);
+                if (record.skipped.empty()) {
+                    //the naive engine has no separate kernel, it is always timed end to end
+                    if (plan.engine == ENGINE_NAIVE) {
+                        record.kernel = measure([&]() { return timed([&]() {
+                            input.fwdConv(filters, layer.stride, 0, layer.padding, plan); }); }, settings, name, record.engine);
+                    } else {
+                        record.kernel = benchConvKernel(input, filters, layer, out, plan, settings, name);
+                        if (settings.endToEnd) {
+                            record.hasEndToEnd = true;
+                            record.endToEnd = measure([&]() { return timed([&]() {
+                                input.fwdConv(filters, layer.stride, 0, layer.padding, plan); }); }, settings, name, record.engine + "/e2e");
+                        }
+                    }
+                }
+                records.push_back(record);
+            }
+            return;
+        }
+
+        //pool and FC run through the Kernels tables, one record per supported ISA;
+        //FC adds ISA-fp16 and ISA-bf16 records over 16-bit copies of the weights
+        long inputCount = (long)in.height*in.width*in.depth;
+        double* input = alignedRandom(inputCount);
+        long weightCount = layer.type == LAYER_FULLY_CONNECTED ? Network::weightCount(layer, in) : 0;
+        double* weights = weightCount > 0 ? alignedRandom(weightCount) : NULL;
+        vector<unsigned short> halves, bfloats;
+        for (long i = 0; i < weightCount; i++) {
+            halves.push_back(Kernels::toHalf((float)weights[i]));
+            bfloats.push_back(Kernels::toBfloat16((float)weights[i]));
+        }
+        double* output;
+        posix_memalign((void**) &output, 64, (long)out.height*out.width*out.depth*sizeof(double));
+
+        base.type = layer.type == LAYER_MAXPOOL ? "pool" : "fc";
+        base.bytes = 8.0*inputCount + weightBytes + outputBytes;
+
+        Kernels::Isa isas[] = {Kernels::ISA_SCALAR, Kernels::ISA_SSE4, Kernels::ISA_AVX2, Kernels::ISA_AVX512};
+        for (Kernels::Isa isa : isas) {
+            if (!Kernels::isSupported(isa))
+                continue;
+
+            const Kernels::Table &kernels = Kernels::table(isa);
+            Record record = base;
+            record.engine = kernels.name;
+
+            if (layer.type == LAYER_MAXPOOL) {
+                record.kernel = measure([&]() { return timed([&]() {
+                    kernels.maxPool(output, input, in.width, in.depth, layer.F, layer.F, layer.stride, layer.stride, out.height, out.width); }); }, settings, name, record.engine);
+            } else {
+                record.kernel = measure([&]() { return timed([&]() {
+                    kernels.fullyConnected(output, input, weights, (int)inputCount, layer.outputs); }); }, settings, name, record.engine);
+            }
+            records.push_back(record);
+
+            if (layer.type == LAYER_FULLY_CONNECTED) {
+                Record half = base, bfloat = base;
+                half.engine = record.engine + "-fp16";
+                bfloat.engine = record.engine + "-bf16";
+                half.bytes = bfloat.bytes = base.bytes - weightBytes*3/4;
+                half.kernel = measure([&]() { return timed([&]() {
+                    kernels.fullyConnectedF16(output, input, halves.data(), (int)inputCount, layer.outputs); }); }, settings, name, half.engine);
+                bfloat.kernel = measure([&]() { return timed([&]() {
+                    kernels.fullyConnectedBF16(output, input, bfloats.data(), (int)inputCount, layer.outputs); }); }, settings, name, bfloat.engine);
+                records.push_back(half);
+                records.push_back(bfloat);
+            }
+        }
+
+        free(input);
+        free(weights);
+        free(output);
+    }
+}
@@ -0,0 +1,92 @@
+#ifndef DEF_BENCHMARK
+#define DEF_BENCHMARK
+
+#include <functional>
+#include <string>
+#include <vector>
+#include "Network.h"
+#include "Tensor.h"
+
+//Layer measurements shared by tools/bench and tools/roofline: warm-up runs,
+//timed repetitions on the calibrated TSC and nearest-rank statistics. Conv
+//engines are timed kernel-only on pre-packed buffers, pool and FC once per
+//supported Kernels ISA.
+namespace Benchmark
+{
+	struct Stats
+	{
+		double median;
+		double p99;
+		double min;
+		double mean;
+	};
+
+	struct Settings
+	{
+		std::vector<std::string> engines; //conv engines, by Autotuner::engineName
+		std::string layersDir;            //input_layer_NxN files for the first layer
+		int warmup;
+		int reps;
+		int xBlock;
+		bool endToEnd;                    //also time fwdConv(plan) including pack/unpack
+		bool counters;                    //attribute the repetitions to PerfCounters
+		double maxWeightsMb;              //layers with more weights are skipped
+	};
+
+	//one layer run with one engine (or ISA for pool/FC)
+	struct Record
+	{
+		int input;
+		std::string layer;
+		std::string type;
+		std::string engine;
+		LayerShape in;
+		LayerShape out;
+		int F;
+		int stride;
+		int padding;
+		double flops;
+		double bytes; //compulsory traffic: packed input, weights and output, once each
+		Stats kernel;
+		bool hasEndToEnd;
+		Stats endToEnd;
+		std::string skipped;
+	};
+
+	//command line of the layer tools
+	struct Options
+	{
+		Settings settings;
+		std::vector<int> inputs; //input sizes, a network per size
+		std::string layerFilter; //substring of the layer names to run
+		std::string json;        //output file, none when empty
+	};
+
+	Settings defaults();
+
+	//non-empty fields of text
+	std::vector<std::string> split(std::string const &text, char separator);
+
+	//reads --inputs, --engines, --layers, --layers-dir, --json, --warmup,
+	//--reps, --xblock and --max-weights-mb over the tool's defaults in
+	//options. Any other argument goes to extra with its index, which steps
+	//the index past the value it takes and returns false for an argument it
+	//does not know either. False on an unknown argument, a missing value or
+	//counts out of range, for the tool to print its usage.
+	bool parseOptions(int argc, char* argv[], Options &options, std::function<bool(std::string const &arg, int &i)> extra);
+
+	Stats summarize(std::vector<double> samples);
+	//run() returns the seconds it measured itself, so setup can be left out
+	Stats measure(std::function<double()> run, Settings const &settings, std::string const &layer, std::string const &engine);
+	double timed(std::function<void()> run);
+
+	//the first layer reads the real inputs when they exist, deeper layers only need the shape
+	Tensor inputFor(LayerShape const &shape, bool first, std::string const &layersDir);
+	bool engineFromName(std::string const &name, int xBlock, ConvPlan &plan);
+
+	//appends one record per engine (conv) or per supported ISA (pool, FC)
+	void runLayer(int inputSize, LayerSpec const &layer, LayerShape const &in, bool first,
+	              Settings const &settings, std::vector<Record> &records);
+}
+
+#endif
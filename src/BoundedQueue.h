@@ -0,0 +1,248 @@
+#ifndef DEF_BOUNDED_QUEUE
+#define DEF_BOUNDED_QUEUE
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <thread>
+
+//waiting on a full or empty queue: spin briefly, then yield, then sleep, so an
+//idle stage leaves its core to the compute threads
+inline void queueBackoff(int attempt)
+{
+	if (attempt < 64)
+		__builtin_ia32_pause();
+	else if (attempt < 128)
+		std::this_thread::yield();
+	else
+		std::this_thread::sleep_for(std::chrono::microseconds(50));
+}
+
+//Fixed-capacity multi-producer multi-consumer queue (Vyukov's bounded queue):
+//every cell carries a sequence number, producers and consumers claim cells
+//with one CAS on their own cache line and never take a lock. A full queue is
+//the backpressure: push() waits (queueBackoff) until a consumer frees a cell.
+//
+//  BoundedQueue<Job*> queue(64);
+//  queue.push(job);            //producers
+//  queue.close();              //after the last producer is done
+//  while (queue.pop(job)) ...  //false once closed and drained
+template <typename T>
+class BoundedQueue
+{
+public:
+	//capacity is rounded up to a power of two
+	explicit BoundedQueue(size_t capacity) : head(0), tail(0), closed(false)
+	{
+		size_t size = 2;
+		while (size < capacity)
+			size *= 2;
+		mask = size - 1;
+		cells = new Cell[size];
+		for (size_t i = 0; i < size; i++)
+			cells[i].sequence.store(i, std::memory_order_relaxed);
+	}
+
+	~BoundedQueue()
+	{
+		delete[] cells;
+	}
+
+	BoundedQueue(BoundedQueue const &) = delete;
+	BoundedQueue& operator=(BoundedQueue const &) = delete;
+
+	bool tryPush(T const &value)
+	{
+		size_t position = tail.load(std::memory_order_relaxed);
+		for (;;) {
+			Cell &cell = cells[position & mask];
+			size_t sequence = cell.sequence.load(std::memory_order_acquire);
+			long difference = (long)sequence - (long)position;
+			if (difference == 0) {
+				if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+					break;
+			} else if (difference < 0) {
+				return false; //full
+			} else {
+				position = tail.load(std::memory_order_relaxed);
+			}
+		}
+
+		Cell &cell = cells[position & mask];
+		cell.value = value;
+		cell.sequence.store(position + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool tryPop(T &value)
+	{
+		size_t position = head.load(std::memory_order_relaxed);
+		for (;;) {
+			Cell &cell = cells[position & mask];
+			size_t sequence = cell.sequence.load(std::memory_order_acquire);
+			long difference = (long)sequence - (long)(position + 1);
+			if (difference == 0) {
+				if (head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+					break;
+			} else if (difference < 0) {
+				return false; //empty
+			} else {
+				position = head.load(std::memory_order_relaxed);
+			}
+		}
+
+		Cell &cell = cells[position & mask];
+		value = cell.value;
+		cell.sequence.store(position + mask + 1, std::memory_order_release);
+		return true;
+	}
+
+	void push(T const &value)
+	{
+		for (int attempt = 0; !tryPush(value); attempt++)
+			queueBackoff(attempt);
+	}
+
+	//waits for an item; false once the queue is closed and empty
+	bool pop(T &value)
+	{
+		for (int attempt = 0; ; attempt++) {
+			if (tryPop(value))
+				return true;
+			if (closed.load(std::memory_order_acquire))
+				return tryPop(value); //a push may have landed before the close
+			queueBackoff(attempt);
+		}
+	}
+
+	void close()
+	{
+		closed.store(true, std::memory_order_release);
+	}
+
+	bool isClosed() const
+	{
+		return closed.load(std::memory_order_acquire);
+	}
+
+	size_t capacity() const
+	{
+		return mask + 1;
+	}
+
+	//approximate, for reporting
+	size_t size() const
+	{
+		size_t first = head.load(std::memory_order_relaxed);
+		size_t last = tail.load(std::memory_order_relaxed);
+		return last > first ? last - first : 0;
+	}
+
+private:
+	struct Cell
+	{
+		std::atomic<size_t> sequence;
+		T value;
+	};
+
+	Cell* cells;
+	size_t mask;
+	//producers and consumers each get their own cache line
+	char padHead[64];
+	std::atomic<size_t> head;
+	char padTail[64];
+	std::atomic<size_t> tail;
+	char padEnd[64];
+	std::atomic<bool> closed;
+};
+
+//Single-producer single-consumer ring for a chain of stages: no CAS at all,
+//each side owns one index and keeps a cached copy of the other's, so the
+//shared lines are only read when the cached view says full or empty.
+template <typename T>
+class SpscQueue
+{
+public:
+	//capacity is rounded up to a power of two
+	explicit SpscQueue(size_t capacity) : head(0), cachedTail(0), tail(0), cachedHead(0), closed(false)
+	{
+		size_t size = 2;
+		while (size < capacity)
+			size *= 2;
+		mask = size - 1;
+		values = new T[size];
+	}
+
+	~SpscQueue()
+	{
+		delete[] values;
+	}
+
+	SpscQueue(SpscQueue const &) = delete;
+	SpscQueue& operator=(SpscQueue const &) = delete;
+
+	//producer side
+	bool tryPush(T const &value)
+	{
+		size_t position = tail.load(std::memory_order_relaxed);
+		if (position - cachedHead > mask) {
+			cachedHead = head.load(std::memory_order_acquire);
+			if (position - cachedHead > mask)
+				return false;
+		}
+		values[position & mask] = value;
+		tail.store(position + 1, std::memory_order_release);
+		return true;
+	}
+
+	//consumer side
+	bool tryPop(T &value)
+	{
+		size_t position = head.load(std::memory_order_relaxed);
+		if (position == cachedTail) {
+			cachedTail = tail.load(std::memory_order_acquire);
+			if (position == cachedTail)
+				return false;
+		}
+		value = values[position & mask];
+		head.store(position + 1, std::memory_order_release);
+		return true;
+	}
+
+	void push(T const &value)
+	{
+		for (int attempt = 0; !tryPush(value); attempt++)
+			queueBackoff(attempt);
+	}
+
+	//waits for an item; false once the queue is closed and empty
+	bool pop(T &value)
+	{
+		for (int attempt = 0; ; attempt++) {
+			if (tryPop(value))
+				return true;
+			if (closed.load(std::memory_order_acquire))
+				return tryPop(value);
+			queueBackoff(attempt);
+		}
+	}
+
+	void close()
+	{
+		closed.store(true, std::memory_order_release);
+	}
+
+private:
+	T* values;
+	size_t mask;
+	char padHead[64];
+	std::atomic<size_t> head;
+	size_t cachedTail; //consumer's view of tail
+	char padTail[64];
+	std::atomic<size_t> tail;
+	size_t cachedHead; //producer's view of head
+	char padEnd[64];
+	std::atomic<bool> closed;
+};
+
+#endif
@@ -1,3 +1,4 @@
+#include <stdexcept>
 #include "Filters.h"
 #include "Utility.h"
 
@@ -19,12 +20,23 @@ Filters::Filters(int height, int width, int depth, int numberOfFilters)
     }
 }
 
+Filters::Filters(vector<Tensor> const &filters)
+{
+    if (filters.empty())
+        throw logic_error("Invalid: Filters need at least one filter to take their shape from.");
+
+    this->height = filters[0].getHeight();
+    this->width = filters[0].getWidth();
+    this->depth = filters[0].getDepth();
+    this->filters = filters;
+}
+
 int Filters::getNumberOfFilters() const
 {
     return filters.size();
 }
 
-Tensor Filters::getFilter(int index)
+Tensor Filters::getFilter(int index) const
 {    
     return filters[index];
 }
@@ -12,13 +12,16 @@ class Filters
 public: 
 	Filters();
 	Filters(int height, int width, int depth, int numberOfFilters);
+	//takes the shape from the first filter, as Tensor(layers) does; throws
+	//logic_error on an empty vector
+	Filters(std::vector<Tensor> const &filters);
 
 	std::vector<Tensor> filters;
 
 	int getDepth() const;
     int getHeight() const;
  	int getWidth() const;
-	Tensor getFilter(int index);
+	Tensor getFilter(int index) const;
 	int getNumberOfFilters() const; 
 protected:
 	int height;
@@ -0,0 +1,332 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+#include "Image.h"
+#include "Kernels.h"
+#include "Trace.h"
+
+//the vendored decoder is compiled here only, for the formats the serving path
+//accepts; its unused static helpers are only reported at the end of the file,
+//so its warnings stay off for the whole translation unit
+#define STB_IMAGE_IMPLEMENTATION
+#define STBI_ONLY_JPEG
+#define STBI_ONLY_PNG
+#pragma GCC diagnostic ignored "-Wunused-function"
+#pragma GCC diagnostic ignored "-Wmisleading-indentation"
+#pragma GCC diagnostic ignored "-Wunused-variable"
+#include "stb_image.h"
+
+using namespace std;
+
+namespace Image
+{
+    Preprocess caffeVgg()
+    {
+        Preprocess preprocess = {true, {103.939, 116.779, 123.68}, 1.0};
+        return preprocess;
+    }
+
+    Preprocess raw()
+    {
+        Preprocess preprocess = {false, {0, 0, 0}, 1.0};
+        return preprocess;
+    }
+
+    unsigned char* decode(string const &path, int &height, int &width)
+    {
+        TRACE_SCOPE("image", "decode");
+        int channels;
+        unsigned char* pixels = stbi_load(path.c_str(), &width, &height, &channels, 3);
+        if (!pixels)
+            throw runtime_error("Image: cannot decode " + path + ": " + stbi_failure_reason());
+        return pixels;
+    }
+
+    unsigned char* decode(const unsigned char* bytes, size_t size, string const &name, int &height, int &width)
+    {
+        TRACE_SCOPE("image", "decode");
+        int channels;
+        unsigned char* pixels = stbi_load_from_memory(bytes, (int)size, &width, &height, &channels, 3);
+        if (!pixels)
+            throw runtime_error("Image: cannot decode " + name + ": " + stbi_failure_reason());
+        return pixels;
+    }
+
+    void release(unsigned char* pixels)
+    {
+        stbi_image_free(pixels);
+    }
+
+    View view(const unsigned char* rgb, int height, int width)
+    {
+        View image = {rgb, height, width, 3L*width};
+        return image;
+    }
+
+    void toPlanes(double* planes, const unsigned char* rgb, int height, int width, Preprocess const &preprocess)
+    {
+        toPlanes(planes, view(rgb, height, width), preprocess);
+    }
+
+    void toPlanes(double* planes, View const &source, Preprocess const &preprocess)
+    {
+        TRACE_SCOPE("image", "to planes");
+        long count = (long)source.height*source.width;
+
+        //reordering is only a matter of which plane each source channel lands in
+        double* red = planes + (preprocess.bgr ? 2 : 0)*count;
+        double* green = planes + count;
+        double* blue = planes + (preprocess.bgr ? 0 : 2)*count;
+        double mean[3] = {preprocess.mean[preprocess.bgr ? 2 : 0], preprocess.mean[1], preprocess.mean[preprocess.bgr ? 0 : 2]};
+        Kernels::Deinterleave3Fn deinterleave3 = Kernels::active().deinterleave3;
+
+        //a crop is converted row by row, a whole image in one call
+        if (source.stride == 3L*source.width) {
+            deinterleave3(red, green, blue, source.pixels, count, mean, preprocess.scale);
+            return;
+        }
+        for (int y = 0; y < source.height; y++) {
+            long offset = (long)y*source.width;
+            deinterleave3(red + offset, green + offset, blue + offset, source.pixels + y*source.stride,
+                          source.width, mean, preprocess.scale);
+        }
+    }
+
+    //------------------------------------------------------------------ resize
+
+    //source taps of every output coordinate along one axis
+    struct Axis
+    {
+        int maxTaps;
+        vector<int> first;
+        vector<int> taps;
+        vector<float> weights; //maxTaps per output coordinate
+    };
+
+    //pixel centres map onto each other, the edge pixels are repeated
+    static Axis bilinearAxis(int sourceSize, int size)
+    {
+        Axis axis = {2, vector<int>(size), vector<int>(size), vector<float>(2*size)};
+        double scale = (double)sourceSize/size;
+
+        for (int o = 0; o < size; o++) {
+            double centre = max(0.0, (o + 0.5)*scale - 0.5);
+            int first = (int)centre;
+            double fraction = centre - first;
+            if (first >= sourceSize - 1) {
+                first = sourceSize - 1;
+                fraction = 0;
+            }
+
+            axis.first[o] = first;
+            axis.taps[o] = fraction > 0 ? 2 : 1;
+            axis.weights[2*o] = (float)(1 - fraction);
+            axis.weights[2*o + 1] = (float)fraction;
+        }
+        return axis;
+    }
+
+    //every source pixel weighs by how much of the output pixel it covers
+    static Axis areaAxis(int sourceSize, int size)
+    {
+        double scale = (double)sourceSize/size;
+        int maxTaps = (int)ceil(scale) + 1;
+        Axis axis = {maxTaps, vector<int>(size), vector<int>(size), vector<float>((size_t)maxTaps*size)};
+
+        for (int o = 0; o < size; o++) {
+            double begin = o*scale;
+            double end = min((o + 1)*scale, (double)sourceSize);
+            int first = (int)begin;
+            int last = min((int)ceil(end), sourceSize) - 1;
+
+            axis.first[o] = first;
+            axis.taps[o] = 0;
+            for (int s = first; s <= last; s++) {
+                double overlap = min(end, s + 1.0) - max(begin, (double)s);
+                axis.weights[(size_t)o*maxTaps + axis.taps[o]++] = (float)(overlap/scale);
+            }
+        }
+        return axis;
+    }
+
+    void resize(unsigned char* out, int height, int width, View const &source, Filter filter)
+    {
+        resize(out, height, width, source, filter, Kernels::active());
+    }
+
+    //vertical taps over whole rows first (contiguous bytes, vectorised along
+    //the row), then the horizontal taps (vectorised across a pixel's channels)
+    void resize(unsigned char* out, int height, int width, View const &source, Filter filter, Kernels::Table const &kernels)
+    {
+        TRACE_SCOPE("image", "resize");
+        if (height < 1 || width < 1)
+            throw logic_error("Invalid: resize needs a non-empty output.");
+
+        Axis rows = filter == FILTER_AREA && height < source.height ? areaAxis(source.height, height) : bilinearAxis(source.height, height);
+        Axis cols = filter == FILTER_AREA && width < source.width ? areaAxis(source.width, width) : bilinearAxis(source.width, width);
+
+        Kernels::AccumulateU8Fn accumulate = kernels.accumulateU8;
+        Kernels::ResampleRowFn resampleRow = kernels.resampleRow;
+        long rowValues = 3L*source.width;
+        //the zeros past the row are what resampleRow reads beyond the last pixel
+        vector<float> blended(rowValues + 3L*cols.maxTaps + 1);
+
+        for (int y = 0; y < height; y++) {
+            fill(blended.begin(), blended.begin() + rowValues, 0.0f);
+            for (int t = 0; t < rows.taps[y]; t++) {
+                accumulate(blended.data(), source.pixels + (rows.first[y] + t)*source.stride, rowValues,
+                           rows.weights[(size_t)y*rows.maxTaps + t]);
+            }
+
+            resampleRow(out + 3L*width*y, blended.data(), cols.first.data(), cols.taps.data(), cols.weights.data(),
+                        cols.maxTaps, width);
+        }
+    }
+
+    void shorterSideTo(int size, int sourceHeight, int sourceWidth, int &height, int &width)
+    {
+        if (sourceHeight <= sourceWidth) {
+            height = size;
+            width = max(1, (int)lround((double)sourceWidth*size/sourceHeight));
+        } else {
+            width = size;
+            height = max(1, (int)lround((double)sourceHeight*size/sourceWidth));
+        }
+    }
+
+    //------------------------------------------------------------------- crops
+
+    View crop(View const &source, int top, int left, int height, int width)
+    {
+        if (top < 0 || left < 0 || height < 1 || width < 1 || top + height > source.height || left + width > source.width)
+            throw logic_error("Invalid: crop outside the image.");
+
+        View cropped = {source.pixels + top*source.stride + 3L*left, height, width, source.stride};
+        return cropped;
+    }
+
+    View centerCrop(View const &source, int size)
+    {
+        return crop(source, (source.height - size)/2, (source.width - size)/2, size, size);
+    }
+
+    void tenCrop(View crops[10], View const &source, int size, unsigned char* flipped)
+    {
+        int bottom = source.height - size;
+        int right = source.width - size;
+        crops[0] = crop(source, 0, 0, size, size);
+        crops[1] = crop(source, 0, right, size, size);
+        crops[2] = crop(source, bottom, 0, size, size);
+        crops[3] = crop(source, bottom, right, size, size);
+        crops[4] = centerCrop(source, size);
+
+        for (int k = 0; k < 5; k++) {
+            unsigned char* mirror = flipped + 3L*size*size*k;
+            for (int y = 0; y < size; y++) {
+                const unsigned char* in = crops[k].pixels + y*crops[k].stride;
+                unsigned char* out = mirror + 3L*size*y;
+                for (int x = 0; x < size; x++)
+                    memcpy(out + 3*x, in + 3*(size - 1 - x), 3);
+            }
+            crops[5 + k] = view(mirror, size, size);
+        }
+    }
+
+    void loadInto(double* planes, string const &path, int height, int width, Preprocess const &preprocess)
+    {
+        int imageHeight, imageWidth;
+        unsigned char* pixels = decode(path, imageHeight, imageWidth);
+
+        if (imageHeight != height || imageWidth != width) {
+            release(pixels);
+            ostringstream message;
+            message << "Invalid: " << path << " is " << imageHeight << "x" << imageWidth
+                    << ", the input needs " << height << "x" << width << ".";
+            throw logic_error(message.str());
+        }
+
+        toPlanes(planes, pixels, height, width, preprocess);
+        release(pixels);
+    }
+
+    double* load(string const &path, int &height, int &width, Preprocess const &preprocess)
+    {
+        unsigned char* pixels = decode(path, height, width);
+
+        double* planes;
+        if (posix_memalign((void**) &planes, 64, 3L*height*width*sizeof(double)) != 0) {
+            release(pixels);
+            throw bad_alloc();
+        }
+
+        toPlanes(planes, pixels, height, width, preprocess);
+        release(pixels);
+        return planes;
+    }
+
+    Tensor loadTensor(string const &path, Preprocess const &preprocess)
+    {
+        int height, width;
+        double* planes = load(path, height, width, preprocess);
+
+        Tensor tensor = Tensor(height, width);
+        for (int c = 0; c < 3; c++) {
+            vector<vector<double> > rows(height);
+            for (int y = 0; y < height; y++) {
+                const double* row = planes + ((long)c*height + y)*width;
+                rows[y].assign(row, row + width);
+            }
+            tensor.addLayer(Matrix(rows));
+        }
+
+        free(planes);
+        return tensor;
+    }
+
+    void prepare(double* planes, View const &source, int resizeTo, int size, Preprocess const &preprocess)
+    {
+        if (resizeTo < size)
+            throw logic_error("Invalid: the crop is larger than the resized image.");
+
+        int height, width;
+        shorterSideTo(resizeTo, source.height, source.width, height, width);
+        vector<unsigned char> resized(3L*height*width);
+        resize(resized.data(), height, width, source, FILTER_AREA);
+        toPlanes(planes, centerCrop(view(resized.data(), height, width), size), preprocess);
+    }
+
+    void loadBatch(double* batch, vector<string> const &paths, int resizeTo, int size, Preprocess const &preprocess)
+    {
+        if (resizeTo < size)
+            throw logic_error("Invalid: the crop is larger than the resized image.");
+
+        //exceptions cannot leave the parallel loop, the first one is rethrown after it
+        vector<string> errors(paths.size());
+
+        #pragma omp parallel for schedule(dynamic, 1)
+        for (size_t i = 0; i < paths.size(); i++) {
+            try {
+                int height, width;
+                unsigned char* pixels = decode(paths[i], height, width);
+                try {
+                    prepare(batch + 3L*size*size*i, view(pixels, height, width), resizeTo, size, preprocess);
+                } catch (...) {
+                    release(pixels);
+                    throw;
+                }
+                release(pixels);
+            } catch (exception const &error) {
+                errors[i] = error.what();
+            }
+        }
+
+        for (size_t i = 0; i < errors.size(); i++) {
+            if (!errors[i].empty())
+                throw runtime_error(errors[i]);
+        }
+    }
+}
@@ -0,0 +1,93 @@
+#ifndef DEF_IMAGE
+#define DEF_IMAGE
+
+#include <string>
+#include <vector>
+#include "Tensor.h"
+
+//JPEG/PNG decoding with the vendored stb_image, then one pass through the
+//Kernels deinterleave3 kernel that converts to double, reorders channels,
+//subtracts the mean and writes CHW planes. loadInto writes straight into a
+//buffer the caller owns (the network input), the way the Caffe test wraps its
+//input blob, with no intermediate float image.
+//
+//  double* input = ...; //3*224*224 doubles
+//  Image::loadInto(input, "cat.jpg", 224, 224, Image::caffeVgg());
+//
+//Arbitrary resolutions go through a separable resampler (bilinear or area)
+//and a centre or ten-crop; crops are Views into the resized pixels.
+//
+//  Image::loadBatch(batch, paths, 256, 224, Image::caffeVgg()); //images in parallel
+namespace Image
+{
+	struct Preprocess
+	{
+		bool bgr;       //plane 0 is blue, as Caffe models trained from OpenCV expect
+		double mean[3]; //subtracted per output plane, in output order
+		double scale;   //applied after the mean
+	};
+
+	//BGR with the ILSVRC-2012 channel means VGG-16 was trained with
+	Preprocess caffeVgg();
+	//RGB 0-255, nothing subtracted
+	Preprocess raw();
+
+	//interleaved 8-bit RGB with rows stride bytes apart, so crops need no copy
+	struct View
+	{
+		const unsigned char* pixels;
+		int height;
+		int width;
+		long stride;
+	};
+
+	enum Filter
+	{
+		FILTER_BILINEAR, //2x2 taps at pixel centres, for enlarging or mild shrinking
+		FILTER_AREA      //average over the covered source area, for shrinking
+	};
+
+	View view(const unsigned char* rgb, int height, int width);
+
+	//8-bit RGB, freed with release(); throws runtime_error when the file cannot be decoded
+	unsigned char* decode(std::string const &path, int &height, int &width);
+	//the same from an encoded file already in memory; name only appears in the error
+	unsigned char* decode(const unsigned char* bytes, size_t size, std::string const &name, int &height, int &width);
+	void release(unsigned char* pixels);
+
+	//interleaved RGB pixels into 3 planes of height*width doubles at planes
+	void toPlanes(double* planes, const unsigned char* rgb, int height, int width, Preprocess const &preprocess);
+
+	//writes height x width contiguous RGB to out; FILTER_AREA falls back to
+	//bilinear along an axis that is being enlarged
+	void resize(unsigned char* out, int height, int width, View const &source, Filter filter);
+	//the same through the accumulateU8 and resampleRow of the given table, e.g.
+	//Kernels::table(ISA_SCALAR) as the reference for the vectorised ones
+	void resize(unsigned char* out, int height, int width, View const &source, Filter filter, Kernels::Table const &kernels);
+	//output size that brings the shorter side to size and keeps the aspect ratio
+	void shorterSideTo(int size, int sourceHeight, int sourceWidth, int &height, int &width);
+
+	View crop(View const &source, int top, int left, int height, int width);
+	View centerCrop(View const &source, int size);
+	//corners, centre, then the same five mirrored; the mirrored crops are written
+	//to flipped (5*size*size*3 bytes) since a View cannot run backwards
+	void tenCrop(View crops[10], View const &source, int size, unsigned char* flipped);
+
+	void toPlanes(double* planes, View const &source, Preprocess const &preprocess);
+
+	//the image must be exactly height x width (resize first otherwise)
+	void loadInto(double* planes, std::string const &path, int height, int width, Preprocess const &preprocess);
+	//64-byte aligned planes sized from the image, free() them
+	double* load(std::string const &path, int &height, int &width, Preprocess const &preprocess);
+	Tensor loadTensor(std::string const &path, Preprocess const &preprocess);
+
+	//shorter side to resizeTo, centre crop of size, then size x size planes
+	void prepare(double* planes, View const &source, int resizeTo, int size, Preprocess const &preprocess);
+
+	//decode, shorter side to resizeTo, centre crop of size, planes; one image
+	//per thread, image i at batch + i*3*size*size
+	void loadBatch(double* batch, std::vector<std::string> const &paths, int resizeTo, int size,
+	               Preprocess const &preprocess);
+}
+
+#endif
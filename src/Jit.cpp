@@ -0,0 +1,400 @@
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <sys/mman.h>
+#include "Jit.h"
+#include "Kernels.h"
+
+using namespace std;
+
+//------------------------------------------------------------------ emitter
+
+size_t JitAssembler::label() const
+{
+    return code.size();
+}
+
+void JitAssembler::byte(int b)
+{
+    code.push_back((unsigned char)b);
+}
+
+void JitAssembler::dword(int d)
+{
+    for (int i = 0; i < 4; i++)
+        byte((d >> (8*i)) & 0xFF);
+}
+
+void JitAssembler::qword(long long q)
+{
+    for (int i = 0; i < 8; i++)
+        byte((int)((q >> (8*i)) & 0xFF));
+}
+
+//REX.W with the high bits of the ModRM reg and rm fields
+void JitAssembler::rex(int reg, int rm)
+{
+    byte(0x48 | ((reg >> 3) << 2) | (rm >> 3));
+}
+
+//3-byte VEX, 256-bit, 66 prefix (every vector instruction used here has it)
+void JitAssembler::vex(int reg, int vvvv, int rm, int map, int w)
+{
+    byte(0xC4);
+    byte((((reg >> 3) ^ 1) << 7) | (1 << 6) | (((rm >> 3) ^ 1) << 5) | map);
+    byte((w << 7) | ((~vvvv & 15) << 3) | (1 << 2) | 1);
+}
+
+void JitAssembler::modrm(int reg, Reg base, int disp)
+{
+    //RSP/R12 would need a SIB byte, the generator never uses them as a base
+    if ((base & 7) == 4)
+        throw logic_error("JitAssembler: RSP/R12 cannot be used as a base register.");
+
+    if (disp == 0 && (base & 7) != 5) {
+        byte(((reg & 7) << 3) | (base & 7));
+    } else if (disp >= -128 && disp <= 127) {
+        byte(0x40 | ((reg & 7) << 3) | (base & 7));
+        byte(disp & 0xFF);
+    } else {
+        byte(0x80 | ((reg & 7) << 3) | (base & 7));
+        dword(disp);
+    }
+}
+
+void JitAssembler::push(Reg r)
+{
+    if (r >= 8)
+        byte(0x41);
+    byte(0x50 + (r & 7));
+}
+
+void JitAssembler::pop(Reg r)
+{
+    if (r >= 8)
+        byte(0x41);
+    byte(0x58 + (r & 7));
+}
+
+void JitAssembler::ret()
+{
+    byte(0xC3);
+}
+
+void JitAssembler::mov(Reg dst, Reg src)
+{
+    rex(src, dst);
+    byte(0x89);
+    byte(0xC0 | ((src & 7) << 3) | (dst & 7));
+}
+
+void JitAssembler::mov(Reg dst, long long imm)
+{
+    rex(0, dst);
+    byte(0xB8 + (dst & 7));
+    qword(imm);
+}
+
+void JitAssembler::add(Reg dst, int imm)
+{
+    rex(0, dst);
+    byte(0x81);
+    byte(0xC0 | (dst & 7));
+    dword(imm);
+}
+
+void JitAssembler::dec(Reg r)
+{
+    rex(0, r);
+    byte(0xFF);
+    byte(0xC8 | (r & 7));
+}
+
+void JitAssembler::jnz(size_t target)
+{
+    byte(0x0F);
+    byte(0x85);
+    dword((int)((long)target - (long)(label() + 4)));
+}
+
+void JitAssembler::vzeroupper()
+{
+    byte(0xC5);
+    byte(0xF8);
+    byte(0x77);
+}
+
+void JitAssembler::vxorpd(int dst, int src1, int src2)
+{
+    vex(dst, src1, src2, 1, 0);
+    byte(0x57);
+    byte(0xC0 | ((dst & 7) << 3) | (src2 & 7));
+}
+
+void JitAssembler::vmovapd(int dst, Reg base, int disp)
+{
+    vex(dst, 0, base, 1, 0);
+    byte(0x28);
+    modrm(dst, base, disp);
+}
+
+void JitAssembler::vmovupd(int dst, Reg base, int disp)
+{
+    vex(dst, 0, base, 1, 0);
+    byte(0x10);
+    modrm(dst, base, disp);
+}
+
+void JitAssembler::vmovupd(Reg base, int disp, int src)
+{
+    vex(src, 0, base, 1, 0);
+    byte(0x11);
+    modrm(src, base, disp);
+}
+
+void JitAssembler::vbroadcastsd(int dst, Reg base, int disp)
+{
+    vex(dst, 0, base, 2, 0);
+    byte(0x19);
+    modrm(dst, base, disp);
+}
+
+void JitAssembler::vfmadd231pd(int dst, int src1, int src2)
+{
+    vex(dst, src1, src2, 2, 1);
+    byte(0xB8);
+    byte(0xC0 | ((dst & 7) << 3) | (src2 & 7));
+}
+
+void JitAssembler::vmaskmovpd(Reg base, int disp, int mask, int src)
+{
+    vex(src, mask, base, 2, 0);
+    byte(0x2F);
+    modrm(src, base, disp);
+}
+
+//------------------------------------------------------------ conv generator
+
+bool JitConvShape::operator<(JitConvShape const &other) const
+{
+    const int a[] = {Fh, Fw, strideX, dilationY, dilationX, paddedHeight, paddedWidth, outWidth, numberOfFilters, depth};
+    const int b[] = {other.Fh, other.Fw, other.strideX, other.dilationY, other.dilationX, other.paddedHeight,
+                     other.paddedWidth, other.outWidth, other.numberOfFilters, other.depth};
+    return lexicographical_compare(a, a + 10, b, b + 10);
+}
+
+//lane masks for the last group when numberOfFilters % 4 != 0
+alignas(32) static const long long jitStoreMasks[4][4] = {
+    {0, 0, 0, 0}, {-1, 0, 0, 0}, {-1, -1, 0, 0}, {-1, -1, -1, 0}
+};
+
+//Register tile: PIXELS adjacent outputs x GROUPS groups of 4 filters live in
+//ymm0-11, the filter vectors in ymm12-14 and the broadcast input in ymm15.
+static int pixelsPerTile(int groups)
+{
+    switch (groups) {
+        case 1: return 12;
+        case 2: return 6;
+        default: return 4;
+    }
+}
+
+//Register use inside the generated row function:
+//  RDI C for the current block of groups    RSI A_row
+//  RDX B for the current block of groups    R8  group block counter
+//  RAX C for the current tile               R9  A for the current tile
+//  RCX tile counter                         R10/R11 A/B inside the depth loop
+//  RBX depth counter (callee saved)
+class ConvGenerator
+{
+public:
+    ConvGenerator(JitConvShape const &shape) : s(shape)
+    {
+        plane = s.paddedHeight*s.paddedWidth*8;
+        filterBytes = s.Fh*s.Fw*32;
+        groupStride = s.Fh*s.Fw*s.depth*32;
+
+        //1x1 layers have tiny bodies, unroll the depth loop to amortise the counter
+        depthUnroll = 1;
+        if (s.Fh == 1 && s.Fw == 1) {
+            int unrolls[] = {4, 2};
+            for (int u : unrolls) {
+                if (s.depth % u == 0) {
+                    depthUnroll = u;
+                    break;
+                }
+            }
+        }
+    }
+
+    void generate()
+    {
+        int fullGroups = s.numberOfFilters/4;
+        int maskLanes = s.numberOfFilters%4;
+        int totalGroups = fullGroups + (maskLanes ? 1 : 0);
+        int groups = totalGroups < 3 ? totalGroups : 3;
+
+        as.push(JitAssembler::RBX);
+
+        //unmasked blocks of groups run in a loop, the rest (including the
+        //partial group) is peeled with its own tile shape
+        int blocks = fullGroups/groups;
+        int tailGroups = fullGroups%groups + (maskLanes ? 1 : 0);
+
+        if (blocks > 0) {
+            as.mov(JitAssembler::R8, (long long)blocks);
+            size_t loop = as.label();
+            row(groups, 0);
+            as.add(JitAssembler::RDI, groups*32);
+            as.add(JitAssembler::RDX, groups*groupStride);
+            as.dec(JitAssembler::R8);
+            as.jnz(loop);
+        }
+        if (tailGroups > 0)
+            row(tailGroups, maskLanes);
+
+        as.pop(JitAssembler::RBX);
+        as.vzeroupper();
+        as.ret();
+    }
+
+    JitAssembler as;
+
+private:
+    JitConvShape s;
+    int plane;
+    int filterBytes;
+    int groupStride;
+    int depthUnroll;
+
+    void row(int groups, int maskLanes)
+    {
+        int pixels = pixelsPerTile(groups);
+        if (pixels > s.outWidth)
+            pixels = s.outWidth;
+        int tiles = s.outWidth/pixels;
+        int tailPixels = s.outWidth%pixels;
+
+        as.mov(JitAssembler::RAX, JitAssembler::RDI);
+        as.mov(JitAssembler::R9, JitAssembler::RSI);
+
+        if (tiles > 0) {
+            as.mov(JitAssembler::RCX, (long long)tiles);
+            size_t loop = as.label();
+            tile(pixels, groups, maskLanes);
+            as.add(JitAssembler::RAX, pixels*s.numberOfFilters*8);
+            as.add(JitAssembler::R9, pixels*s.strideX*8);
+            as.dec(JitAssembler::RCX);
+            as.jnz(loop);
+        }
+        if (tailPixels > 0)
+            tile(tailPixels, groups, maskLanes);
+    }
+
+    void tile(int pixels, int groups, int maskLanes)
+    {
+        const int filterReg = 12;
+        const int inputReg = 15;
+
+        for (int t = 0; t < pixels*groups; t++)
+            as.vxorpd(t, t, t);
+
+        as.mov(JitAssembler::R10, JitAssembler::R9);
+        as.mov(JitAssembler::R11, JitAssembler::RDX);
+        as.mov(JitAssembler::RBX, (long long)(s.depth/depthUnroll));
+
+        size_t loop = as.label();
+        for (int u = 0; u < depthUnroll; u++) {
+            for (int i = 0; i < s.Fh; i++) {
+                for (int j = 0; j < s.Fw; j++) {
+                    for (int g = 0; g < groups; g++)
+                        as.vmovapd(filterReg + g, JitAssembler::R11, g*groupStride + u*filterBytes + (s.Fw*i + j)*32);
+
+                    for (int t = 0; t < pixels; t++) {
+                        as.vbroadcastsd(inputReg, JitAssembler::R10, u*plane + (s.paddedWidth*i*s.dilationY + j*s.dilationX + t*s.strideX)*8);
+                        for (int g = 0; g < groups; g++)
+                            as.vfmadd231pd(t*groups + g, inputReg, filterReg + g);
+                    }
+                }
+            }
+        }
+        as.add(JitAssembler::R10, depthUnroll*plane);
+        as.add(JitAssembler::R11, depthUnroll*filterBytes);
+        as.dec(JitAssembler::RBX);
+        as.jnz(loop);
+
+        if (maskLanes) {
+            as.mov(JitAssembler::R11, (long long)jitStoreMasks[maskLanes]);
+            as.vmovupd(filterReg, JitAssembler::R11, 0);
+        }
+
+        for (int t = 0; t < pixels; t++) {
+            for (int g = 0; g < groups; g++) {
+                int disp = t*s.numberOfFilters*8 + g*32;
+                if (maskLanes && g == groups - 1)
+                    as.vmaskmovpd(JitAssembler::RAX, disp, filterReg, t*groups + g);
+                else
+                    as.vmovupd(JitAssembler::RAX, disp, t*groups + g);
+            }
+        }
+    }
+};
+
+static JitConvFn install(vector<unsigned char> const &code)
+{
+    size_t bytes = code.size();
+    void* memory = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (memory == MAP_FAILED)
+        throw runtime_error("Jit: cannot map memory for generated code.");
+
+    memcpy(memory, code.data(), bytes);
+
+    //never writable and executable at the same time
+    if (mprotect(memory, bytes, PROT_READ | PROT_EXEC) != 0) {
+        munmap(memory, bytes);
+        throw runtime_error("Jit: cannot make generated code executable.");
+    }
+
+    return (JitConvFn)memory;
+}
+
+namespace Jit
+{
+    static mutex cacheLock;
+    static map<JitConvShape, JitConvFn> cache;
+
+    bool isAvailable()
+    {
+        return Kernels::active().isa >= Kernels::ISA_AVX2;
+    }
+
+    JitConvFn convKernel(JitConvShape const &shape)
+    {
+        lock_guard<mutex> guard(cacheLock);
+
+        map<JitConvShape, JitConvFn>::iterator it = cache.find(shape);
+        if (it != cache.end())
+            return it->second;
+
+        if (!isAvailable())
+            throw logic_error("Invalid: JIT convolution needs AVX2 and FMA.");
+        if (shape.Fh < 1 || shape.Fw < 1 || shape.strideX < 1 || shape.dilationY < 1 || shape.dilationX < 1 || shape.outWidth < 1 || shape.numberOfFilters < 1 || shape.depth < 1)
+            throw logic_error("Invalid: JIT convolution shape.");
+
+        ConvGenerator generator(shape);
+        generator.generate();
+
+        JitConvFn fn = install(generator.as.code);
+        cache[shape] = fn;
+        return fn;
+    }
+
+    size_t cachedKernels()
+    {
+        lock_guard<mutex> guard(cacheLock);
+        return cache.size();
+    }
+}
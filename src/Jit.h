@@ -0,0 +1,80 @@
+#ifndef DEF_JIT
+#define DEF_JIT
+
+#include <cstddef>
+#include <vector>
+
+//Minimal x86-64 code emitter: only the AVX2/FMA and integer instructions the
+//convolution microkernels need, so there is no dependency on an assembler.
+class JitAssembler
+{
+public:
+	//general purpose registers, SysV passes the first arguments in RDI, RSI, RDX
+	enum Reg { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+
+	std::vector<unsigned char> code;
+
+	size_t label() const;
+
+	void push(Reg r);
+	void pop(Reg r);
+	void ret();
+	void mov(Reg dst, Reg src);
+	void mov(Reg dst, long long imm);
+	void add(Reg dst, int imm);
+	void dec(Reg r);
+	void jnz(size_t target);
+
+	//ymm registers are plain numbers 0-15, memory operands are [base + disp]
+	void vzeroupper();
+	void vxorpd(int dst, int src1, int src2);
+	void vmovapd(int dst, Reg base, int disp);
+	void vmovupd(int dst, Reg base, int disp);
+	void vmovupd(Reg base, int disp, int src);
+	void vbroadcastsd(int dst, Reg base, int disp);
+	void vfmadd231pd(int dst, int src1, int src2);
+	void vmaskmovpd(Reg base, int disp, int mask, int src);
+
+private:
+	void byte(int b);
+	void dword(int d);
+	void qword(long long q);
+	void rex(int reg, int rm);
+	void vex(int reg, int vvvv, int rm, int map, int w);
+	void modrm(int reg, Reg base, int disp);
+};
+
+//everything the generated address arithmetic depends on; the row stride
+//only moves A_row, so it is not part of the code
+struct JitConvShape
+{
+	int Fh;
+	int Fw;
+	int strideX;
+	int dilationY;
+	int dilationX;
+	int paddedHeight;
+	int paddedWidth;
+	int outWidth;
+	int numberOfFilters;
+	int depth;
+
+	bool operator<(JitConvShape const &other) const;
+};
+
+//computes one output row: C_row = C + numberOfFilters*outWidth*y,
+//A_row = A + paddedWidth*y*strideY, B holds zero-padded groups of 4 filters
+typedef void (*JitConvFn)(double* C_row, const double* A_row, const double* B);
+
+namespace Jit
+{
+	//the kernels are AVX2/FMA code, so the host (and FASTCODE_ISA) must allow it
+	bool isAvailable();
+
+	//microkernel for the shape, emitted on first request and cached for the process
+	JitConvFn convKernel(JitConvShape const &shape);
+
+	size_t cachedKernels();
+}
+
+#endif
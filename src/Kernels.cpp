@@ -0,0 +1,1721 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <immintrin.h>
+#include "Kernels.h"
+
+using namespace std;
+
+#define TARGET_SSE4 __attribute__((target("sse4.2")))
+#define TARGET_AVX2 __attribute__((target("avx2,fma,f16c")))
+#define TARGET_AVX512 __attribute__((target("avx512f,avx2,fma,f16c")))
+
+#define ISA_ENV "FASTCODE_ISA"
+
+namespace Kernels
+{
+    //keeps the peak loops from being optimised away
+    static volatile double peakSink;
+
+    #define PEAK_CHAINS 12
+
+    //------------------------------------------------------------ pointwise
+
+    //one GEMM_MR x NR tile of C from a packed strip of A and a filter panel,
+    //rows x columns of it live (the rest of the strip and panel is zero)
+    typedef void (*PointwiseTileFn)(double* C, long plane, const double* strip, const double* panel,
+                                    int depth, int rows, int columns, double bias);
+
+    //Strips of NR pixels are copied out of the A planes into a contiguous
+    //[k][NR] buffer, zero past the last pixel, and every filter panel runs
+    //over the strip while it is in cache. A strided 1x1 conv was subsampled
+    //into A already, so nothing here knows about strides.
+    template <int NR, PointwiseTileFn TILE>
+    static void pointwiseGemm(double* C, const double* A, const double* B, GemmShape const &s,
+                              int first, int count, double bias)
+    {
+        double* strip;
+        if (posix_memalign((void**) &strip, 64, (size_t)s.depth*NR*sizeof(double)) != 0)
+            throw bad_alloc();
+
+        for (int p = first; p < first + count; p += NR) {
+            int columns = min(NR, first + count - p);
+            for (int k = 0; k < s.depth; k++) {
+                const double* row = A + (long)s.pixels*k + p;
+                double* packed = strip + (long)NR*k;
+                int c = 0;
+                for (; c < columns; c++)
+                    packed[c] = row[c];
+                for (; c < NR; c++)
+                    packed[c] = 0;
+            }
+
+            for (int z = 0; z < s.numberOfFilters; z += GEMM_MR)
+                TILE(C + (long)s.pixels*z + p, s.pixels, strip, B + (long)s.depth*z, s.depth,
+                     min(GEMM_MR, s.numberOfFilters - z), columns, bias);
+        }
+
+        free(strip);
+    }
+
+    //------------------------------------------------------------ 16-bit weights
+
+    static unsigned int floatBits(float value)
+    {
+        unsigned int bits;
+        memcpy(&bits, &value, sizeof(bits));
+        return bits;
+    }
+
+    static float bitsFloat(unsigned int bits)
+    {
+        float value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    unsigned short toHalf(float value)
+    {
+        unsigned int bits = floatBits(value);
+        unsigned int sign = (bits >> 16) & 0x8000;
+        unsigned int mantissa = bits & 0x7fffff;
+        int exponent = (int)((bits >> 23) & 0xff) - 127 + 15;
+
+        if (exponent == 128 + 15)
+            return (unsigned short)(sign | 0x7c00 | (mantissa ? 0x200 | (mantissa >> 13) : 0));
+        if (exponent >= 31)
+            return (unsigned short)(sign | 0x7c00);
+
+        //the bits shifted out decide the rounding; a carry out of the mantissa
+        //moves to the next exponent, up to infinity, as it should
+        unsigned int half, rest, halfway;
+        if (exponent <= 0) {
+            if (exponent < -10)
+                return (unsigned short)sign;
+            int shift = 14 - exponent;
+            mantissa |= 0x800000;
+            half = mantissa >> shift;
+            rest = mantissa & ((1u << shift) - 1);
+            halfway = 1u << (shift - 1);
+        } else {
+            half = ((unsigned int)exponent << 10) | (mantissa >> 13);
+            rest = mantissa & 0x1fff;
+            halfway = 0x1000;
+        }
+        if (rest > halfway || (rest == halfway && (half & 1)))
+            half++;
+        return (unsigned short)(sign | half);
+    }
+
+    float fromHalf(unsigned short half)
+    {
+        unsigned int sign = (unsigned int)(half & 0x8000) << 16;
+        unsigned int exponent = (half >> 10) & 0x1f;
+        unsigned int mantissa = half & 0x3ff;
+
+        if (exponent == 0x1f)
+            return bitsFloat(sign | 0x7f800000 | (mantissa << 13));
+        if (exponent != 0)
+            return bitsFloat(sign | ((exponent + 127 - 15) << 23) | (mantissa << 13));
+        if (mantissa == 0)
+            return bitsFloat(sign);
+
+        //subnormal: shift the leading one up to the implicit bit
+        exponent = 127 - 15 + 1;
+        while (!(mantissa & 0x400)) {
+            mantissa <<= 1;
+            exponent--;
+        }
+        return bitsFloat(sign | (exponent << 23) | ((mantissa & 0x3ff) << 13));
+    }
+
+    unsigned short toBfloat16(float value)
+    {
+        unsigned int bits = floatBits(value);
+        if ((bits & 0x7fffffff) > 0x7f800000)
+            return (unsigned short)((bits >> 16) | 0x40);
+        bits += 0x7fff + ((bits >> 16) & 1);
+        return (unsigned short)(bits >> 16);
+    }
+
+    float fromBfloat16(unsigned short bits)
+    {
+        return bitsFloat((unsigned int)bits << 16);
+    }
+
+    //----------------------------------------------------------------- scalar
+
+    static void convRowScalar(double* C, const double* A, const double* B, ConvShape const &s, int y, int xBlock)
+    {
+        long plane = (long)s.paddedHeight*s.paddedWidth;
+        int taps = s.Fh*s.Fw;
+        for (int z = 0; z < s.numberOfFilters; z += 4) {
+            int lanes = min(4, s.numberOfFilters - z);
+            for (int x = 0; x < s.outWidth; x++) {
+                double output[4] = {0, 0, 0, 0};
+
+                for (int k = 0; k < s.depth; k++) {
+                    for (int i = 0; i < s.Fh; i++) {
+                        const double* a_row = A + (plane*k + s.paddedWidth*(y*s.strideY + i*s.dilationY) + x*s.strideX);
+                        const double* b_row = B + (taps*s.depth*z + taps*k*4 + s.Fw*i*4);
+                        for (int j = 0; j < s.Fw; j++) {
+                            for (int l = 0; l < 4; l++)
+                                output[l] += a_row[j*s.dilationX] * b_row[j*4 + l];
+                        }
+                    }
+                }
+
+                for (int l = 0; l < lanes; l++)
+                    C[(long)s.numberOfFilters*s.outWidth*y + s.numberOfFilters*x + z + l] = output[l];
+            }
+        }
+    }
+
+    static void depthwiseRowScalar(double* C, const double* A, const double* B, ConvShape const &s, int y)
+    {
+        const int L = DEPTHWISE_BLOCK;
+        long inBlock = (long)s.paddedHeight*s.paddedWidth*L;
+        long outBlock = (long)s.outHeight*s.outWidth*L;
+        int blocks = (s.numberOfFilters + L - 1)/L;
+
+        for (int cb = 0; cb < blocks; cb++) {
+            const double* a_block = A + inBlock*cb;
+            const double* b_block = B + s.Fh*s.Fw*L*cb;
+            for (int x = 0; x < s.outWidth; x++) {
+                double output[DEPTHWISE_BLOCK] = {0, 0, 0, 0};
+                for (int i = 0; i < s.Fh; i++) {
+                    const double* a_row = a_block + ((long)s.paddedWidth*(y*s.strideY + i*s.dilationY) + x*s.strideX)*L;
+                    for (int j = 0; j < s.Fw; j++) {
+                        for (int l = 0; l < L; l++)
+                            output[l] += a_row[j*s.dilationX*L + l] * b_block[(s.Fw*i + j)*L + l];
+                    }
+                }
+                for (int l = 0; l < L; l++)
+                    C[outBlock*cb + ((long)s.outWidth*y + x)*L + l] = output[l];
+            }
+        }
+    }
+
+    static void pointwiseTileScalar(double* C, long plane, const double* strip, const double* panel,
+                                    int depth, int rows, int columns, double bias)
+    {
+        const int NR = 4;
+        double output[GEMM_MR][NR] = {};
+        for (int k = 0; k < depth; k++) {
+            for (int r = 0; r < GEMM_MR; r++) {
+                for (int c = 0; c < NR; c++)
+                    output[r][c] += panel[GEMM_MR*k + r] * strip[NR*k + c];
+            }
+        }
+        for (int r = 0; r < rows; r++) {
+            for (int c = 0; c < columns; c++)
+                C[plane*r + c] = output[r][c] + bias;
+        }
+    }
+
+    static void maxPoolScalar(double* output, const double* input, int width, int depth,
+                              int Fh, int Fw, int strideY, int strideX, int outHeight, int outWidth)
+    {
+        for (int y = 0; y < outHeight; y++) {
+            for (int x = 0; x < outWidth; x++) {
+                const double* window = input + (width*y*strideY + x*strideX)*depth;
+                double* out = output + (outWidth*y + x)*depth;
+
+                for (int c = 0; c < depth; c++) {
+                    double max = window[c];
+                    for (int i = 0; i < Fh; i++) {
+                        for (int j = 0; j < Fw; j++) {
+                            double value = window[(width*i + j)*depth + c];
+                            if (value > max)
+                                max = value;
+                        }
+                    }
+                    out[c] = max;
+                }
+            }
+        }
+    }
+
+    static void fullyConnectedScalar(double* output, const double* input, const double* weights,
+                                     int inputs, int outputs)
+    {
+        for (int o = 0; o < outputs; o++) {
+            const double* row = weights + (long)o*inputs;
+            double sum = 0;
+            for (int i = 0; i < inputs; i++)
+                sum += row[i] * input[i];
+            output[o] = sum;
+        }
+    }
+
+    template <float (*WIDEN)(unsigned short)>
+    static void fullyConnectedHalfScalar(double* output, const double* input, const unsigned short* weights,
+                                         int inputs, int outputs)
+    {
+        for (int o = 0; o < outputs; o++) {
+            const unsigned short* row = weights + (long)o*inputs;
+            double sum = 0;
+            for (int i = 0; i < inputs; i++)
+                sum += (double)WIDEN(row[i]) * input[i];
+            output[o] = sum;
+        }
+    }
+
+    static void pack4Scalar(double* dst, const double* src0, const double* src1,
+                            const double* src2, const double* src3, int n)
+    {
+        for (int j = 0; j < n; j++) {
+            dst[4*j] = src0[j];
+            dst[4*j+1] = src1[j];
+            dst[4*j+2] = src2[j];
+            dst[4*j+3] = src3[j];
+        }
+    }
+
+    template <float (*WIDEN)(unsigned short)>
+    static void pack4HalfScalar(double* dst, const unsigned short* src0, const unsigned short* src1,
+                                const unsigned short* src2, const unsigned short* src3, int n)
+    {
+        for (int j = 0; j < n; j++) {
+            dst[4*j] = WIDEN(src0[j]);
+            dst[4*j+1] = WIDEN(src1[j]);
+            dst[4*j+2] = WIDEN(src2[j]);
+            dst[4*j+3] = WIDEN(src3[j]);
+        }
+    }
+
+    static void deinterleave3Scalar(double* plane0, double* plane1, double* plane2, const unsigned char* pixels,
+                                    long count, const double* mean, double scale)
+    {
+        for (long i = 0; i < count; i++) {
+            plane0[i] = (pixels[3*i] - mean[0])*scale;
+            plane1[i] = (pixels[3*i + 1] - mean[1])*scale;
+            plane2[i] = (pixels[3*i + 2] - mean[2])*scale;
+        }
+    }
+
+    static void accumulateU8Scalar(float* acc, const unsigned char* row, long n, float weight)
+    {
+        for (long i = 0; i < n; i++)
+            acc[i] += weight*row[i];
+    }
+
+    static inline unsigned char resampleByte(float value)
+    {
+        int rounded = (int)(value + 0.5f);
+        return (unsigned char)(rounded < 0 ? 0 : rounded > 255 ? 255 : rounded);
+    }
+
+    static void resampleRowScalar(unsigned char* out, const float* row, const int* first, const int* taps,
+                                  const float* weights, int maxTaps, int width)
+    {
+        for (int x = 0; x < width; x++) {
+            const float* in = row + 3L*first[x];
+            const float* w = weights + (long)x*maxTaps;
+            float r = 0, g = 0, b = 0;
+            for (int t = 0; t < taps[x]; t++) {
+                r += w[t]*in[3*t];
+                g += w[t]*in[3*t + 1];
+                b += w[t]*in[3*t + 2];
+            }
+            out[3*x] = resampleByte(r);
+            out[3*x + 1] = resampleByte(g);
+            out[3*x + 2] = resampleByte(b);
+        }
+    }
+
+    //portable code, so this is whatever the compiler makes of baseline x86-64
+    static double peakFlopsScalar(long iterations)
+    {
+        double acc[PEAK_CHAINS];
+        for (int r = 0; r < PEAK_CHAINS; r++)
+            acc[r] = r;
+
+        for (long n = 0; n < iterations; n++) {
+            #pragma GCC unroll 12
+            for (int r = 0; r < PEAK_CHAINS; r++)
+                acc[r] = acc[r] * 0.999999 + 1e-6;
+        }
+
+        double sum = 0;
+        for (int r = 0; r < PEAK_CHAINS; r++)
+            sum += acc[r];
+        peakSink = sum;
+        return 2.0 * PEAK_CHAINS * iterations;
+    }
+
+    //a real value far outside every byte range; clamping to it first keeps the
+    //float to int32 conversion defined
+    const float REQUANTIZE_LIMIT = 65536.0f;
+
+    //4 unsigned activations as one dword, for the broadcasts
+    static inline int quad(const unsigned char* p)
+    {
+        int value;
+        memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    static inline unsigned char requantizeScalar(int sum, Requantize const &q, int z)
+    {
+        float scaled = min(max((float)sum*q.multiplier[z], -REQUANTIZE_LIMIT), REQUANTIZE_LIMIT);
+        int value = (int)lrintf(scaled) + q.zeroPoint[z];
+        return (unsigned char)min(max(value, q.lower[z]), 255);
+    }
+
+    static void convRowU8Scalar(unsigned char* C, const unsigned char* A, const signed char* B, ConvShape const &s,
+                                Requantize const &q, int y)
+    {
+        const int N = QUANT_FILTERS, K = QUANT_K;
+        long groupSize = (long)s.Fh*s.Fw*s.depth*N;
+        for (int x = 0; x < s.outWidth; x++) {
+            unsigned char* out = C + ((long)s.outWidth*y + x)*s.numberOfFilters;
+            for (int z = 0; z < s.numberOfFilters; z += N) {
+                const signed char* b = B + groupSize*(z/N);
+                int sum[N];
+                for (int n = 0; n < N; n++)
+                    sum[n] = q.bias[z + n];
+
+                for (int i = 0; i < s.Fh; i++) {
+                    for (int j = 0; j < s.Fw; j++) {
+                        const unsigned char* a = A + ((long)s.paddedWidth*(y*s.strideY + i) + x*s.strideX + j)*s.depth;
+                        for (int k = 0; k < s.depth; k += K, b += N*K) {
+                            for (int n = 0; n < N; n++) {
+                                for (int l = 0; l < K; l++)
+                                    sum[n] += b[K*n + l]*a[k + l];
+                            }
+                        }
+                    }
+                }
+
+                for (int n = 0; n < N; n++)
+                    out[z + n] = requantizeScalar(sum[n], q, z + n);
+            }
+        }
+    }
+
+    static void fullyConnectedU8Scalar(int* output, const unsigned char* input, const signed char* weights,
+                                       int inputs, int outputs)
+    {
+        for (int o = 0; o < outputs; o++) {
+            const signed char* row = weights + (long)o*inputs;
+            int sum = 0;
+            for (int i = 0; i < inputs; i++)
+                sum += row[i]*input[i];
+            output[o] = sum;
+        }
+    }
+
+    //------------------------------------------------------------------- SSE4
+
+    //no FMA here: each group of 4 filters is two __m128d accumulated with mul + add
+    TARGET_SSE4
+    static void convRowSse4(double* C, const double* A, const double* B, ConvShape const &s, int y, int xBlock)
+    {
+        long plane = (long)s.paddedHeight*s.paddedWidth;
+        int taps = s.Fh*s.Fw;
+        for (int z = 0; z < s.numberOfFilters; z += 4) {
+            int lanes = min(4, s.numberOfFilters - z);
+            for (int x = 0; x < s.outWidth; x++) {
+                __m128d lo = _mm_setzero_pd();
+                __m128d hi = _mm_setzero_pd();
+
+                for (int k = 0; k < s.depth; k++) {
+                    for (int i = 0; i < s.Fh; i++) {
+                        const double* a_row = A + (plane*k + s.paddedWidth*(y*s.strideY + i*s.dilationY) + x*s.strideX);
+                        const double* b_row = B + (taps*s.depth*z + taps*k*4 + s.Fw*i*4);
+                        for (int j = 0; j < s.Fw; j++) {
+                            __m128d a = _mm_set1_pd(a_row[j*s.dilationX]);
+                            lo = _mm_add_pd(lo, _mm_mul_pd(a, _mm_load_pd(b_row + j*4)));
+                            hi = _mm_add_pd(hi, _mm_mul_pd(a, _mm_load_pd(b_row + j*4 + 2)));
+                        }
+                    }
+                }
+
+                //C rows are only 16-byte aligned when numberOfFilters is even
+                double* out = C + ((long)s.numberOfFilters*s.outWidth*y + s.numberOfFilters*x + z);
+                if (lanes == 4) {
+                    _mm_storeu_pd(out, lo);
+                    _mm_storeu_pd(out + 2, hi);
+                } else {
+                    double lanesOut[4];
+                    _mm_storeu_pd(lanesOut, lo);
+                    _mm_storeu_pd(lanesOut + 2, hi);
+                    for (int l = 0; l < lanes; l++)
+                        out[l] = lanesOut[l];
+                }
+            }
+        }
+    }
+
+    TARGET_SSE4
+    static void depthwiseRowSse4(double* C, const double* A, const double* B, ConvShape const &s, int y)
+    {
+        const int L = DEPTHWISE_BLOCK;
+        long inBlock = (long)s.paddedHeight*s.paddedWidth*L;
+        long outBlock = (long)s.outHeight*s.outWidth*L;
+        int blocks = (s.numberOfFilters + L - 1)/L;
+
+        for (int cb = 0; cb < blocks; cb++) {
+            const double* a_block = A + inBlock*cb;
+            const double* b_block = B + s.Fh*s.Fw*L*cb;
+            for (int x = 0; x < s.outWidth; x++) {
+                __m128d lo = _mm_setzero_pd();
+                __m128d hi = _mm_setzero_pd();
+                for (int i = 0; i < s.Fh; i++) {
+                    const double* a_row = a_block + ((long)s.paddedWidth*(y*s.strideY + i*s.dilationY) + x*s.strideX)*L;
+                    for (int j = 0; j < s.Fw; j++) {
+                        const double* a = a_row + j*s.dilationX*L;
+                        const double* b = b_block + (s.Fw*i + j)*L;
+                        lo = _mm_add_pd(lo, _mm_mul_pd(_mm_load_pd(a), _mm_load_pd(b)));
+                        hi = _mm_add_pd(hi, _mm_mul_pd(_mm_load_pd(a + 2), _mm_load_pd(b + 2)));
+                    }
+                }
+                double* out = C + outBlock*cb + ((long)s.outWidth*y + x)*L;
+                _mm_store_pd(out, lo);
+                _mm_store_pd(out + 2, hi);
+            }
+        }
+    }
+
+    //4 filters x 4 pixels, 8 xmm accumulators. Every loop over them is
+    //unrolled so they stay in registers; a partial tile goes out through a
+    //stack copy.
+    TARGET_SSE4
+    static void pointwiseTileSse4(double* C, long plane, const double* strip, const double* panel,
+                                  int depth, int rows, int columns, double bias)
+    {
+        const int NR = 4;
+        __m128d output[GEMM_MR][2];
+        #pragma GCC unroll 4
+        for (int r = 0; r < GEMM_MR; r++)
+            output[r][0] = output[r][1] = _mm_setzero_pd();
+
+        for (int k = 0; k < depth; k++) {
+            __m128d a0 = _mm_load_pd(strip + NR*k);
+            __m128d a1 = _mm_load_pd(strip + NR*k + 2);
+            #pragma GCC unroll 4
+            for (int r = 0; r < GEMM_MR; r++) {
+                __m128d b = _mm_set1_pd(panel[GEMM_MR*k + r]);
+                output[r][0] = _mm_add_pd(output[r][0], _mm_mul_pd(b, a0));
+                output[r][1] = _mm_add_pd(output[r][1], _mm_mul_pd(b, a1));
+            }
+        }
+
+        __m128d b = _mm_set1_pd(bias);
+        double tile[GEMM_MR][NR];
+        #pragma GCC unroll 4
+        for (int r = 0; r < GEMM_MR; r++) {
+            _mm_storeu_pd(tile[r], _mm_add_pd(output[r][0], b));
+            _mm_storeu_pd(tile[r] + 2, _mm_add_pd(output[r][1], b));
+        }
+        for (int r = 0; r < rows; r++) {
+            for (int c = 0; c < columns; c++)
+                C[plane*r + c] = tile[r][c];
+        }
+    }
+
+    TARGET_SSE4
+    static void maxPoolSse4(double* output, const double* input, int width, int depth,
+                            int Fh, int Fw, int strideY, int strideX, int outHeight, int outWidth)
+    {
+        for (int y = 0; y < outHeight; y++) {
+            for (int x = 0; x < outWidth; x++) {
+                const double* window = input + (width*y*strideY + x*strideX)*depth;
+                double* out = output + (outWidth*y + x)*depth;
+
+                int c = 0;
+                for (; c + 2 <= depth; c += 2) {
+                    __m128d max = _mm_loadu_pd(window + c);
+                    for (int i = 0; i < Fh; i++) {
+                        for (int j = 0; j < Fw; j++)
+                            max = _mm_max_pd(max, _mm_loadu_pd(window + (width*i + j)*depth + c));
+                    }
+                    _mm_storeu_pd(out + c, max);
+                }
+                for (; c < depth; c++) {
+                    double max = window[c];
+                    for (int i = 0; i < Fh; i++) {
+                        for (int j = 0; j < Fw; j++) {
+                            double value = window[(width*i + j)*depth + c];
+                            if (value > max)
+                                max = value;
+                        }
+                    }
+                    out[c] = max;
+                }
+            }
+        }
+    }
+
+    TARGET_SSE4
+    static void fullyConnectedSse4(double* output, const double* input, const double* weights,
+                                   int inputs, int outputs)
+    {
+        for (int o = 0; o < outputs; o++) {
+            const double* row = weights + (long)o*inputs;
+            __m128d sum0 = _mm_setzero_pd();
+            __m128d sum1 = _mm_setzero_pd();
+
+            int i = 0;
+            for (; i + 4 <= inputs; i += 4) {
+                sum0 = _mm_add_pd(sum0, _mm_mul_pd(_mm_loadu_pd(row + i), _mm_loadu_pd(input + i)));
+                sum1 = _mm_add_pd(sum1, _mm_mul_pd(_mm_loadu_pd(row + i + 2), _mm_loadu_pd(input + i + 2)));
+            }
+            sum0 = _mm_add_pd(sum0, sum1);
+            double sum = _mm_cvtsd_f64(_mm_hadd_pd(sum0, sum0));
+            for (; i < inputs; i++)
+                sum += row[i] * input[i];
+            output[o] = sum;
+        }
+    }
+
+    //a bfloat16 is the top half of a float, unpacked against zeros; fp16 has
+    //no conversion before F16C and is widened one word at a time. Either way
+    //the sums run in the double kernel's order
+    template <bool BF16>
+    TARGET_SSE4
+    static void fullyConnectedHalfSse4(double* output, const double* input, const unsigned short* weights,
+                                       int inputs, int outputs)
+    {
+        __m128i zero = _mm_setzero_si128();
+        for (int o = 0; o < outputs; o++) {
+            const unsigned short* row = weights + (long)o*inputs;
+            __m128d sum0 = _mm_setzero_pd();
+            __m128d sum1 = _mm_setzero_pd();
+
+            int i = 0;
+            for (; i + 4 <= inputs; i += 4) {
+                __m128d w0, w1;
+                if (BF16) {
+                    __m128 w = _mm_castsi128_ps(_mm_unpacklo_epi16(zero, _mm_loadl_epi64((const __m128i*)(row + i))));
+                    w0 = _mm_cvtps_pd(w);
+                    w1 = _mm_cvtps_pd(_mm_movehl_ps(w, w));
+                } else {
+                    w0 = _mm_set_pd(fromHalf(row[i + 1]), fromHalf(row[i]));
+                    w1 = _mm_set_pd(fromHalf(row[i + 3]), fromHalf(row[i + 2]));
+                }
+                sum0 = _mm_add_pd(sum0, _mm_mul_pd(w0, _mm_loadu_pd(input + i)));
+                sum1 = _mm_add_pd(sum1, _mm_mul_pd(w1, _mm_loadu_pd(input + i + 2)));
+            }
+            sum0 = _mm_add_pd(sum0, sum1);
+            double sum = _mm_cvtsd_f64(_mm_hadd_pd(sum0, sum0));
+            for (; i < inputs; i++)
+                sum += (double)(BF16 ? fromBfloat16(row[i]) : fromHalf(row[i])) * input[i];
+            output[o] = sum;
+        }
+    }
+
+    TARGET_SSE4
+    static void pack4Sse4(double* dst, const double* src0, const double* src1,
+                          const double* src2, const double* src3, int n)
+    {
+        int j = 0;
+        for (; j + 2 <= n; j += 2) {
+            __m128d r0 = _mm_loadu_pd(src0 + j);
+            __m128d r1 = _mm_loadu_pd(src1 + j);
+            __m128d r2 = _mm_loadu_pd(src2 + j);
+            __m128d r3 = _mm_loadu_pd(src3 + j);
+            _mm_storeu_pd(dst + 4*j, _mm_unpacklo_pd(r0, r1));
+            _mm_storeu_pd(dst + 4*j + 2, _mm_unpacklo_pd(r2, r3));
+            _mm_storeu_pd(dst + 4*j + 4, _mm_unpackhi_pd(r0, r1));
+            _mm_storeu_pd(dst + 4*j + 6, _mm_unpackhi_pd(r2, r3));
+        }
+        pack4Scalar(dst + 4*j, src0 + j, src1 + j, src2 + j, src3 + j, n - j);
+    }
+
+    //gathers channel 0 of 4 pixels into bytes 0-3, channel 1 into 4-7, channel 2 into 8-11
+    #define DEINTERLEAVE3_SHUFFLE _mm_setr_epi8(0, 3, 6, 9, 1, 4, 7, 10, 2, 5, 8, 11, -1, -1, -1, -1)
+
+    TARGET_SSE4
+    static void deinterleave3Sse4(double* plane0, double* plane1, double* plane2, const unsigned char* pixels,
+                                  long count, const double* mean, double scale)
+    {
+        const __m128i shuffle = DEINTERLEAVE3_SHUFFLE;
+        const __m128d s = _mm_set1_pd(scale);
+        const __m128d m[3] = {_mm_set1_pd(mean[0]), _mm_set1_pd(mean[1]), _mm_set1_pd(mean[2])};
+        double* planes[3] = {plane0, plane1, plane2};
+
+        //each 16 byte load covers 4 pixels (12 bytes), stop while it stays inside the image
+        long i = 0;
+        for (; i + 6 <= count; i += 4) {
+            __m128i channels = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (pixels + 3*i)), shuffle);
+            //the byte shift takes an immediate, one per channel
+            __m128i values[3] = {_mm_cvtepu8_epi32(channels),
+                                 _mm_cvtepu8_epi32(_mm_srli_si128(channels, 4)),
+                                 _mm_cvtepu8_epi32(_mm_srli_si128(channels, 8))};
+            for (int c = 0; c < 3; c++) {
+                __m128d lo = _mm_cvtepi32_pd(values[c]);
+                __m128d hi = _mm_cvtepi32_pd(_mm_srli_si128(values[c], 8));
+                _mm_storeu_pd(planes[c] + i, _mm_mul_pd(_mm_sub_pd(lo, m[c]), s));
+                _mm_storeu_pd(planes[c] + i + 2, _mm_mul_pd(_mm_sub_pd(hi, m[c]), s));
+            }
+        }
+        deinterleave3Scalar(plane0 + i, plane1 + i, plane2 + i, pixels + 3*i, count - i, mean, scale);
+    }
+
+    //the rounded, clamped bytes of the low 3 lanes (cvtt truncates like the
+    //scalar cast, the saturating packs clamp)
+    TARGET_SSE4
+    static inline int resampleBytesSse4(__m128 sum)
+    {
+        __m128i rounded = _mm_cvttps_epi32(_mm_add_ps(sum, _mm_set1_ps(0.5f)));
+        __m128i words = _mm_packs_epi32(rounded, rounded);
+        return _mm_cvtsi128_si32(_mm_packus_epi16(words, words));
+    }
+
+    //one pixel per vector, its 3 channels and one ignored float of the next
+    //pixel, with one multiply-add per tap in the scalar order
+    TARGET_SSE4
+    static void resampleRowSse4(unsigned char* out, const float* row, const int* first, const int* taps,
+                                const float* weights, int maxTaps, int width)
+    {
+        for (int x = 0; x < width; x++) {
+            const float* in = row + 3L*first[x];
+            const float* w = weights + (long)x*maxTaps;
+            __m128 sum = _mm_setzero_ps();
+            for (int t = 0; t < taps[x]; t++)
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(w[t]), _mm_loadu_ps(in + 3*t)));
+
+            int bytes = resampleBytesSse4(sum);
+            memcpy(out + 3*x, &bytes, 3);
+        }
+    }
+
+    TARGET_SSE4
+    static void accumulateU8Sse4(float* acc, const unsigned char* row, long n, float weight)
+    {
+        const __m128 w = _mm_set1_ps(weight);
+
+        long i = 0;
+        for (; i + 16 <= n; i += 16) {
+            __m128i bytes = _mm_loadu_si128((const __m128i*) (row + i));
+            for (int q = 0; q < 4; q++) {
+                __m128 values = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(bytes));
+                _mm_storeu_ps(acc + i + 4*q, _mm_add_ps(_mm_loadu_ps(acc + i + 4*q), _mm_mul_ps(w, values)));
+                bytes = _mm_srli_si128(bytes, 4);
+            }
+        }
+        accumulateU8Scalar(acc + i, row + i, n - i, weight);
+    }
+
+    TARGET_SSE4
+    static double peakFlopsSse4(long iterations)
+    {
+        __m128d acc[PEAK_CHAINS];
+        const __m128d m = _mm_set1_pd(0.999999);
+        const __m128d c = _mm_set1_pd(1e-6);
+        for (int r = 0; r < PEAK_CHAINS; r++)
+            acc[r] = _mm_set1_pd(r);
+
+        for (long n = 0; n < iterations; n++) {
+            #pragma GCC unroll 12
+            for (int r = 0; r < PEAK_CHAINS; r++)
+                acc[r] = _mm_add_pd(_mm_mul_pd(acc[r], m), c);
+        }
+
+        __m128d sum = _mm_setzero_pd();
+        for (int r = 0; r < PEAK_CHAINS; r++)
+            sum = _mm_add_pd(sum, acc[r]);
+        peakSink = _mm_cvtsd_f64(sum);
+        return 2.0 * 2 * PEAK_CHAINS * iterations;
+    }
+
+    //4 filters of 8 bits into 4 int32 lanes: vpmaddubsw multiplies the
+    //broadcast activations with the weights and adds pairs to int16, pmaddwd
+    //against ones adds the pairs of those
+    TARGET_SSE4
+    static inline __m128i dotU8Sse4(__m128i a, const signed char* b, __m128i ones)
+    {
+        return _mm_madd_epi16(_mm_maddubs_epi16(a, _mm_loadu_si128((const __m128i*)b)), ones);
+    }
+
+    TARGET_SSE4
+    static inline __m128i requantizeSse4(__m128i sum, Requantize const &q, int z)
+    {
+        __m128 scaled = _mm_mul_ps(_mm_cvtepi32_ps(sum), _mm_loadu_ps(q.multiplier + z));
+        scaled = _mm_min_ps(_mm_max_ps(scaled, _mm_set1_ps(-REQUANTIZE_LIMIT)), _mm_set1_ps(REQUANTIZE_LIMIT));
+        __m128i value = _mm_add_epi32(_mm_cvtps_epi32(scaled), _mm_loadu_si128((const __m128i*)(q.zeroPoint + z)));
+        value = _mm_max_epi32(value, _mm_loadu_si128((const __m128i*)(q.lower + z)));
+        return _mm_min_epi32(value, _mm_set1_epi32(255));
+    }
+
+    TARGET_SSE4
+    static void convRowU8Sse4(unsigned char* C, const unsigned char* A, const signed char* B, ConvShape const &s,
+                              Requantize const &q, int y)
+    {
+        const int N = QUANT_FILTERS, K = QUANT_K;
+        long groupSize = (long)s.Fh*s.Fw*s.depth*N;
+        __m128i ones = _mm_set1_epi16(1);
+        for (int x = 0; x < s.outWidth; x++) {
+            unsigned char* out = C + ((long)s.outWidth*y + x)*s.numberOfFilters;
+            for (int z = 0; z < s.numberOfFilters; z += N) {
+                const signed char* b = B + groupSize*(z/N);
+                __m128i sum0 = _mm_loadu_si128((const __m128i*)(q.bias + z));
+                __m128i sum1 = _mm_loadu_si128((const __m128i*)(q.bias + z + 4));
+
+                for (int i = 0; i < s.Fh; i++) {
+                    for (int j = 0; j < s.Fw; j++) {
+                        const unsigned char* a = A + ((long)s.paddedWidth*(y*s.strideY + i) + x*s.strideX + j)*s.depth;
+                        for (int k = 0; k < s.depth; k += K, b += N*K) {
+                            __m128i activations = _mm_set1_epi32(quad(a + k));
+                            sum0 = _mm_add_epi32(sum0, dotU8Sse4(activations, b, ones));
+                            sum1 = _mm_add_epi32(sum1, dotU8Sse4(activations, b + 16, ones));
+                        }
+                    }
+                }
+
+                __m128i words = _mm_packs_epi32(requantizeSse4(sum0, q, z), requantizeSse4(sum1, q, z + 4));
+                _mm_storel_epi64((__m128i*)(out + z), _mm_packus_epi16(words, words));
+            }
+        }
+    }
+
+    TARGET_SSE4
+    static void fullyConnectedU8Sse4(int* output, const unsigned char* input, const signed char* weights,
+                                     int inputs, int outputs)
+    {
+        __m128i ones = _mm_set1_epi16(1);
+        for (int o = 0; o < outputs; o++) {
+            const signed char* row = weights + (long)o*inputs;
+            __m128i sum = _mm_setzero_si128();
+
+            int i = 0;
+            for (; i + 16 <= inputs; i += 16)
+                sum = _mm_add_epi32(sum, dotU8Sse4(_mm_loadu_si128((const __m128i*)(input + i)), row + i, ones));
+            sum = _mm_hadd_epi32(sum, sum);
+            sum = _mm_hadd_epi32(sum, sum);
+            int total = _mm_cvtsi128_si32(sum);
+            for (; i < inputs; i++)
+                total += row[i]*input[i];
+            output[o] = total;
+        }
+    }
+
+    //------------------------------------------------------------------- AVX2
+
+    //lane masks for a last group of 1-3 filters, as the JIT uses
+    alignas(32) static const long long storeMasks[4][4] = {
+        {-1, -1, -1, -1}, {-1, 0, 0, 0}, {-1, -1, 0, 0}, {-1, -1, -1, 0}
+    };
+
+    //Computes XB adjacent output pixels of row y for one group of 4 filters, so
+    //every packed filter load is reused XB times. With FF/SS non-zero the filter
+    //size and stride are compile-time constants (and there is no dilation): the
+    //filter loops unroll completely and every input/filter offset folds into an
+    //immediate. FF = SS = 0 is the generic kernel taking F, stride and dilation
+    //at runtime.
+    template <int FF, int SS, int XB>
+    TARGET_AVX2
+    static inline void convTileAvx2(double* C, const double* A, const double* B, ConvShape const &s, int y, int x, int z)
+    {
+        const int Fh = FF ? FF : s.Fh;
+        const int Fw = FF ? FF : s.Fw;
+        const int SY = SS ? SS : s.strideY;
+        const int SX = SS ? SS : s.strideX;
+        const int DY = FF ? 1 : s.dilationY;
+        const int DX = FF ? 1 : s.dilationX;
+        const int W = s.paddedWidth;
+        const int depth = s.depth;
+        const long plane = (long)s.paddedHeight*W;
+
+        __m256d output[XB];
+        for (int t = 0; t < XB; t++)
+            output[t] = _mm256_setzero_pd();
+
+        const double* a_k = A + (W*y*SY + x*SX);
+        const double* b_k = B + Fh*Fw*depth*z;
+        for (int k = 0; k < depth; k++, a_k += plane, b_k += Fh*Fw*4) {
+            #pragma GCC unroll 11
+            for (int i = 0; i < Fh; i++) {
+                const double* a_row = a_k + W*i*DY;
+                #pragma GCC unroll 11
+                for (int j = 0; j < Fw; j++) {
+                    __m256d b = _mm256_load_pd(b_k + (Fw*i + j)*4);
+                    for (int t = 0; t < XB; t++)
+                        output[t] = _mm256_fmadd_pd(_mm256_broadcast_sd(a_row + j*DX + t*SX), b, output[t]);
+                }
+            }
+        }
+
+        //C is only 32-byte aligned when numberOfFilters % 4 == 0
+        double* out = C + ((long)s.numberOfFilters*s.outWidth*y + s.numberOfFilters*x + z);
+        int lanes = s.numberOfFilters - z;
+        if (lanes >= 4) {
+            for (int t = 0; t < XB; t++)
+                _mm256_storeu_pd(out + s.numberOfFilters*t, output[t]);
+        } else {
+            __m256i mask = _mm256_load_si256((const __m256i*)storeMasks[lanes]);
+            for (int t = 0; t < XB; t++)
+                _mm256_maskstore_pd(out + s.numberOfFilters*t, mask, output[t]);
+        }
+    }
+
+    template <int FF, int SS, int XB>
+    TARGET_AVX2
+    static void convGroupAvx2(double* C, const double* A, const double* B, ConvShape const &s, int y, int z)
+    {
+        int x = 0;
+        for (; x + XB <= s.outWidth; x += XB)
+            convTileAvx2<FF, SS, XB>(C, A, B, s, y, x, z);
+        for (; x < s.outWidth; x++)
+            convTileAvx2<FF, SS, 1>(C, A, B, s, y, x, z);
+    }
+
+    template <int FF, int SS>
+    TARGET_AVX2
+    static void convGroupAvx2(double* C, const double* A, const double* B, ConvShape const &s, int y, int z, int xBlock)
+    {
+        switch (xBlock) {
+            case 8: convGroupAvx2<FF, SS, 8>(C, A, B, s, y, z); break;
+            case 4: convGroupAvx2<FF, SS, 4>(C, A, B, s, y, z); break;
+            case 2: convGroupAvx2<FF, SS, 2>(C, A, B, s, y, z); break;
+            default: convGroupAvx2<FF, SS, 1>(C, A, B, s, y, z); break;
+        }
+    }
+
+    template <int FF, int SS>
+    TARGET_AVX2
+    static void convRowAvx2(double* C, const double* A, const double* B, ConvShape const &s, int y, int xBlock)
+    {
+        for (int z = 0; z < s.numberOfFilters; z += 4)
+            convGroupAvx2<FF, SS>(C, A, B, s, y, z, xBlock);
+    }
+
+    //XB adjacent output pixels of one channel block share every filter load;
+    //a block of 4 channels is one __m256d, so there are no shuffles at all.
+    //FF/SS fix the filter size and stride (no dilation) as in convTileAvx2.
+    template <int FF, int SS, int XB>
+    TARGET_AVX2
+    static inline void depthwiseTileAvx2(double* out, const double* a_block, const double* b_block, ConvShape const &s, int y, int x)
+    {
+        const int L = DEPTHWISE_BLOCK;
+        const int Fh = FF ? FF : s.Fh;
+        const int Fw = FF ? FF : s.Fw;
+        const int SY = SS ? SS : s.strideY;
+        const int SX = SS ? SS : s.strideX;
+        const int DY = FF ? 1 : s.dilationY;
+        const int DX = FF ? 1 : s.dilationX;
+
+        __m256d output[XB];
+        for (int t = 0; t < XB; t++)
+            output[t] = _mm256_setzero_pd();
+
+        #pragma GCC unroll 5
+        for (int i = 0; i < Fh; i++) {
+            const double* a_row = a_block + ((long)s.paddedWidth*(y*SY + i*DY) + x*SX)*L;
+            #pragma GCC unroll 5
+            for (int j = 0; j < Fw; j++) {
+                __m256d b = _mm256_load_pd(b_block + (Fw*i + j)*L);
+                for (int t = 0; t < XB; t++)
+                    output[t] = _mm256_fmadd_pd(_mm256_load_pd(a_row + (j*DX + t*SX)*L), b, output[t]);
+            }
+        }
+
+        for (int t = 0; t < XB; t++)
+            _mm256_store_pd(out + t*L, output[t]);
+    }
+
+    template <int FF, int SS>
+    TARGET_AVX2
+    static void depthwiseRowAvx2(double* C, const double* A, const double* B, ConvShape const &s, int y)
+    {
+        const int L = DEPTHWISE_BLOCK;
+        long inBlock = (long)s.paddedHeight*s.paddedWidth*L;
+        long outBlock = (long)s.outHeight*s.outWidth*L;
+        int blocks = (s.numberOfFilters + L - 1)/L;
+
+        for (int cb = 0; cb < blocks; cb++) {
+            const double* a_block = A + inBlock*cb;
+            const double* b_block = B + s.Fh*s.Fw*L*cb;
+            double* out = C + outBlock*cb + (long)s.outWidth*y*L;
+            int x = 0;
+            for (; x + 8 <= s.outWidth; x += 8)
+                depthwiseTileAvx2<FF, SS, 8>(out + x*L, a_block, b_block, s, y, x);
+            for (; x < s.outWidth; x++)
+                depthwiseTileAvx2<FF, SS, 1>(out + x*L, a_block, b_block, s, y, x);
+        }
+    }
+
+    //depthwise layers are nearly always 3x3 (sometimes 5x5), stride 1 or 2
+    TARGET_AVX2
+    static void depthwiseRowAvx2(double* C, const double* A, const double* B, ConvShape const &s, int y)
+    {
+        if (s.Fh == s.Fw && s.strideY == s.strideX && s.dilationY == 1 && s.dilationX == 1) {
+            switch (s.Fw*16 + s.strideX) {
+                case 3*16 + 1: return depthwiseRowAvx2<3, 1>(C, A, B, s, y);
+                case 3*16 + 2: return depthwiseRowAvx2<3, 2>(C, A, B, s, y);
+                case 5*16 + 1: return depthwiseRowAvx2<5, 1>(C, A, B, s, y);
+                case 5*16 + 2: return depthwiseRowAvx2<5, 2>(C, A, B, s, y);
+            }
+        }
+        depthwiseRowAvx2<0, 0>(C, A, B, s, y);
+    }
+
+    //4 filters x 12 pixels: 12 ymm accumulators, 3 for the strip, 1 broadcast.
+    //As in the SSE4 tile every loop over the accumulators is unrolled.
+    TARGET_AVX2
+    static void pointwiseTileAvx2(double* C, long plane, const double* strip, const double* panel,
+                                  int depth, int rows, int columns, double bias)
+    {
+        const int NR = 12;
+        __m256d output[GEMM_MR][3];
+        #pragma GCC unroll 4
+        for (int r = 0; r < GEMM_MR; r++)
+            output[r][0] = output[r][1] = output[r][2] = _mm256_setzero_pd();
+
+        for (int k = 0; k < depth; k++) {
+            __m256d a0 = _mm256_load_pd(strip + NR*k);
+            __m256d a1 = _mm256_load_pd(strip + NR*k + 4);
+            __m256d a2 = _mm256_load_pd(strip + NR*k + 8);
+            #pragma GCC unroll 4
+            for (int r = 0; r < GEMM_MR; r++) {
+                __m256d b = _mm256_broadcast_sd(panel + GEMM_MR*k + r);
+                output[r][0] = _mm256_fmadd_pd(b, a0, output[r][0]);
+                output[r][1] = _mm256_fmadd_pd(b, a1, output[r][1]);
+                output[r][2] = _mm256_fmadd_pd(b, a2, output[r][2]);
+            }
+        }
+
+        __m256d b = _mm256_set1_pd(bias);
+        alignas(32) double tile[GEMM_MR][NR];
+        #pragma GCC unroll 4
+        for (int r = 0; r < GEMM_MR; r++) {
+            #pragma GCC unroll 3
+            for (int v = 0; v < 3; v++)
+                _mm256_store_pd(tile[r] + 4*v, _mm256_add_pd(output[r][v], b));
+        }
+        for (int r = 0; r < rows; r++) {
+            double* out = C + plane*r;
+            int c = 0;
+            for (; c + 4 <= columns; c += 4)
+                _mm256_storeu_pd(out + c, _mm256_load_pd(tile[r] + c));
+            for (; c < columns; c++)
+                out[c] = tile[r][c];
+        }
+    }
+
+    TARGET_AVX2
+    static void maxPoolAvx2(double* output, const double* input, int width, int depth,
+                            int Fh, int Fw, int strideY, int strideX, int outHeight, int outWidth)
+    {
+        for (int y = 0; y < outHeight; y++) {
+            for (int x = 0; x < outWidth; x++) {
+                const double* window = input + (width*y*strideY + x*strideX)*depth;
+                double* out = output + (outWidth*y + x)*depth;
+
+                int c = 0;
+                for (; c + 4 <= depth; c += 4) {
+                    __m256d max = _mm256_loadu_pd(window + c);
+                    for (int i = 0; i < Fh; i++) {
+                        for (int j = 0; j < Fw; j++)
+                            max = _mm256_max_pd(max, _mm256_loadu_pd(window + (width*i + j)*depth + c));
+                    }
+                    _mm256_storeu_pd(out + c, max);
+                }
+                for (; c < depth; c++) {
+                    double max = window[c];
+                    for (int i = 0; i < Fh; i++) {
+                        for (int j = 0; j < Fw; j++) {
+                            double value = window[(width*i + j)*depth + c];
+                            if (value > max)
+                                max = value;
+                        }
+                    }
+                    out[c] = max;
+                }
+            }
+        }
+    }
+
+    TARGET_AVX2
+    static void fullyConnectedAvx2(double* output, const double* input, const double* weights,
+                                   int inputs, int outputs)
+    {
+        for (int o = 0; o < outputs; o++) {
+            const double* row = weights + (long)o*inputs;
+            __m256d sum0 = _mm256_setzero_pd();
+            __m256d sum1 = _mm256_setzero_pd();
+
+            int i = 0;
+            for (; i + 8 <= inputs; i += 8) {
+                sum0 = _mm256_fmadd_pd(_mm256_loadu_pd(row + i), _mm256_loadu_pd(input + i), sum0);
+                sum1 = _mm256_fmadd_pd(_mm256_loadu_pd(row + i + 4), _mm256_loadu_pd(input + i + 4), sum1);
+            }
+            sum0 = _mm256_add_pd(sum0, sum1);
+            __m128d sum2 = _mm_add_pd(_mm256_castpd256_pd128(sum0), _mm256_extractf128_pd(sum0, 1));
+            double sum = _mm_cvtsd_f64(_mm_hadd_pd(sum2, sum2));
+            for (; i < inputs; i++)
+                sum += row[i] * input[i];
+            output[o] = sum;
+        }
+    }
+
+    //8 weights widened to floats: vcvtph2ps, or zero-extend and shift for bfloat16
+    template <bool BF16>
+    TARGET_AVX2
+    static inline __m256 widenAvx2(const unsigned short* weights)
+    {
+        __m128i bits = _mm_loadu_si128((const __m128i*)weights);
+        if (BF16)
+            return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(bits), 16));
+        return _mm256_cvtph_ps(bits);
+    }
+
+    //the double kernel's two accumulators over the same lanes
+    template <bool BF16>
+    TARGET_AVX2
+    static void fullyConnectedHalfAvx2(double* output, const double* input, const unsigned short* weights,
+                                       int inputs, int outputs)
+    {
+        for (int o = 0; o < outputs; o++) {
+            const unsigned short* row = weights + (long)o*inputs;
+            __m256d sum0 = _mm256_setzero_pd();
+            __m256d sum1 = _mm256_setzero_pd();
+
+            int i = 0;
+            for (; i + 8 <= inputs; i += 8) {
+                __m256 w = widenAvx2<BF16>(row + i);
+                sum0 = _mm256_fmadd_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(w)), _mm256_loadu_pd(input + i), sum0);
+                sum1 = _mm256_fmadd_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(w, 1)), _mm256_loadu_pd(input + i + 4), sum1);
+            }
+            sum0 = _mm256_add_pd(sum0, sum1);
+            __m128d sum2 = _mm_add_pd(_mm256_castpd256_pd128(sum0), _mm256_extractf128_pd(sum0, 1));
+            double sum = _mm_cvtsd_f64(_mm_hadd_pd(sum2, sum2));
+            for (; i < inputs; i++)
+                sum += (double)(BF16 ? fromBfloat16(row[i]) : fromHalf(row[i])) * input[i];
+            output[o] = sum;
+        }
+    }
+
+    //4 values of 4 rows, stored transposed: dst[4*j + l] = r_l[j]
+    TARGET_AVX2
+    static inline void store4x4Avx2(double* dst, __m256d r0, __m256d r1, __m256d r2, __m256d r3)
+    {
+        __m256d t0 = _mm256_unpacklo_pd(r0, r1);
+        __m256d t1 = _mm256_unpackhi_pd(r0, r1);
+        __m256d t2 = _mm256_unpacklo_pd(r2, r3);
+        __m256d t3 = _mm256_unpackhi_pd(r2, r3);
+
+        _mm256_storeu_pd(dst, _mm256_permute2f128_pd(t0, t2, 0x20));
+        _mm256_storeu_pd(dst + 4, _mm256_permute2f128_pd(t1, t3, 0x20));
+        _mm256_storeu_pd(dst + 8, _mm256_permute2f128_pd(t0, t2, 0x31));
+        _mm256_storeu_pd(dst + 12, _mm256_permute2f128_pd(t1, t3, 0x31));
+    }
+
+    TARGET_AVX2
+    static void pack4Avx2(double* dst, const double* src0, const double* src1,
+                          const double* src2, const double* src3, int n)
+    {
+        int j = 0;
+        for (; j + 4 <= n; j += 4)
+            store4x4Avx2(dst + 4*j, _mm256_loadu_pd(src0 + j), _mm256_loadu_pd(src1 + j),
+                         _mm256_loadu_pd(src2 + j), _mm256_loadu_pd(src3 + j));
+        pack4Scalar(dst + 4*j, src0 + j, src1 + j, src2 + j, src3 + j, n - j);
+    }
+
+    //4 weights widened to doubles: vcvtph2ps, or unpacked against zeros for bfloat16
+    template <bool BF16>
+    TARGET_AVX2
+    static inline __m256d widen4Avx2(const unsigned short* weights)
+    {
+        __m128i bits = _mm_loadl_epi64((const __m128i*)weights);
+        if (BF16)
+            return _mm256_cvtps_pd(_mm_castsi128_ps(_mm_unpacklo_epi16(_mm_setzero_si128(), bits)));
+        return _mm256_cvtps_pd(_mm_cvtph_ps(bits));
+    }
+
+    template <bool BF16>
+    TARGET_AVX2
+    static void pack4HalfAvx2(double* dst, const unsigned short* src0, const unsigned short* src1,
+                              const unsigned short* src2, const unsigned short* src3, int n)
+    {
+        int j = 0;
+        for (; j + 4 <= n; j += 4)
+            store4x4Avx2(dst + 4*j, widen4Avx2<BF16>(src0 + j), widen4Avx2<BF16>(src1 + j),
+                         widen4Avx2<BF16>(src2 + j), widen4Avx2<BF16>(src3 + j));
+        if (BF16)
+            pack4HalfScalar<fromBfloat16>(dst + 4*j, src0 + j, src1 + j, src2 + j, src3 + j, n - j);
+        else
+            pack4HalfScalar<fromHalf>(dst + 4*j, src0 + j, src1 + j, src2 + j, src3 + j, n - j);
+    }
+
+    TARGET_AVX2
+    static void deinterleave3Avx2(double* plane0, double* plane1, double* plane2, const unsigned char* pixels,
+                                  long count, const double* mean, double scale)
+    {
+        const __m128i shuffle = DEINTERLEAVE3_SHUFFLE;
+        const __m256d s = _mm256_set1_pd(scale);
+        const __m256d m0 = _mm256_set1_pd(mean[0]);
+        const __m256d m1 = _mm256_set1_pd(mean[1]);
+        const __m256d m2 = _mm256_set1_pd(mean[2]);
+
+        long i = 0;
+        for (; i + 6 <= count; i += 4) {
+            __m128i channels = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (pixels + 3*i)), shuffle);
+            __m256d c0 = _mm256_cvtepi32_pd(_mm_cvtepu8_epi32(channels));
+            __m256d c1 = _mm256_cvtepi32_pd(_mm_cvtepu8_epi32(_mm_srli_si128(channels, 4)));
+            __m256d c2 = _mm256_cvtepi32_pd(_mm_cvtepu8_epi32(_mm_srli_si128(channels, 8)));
+            _mm256_storeu_pd(plane0 + i, _mm256_mul_pd(_mm256_sub_pd(c0, m0), s));
+            _mm256_storeu_pd(plane1 + i, _mm256_mul_pd(_mm256_sub_pd(c1, m1), s));
+            _mm256_storeu_pd(plane2 + i, _mm256_mul_pd(_mm256_sub_pd(c2, m2), s));
+        }
+        deinterleave3Scalar(plane0 + i, plane1 + i, plane2 + i, pixels + 3*i, count - i, mean, scale);
+    }
+
+    //two pixels per vector, one in each 128-bit lane, a multiply and an add
+    //per tap (no FMA, so the bytes round as the scalar kernel's do); the pair
+    //runs the taps of the wider one, the other's weights are zero there
+    TARGET_AVX2
+    static void resampleRowAvx2(unsigned char* out, const float* row, const int* first, const int* taps,
+                                const float* weights, int maxTaps, int width)
+    {
+        int x = 0;
+        for (; x + 2 <= width; x += 2) {
+            const float* in0 = row + 3L*first[x];
+            const float* in1 = row + 3L*first[x + 1];
+            const float* w0 = weights + (long)x*maxTaps;
+            const float* w1 = w0 + maxTaps;
+            int count = max(taps[x], taps[x + 1]);
+
+            __m256 sum = _mm256_setzero_ps();
+            for (int t = 0; t < count; t++) {
+                __m256 values = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(in0 + 3*t)), _mm_loadu_ps(in1 + 3*t), 1);
+                __m256 w = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_set1_ps(w0[t])), _mm_set1_ps(w1[t]), 1);
+                sum = _mm256_add_ps(sum, _mm256_mul_ps(w, values));
+            }
+
+            __m256i rounded = _mm256_cvttps_epi32(_mm256_add_ps(sum, _mm256_set1_ps(0.5f)));
+            __m128i words = _mm_packs_epi32(_mm256_castsi256_si128(rounded), _mm256_extracti128_si256(rounded, 1));
+            __m128i bytes = _mm_packus_epi16(words, words);
+            int pixels[2] = {_mm_cvtsi128_si32(bytes), _mm_extract_epi32(bytes, 1)};
+            memcpy(out + 3*x, &pixels[0], 3);
+            memcpy(out + 3*x + 3, &pixels[1], 3);
+        }
+        resampleRowScalar(out + 3*x, row, first + x, taps + x, weights + (long)x*maxTaps, maxTaps, width - x);
+    }
+
+    //multiply and add as accumulateU8Scalar does, for the same rounding
+    TARGET_AVX2
+    static void accumulateU8Avx2(float* acc, const unsigned char* row, long n, float weight)
+    {
+        const __m256 w = _mm256_set1_ps(weight);
+
+        long i = 0;
+        for (; i + 16 <= n; i += 16) {
+            __m128i bytes = _mm_loadu_si128((const __m128i*) (row + i));
+            __m256 lo = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bytes));
+            __m256 hi = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(bytes, 8)));
+            _mm256_storeu_ps(acc + i, _mm256_add_ps(_mm256_loadu_ps(acc + i), _mm256_mul_ps(w, lo)));
+            _mm256_storeu_ps(acc + i + 8, _mm256_add_ps(_mm256_loadu_ps(acc + i + 8), _mm256_mul_ps(w, hi)));
+        }
+        accumulateU8Scalar(acc + i, row + i, n - i, weight);
+    }
+
+    TARGET_AVX2
+    static double peakFlopsAvx2(long iterations)
+    {
+        __m256d acc[PEAK_CHAINS];
+        const __m256d m = _mm256_set1_pd(0.999999);
+        const __m256d c = _mm256_set1_pd(1e-6);
+        for (int r = 0; r < PEAK_CHAINS; r++)
+            acc[r] = _mm256_set1_pd(r);
+
+        for (long n = 0; n < iterations; n++) {
+            #pragma GCC unroll 12
+            for (int r = 0; r < PEAK_CHAINS; r++)
+                acc[r] = _mm256_fmadd_pd(acc[r], m, c);
+        }
+
+        __m256d sum = _mm256_setzero_pd();
+        for (int r = 0; r < PEAK_CHAINS; r++)
+            sum = _mm256_add_pd(sum, acc[r]);
+        peakSink = _mm_cvtsd_f64(_mm256_castpd256_pd128(sum));
+        return 2.0 * 4 * PEAK_CHAINS * iterations;
+    }
+
+    //8 filters x 4 channels of 8 bits into 8 int32 lanes, as dotU8Sse4
+    TARGET_AVX2
+    static inline __m256i dotU8Avx2(__m256i a, __m256i b, __m256i ones)
+    {
+        return _mm256_madd_epi16(_mm256_maddubs_epi16(a, b), ones);
+    }
+
+    //requantizes the 8 sums of filters z..z+7 and stores them as bytes
+    TARGET_AVX2
+    static inline void storeU8Avx2(unsigned char* out, __m256i sum, Requantize const &q, int z)
+    {
+        __m256 scaled = _mm256_mul_ps(_mm256_cvtepi32_ps(sum), _mm256_loadu_ps(q.multiplier + z));
+        scaled = _mm256_min_ps(_mm256_max_ps(scaled, _mm256_set1_ps(-REQUANTIZE_LIMIT)), _mm256_set1_ps(REQUANTIZE_LIMIT));
+        __m256i value = _mm256_add_epi32(_mm256_cvtps_epi32(scaled), _mm256_loadu_si256((const __m256i*)(q.zeroPoint + z)));
+        value = _mm256_max_epi32(value, _mm256_loadu_si256((const __m256i*)(q.lower + z)));
+        value = _mm256_min_epi32(value, _mm256_set1_epi32(255));
+
+        __m128i words = _mm_packs_epi32(_mm256_castsi256_si128(value), _mm256_extracti128_si256(value, 1));
+        _mm_storel_epi64((__m128i*)out, _mm_packus_epi16(words, words));
+    }
+
+    //XB adjacent output pixels for one group of 8 filters: every weight load
+    //is reused XB times, each pixel broadcasts its 4 channels
+    template <int XB>
+    TARGET_AVX2
+    static inline void convTileU8Avx2(unsigned char* out, const unsigned char* A, const signed char* b, ConvShape const &s,
+                                      Requantize const &q, int y, int x, int z)
+    {
+        const int N = QUANT_FILTERS, K = QUANT_K;
+        __m256i ones = _mm256_set1_epi16(1);
+        __m256i sum[XB];
+        for (int t = 0; t < XB; t++)
+            sum[t] = _mm256_loadu_si256((const __m256i*)(q.bias + z));
+
+        for (int i = 0; i < s.Fh; i++) {
+            for (int j = 0; j < s.Fw; j++) {
+                const unsigned char* a = A + ((long)s.paddedWidth*(y*s.strideY + i) + x*s.strideX + j)*s.depth;
+                for (int k = 0; k < s.depth; k += K, b += N*K) {
+                    __m256i weights = _mm256_loadu_si256((const __m256i*)b);
+                    for (int t = 0; t < XB; t++) {
+                        __m256i activations = _mm256_set1_epi32(quad(a + (long)t*s.strideX*s.depth + k));
+                        sum[t] = _mm256_add_epi32(sum[t], dotU8Avx2(activations, weights, ones));
+                    }
+                }
+            }
+        }
+
+        for (int t = 0; t < XB; t++)
+            storeU8Avx2(out + (long)t*s.numberOfFilters, sum[t], q, z);
+    }
+
+    TARGET_AVX2
+    static void convRowU8Avx2(unsigned char* C, const unsigned char* A, const signed char* B, ConvShape const &s,
+                              Requantize const &q, int y)
+    {
+        const int N = QUANT_FILTERS, XB = 4;
+        long groupSize = (long)s.Fh*s.Fw*s.depth*N;
+        for (int z = 0; z < s.numberOfFilters; z += N) {
+            const signed char* group = B + groupSize*(z/N);
+            unsigned char* out = C + (long)s.outWidth*y*s.numberOfFilters + z;
+            int x = 0;
+            for (; x + XB <= s.outWidth; x += XB)
+                convTileU8Avx2<XB>(out + (long)x*s.numberOfFilters, A, group, s, q, y, x, z);
+            for (; x < s.outWidth; x++)
+                convTileU8Avx2<1>(out + (long)x*s.numberOfFilters, A, group, s, q, y, x, z);
+        }
+    }
+
+    TARGET_AVX2
+    static void fullyConnectedU8Avx2(int* output, const unsigned char* input, const signed char* weights,
+                                     int inputs, int outputs)
+    {
+        __m256i ones = _mm256_set1_epi16(1);
+        for (int o = 0; o < outputs; o++) {
+            const signed char* row = weights + (long)o*inputs;
+            __m256i sum = _mm256_setzero_si256();
+
+            int i = 0;
+            for (; i + 32 <= inputs; i += 32)
+                sum = _mm256_add_epi32(sum, dotU8Avx2(_mm256_loadu_si256((const __m256i*)(input + i)),
+                                                      _mm256_loadu_si256((const __m256i*)(row + i)), ones));
+            __m128i half = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+            half = _mm_hadd_epi32(half, half);
+            half = _mm_hadd_epi32(half, half);
+            int total = _mm_cvtsi128_si32(half);
+            for (; i < inputs; i++)
+                total += row[i]*input[i];
+            output[o] = total;
+        }
+    }
+
+    //----------------------------------------------------------------- AVX-512
+
+    //the AVX-512 intrinsic headers seed results with _mm512_undefined_*(),
+    //which GCC 12 reports as uninitialised once they are inlined into these
+    //target() functions; the rest of the file keeps the warning
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+    //sum of the 8 lanes: the two halves added, then an AVX2 horizontal add.
+    //_mm512_reduce_add_pd and the unmasked extract (the 512 to 256 cast too)
+    //seed their results with undefined registers, which GCC 12 warns about;
+    //the zero-masked extract with every lane set has no such operand.
+    TARGET_AVX512
+    static inline double reduceAvx512(__m512d v)
+    {
+        __m256d low = _mm512_maskz_extractf64x4_pd((__mmask8)0xff, v, 0);
+        __m256d high = _mm512_maskz_extractf64x4_pd((__mmask8)0xff, v, 1);
+        __m256d half = _mm256_add_pd(low, high);
+        __m128d quarter = _mm_add_pd(_mm256_castpd256_pd128(half), _mm256_extractf128_pd(half, 1));
+        return _mm_cvtsd_f64(_mm_hadd_pd(quarter, quarter));
+    }
+
+    //two neighbouring groups of 4 filters share one zmm, so each broadcast of the
+    //input feeds 8 filters and the 8 outputs are one contiguous store; the
+    //second group may be partial, then the store is masked to the filters left
+    template <int FF, int SS, int XB>
+    TARGET_AVX512
+    static inline void convTileAvx512(double* C, const double* A, const double* B, ConvShape const &s, int y, int x, int z)
+    {
+        const int Fh = FF ? FF : s.Fh;
+        const int Fw = FF ? FF : s.Fw;
+        const int SY = SS ? SS : s.strideY;
+        const int SX = SS ? SS : s.strideX;
+        const int DY = FF ? 1 : s.dilationY;
+        const int DX = FF ? 1 : s.dilationX;
+        const int W = s.paddedWidth;
+        const int depth = s.depth;
+        const long plane = (long)s.paddedHeight*W;
+
+        __m512d output[XB];
+        for (int t = 0; t < XB; t++)
+            output[t] = _mm512_setzero_pd();
+
+        const double* a_k = A + (W*y*SY + x*SX);
+        const double* b_k = B + Fh*Fw*depth*z;
+        for (int k = 0; k < depth; k++, a_k += plane, b_k += Fh*Fw*4) {
+            #pragma GCC unroll 11
+            for (int i = 0; i < Fh; i++) {
+                const double* a_row = a_k + W*i*DY;
+                #pragma GCC unroll 11
+                for (int j = 0; j < Fw; j++) {
+                    __m512d b = _mm512_insertf64x4(_mm512_broadcast_f64x4(_mm256_load_pd(b_k + (Fw*i + j)*4)),
+                                                   _mm256_load_pd(b_k + Fh*Fw*depth*4 + (Fw*i + j)*4), 1);
+                    for (int t = 0; t < XB; t++)
+                        output[t] = _mm512_fmadd_pd(_mm512_set1_pd(a_row[j*DX + t*SX]), b, output[t]);
+                }
+            }
+        }
+
+        double* out = C + ((long)s.numberOfFilters*s.outWidth*y + s.numberOfFilters*x + z);
+        int lanes = s.numberOfFilters - z;
+        if (lanes >= 8) {
+            for (int t = 0; t < XB; t++)
+                _mm512_storeu_pd(out + s.numberOfFilters*t, output[t]);
+        } else {
+            __mmask8 mask = (__mmask8)((1u << lanes) - 1);
+            for (int t = 0; t < XB; t++)
+                _mm512_mask_storeu_pd(out + s.numberOfFilters*t, mask, output[t]);
+        }
+    }
+
+    template <int FF, int SS, int XB>
+    TARGET_AVX512
+    static void convGroupAvx512(double* C, const double* A, const double* B, ConvShape const &s, int y, int z)
+    {
+        int x = 0;
+        for (; x + XB <= s.outWidth; x += XB)
+            convTileAvx512<FF, SS, XB>(C, A, B, s, y, x, z);
+        for (; x < s.outWidth; x++)
+            convTileAvx512<FF, SS, 1>(C, A, B, s, y, x, z);
+    }
+
+    template <int FF, int SS>
+    TARGET_AVX512
+    static void convRowAvx512(double* C, const double* A, const double* B, ConvShape const &s, int y, int xBlock)
+    {
+        //a pair of groups as long as there are more than 4 filters left, so a
+        //partial last group rides in the upper half of a masked zmm
+        int z = 0;
+        for (; z + 4 < s.numberOfFilters; z += 8) {
+            switch (xBlock) {
+                case 8: convGroupAvx512<FF, SS, 8>(C, A, B, s, y, z); break;
+                case 4: convGroupAvx512<FF, SS, 4>(C, A, B, s, y, z); break;
+                case 2: convGroupAvx512<FF, SS, 2>(C, A, B, s, y, z); break;
+                default: convGroupAvx512<FF, SS, 1>(C, A, B, s, y, z); break;
+            }
+        }
+        //one group of at most 4 left over
+        for (; z < s.numberOfFilters; z += 4)
+            convGroupAvx2<FF, SS>(C, A, B, s, y, z, xBlock);
+    }
+
+    //4 filters x 32 pixels: 16 zmm accumulators, 4 for the strip, 1 broadcast,
+    //with the accumulator loops unrolled as in the AVX2 tile
+    TARGET_AVX512
+    static void pointwiseTileAvx512(double* C, long plane, const double* strip, const double* panel,
+                                    int depth, int rows, int columns, double bias)
+    {
+        const int NR = 32;
+        __m512d output[GEMM_MR][4];
+        #pragma GCC unroll 4
+        for (int r = 0; r < GEMM_MR; r++)
+            output[r][0] = output[r][1] = output[r][2] = output[r][3] = _mm512_setzero_pd();
+
+        for (int k = 0; k < depth; k++) {
+            __m512d a0 = _mm512_load_pd(strip + NR*k);
+            __m512d a1 = _mm512_load_pd(strip + NR*k + 8);
+            __m512d a2 = _mm512_load_pd(strip + NR*k + 16);
+            __m512d a3 = _mm512_load_pd(strip + NR*k + 24);
+            #pragma GCC unroll 4
+            for (int r = 0; r < GEMM_MR; r++) {
+                __m512d b = _mm512_set1_pd(panel[GEMM_MR*k + r]);
+                output[r][0] = _mm512_fmadd_pd(b, a0, output[r][0]);
+                output[r][1] = _mm512_fmadd_pd(b, a1, output[r][1]);
+                output[r][2] = _mm512_fmadd_pd(b, a2, output[r][2]);
+                output[r][3] = _mm512_fmadd_pd(b, a3, output[r][3]);
+            }
+        }
+
+        __m512d b = _mm512_set1_pd(bias);
+        alignas(64) double tile[GEMM_MR][NR];
+        #pragma GCC unroll 4
+        for (int r = 0; r < GEMM_MR; r++) {
+            #pragma GCC unroll 4
+            for (int v = 0; v < 4; v++)
+                _mm512_store_pd(tile[r] + 8*v, _mm512_add_pd(output[r][v], b));
+        }
+        for (int r = 0; r < rows; r++) {
+            double* out = C + plane*r;
+            for (int c = 0; c < columns; c += 8) {
+                int lanes = min(8, columns - c);
+                _mm512_mask_storeu_pd(out + c, (__mmask8)((1u << lanes) - 1), _mm512_load_pd(tile[r] + c));
+            }
+        }
+    }
+
+    TARGET_AVX512
+    static void maxPoolAvx512(double* output, const double* input, int width, int depth,
+                              int Fh, int Fw, int strideY, int strideX, int outHeight, int outWidth)
+    {
+        for (int y = 0; y < outHeight; y++) {
+            for (int x = 0; x < outWidth; x++) {
+                const double* window = input + (width*y*strideY + x*strideX)*depth;
+                double* out = output + (outWidth*y + x)*depth;
+
+                int c = 0;
+                for (; c + 8 <= depth; c += 8) {
+                    __m512d max = _mm512_loadu_pd(window + c);
+                    for (int i = 0; i < Fh; i++) {
+                        for (int j = 0; j < Fw; j++)
+                            max = _mm512_max_pd(max, _mm512_loadu_pd(window + (width*i + j)*depth + c));
+                    }
+                    _mm512_storeu_pd(out + c, max);
+                }
+                if (c < depth) {
+                    //channel tail under a mask instead of a scalar loop
+                    __mmask8 mask = (__mmask8)((1u << (depth - c)) - 1);
+                    __m512d max = _mm512_maskz_loadu_pd(mask, window + c);
+                    for (int i = 0; i < Fh; i++) {
+                        for (int j = 0; j < Fw; j++)
+                            max = _mm512_max_pd(max, _mm512_maskz_loadu_pd(mask, window + (width*i + j)*depth + c));
+                    }
+                    _mm512_mask_storeu_pd(out + c, mask, max);
+                }
+            }
+        }
+    }
+
+    TARGET_AVX512
+    static void fullyConnectedAvx512(double* output, const double* input, const double* weights,
+                                     int inputs, int outputs)
+    {
+        for (int o = 0; o < outputs; o++) {
+            const double* row = weights + (long)o*inputs;
+            __m512d sum0 = _mm512_setzero_pd();
+            __m512d sum1 = _mm512_setzero_pd();
+
+            int i = 0;
+            for (; i + 16 <= inputs; i += 16) {
+                sum0 = _mm512_fmadd_pd(_mm512_loadu_pd(row + i), _mm512_loadu_pd(input + i), sum0);
+                sum1 = _mm512_fmadd_pd(_mm512_loadu_pd(row + i + 8), _mm512_loadu_pd(input + i + 8), sum1);
+            }
+            if (i < inputs) {
+                __mmask16 mask = (__mmask16)((1u << (inputs - i)) - 1);
+                sum0 = _mm512_fmadd_pd(_mm512_maskz_loadu_pd((__mmask8)mask, row + i),
+                                       _mm512_maskz_loadu_pd((__mmask8)mask, input + i), sum0);
+                sum1 = _mm512_fmadd_pd(_mm512_maskz_loadu_pd((__mmask8)(mask >> 8), row + i + 8),
+                                       _mm512_maskz_loadu_pd((__mmask8)(mask >> 8), input + i + 8), sum1);
+            }
+            output[o] = reduceAvx512(_mm512_add_pd(sum0, sum1));
+        }
+    }
+
+    template <bool BF16>
+    TARGET_AVX512
+    static inline __m512 widenAvx512(const unsigned short* weights)
+    {
+        __m256i bits = _mm256_loadu_si256((const __m256i*)weights);
+        if (BF16)
+            return _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_cvtepu16_epi32(bits), 16));
+        return _mm512_cvtph_ps(bits);
+    }
+
+    //the tail is copied into a zeroed block of 16 weights, so it widens like the others
+    template <bool BF16>
+    TARGET_AVX512
+    static void fullyConnectedHalfAvx512(double* output, const double* input, const unsigned short* weights,
+                                         int inputs, int outputs)
+    {
+        for (int o = 0; o < outputs; o++) {
+            const unsigned short* row = weights + (long)o*inputs;
+            __m512d sum0 = _mm512_setzero_pd();
+            __m512d sum1 = _mm512_setzero_pd();
+
+            int i = 0;
+            for (; i + 16 <= inputs; i += 16) {
+                __m512 w = widenAvx512<BF16>(row + i);
+                __m256 high = _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(w), 1));
+                sum0 = _mm512_fmadd_pd(_mm512_cvtps_pd(_mm512_castps512_ps256(w)), _mm512_loadu_pd(input + i), sum0);
+                sum1 = _mm512_fmadd_pd(_mm512_cvtps_pd(high), _mm512_loadu_pd(input + i + 8), sum1);
+            }
+            if (i < inputs) {
+                unsigned short tail[16] = {0};
+                memcpy(tail, row + i, (inputs - i)*sizeof(unsigned short));
+                __m512 w = widenAvx512<BF16>(tail);
+                __m256 high = _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(w), 1));
+                __mmask16 mask = (__mmask16)((1u << (inputs - i)) - 1);
+                sum0 = _mm512_fmadd_pd(_mm512_cvtps_pd(_mm512_castps512_ps256(w)),
+                                       _mm512_maskz_loadu_pd((__mmask8)mask, input + i), sum0);
+                sum1 = _mm512_fmadd_pd(_mm512_cvtps_pd(high),
+                                       _mm512_maskz_loadu_pd((__mmask8)(mask >> 8), input + i + 8), sum1);
+            }
+            output[o] = reduceAvx512(_mm512_add_pd(sum0, sum1));
+        }
+    }
+
+    TARGET_AVX512
+    static double peakFlopsAvx512(long iterations)
+    {
+        __m512d acc[PEAK_CHAINS];
+        const __m512d m = _mm512_set1_pd(0.999999);
+        const __m512d c = _mm512_set1_pd(1e-6);
+        for (int r = 0; r < PEAK_CHAINS; r++)
+            acc[r] = _mm512_set1_pd(r);
+
+        for (long n = 0; n < iterations; n++) {
+            #pragma GCC unroll 12
+            for (int r = 0; r < PEAK_CHAINS; r++)
+                acc[r] = _mm512_fmadd_pd(acc[r], m, c);
+        }
+
+        __m512d sum = _mm512_setzero_pd();
+        for (int r = 0; r < PEAK_CHAINS; r++)
+            sum = _mm512_add_pd(sum, acc[r]);
+        peakSink = reduceAvx512(sum);
+        return 2.0 * 8 * PEAK_CHAINS * iterations;
+    }
+
+    #pragma GCC diagnostic pop
+
+    //------------------------------------------------------------------ dispatch
+
+    //(F, stride) pairs that get their own fully unrolled kernel, anything else
+    //runs the generic one
+    #define FIXED_CONV_CASE(ROW, F, S) case F*16 + S: return ROW<F, S>;
+    #define FIXED_CONV_SHAPES(ROW) \
+        FIXED_CONV_CASE(ROW, 1, 1) FIXED_CONV_CASE(ROW, 1, 2) FIXED_CONV_CASE(ROW, 1, 4) \
+        FIXED_CONV_CASE(ROW, 3, 1) FIXED_CONV_CASE(ROW, 3, 2) FIXED_CONV_CASE(ROW, 3, 4) \
+        FIXED_CONV_CASE(ROW, 5, 1) FIXED_CONV_CASE(ROW, 5, 2) FIXED_CONV_CASE(ROW, 5, 4) \
+        FIXED_CONV_CASE(ROW, 7, 1) FIXED_CONV_CASE(ROW, 7, 2) FIXED_CONV_CASE(ROW, 7, 4) \
+        FIXED_CONV_CASE(ROW, 11, 1) FIXED_CONV_CASE(ROW, 11, 2) FIXED_CONV_CASE(ROW, 11, 4)
+
+    static ConvRowFn convRowForScalar(ConvShape const &shape)
+    {
+        return convRowScalar;
+    }
+
+    static ConvRowFn convRowForSse4(ConvShape const &shape)
+    {
+        return convRowSse4;
+    }
+
+    //only square, undilated filters with equal strides are specialised
+    static bool isFixedShape(ConvShape const &shape)
+    {
+        return shape.Fh == shape.Fw && shape.strideY == shape.strideX && shape.strideX < 16
+            && shape.dilationY == 1 && shape.dilationX == 1;
+    }
+
+    static ConvRowFn convRowForAvx2(ConvShape const &shape)
+    {
+        if (isFixedShape(shape)) {
+            switch (shape.Fw*16 + shape.strideX) {
+                FIXED_CONV_SHAPES(convRowAvx2)
+            }
+        }
+        return convRowAvx2<0, 0>;
+    }
+
+    static ConvRowFn convRowForAvx512(ConvShape const &shape)
+    {
+        if (isFixedShape(shape)) {
+            switch (shape.Fw*16 + shape.strideX) {
+                FIXED_CONV_SHAPES(convRowAvx512)
+            }
+        }
+        return convRowAvx512<0, 0>;
+    }
+
+    static const Table tables[] = {
+        {ISA_SCALAR, "scalar", convRowScalar, convRowForScalar, depthwiseRowScalar, pointwiseGemm<4, pointwiseTileScalar>, maxPoolScalar, fullyConnectedScalar, fullyConnectedHalfScalar<fromHalf>, fullyConnectedHalfScalar<fromBfloat16>, convRowU8Scalar, fullyConnectedU8Scalar, pack4Scalar, pack4HalfScalar<fromHalf>, pack4HalfScalar<fromBfloat16>, deinterleave3Scalar, accumulateU8Scalar, resampleRowScalar, peakFlopsScalar},
+        {ISA_SSE4, "sse4", convRowSse4, convRowForSse4, depthwiseRowSse4, pointwiseGemm<4, pointwiseTileSse4>, maxPoolSse4, fullyConnectedSse4, fullyConnectedHalfSse4<false>, fullyConnectedHalfSse4<true>, convRowU8Sse4, fullyConnectedU8Sse4, pack4Sse4, pack4HalfScalar<fromHalf>, pack4HalfScalar<fromBfloat16>, deinterleave3Sse4, accumulateU8Sse4, resampleRowSse4, peakFlopsSse4},
+        {ISA_AVX2, "avx2", convRowAvx2<0, 0>, convRowForAvx2, depthwiseRowAvx2, pointwiseGemm<12, pointwiseTileAvx2>, maxPoolAvx2, fullyConnectedAvx2, fullyConnectedHalfAvx2<false>, fullyConnectedHalfAvx2<true>, convRowU8Avx2, fullyConnectedU8Avx2, pack4Avx2, pack4HalfAvx2<false>, pack4HalfAvx2<true>, deinterleave3Avx2, accumulateU8Avx2, resampleRowAvx2, peakFlopsAvx2},
+        //packing and depthwise rows are bound by memory, the 4-channel AVX2 code is as fast as it gets;
+        //the 8-bit kernels are the AVX2 vpmaddubsw ones
+        {ISA_AVX512, "avx512", convRowAvx512<0, 0>, convRowForAvx512, depthwiseRowAvx2, pointwiseGemm<32, pointwiseTileAvx512>, maxPoolAvx512, fullyConnectedAvx512, fullyConnectedHalfAvx512<false>, fullyConnectedHalfAvx512<true>, convRowU8Avx2, fullyConnectedU8Avx2, pack4Avx2, pack4HalfAvx2<false>, pack4HalfAvx2<true>, deinterleave3Avx2, accumulateU8Avx2, resampleRowAvx2, peakFlopsAvx512},
+    };
+
+    Isa detect()
+    {
+        __builtin_cpu_init();
+
+        //__builtin_cpu_supports also checks that the OS saves the wider registers
+        if (__builtin_cpu_supports("avx512f"))
+            return ISA_AVX512;
+        //every AVX2 part has F16C, which the 16-bit weight kernels use
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && __builtin_cpu_supports("f16c"))
+            return ISA_AVX2;
+        if (__builtin_cpu_supports("sse4.2"))
+            return ISA_SSE4;
+        return ISA_SCALAR;
+    }
+
+    bool isSupported(Isa isa)
+    {
+        //every level implies the ones below it
+        return isa <= detect();
+    }
+
+    const char* isaName(Isa isa)
+    {
+        return tables[isa].name;
+    }
+
+    const Table& table(Isa isa)
+    {
+        return tables[isa];
+    }
+
+    static Isa select()
+    {
+        Isa detected = detect();
+        const char* requested = getenv(ISA_ENV);
+
+        if (requested == NULL || *requested == '\0')
+            return detected;
+
+        for (const Table &candidate : tables) {
+            if (strcmp(candidate.name, requested) != 0)
+                continue;
+
+            if (candidate.isa <= detected)
+                return candidate.isa;
+
+            cerr << ISA_ENV << "=" << requested << " is not supported on this host, using "
+                 << isaName(detected) << endl;
+            return detected;
+        }
+
+        cerr << ISA_ENV << "=" << requested << " is unknown (scalar, sse4, avx2, avx512), using "
+             << isaName(detected) << endl;
+        return detected;
+    }
+
+    const Table& active()
+    {
+        //chosen once, on first use
+        static const Table &selected = table(select());
+        return selected;
+    }
+}
@@ -0,0 +1,186 @@
+#ifndef DEF_KERNELS
+#define DEF_KERNELS
+
+//Hot loops built for several instruction sets in one binary. Each variant is
+//compiled with a function-level target attribute, so the rest of the program
+//stays baseline x86-64 and the widest variant the host supports is picked at
+//startup via CPUID. FASTCODE_ISA=scalar|sse4|avx2|avx512 forces a variant
+//(unsupported requests fall back to the detected one). The avx2 level also
+//takes F16C, which every AVX2 part has.
+namespace Kernels
+{
+	enum Isa
+	{
+		ISA_SCALAR,
+		ISA_SSE4,
+		ISA_AVX2,
+		ISA_AVX512
+	};
+
+	//one convolution over packed inputs A (depth planes of paddedHeight x
+	//paddedWidth, the padding already in place) and filters B (groups of 4
+	//filters of Fh x Fw taps, interleaved), written to C (HWC, outWidth pixels
+	//a row); height and width are independent throughout. Tap (i, j) reads the
+	//input dilationY*i rows and dilationX*j columns into the window, and the
+	//last group of 4 filters may be partial (numberOfFilters % 4 lanes stored).
+	struct ConvShape
+	{
+		int Fh, Fw;
+		int strideY, strideX;
+		int dilationY, dilationX;
+		int paddedHeight, paddedWidth;
+		int outHeight, outWidth;
+		int numberOfFilters;
+		int depth;
+	};
+
+	//one output row y of that convolution
+	typedef void (*ConvRowFn)(double* C, const double* A, const double* B, ConvShape const &shape, int y, int xBlock);
+
+	//row kernel for a layer shape: compile-time specialised for the common
+	//square (F, stride) pairs without dilation, the generic convRow otherwise
+	typedef ConvRowFn (*ConvSelectFn)(ConvShape const &shape);
+
+	//channels per block of the depthwise layout
+	const int DEPTHWISE_BLOCK = 4;
+
+	//one output row y of a depthwise convolution (one Fh x Fw filter per
+	//channel, numberOfFilters channels, depth 1), vectorised across channels:
+	//A is blocks of DEPTHWISE_BLOCK channels, each paddedHeight x paddedWidth x
+	//DEPTHWISE_BLOCK, B is blocks of Fh x Fw x DEPTHWISE_BLOCK taps and C is
+	//blocks of outHeight x outWidth x DEPTHWISE_BLOCK; lanes past the last
+	//channel are zero in A and B and are computed like the others
+	typedef void (*DepthwiseRowFn)(double* C, const double* A, const double* B, ConvShape const &shape, int y);
+
+	//filters per panel of the packed pointwise weights: the groups of 4 that
+	//Tensor::pack_filters writes, which for a 1x1 layer are B[panel][k][GEMM_MR]
+	const int GEMM_MR = 4;
+
+	//a 1x1 convolution as a matrix product on planar activations
+	struct GemmShape
+	{
+		int pixels;          //columns of A and C
+		int depth;           //rows of A, the reduction
+		int numberOfFilters; //rows of C
+	};
+
+	//C[z][p] = bias + sum_k B[z][k]*A[k][p] for the pixels [first, first + count):
+	//A is depth planes of pixels and C numberOfFilters planes, so the output
+	//stays in the planar layout of the input. The bias is added in registers
+	//before the store; B panels are zero past the last filter.
+	typedef void (*PointwiseFn)(double* C, const double* A, const double* B, GemmShape const &shape,
+	                            int first, int count, double bias);
+
+	//max pool over an HWC volume with Fh x Fw windows, vectorised across channels
+	typedef void (*MaxPoolFn)(double* output, const double* input, int width, int depth,
+	                          int Fh, int Fw, int strideY, int strideX, int outHeight, int outWidth);
+
+	//output[o] = sum_i weights[o*inputs + i] * input[i]
+	typedef void (*FullyConnectedFn)(double* output, const double* input, const double* weights,
+	                                 int inputs, int outputs);
+
+	//the same with 16-bit weights, IEEE half (fp16) or bfloat16 (the top half
+	//of a float): each is widened to float in registers (vcvtph2ps, or a 16-bit
+	//shift) and to double, and accumulated in double like the kernel above, so
+	//weights that fit 16 bits exactly give its results at a quarter of the
+	//weight traffic
+	typedef void (*FullyConnectedHalfFn)(double* output, const double* input, const unsigned short* weights,
+	                                     int inputs, int outputs);
+
+	//float <-> fp16 / bfloat16, rounded to nearest even; overflow goes to
+	//infinity and a NaN stays a NaN
+	unsigned short toHalf(float value);
+	float fromHalf(unsigned short half);
+	unsigned short toBfloat16(float value);
+	float fromBfloat16(unsigned short bits);
+
+	//8-bit convolution for the vpmaddubsw/vpmaddwd idiom: A is paddedHeight x
+	//paddedWidth pixels of depth unsigned bytes each (HWC, depth a multiple of
+	//QUANT_K, the border holding every channel's zero point), B is groups of
+	//QUANT_FILTERS filters, [group][i][j][k/QUANT_K][filter][k%QUANT_K] signed
+	//bytes, and C is outHeight x outWidth pixels of numberOfFilters bytes (a
+	//multiple of QUANT_FILTERS). Weights stay within +-QUANT_WEIGHT_MAX, so the
+	//pair sums of vpmaddubsw cannot saturate (2*255*64 < 32768); accumulation
+	//is int32. Dilation is not supported.
+	const int QUANT_K = 4;
+	const int QUANT_FILTERS = 8;
+	const int QUANT_WEIGHT_MAX = 64;
+
+	//per output channel z the int32 sum starts at bias[z] and is stored as
+	//clamp(round(sum*multiplier[z]) + zeroPoint[z], lower[z], 255); lower is
+	//the zero point for a fused ReLU, 0 otherwise
+	struct Requantize
+	{
+		const int* bias;
+		const float* multiplier;
+		const int* zeroPoint;
+		const int* lower;
+	};
+
+	//one output row y of that convolution, requantized on the way out
+	typedef void (*ConvRowU8Fn)(unsigned char* C, const unsigned char* A, const signed char* B, ConvShape const &shape,
+	                            Requantize const &requantize, int y);
+
+	//output[o] = sum_i weights[o*inputs + i] * input[i] in int32, same ranges as above
+	typedef void (*FullyConnectedU8Fn)(int* output, const unsigned char* input, const signed char* weights,
+	                                   int inputs, int outputs);
+
+	//interleaves 4 rows of n values: dst[4*j + l] = src_l[j]
+	typedef void (*Pack4Fn)(double* dst, const double* src0, const double* src1,
+	                        const double* src2, const double* src3, int n);
+
+	//the same from 16-bit rows (fp16 or bfloat16, one table entry each),
+	//widened to doubles on the way
+	typedef void (*Pack4HalfFn)(double* dst, const unsigned short* src0, const unsigned short* src1,
+	                            const unsigned short* src2, const unsigned short* src3, int n);
+
+	//splits 8-bit interleaved 3-channel pixels into double planes:
+	//planeC[i] = (pixels[3*i + C] - mean[C]) * scale
+	typedef void (*Deinterleave3Fn)(double* plane0, double* plane1, double* plane2, const unsigned char* pixels,
+	                                long count, const double* mean, double scale);
+
+	//acc[i] += weight*row[i], one vertical tap of the separable image resampler
+	typedef void (*AccumulateU8Fn)(float* acc, const unsigned char* row, long n, float weight);
+
+	//the horizontal taps of the resampler over a row of interleaved 3-channel
+	//floats: out[3*x + c] = sum_t weights[maxTaps*x + t]*row[3*(first[x] + t) + c]
+	//for t < taps[x], rounded half up and clamped to a byte. Weights past a
+	//pixel's taps must be zero, and row is read up to 3*maxTaps + 1 floats past
+	//the last source pixel, which the caller pads with zeros.
+	typedef void (*ResampleRowFn)(unsigned char* out, const float* row, const int* first, const int* taps,
+	                              const float* weights, int maxTaps, int width);
+
+	//register-only multiply-add chains for the compute roof; returns the FLOPs executed
+	typedef double (*PeakFlopsFn)(long iterations);
+
+	struct Table
+	{
+		Isa isa;
+		const char* name;
+		ConvRowFn convRow;
+		ConvSelectFn convRowFor;
+		DepthwiseRowFn depthwiseRow;
+		PointwiseFn pointwise;
+		MaxPoolFn maxPool;
+		FullyConnectedFn fullyConnected;
+		FullyConnectedHalfFn fullyConnectedF16;
+		FullyConnectedHalfFn fullyConnectedBF16;
+		ConvRowU8Fn convRowU8;
+		FullyConnectedU8Fn fullyConnectedU8;
+		Pack4Fn pack4;
+		Pack4HalfFn pack4F16;
+		Pack4HalfFn pack4BF16;
+		Deinterleave3Fn deinterleave3;
+		AccumulateU8Fn accumulateU8;
+		ResampleRowFn resampleRow;
+		PeakFlopsFn peakFlops;
+	};
+
+	Isa detect();
+	bool isSupported(Isa isa);
+	const Table& table(Isa isa);
+	const Table& active();
+	const char* isaName(Isa isa);
+}
+
+#endif
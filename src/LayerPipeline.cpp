@@ -0,0 +1,251 @@
+#include <algorithm>
+#include <limits>
+#include <omp.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdexcept>
+#include "LayerPipeline.h"
+#include "Timer.h"
+#include "Trace.h"
+
+using namespace std;
+
+LayerPipeline::LayerPipeline(Model const &model, int stages, int depth) : model(model), started(false)
+{
+    setup(layerFlops(model), stages, depth);
+}
+
+LayerPipeline::LayerPipeline(Model const &model, vector<double> const &costs, int stages, int depth) : model(model), started(false)
+{
+    setup(costs, stages, depth);
+}
+
+void LayerPipeline::setup(vector<double> const &costs, int stages, int depth)
+{
+    if (costs.size() != model.getNetwork().getLayers().size())
+        throw logic_error("Invalid: one cost per layer is needed, got " + to_string(costs.size()) + ".");
+    if (stages < 1 || depth < 1)
+        throw logic_error("Invalid: a layer pipeline needs at least one stage and a depth of one.");
+
+    vector<int> bounds = partition(costs, stages);
+    int count = (int)bounds.size() - 1;
+    vector<vector<int> > groups = coreGroups(count);
+
+    for (int s = 0; s <= count; s++)
+        rings.push_back(new SpscQueue<Frame*>(depth));
+
+    for (int s = 0; s < count; s++) {
+        Runner* runner = new Runner();
+        runner->stage.first = bounds[s];
+        runner->stage.end = bounds[s + 1];
+        runner->stage.cost = 0;
+        for (int l = bounds[s]; l < bounds[s + 1]; l++)
+            runner->stage.cost += costs[l];
+        runner->stage.cpus = groups[s];
+        runner->in = rings[s];
+        runner->out = rings[s + 1];
+        runner->frames = 0;
+        runner->busy = 0;
+        runner->starved = 0;
+        runners.push_back(runner);
+    }
+}
+
+LayerPipeline::~LayerPipeline()
+{
+    if (started) {
+        close();
+        //drop what the consumer left, or the last stage would wait on a full ring forever
+        Frame* frame;
+        while (rings.back()->pop(frame))
+            delete frame;
+        for (size_t r = 0; r < runners.size(); r++)
+            runners[r]->worker.join();
+    }
+    for (size_t r = 0; r < runners.size(); r++)
+        delete runners[r];
+    for (size_t r = 0; r < rings.size(); r++)
+        delete rings[r];
+}
+
+void LayerPipeline::start()
+{
+    if (started)
+        throw logic_error("Invalid: the layer pipeline is already running.");
+    started = true;
+    for (size_t r = 0; r < runners.size(); r++)
+        runners[r]->worker = thread(&LayerPipeline::run, this, ref(*runners[r]));
+}
+
+void LayerPipeline::push(const double* planes)
+{
+    Frame* frame = new Frame();
+    frame->volume = Model::fromPlanes(planes, model.getInputShape());
+    rings.front()->push(frame);
+}
+
+void LayerPipeline::close()
+{
+    rings.front()->close();
+}
+
+bool LayerPipeline::pop(double* out)
+{
+    Frame* frame;
+    if (!rings.back()->pop(frame))
+        return false;
+
+    string error = frame->error;
+    if (error.empty())
+        Model::toPlanes(frame->volume, out);
+    delete frame;
+    if (!error.empty())
+        throw runtime_error(error);
+    return true;
+}
+
+vector<LayerPipeline::Stage> LayerPipeline::getStages() const
+{
+    vector<Stage> stages;
+    for (size_t r = 0; r < runners.size(); r++) {
+        Stage stage = runners[r]->stage;
+        stage.frames = runners[r]->frames;
+        stage.busySeconds = Timer::seconds(runners[r]->busy);
+        stage.starvedSeconds = Timer::seconds(runners[r]->starved);
+        stages.push_back(stage);
+    }
+    return stages;
+}
+
+//pinned before the first parallel region, so the OpenMP team this thread
+//creates inherits the group's mask along with the team size
+void LayerPipeline::run(Runner &runner)
+{
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    for (size_t c = 0; c < runner.stage.cpus.size(); c++)
+        CPU_SET(runner.stage.cpus[c], &mask);
+    pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask);
+    omp_set_num_threads((int)runner.stage.cpus.size());
+
+    Frame* frame;
+    unsigned long long waited = Timer::rdtsc();
+    while (runner.in->pop(frame)) {
+        unsigned long long begin = Timer::rdtsc();
+        runner.starved += begin - waited;
+
+        if (frame->error.empty()) {
+            try {
+                TRACE_SCOPE("layerpipeline", "stage");
+                frame->volume = model.forward(frame->volume, runner.stage.first, runner.stage.end);
+            } catch (exception const &error) {
+                frame->error = error.what();
+            }
+        }
+
+        waited = Timer::rdtsc();
+        runner.busy += waited - begin;
+        runner.frames++;
+        runner.out->push(frame);
+    }
+    runner.out->close();
+}
+
+vector<double> LayerPipeline::layerFlops(Model const &model)
+{
+    vector<LayerSpec> const &layers = model.getNetwork().getLayers();
+    LayerShape input = model.getInputShape();
+    vector<LayerShape> shapes = model.getNetwork().shapesFor(input.height, input.width, input.depth);
+
+    vector<double> costs;
+    for (size_t l = 0; l < layers.size(); l++)
+        costs.push_back(Network::flops(layers[l], shapes[l]));
+    return costs;
+}
+
+vector<double> LayerPipeline::measureLayers(Model const &model, int repeats)
+{
+    int layers = (int)model.getNetwork().getLayers().size();
+    LayerShape input = model.getInputShape();
+    Tensor volume = Tensor(input.height, input.width, input.depth);
+    volume.randomValueInit(0, 255);
+
+    int threads = omp_get_max_threads();
+    omp_set_num_threads(1);
+
+    vector<double> costs(layers, numeric_limits<double>::max());
+    for (int l = 0; l < layers; l++) {
+        Tensor next;
+        for (int r = 0; r < max(repeats, 1); r++) {
+            unsigned long long begin = Timer::rdtsc();
+            next = model.forward(volume, l, l + 1);
+            costs[l] = min(costs[l], Timer::seconds(Timer::rdtsc() - begin));
+        }
+        volume = next;
+    }
+
+    omp_set_num_threads(threads);
+    return costs;
+}
+
+//best[k][i]: smallest largest range when the first i layers make k ranges
+vector<int> LayerPipeline::partition(vector<double> const &costs, int parts)
+{
+    int n = (int)costs.size();
+    parts = max(1, min(parts, n));
+
+    vector<double> prefix(n + 1, 0);
+    for (int i = 0; i < n; i++)
+        prefix[i + 1] = prefix[i] + costs[i];
+
+    const double INF = numeric_limits<double>::max();
+    vector<vector<double> > best(parts + 1, vector<double>(n + 1, INF));
+    vector<vector<int> > cut(parts + 1, vector<int>(n + 1, 0));
+    best[0][0] = 0;
+    for (int k = 1; k <= parts; k++) {
+        for (int i = k; i <= n; i++) {
+            for (int j = k - 1; j < i; j++) {
+                if (best[k - 1][j] == INF)
+                    continue;
+                double largest = max(best[k - 1][j], prefix[i] - prefix[j]);
+                if (largest < best[k][i]) {
+                    best[k][i] = largest;
+                    cut[k][i] = j;
+                }
+            }
+        }
+    }
+
+    vector<int> bounds(parts + 1);
+    bounds[parts] = n;
+    for (int k = parts; k > 0; k--)
+        bounds[k - 1] = cut[k][bounds[k]];
+    return bounds;
+}
+
+vector<vector<int> > LayerPipeline::coreGroups(int parts)
+{
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    vector<int> cpus;
+    if (sched_getaffinity(0, sizeof(mask), &mask) == 0) {
+        for (int c = 0; c < CPU_SETSIZE; c++) {
+            if (CPU_ISSET(c, &mask))
+                cpus.push_back(c);
+        }
+    }
+    if (cpus.empty())
+        cpus.push_back(0);
+
+    vector<vector<int> > groups(parts);
+    if ((int)cpus.size() < parts) {
+        for (int p = 0; p < parts; p++)
+            groups[p].push_back(cpus[p % cpus.size()]);
+        return groups;
+    }
+    for (int p = 0; p < parts; p++) {
+        size_t first = cpus.size()*p/parts, last = cpus.size()*(p + 1)/parts;
+        groups[p].assign(cpus.begin() + first, cpus.begin() + last);
+    }
+    return groups;
+}
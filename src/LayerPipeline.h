@@ -0,0 +1,99 @@
+#ifndef DEF_LAYER_PIPELINE
+#define DEF_LAYER_PIPELINE
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include "BoundedQueue.h"
+#include "Model.h"
+
+//Streaming inference with the layers split across core groups: the layer list
+//is cut into contiguous stages of about equal cost (FLOPs from Network::flops,
+//or measured seconds), each stage runs on its own thread pinned to its own
+//group of cores with an OpenMP team of that size, and frames flow from stage
+//to stage over SpscQueues. Each group only ever touches its own layers'
+//weights, so they stay in that group's caches instead of being streamed in
+//for every image; throughput is set by the slowest stage, latency by the sum.
+//
+//  LayerPipeline pipeline(model, 4);
+//  pipeline.start();
+//  //one producer thread               //one consumer thread
+//  pipeline.push(planes);              while (pipeline.pop(scores)) use(scores);
+//  pipeline.close();
+//
+//Outputs come back in push order. With fewer cores than stages the groups
+//share cores round-robin, which still runs but cannot be faster than one
+//Model::forward.
+class LayerPipeline
+{
+public:
+	struct Stage
+	{
+		int first, end;         //layers [first, end)
+		double cost;            //summed layer costs the partition balanced
+		std::vector<int> cpus;
+		unsigned long long frames;
+		double busySeconds;
+		double starvedSeconds;  //waiting on the stage before
+	};
+
+	//depth is the number of frames each ring holds
+	LayerPipeline(Model const &model, int stages, int depth = 4);
+	//costs has one entry per layer, e.g. measureLayers()
+	LayerPipeline(Model const &model, std::vector<double> const &costs, int stages, int depth = 4);
+	//closes the input and joins the stages; unread outputs are dropped
+	~LayerPipeline();
+
+	LayerPipeline(LayerPipeline const &) = delete;
+	LayerPipeline& operator=(LayerPipeline const &) = delete;
+
+	void start();
+	//producer side: copies model.inputSize() doubles, waits while the first ring is full
+	void push(const double* planes);
+	//no more frames; pop() returns false once the last one is out
+	void close();
+	//consumer side: the next outputSize() doubles in push order; throws
+	//runtime_error if a stage failed on that frame
+	bool pop(double* out);
+
+	//partition and counters so far
+	std::vector<Stage> getStages() const;
+
+	static std::vector<double> layerFlops(Model const &model);
+	//best of repeats single-thread runs of each layer, in seconds
+	static std::vector<double> measureLayers(Model const &model, int repeats);
+	//cuts costs into at most parts contiguous ranges with the smallest
+	//possible largest sum; returns the boundaries, first 0 and last costs.size()
+	static std::vector<int> partition(std::vector<double> const &costs, int parts);
+	//the cores this process may run on, dealt into parts contiguous groups
+	static std::vector<std::vector<int> > coreGroups(int parts);
+
+private:
+	struct Frame
+	{
+		Tensor volume;
+		std::string error;
+	};
+
+	struct Runner
+	{
+		Stage stage;
+		SpscQueue<Frame*>* in;
+		SpscQueue<Frame*>* out;
+		std::atomic<unsigned long long> frames;
+		std::atomic<unsigned long long> busy;
+		std::atomic<unsigned long long> starved;
+		std::thread worker;
+	};
+
+	Model const &model;
+	std::vector<SpscQueue<Frame*>*> rings; //stages + 1: input, between stages, output
+	std::vector<Runner*> runners;
+	bool started;
+
+	void setup(std::vector<double> const &costs, int stages, int depth);
+	void run(Runner &runner);
+};
+
+#endif
@@ -1,286 +1,254 @@
-#include "Matrix.h"
-#include "Utility.h"
-#include <cmath>
-
-#include <x86intrin.h>
-#include <immintrin.h>
-
-using namespace std;
-
-Matrix::Matrix(){}
-
-Matrix::Matrix(int height, int width)
-{
-    this->height = height;
-    this->width = width;
-    this->padding = 0;
-    this->matrix = vector<vector<double>> (height, vector<double>(width));
-}
-
-Matrix::Matrix(int height, int width, int padding)
-{
-    this->height = height;
-    this->width = width;
-    this->padding = padding;
-    this->matrix = vector<vector<double>> (height, vector<double>(width));
-
-    if (padding > 0) {
-        padMatrix();
-    }
-}
-
-Matrix::Matrix(vector<vector<double>> const &matrix)
-{
-    this->height = matrix.size();
-    this->width = matrix[0].size();
-    this->padding = 0;
-    this->matrix = matrix;
-}
-
-Matrix::Matrix(vector<vector<double>> const &matrix, int padding)
-{
-    this->height = matrix.size();
-    this->width = matrix[0].size();
-    this->padding = padding;
-    this->matrix = matrix;
-
-    if (padding > 0) {
-        padMatrix();
-    }
-}
-
-int Matrix::getHeight() const
-{
-    return height;
-}
-
-int Matrix::getWidth() const
-{
-    return width;
-}
-
-int Matrix::getIndexValue(int i, int j) const
-{
-    return matrix[i][j];
-}
-
-void Matrix::padMatrix()
-{
-    vector<vector<double>> padded_matrix(height+(2*padding), vector<double>(width+(2*padding), 0));
-
-    for (int i=padding; i<padded_matrix.size()-padding; i++){
-        for (int j=padding; j<padded_matrix[i].size()-padding; j++){
-            padded_matrix[i][j] = getIndexValue(i-padding, j-padding);
-        }
-    }
-}
-
-std::vector<std::vector<double>> Matrix::getPadMatrix(int padding)
-{
-    std::vector<std::vector<double>> padded_matrix(height+(2*padding), vector<double>(width+(2*padding), 0));
-
-    for (int i=padding; i<padded_matrix.size()-padding; i++){
-        for (int j=padding; j<padded_matrix[i].size()-padding; j++){
-            padded_matrix[i][j] = getIndexValue(i-padding, j-padding);
-        }
-    }
-
-    return padded_matrix;
-}
-
-void Matrix::checkIfEqual(Matrix &other) const
-{
-    if (height != other.getHeight()){
-        cout << height << endl;
-        cout << other.getHeight() << endl;
-        throw logic_error("Heights of matrices are not the same.");
-    }
-    
-    if (width != other.getWidth()){
-        cout << width << endl;
-        cout << other.getWidth() << endl;
-        throw logic_error("Width of matrices are not the same.");
-    }
-}
-
-int Matrix::dotProduct(Matrix &other) const
-{
-    checkIfEqual(other);
-
-    int product = 0;
-
-    for (int i=0; i<height; i++){
-        for (int j=0; j<width; j++){
-            product += (matrix[i][j] * other.getIndexValue(i, j));
-        }
-    }
-
-    return product;
-}
-
-int Matrix::getMax() const
-{    
-    int max = 0;
-
-    for (int i=0; i<height; i++){
-        for (int j=0; j<width; j++){
-            if (matrix[i][j] > max)
-                max = matrix[i][j];
-        }
-    }
-
-    return max;
-}
-
-void Matrix::add(Matrix other)
-{
-    checkIfEqual(other);
-
-    vector<vector<double>> result; 
-
-    for (int i=0; i<height; i++){
-        vector<double> row_result;
-        for (int j=0; j<width; j++){
-            row_result.push_back( matrix[i][j] + other.getIndexValue(i, j));
-        }
-        result.push_back(row_result);
-    }
-
-    matrix = result;
-}
-
-Matrix Matrix::filterSlide(Matrix filter, int stride, int bias)
-{
-    int F = filter.getWidth();
-    float f_W = (float)width;
-    float f_F = (float)F;
-    float f_S = (float)stride;
-    int output_size = ceil((f_W-f_F)/f_S)+1;
-
-    //checking if output Matrix will have size greater than 1
-    if (output_size < 1)
-        throw logic_error("Invalid: Output matrix size 0.");
-    
-    vector<vector<double>> output_layer;
-
-    //goes through matrix and performs dot product on small local regions 
-    for (int i=0; i<=height-F; i+=stride){
-        vector<double> row_output_layer;
-        for (int j=0; j<=width-F; j+=stride){
-
-            vector<vector<double>> local_region;
-            //disgusting I know... creates a local region
-            for (int y=i; y<(i+F); y++){
-                vector<double> row_local_region;
-                for (int x=j; x<(j+F); x++){
-                    //gets row of local region
-                    row_local_region.push_back(matrix[y][x]);     
-                }
-                //adds row of local region to local_region matrix
-                local_region.push_back(row_local_region);
-            }
-            //adds dot product of local region and filter to row of output  
-            double output = Matrix(local_region).dotProduct(filter);
-
-            row_output_layer.push_back(output);
-        }
-        //adds row of output to output matrix
-        output_layer.push_back(row_output_layer);
-    }
-    Matrix output = Matrix(output_layer);
-    return output;
-}
-
-Matrix Matrix::filterSlide(Matrix filter, int stride, int bias, int padding)
-{
-    int F = filter.getWidth();
-    float f_W = (float)width;
-    float f_F = (float)F;
-    float f_S = (float)stride;
-    float f_P = (float)padding;
-    int output_size = ceil((f_W-f_F+2*f_P)/f_S)+1;
-
-    //checking if output Matrix will have size greater than 1
-    if (output_size < 1)
-        throw logic_error("Invalid: Output matrix size 0.");
-
-    std::vector<std::vector<double>> padded_matrix;
-    if (padding > 0) {
-        padded_matrix = getPadMatrix(padding);
-    } else {
-        padded_matrix = matrix;
-    }
-
-    vector<vector<double>> output_layer;
-
-    //goes through matrix and performs dot product on small local regions 
-    for (int i=0; i<=height-F+2*f_P; i+=stride){
-        vector<double> row_output_layer;
-        for (int j=0; j<=width-F+2*f_P; j+=stride){
-            vector<vector<double>> local_region;
-            //disgusting I know... creates a local region
-            for (int y=i; y<(i+F); y++){
-                vector<double> row_local_region;
-                for (int x=j; x<(j+F); x++){
-                    //gets row of local region
-                    row_local_region.push_back(padded_matrix[y][x]);     
-                }
-                //adds row of local region to local_region matrix
-                local_region.push_back(row_local_region);
-            }
-            //adds dot product of local region and filter to row of output  
-            row_output_layer.push_back( Matrix(local_region).dotProduct(filter) );
-        }
-        //adds row of output to output matrix
-        output_layer.push_back(row_output_layer);
-    }
-
-    Matrix output = Matrix(output_layer);
-    return output;
-}
-
-Matrix Matrix::maxSlide(int H, int F, int stride, int bias)
-{
-    //for now H isn't use since the filters are always squares... keeping it here for now... if I want to do rectangular stuff
-    
-    float f_W = (float)width;
-    float f_F = (float)F;
-    float f_S = (float)stride;
-    int output_size = ceil((f_W-f_F)/f_S)+1;
-
-    //checking if output Matrix will have size greater than 1
-    if (output_size < 1)
-        throw logic_error("Invalid: Output matrix size 0.");
-    
-    vector<vector<double>> output_layer;
-
-    //goes through matrix and performs max pool on small local regions 
-    for (int i=0; i<=height-F; i+=stride){
-        vector<double> row_output_layer;
-
-        for (int j=0; j<=width-F; j+=stride){
-            vector<vector<double>> local_region;
-            //creates a local region
-            for (int y=i; y<(i+F); y++){
-                vector<double> row_local_region;
-                for (int x=j; x<(j+F); x++){
-                    //gets row of local region
-                    row_local_region.push_back(matrix[y][x]);     
-                }
-                //adds row of local region to local_region matrix
-                local_region.push_back(row_local_region);
-            }
-            //max pool on local region  
-            row_output_layer.push_back(Matrix(local_region).getMax());
-        }
-        //adds row of output to output matrix
-        output_layer.push_back(row_output_layer);
-    }
-    Matrix output = Matrix(output_layer);
-    return output;
-}
-
-void Matrix::print() const
-{
-    Utility::printVec(matrix);
-}
+#include "Matrix.h"
+#include "Utility.h"
+#include <cmath>
+
+#include <x86intrin.h>
+#include <immintrin.h>
+
+using namespace std;
+
+Matrix::Matrix(){}
+
+Matrix::Matrix(int height, int width)
+{
+    this->height = height;
+    this->width = width;
+    this->padding = 0;
+    this->matrix = vector<vector<double>> (height, vector<double>(width));
+}
+
+Matrix::Matrix(int height, int width, int padding)
+{
+    this->height = height;
+    this->width = width;
+    this->padding = padding;
+    this->matrix = vector<vector<double>> (height, vector<double>(width));
+
+    if (padding > 0) {
+        padMatrix();
+    }
+}
+
+Matrix::Matrix(vector<vector<double>> const &matrix)
+{
+    this->height = matrix.size();
+    this->width = matrix[0].size();
+    this->padding = 0;
+    this->matrix = matrix;
+}
+
+Matrix::Matrix(vector<vector<double>> const &matrix, int padding)
+{
+    this->height = matrix.size();
+    this->width = matrix[0].size();
+    this->padding = padding;
+    this->matrix = matrix;
+
+    if (padding > 0) {
+        padMatrix();
+    }
+}
+
+int Matrix::getHeight() const
+{
+    return height;
+}
+
+int Matrix::getWidth() const
+{
+    return width;
+}
+
+int Matrix::getIndexValue(int i, int j) const
+{
+    return matrix[i][j];
+}
+
+void Matrix::padMatrix()
+{
+    vector<vector<double>> padded_matrix(height+(2*padding), vector<double>(width+(2*padding), 0));
+
+    for (int i=padding; i<padded_matrix.size()-padding; i++){
+        for (int j=padding; j<padded_matrix[i].size()-padding; j++){
+            padded_matrix[i][j] = getIndexValue(i-padding, j-padding);
+        }
+    }
+}
+
+std::vector<std::vector<double>> Matrix::getPadMatrix(int padding)
+{
+    return getPadMatrix(padding, padding);
+}
+
+std::vector<std::vector<double>> Matrix::getPadMatrix(int padY, int padX)
+{
+    std::vector<std::vector<double>> padded_matrix(height+(2*padY), vector<double>(width+(2*padX), 0));
+
+    for (int i=0; i<height; i++){
+        for (int j=0; j<width; j++){
+            padded_matrix[i+padY][j+padX] = matrix[i][j];
+        }
+    }
+
+    return padded_matrix;
+}
+
+void Matrix::checkIfEqual(Matrix &other) const
+{
+    if (height != other.getHeight()){
+        cout << height << endl;
+        cout << other.getHeight() << endl;
+        throw logic_error("Heights of matrices are not the same.");
+    }
+    
+    if (width != other.getWidth()){
+        cout << width << endl;
+        cout << other.getWidth() << endl;
+        throw logic_error("Width of matrices are not the same.");
+    }
+}
+
+int Matrix::dotProduct(Matrix &other) const
+{
+    checkIfEqual(other);
+
+    int product = 0;
+
+    for (int i=0; i<height; i++){
+        for (int j=0; j<width; j++){
+            product += (matrix[i][j] * other.getIndexValue(i, j));
+        }
+    }
+
+    return product;
+}
+
+int Matrix::getMax() const
+{    
+    int max = 0;
+
+    for (int i=0; i<height; i++){
+        for (int j=0; j<width; j++){
+            if (matrix[i][j] > max)
+                max = matrix[i][j];
+        }
+    }
+
+    return max;
+}
+
+void Matrix::add(Matrix other)
+{
+    checkIfEqual(other);
+
+    vector<vector<double>> result; 
+
+    for (int i=0; i<height; i++){
+        vector<double> row_result;
+        for (int j=0; j<width; j++){
+            row_result.push_back( matrix[i][j] + other.getIndexValue(i, j));
+        }
+        result.push_back(row_result);
+    }
+
+    matrix = result;
+}
+
+Matrix Matrix::filterSlide(Matrix filter, int stride, int bias)
+{
+    return filterSlide(filter, stride, stride, bias, 0, 0);
+}
+
+Matrix Matrix::filterSlide(Matrix filter, int stride, int bias, int padding)
+{
+    return filterSlide(filter, stride, stride, bias, padding, padding);
+}
+
+Matrix Matrix::filterSlide(Matrix filter, int strideY, int strideX, int bias, int padY, int padX)
+{
+    int Fh = filter.getHeight();
+    int Fw = filter.getWidth();
+
+    //checking if output Matrix will have size greater than 1
+    if (height+2*padY < Fh || width+2*padX < Fw)
+        throw logic_error("Invalid: Output matrix size 0.");
+
+    std::vector<std::vector<double>> padded_matrix;
+    if (padY > 0 || padX > 0) {
+        padded_matrix = getPadMatrix(padY, padX);
+    } else {
+        padded_matrix = matrix;
+    }
+
+    vector<vector<double>> output_layer;
+
+    //goes through matrix and performs dot product on small local regions 
+    for (int i=0; i<=height-Fh+2*padY; i+=strideY){
+        vector<double> row_output_layer;
+        for (int j=0; j<=width-Fw+2*padX; j+=strideX){
+            vector<vector<double>> local_region;
+            //disgusting I know... creates a local region
+            for (int y=i; y<(i+Fh); y++){
+                vector<double> row_local_region;
+                for (int x=j; x<(j+Fw); x++){
+                    //gets row of local region
+                    row_local_region.push_back(padded_matrix[y][x]);     
+                }
+                //adds row of local region to local_region matrix
+                local_region.push_back(row_local_region);
+            }
+            //adds dot product of local region and filter to row of output  
+            row_output_layer.push_back( Matrix(local_region).dotProduct(filter) );
+        }
+        //adds row of output to output matrix
+        output_layer.push_back(row_output_layer);
+    }
+
+    Matrix output = Matrix(output_layer);
+    return output;
+}
+
+Matrix Matrix::maxSlide(int H, int F, int stride, int bias)
+{
+    return maxSlide(H, F, stride, stride, bias);
+}
+
+//H x W windows; ones that would run past the edge are dropped
+Matrix Matrix::maxSlide(int H, int W, int strideY, int strideX, int bias)
+{
+    //checking if output Matrix will have size greater than 1
+    if (height < H || width < W)
+        throw logic_error("Invalid: Output matrix size 0.");
+    
+    vector<vector<double>> output_layer;
+
+    //goes through matrix and performs max pool on small local regions 
+    for (int i=0; i<=height-H; i+=strideY){
+        vector<double> row_output_layer;
+
+        for (int j=0; j<=width-W; j+=strideX){
+            vector<vector<double>> local_region;
+            //creates a local region
+            for (int y=i; y<(i+H); y++){
+                vector<double> row_local_region;
+                for (int x=j; x<(j+W); x++){
+                    //gets row of local region
+                    row_local_region.push_back(matrix[y][x]);     
+                }
+                //adds row of local region to local_region matrix
+                local_region.push_back(row_local_region);
+            }
+            //max pool on local region  
+            row_output_layer.push_back(Matrix(local_region).getMax());
+        }
+        //adds row of output to output matrix
+        output_layer.push_back(row_output_layer);
+    }
+    Matrix output = Matrix(output_layer);
+    return output;
+}
+
+void Matrix::print() const
+{
+    Utility::printVec(matrix);
+}
@@ -0,0 +1,564 @@
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+#include <unistd.h>
+#include "Model.h"
+#include "Stats.h"
+#include "Trace.h"
+
+using namespace std;
+
+//first supported engine in the autotuner's own candidate order, without measuring
+static ConvPlan defaultPlan(ConvSignature const &signature)
+{
+    ConvPlan candidates[] = {{ENGINE_GEMM, 1}, {ENGINE_JIT, 1}, {ENGINE_SIMD_OPENMP, 1}, {ENGINE_BASELINE, 1}};
+    for (ConvPlan plan : candidates) {
+        if (Autotuner::supports(plan, signature))
+            return plan;
+    }
+    ConvPlan naive = {ENGINE_NAIVE, 1};
+    return naive;
+}
+
+Model::Model()
+{
+    tiling.layers = 0;
+    tiling.tile = 0;
+    format = WEIGHTS_DOUBLE;
+}
+
+Model::Model(Network const &network, LayerShape const &input)
+{
+    tiling.layers = 0;
+    tiling.tile = 0;
+    format = WEIGHTS_DOUBLE;
+    this->network = network;
+    this->shapes = network.shapesFor(input.height, input.width, input.depth);
+
+    vector<LayerSpec> const &layers = network.getLayers();
+    for (size_t l = 0; l < layers.size(); l++) {
+        LayerSpec const &layer = layers[l];
+        LayerShape const &in = shapes[l];
+        ConvPlan plan = {ENGINE_NAIVE, 1};
+
+        switch (layer.type) {
+            case LAYER_CONV: {
+                weights.push_back(Filters(layer.F, layer.F, in.depth/layer.groups, layer.outputs));
+                ConvSignature signature = Autotuner::signatureOf(in.height, in.width, in.depth, layer.outputs, layer.F, layer.F,
+                                                                 convParams(layer.stride, layer.padding, 1, layer.groups), 1);
+                plan = defaultPlan(signature);
+                break;
+            }
+            case LAYER_MAXPOOL:
+                weights.push_back(Filters());
+                break;
+            case LAYER_FULLY_CONNECTED:
+                weights.push_back(Filters(in.height, in.width, in.depth, layer.outputs));
+                break;
+        }
+        plans.push_back(plan);
+    }
+    halfWeights.resize(layers.size());
+}
+
+void Model::tune(Autotuner &autotuner)
+{
+    vector<LayerSpec> const &layers = network.getLayers();
+    Tensor volume = Tensor(shapes[0].height, shapes[0].width, shapes[0].depth);
+    volume.randomValueInit(0, 255);
+
+    for (size_t l = 0; l < layers.size(); l++) {
+        Filters filters = getWeights((int)l);
+        ConvParams params = convParams(layers[l].stride, layers[l].padding, 1, layers[l].groups);
+
+        if (layers[l].type == LAYER_CONV)
+            plans[l] = autotuner.tune(volume, filters, params, 0, 1);
+
+        //deeper layers are tuned on the volume the previous ones really produce
+        Tensor next;
+        if (layers[l].type == LAYER_CONV)
+            next = volume.fwdConv(filters, params, 0, plans[l]);
+        else if (layers[l].type == LAYER_MAXPOOL)
+            next = volume.fwdMaxPool(layers[l].F, layers[l].F, layers[l].stride, 0);
+        else
+            next = volume.fwdFullyConnected(filters, 0);
+        volume = next;
+    }
+}
+
+Network const &Model::getNetwork() const
+{
+    return network;
+}
+
+//------------------------------------------------------------ weight formats
+
+static unsigned short narrow(double value, WeightFormat format)
+{
+    return format == WEIGHTS_FP16 ? Kernels::toHalf((float)value) : Kernels::toBfloat16((float)value);
+}
+
+//the 16-bit words of layer l in the shape the constructor gave its Filters
+HalfFilters Model::halfFilters(int l) const
+{
+    LayerSpec const &layer = network.getLayers()[l];
+    LayerShape const &in = shapes[l];
+    bool conv = layer.type == LAYER_CONV;
+    HalfFilters half = {halfWeights[l].data(), format, conv ? layer.F : in.height, conv ? layer.F : in.width,
+                        conv ? in.depth/layer.groups : in.depth, layer.outputs};
+    return half;
+}
+
+Filters Model::getWeights(int l) const
+{
+    if (format == WEIGHTS_DOUBLE || halfWeights[l].empty())
+        return weights[l];
+    return widenFilters(halfFilters(l));
+}
+
+void Model::setWeightFormat(WeightFormat format)
+{
+    if (format == this->format)
+        return;
+    if (this->format != WEIGHTS_DOUBLE && format != WEIGHTS_DOUBLE)
+        throw logic_error(string("Invalid: the weights are ") + weightFormatName(this->format) + " already, converting them to "
+                          + weightFormatName(format) + " would round them twice.");
+
+    for (size_t l = 0; l < weights.size(); l++) {
+        if (format == WEIGHTS_DOUBLE) {
+            weights[l] = getWeights((int)l);
+            vector<unsigned short>().swap(halfWeights[l]);
+            continue;
+        }
+
+        //[o][k][i][j], the order fwdFullyConnected flattens the input in
+        Filters &filters = weights[l];
+        vector<unsigned short> &bits = halfWeights[l];
+        bits.reserve(Network::weightCount(network.getLayers()[l], shapes[l]));
+        for (int o = 0; o < filters.getNumberOfFilters(); o++) {
+            for (int k = 0; k < filters.getDepth(); k++) {
+                vector<vector<double> > const &plane = filters.filters[o].layers[k].matrix;
+                for (int i = 0; i < filters.getHeight(); i++) {
+                    for (int j = 0; j < filters.getWidth(); j++)
+                        bits.push_back(narrow(plane[i][j], format));
+                }
+            }
+        }
+        weights[l] = Filters();
+    }
+    this->format = format;
+}
+
+WeightFormat Model::getWeightFormat() const
+{
+    return format;
+}
+
+long Model::weightBytes() const
+{
+    long bytes = 0;
+    vector<LayerSpec> const &layers = network.getLayers();
+    for (size_t l = 0; l < layers.size(); l++) {
+        long count = Network::weightCount(layers[l], shapes[l]);
+        bytes += count*(format == WEIGHTS_DOUBLE ? sizeof(double) : sizeof(unsigned short));
+    }
+    return bytes;
+}
+
+WeightFormat Model::weightFormatFromName(string const &name)
+{
+    WeightFormat formats[] = {WEIGHTS_DOUBLE, WEIGHTS_FP16, WEIGHTS_BF16};
+    for (WeightFormat format : formats) {
+        if (name == weightFormatName(format))
+            return format;
+    }
+    throw logic_error("Invalid: unknown weight format " + name + " (double, fp16, bf16).");
+}
+
+const char* Model::weightFormatName(WeightFormat format)
+{
+    switch (format) {
+        case WEIGHTS_FP16:
+            return "fp16";
+        case WEIGHTS_BF16:
+            return "bf16";
+        case WEIGHTS_DOUBLE:
+            break;
+    }
+    return "double";
+}
+
+LayerShape Model::getInputShape() const
+{
+    return shapes.front();
+}
+
+LayerShape Model::getOutputShape() const
+{
+    return shapes.back();
+}
+
+long Model::inputSize() const
+{
+    return (long)shapes.front().height*shapes.front().width*shapes.front().depth;
+}
+
+long Model::outputSize() const
+{
+    return (long)shapes.back().height*shapes.back().width*shapes.back().depth;
+}
+
+Tensor Model::forward(Tensor input) const
+{
+    int layers = (int)network.getLayers().size();
+    if (tiling.layers > 0) {
+        checkInput(input, 0);
+        return forward(forwardTiled(input), tiling.layers, layers);
+    }
+    return forward(input, 0, layers);
+}
+
+Tensor Model::forward(Tensor input, int first, int end) const
+{
+    vector<LayerSpec> const &layers = network.getLayers();
+    if (first < 0 || end > (int)layers.size() || first > end)
+        throw logic_error("Invalid: layer range [" + to_string(first) + ", " + to_string(end) + ") of a "
+                          + to_string(layers.size()) + "-layer model.");
+    checkInput(input, first);
+
+    Tensor volume = input;
+    for (int l = first; l < end; l++)
+        volume = runLayer(volume, l, layers[l].padding, plans[l]);
+    return volume;
+}
+
+void Model::checkInput(Tensor const &input, int first) const
+{
+    vector<LayerSpec> const &layers = network.getLayers();
+    LayerShape const &shape = shapes[first];
+    if (input.getHeight() != shape.height || input.getWidth() != shape.width || input.getDepth() != shape.depth) {
+        ostringstream message;
+        message << "Invalid: " << (first == 0 ? string("the model") : "layer " + layers[first].name)
+                << " takes " << shape.height << "x" << shape.width << "x" << shape.depth
+                << " inputs, got " << input.getHeight() << "x" << input.getWidth() << "x" << input.getDepth() << ".";
+        throw logic_error(message.str());
+    }
+}
+
+Tensor Model::runLayer(Tensor &volume, int l, int padding, ConvPlan plan) const
+{
+    LayerSpec const &layer = network.getLayers()[l];
+    Stats::LayerScope scope(layer.name.c_str());
+    TRACE_LAYER(layer.name);
+
+    switch (layer.type) {
+        case LAYER_CONV:
+            //16-bit weights are widened into the engine's packed filters
+            if (format != WEIGHTS_DOUBLE)
+                return volume.fwdConv(halfFilters(l), convParams(layer.stride, padding, 1, layer.groups), 0, plan);
+            return volume.fwdConv(weights[l], convParams(layer.stride, padding, 1, layer.groups), 0, plan);
+        case LAYER_MAXPOOL:
+            return volume.fwdMaxPool(layer.F, layer.F, layer.stride, 0);
+        case LAYER_FULLY_CONNECTED:
+            break;
+    }
+    if (format != WEIGHTS_DOUBLE)
+        return volume.fwdFullyConnected(halfWeights[l].data(), format, layer.outputs, 0);
+    return volume.fwdFullyConnected(weights[l], 0);
+}
+
+void Model::forward(const double* planes, double* out) const
+{
+    toPlanes(forward(fromPlanes(planes, shapes.front())), out);
+}
+
+void Model::forward(const double* batch, int count, double* out) const
+{
+    vector<const double*> inputs(count);
+    vector<double*> outputs(count);
+    for (int i = 0; i < count; i++) {
+        inputs[i] = batch + i*inputSize();
+        outputs[i] = out + i*outputSize();
+    }
+    forward(inputs.data(), outputs.data(), count);
+}
+
+//one image per thread: with nested parallelism off (the OpenMP default) the
+//engines' own parallel regions run on a team of one inside each image, which
+//keeps every core busy on layers too small to split well
+void Model::forward(const double* const* inputs, double* const* outputs, int count) const
+{
+    if (count == 1) {
+        forward(inputs[0], outputs[0]);
+        return;
+    }
+
+    //exceptions cannot leave the parallel loop, the first one is rethrown after it
+    vector<string> errors(count);
+
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int i = 0; i < count; i++) {
+        try {
+            forward(inputs[i], outputs[i]);
+        } catch (exception const &error) {
+            errors[i] = error.what();
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (!errors[i].empty())
+            throw runtime_error(errors[i]);
+    }
+}
+
+//------------------------------------------------------------------ Tiling
+
+//rows or columns of one layer's volume; a span may reach past the edge,
+//where that layer's zero padding is
+struct Span
+{
+    int begin;
+    int end;
+};
+
+//the input rows a conv or pool layer reads to produce the output rows out
+static Span inputSpan(LayerSpec const &layer, Span out)
+{
+    int padding = layer.type == LAYER_CONV ? layer.padding : 0;
+    Span in = {out.begin*layer.stride - padding, (out.end - 1)*layer.stride - padding + layer.F};
+    return in;
+}
+
+//spans[l] is what layer l reads for the tile at origin in the output of the last tiled layer
+static vector<Span> tileSpans(vector<LayerSpec> const &layers, int count, int origin, int tile)
+{
+    vector<Span> spans(count + 1);
+    spans[count].begin = origin;
+    spans[count].end = origin + tile;
+    for (int l = count - 1; l >= 0; l--)
+        spans[l] = inputSpan(layers[l], spans[l + 1]);
+    return spans;
+}
+
+//tile k owns rows [k*tile, (k+1)*tile); the last one starts early enough to
+//keep the full side, so every tile has the same geometry. Columns are cut the
+//same way, with the tile clamped to each side (tileSide) on its own.
+static int tileSide(int tile, int side)
+{
+    return min(tile, side);
+}
+
+static vector<int> tileOrigins(int side, int tile)
+{
+    vector<int> origins;
+    for (int begin = 0; begin < side; begin += tile)
+        origins.push_back(min(begin, side - tile));
+    return origins;
+}
+
+//the rows and columns ys x xs of input, zero where they fall outside it
+static Tensor window(Tensor const &input, Span ys, Span xs)
+{
+    int height = ys.end - ys.begin, width = xs.end - xs.begin;
+    Tensor tensor = Tensor(height, width);
+    for (int d = 0; d < input.getDepth(); d++) {
+        Matrix layer = Matrix(height, width);
+        for (int y = max(ys.begin, 0); y < min(ys.end, input.getHeight()); y++) {
+            for (int x = max(xs.begin, 0); x < min(xs.end, input.getWidth()); x++)
+                layer.matrix[y - ys.begin][x - xs.begin] = input.layers[d].matrix[y][x];
+        }
+        tensor.addLayer(layer);
+    }
+    return tensor;
+}
+
+//a tile computed past the edge of a layer holds values there, but the next
+//layer must read its zero padding instead
+static void clearOutside(Tensor &tile, Span ys, Span xs, int height, int width)
+{
+    for (int d = 0; d < tile.getDepth(); d++) {
+        vector<vector<double> > &rows = tile.layers[d].matrix;
+        for (int y = ys.begin; y < ys.end; y++) {
+            for (int x = xs.begin; x < xs.end; x++) {
+                if (y < 0 || y >= height || x < 0 || x >= width)
+                    rows[y - ys.begin][x - xs.begin] = 0;
+            }
+        }
+    }
+}
+
+void Model::setTiling(Tiling tiling)
+{
+    vector<LayerSpec> const &layers = network.getLayers();
+    if (tiling.layers < 0 || tiling.layers > (int)layers.size())
+        throw logic_error("Invalid: cannot tile " + to_string(tiling.layers) + " layers of a "
+                          + to_string(layers.size()) + "-layer model.");
+    for (int l = 0; l < tiling.layers; l++) {
+        if (layers[l].type == LAYER_FULLY_CONNECTED)
+            throw logic_error("Invalid: only conv and pool layers can be tiled, " + layers[l].name + " is fully connected.");
+    }
+    if (tiling.layers > 0) {
+        LayerShape const &out = shapes[tiling.layers];
+        if (tiling.tile < 1 || tiling.tile > max(out.height, out.width))
+            throw logic_error("Invalid: tiles of " + to_string(tiling.tile) + " do not fit the "
+                              + to_string(out.height) + "x" + to_string(out.width) + " output of " + layers[tiling.layers - 1].name + ".");
+    }
+    this->tiling = tiling;
+}
+
+Tiling Model::getTiling() const
+{
+    return tiling;
+}
+
+double Model::tilingOverhead(Tiling tiling) const
+{
+    vector<LayerSpec> const &layers = network.getLayers();
+    LayerShape const &out = shapes[tiling.layers];
+    int tileY = tileSide(tiling.tile, out.height), tileX = tileSide(tiling.tile, out.width);
+    vector<Span> ys = tileSpans(layers, tiling.layers, 0, tileY);
+    vector<Span> xs = tileSpans(layers, tiling.layers, 0, tileX);
+    double tiles = (double)tileOrigins(out.height, tileY).size()*tileOrigins(out.width, tileX).size();
+
+    double tiled = 0, untiled = 0;
+    for (int l = 0; l < tiling.layers; l++) {
+        LayerSpec layer = layers[l];
+        layer.padding = 0;
+        LayerShape shape = {ys[l].end - ys[l].begin, xs[l].end - xs[l].begin, shapes[l].depth};
+        tiled += tiles*Network::flops(layer, shape);
+        untiled += Network::flops(layers[l], shapes[l]);
+    }
+    return untiled > 0 ? tiled/untiled : 1;
+}
+
+Tiling Model::planTiling(long cacheBytes) const
+{
+    if (cacheBytes <= 0)
+        cacheBytes = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    if (cacheBytes <= 0)
+        cacheBytes = 1 << 20;
+    double budget = cacheBytes/2;
+
+    vector<LayerSpec> const &layers = network.getLayers();
+    Tiling best = {0, 0};
+    for (int count = 1; count <= (int)layers.size() && layers[count - 1].type != LAYER_FULLY_CONNECTED; count++) {
+        //the largest tile whose input and output activations fit, layer by layer
+        int height = shapes[count].height, width = shapes[count].width;
+        int side = max(height, width), tile = 0;
+        for (int candidate = side; candidate >= 1 && tile == 0; candidate--) {
+            vector<Span> ys = tileSpans(layers, count, 0, tileSide(candidate, height));
+            vector<Span> xs = tileSpans(layers, count, 0, tileSide(candidate, width));
+            double largest = 0;
+            for (int l = 0; l < count; l++) {
+                double in = (double)(ys[l].end - ys[l].begin)*(xs[l].end - xs[l].begin);
+                double out = (double)(ys[l + 1].end - ys[l + 1].begin)*(xs[l + 1].end - xs[l + 1].begin);
+                largest = max(largest, sizeof(double)*(in*shapes[l].depth + out*shapes[l + 1].depth));
+            }
+            if (largest <= budget)
+                tile = candidate;
+        }
+        if (tile == 0)
+            break;
+        //as many tiles as that size needs, evened out so the last one does not mostly overlap
+        int tiles = (side + tile - 1)/tile;
+        Tiling tiling = {count, (side + tiles - 1)/tiles};
+        if (tiling.tile < side && tilingOverhead(tiling) <= 1.25)
+            best = tiling;
+    }
+    return best;
+}
+
+//every tile runs the tiled layers on its own window without padding; the
+//padding the real layers have is in the window as zeros
+Tensor Model::forwardTiled(Tensor const &input) const
+{
+    vector<LayerSpec> const &layers = network.getLayers();
+    int count = tiling.layers, tile = tiling.tile;
+    LayerShape const &out = shapes[count];
+
+    //tiles are smaller than the layers the plans were picked for
+    vector<ConvPlan> tilePlans(plans.begin(), plans.begin() + count);
+    int tileY = tileSide(tile, out.height), tileX = tileSide(tile, out.width);
+    vector<Span> spanYs = tileSpans(layers, count, 0, tileY);
+    vector<Span> spanXs = tileSpans(layers, count, 0, tileX);
+    for (int l = 0; l < count; l++) {
+        if (layers[l].type != LAYER_CONV)
+            continue;
+        ConvSignature signature = Autotuner::signatureOf(spanYs[l].end - spanYs[l].begin, spanXs[l].end - spanXs[l].begin, shapes[l].depth,
+                                                         layers[l].outputs, layers[l].F, layers[l].F,
+                                                         convParams(layers[l].stride, 0, 1, layers[l].groups), 1);
+        if (!Autotuner::supports(tilePlans[l], signature))
+            tilePlans[l] = defaultPlan(signature);
+    }
+
+    vector<int> originYs = tileOrigins(out.height, tileY);
+    vector<int> originXs = tileOrigins(out.width, tileX);
+    int tiles = (int)(originYs.size()*originXs.size());
+    Tensor result = Tensor(out.height, out.width);
+    for (int d = 0; d < out.depth; d++)
+        result.addLayer(Matrix(out.height, out.width));
+
+    //tiles write disjoint parts of result; errors are rethrown after the loop
+    vector<string> errors(tiles);
+
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int t = 0; t < tiles; t++) {
+        try {
+            int ty = t/(int)originXs.size(), tx = t%(int)originXs.size();
+            vector<Span> ys = tileSpans(layers, count, originYs[ty], tileY);
+            vector<Span> xs = tileSpans(layers, count, originXs[tx], tileX);
+
+            Tensor volume = window(input, ys[0], xs[0]);
+            for (int l = 0; l < count; l++) {
+                volume = runLayer(volume, l, 0, tilePlans[l]);
+                if (l + 1 < count)
+                    clearOutside(volume, ys[l + 1], xs[l + 1], shapes[l + 1].height, shapes[l + 1].width);
+            }
+
+            for (int d = 0; d < out.depth; d++) {
+                for (int y = ty*tileY; y < min((ty + 1)*tileY, out.height); y++) {
+                    for (int x = tx*tileX; x < min((tx + 1)*tileX, out.width); x++)
+                        result.layers[d].matrix[y][x] = volume.layers[d].matrix[y - originYs[ty]][x - originXs[tx]];
+                }
+            }
+        } catch (exception const &error) {
+            errors[t] = error.what();
+        }
+    }
+
+    for (size_t t = 0; t < errors.size(); t++) {
+        if (!errors[t].empty())
+            throw runtime_error(errors[t]);
+    }
+    return result;
+}
+
+Inference Model::submit(vector<double> planes) const
+{
+    return Async::submit(*this, move(planes));
+}
+
+Tensor Model::fromPlanes(const double* planes, LayerShape const &shape)
+{
+    Tensor tensor = Tensor(shape.height, shape.width);
+    for (int d = 0; d < shape.depth; d++) {
+        vector<vector<double> > rows(shape.height);
+        for (int y = 0; y < shape.height; y++) {
+            const double* row = planes + ((long)d*shape.height + y)*shape.width;
+            rows[y].assign(row, row + shape.width);
+        }
+        tensor.addLayer(Matrix(rows));
+    }
+    return tensor;
+}
+
+void Model::toPlanes(Tensor const &tensor, double* planes)
+{
+    int height = tensor.getHeight(), width = tensor.getWidth();
+    for (int d = 0; d < tensor.getDepth(); d++) {
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++)
+                planes[((long)d*height + y)*width + x] = tensor.layers[d].matrix[y][x];
+        }
+    }
+}
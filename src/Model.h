@@ -0,0 +1,111 @@
+#ifndef DEF_MODEL
+#define DEF_MODEL
+
+#include <string>
+#include <vector>
+#include "Async.h"
+#include "Autotuner.h"
+#include "Filters.h"
+#include "Network.h"
+#include "Tensor.h"
+
+//A Network bound to weights for one input shape: forward() runs the layers in
+//order with the Tensor engines, recording a Stats::LayerScope per layer. Conv
+//layers use the first engine Autotuner::supports (JIT, SIMD + OpenMP,
+//baseline, naive) unless tune() measured a better one. Weights are random,
+//as in the benchmarks; forward() only reads the Model, so threads may share one.
+//
+//  Model model(Network::vgg16(), input);
+//  model.forward(planes, scores); //CHW planes in, last layer flattened out
+//
+//With a Tiling set, forward() runs the leading conv/pool layers tile by tile:
+//the output of the last tiled layer is cut into square tiles (clamped to
+//each side of a rectangular volume), each tile is traced back through the
+//layers to the input window it depends on (its halo, with the zero padding
+//made explicit at the image border) and the tiles run
+//in parallel, one per OpenMP thread, each on activations small enough for
+//L2. The stitched volume is the same, bit for bit, as the untiled one.
+//
+//setWeightFormat(WEIGHTS_FP16 or WEIGHTS_BF16) keeps the conv and fully
+//connected weights as 16 bits each and drops the doubles, a quarter of the
+//weight bytes. Fully connected layers (bound by the weight stream at batch 1)
+//read them straight from the Kernels 16-bit kernels; conv layers widen them
+//straight into the engine's packed filters (Tensor::fwdConv on HalfFilters),
+//where the doubles would have been copied, so the packing costs the same.
+//The random weights are small integers, exact in either format, so the
+//outputs do not change.
+struct Tiling
+{
+	int layers; //leading conv/pool layers run per tile, 0 = untiled
+	int tile;   //side of one tile in the output of the last tiled layer, per axis
+};
+
+class Model
+{
+public:
+	Model();
+	Model(Network const &network, LayerShape const &input);
+
+	//benchmarks every conv layer once through the autotuner and its cache
+	void tune(Autotuner &autotuner);
+
+	Network const &getNetwork() const;
+	//weights of layer l (widened to doubles when stored in 16 bits), empty Filters for a pool
+	Filters getWeights(int l) const;
+	LayerShape getInputShape() const;
+	LayerShape getOutputShape() const;
+	//doubles per image on either side of forward()
+	long inputSize() const;
+	long outputSize() const;
+
+	Tensor forward(Tensor input) const;
+	//layers [first, end) only, on the volume layer first takes; a chain of
+	//these over consecutive ranges is one forward pass (see LayerPipeline)
+	Tensor forward(Tensor input, int first, int end) const;
+	void forward(const double* planes, double* out) const;
+	//count images stored one after another, each on its own OpenMP thread
+	void forward(const double* batch, int count, double* out) const;
+	//the same for images wherever they are, e.g. in shared memory
+	void forward(const double* const* inputs, double* const* outputs, int count) const;
+
+	//converts the stored weights; logic_error from one 16-bit format to the
+	//other, which would round twice (back to WEIGHTS_DOUBLE is exact)
+	void setWeightFormat(WeightFormat format);
+	WeightFormat getWeightFormat() const;
+	//bytes of the weights as stored
+	long weightBytes() const;
+	//"double", "fp16", "bf16"; logic_error for any other name
+	static WeightFormat weightFormatFromName(std::string const &name);
+	static const char* weightFormatName(WeightFormat format);
+
+	//logic_error unless the first tiling.layers layers are conv/pool and the tile fits
+	void setTiling(Tiling tiling);
+	Tiling getTiling() const;
+	//largest tiles whose activations fit in half of cacheBytes (the L2 when 0),
+	//over as many leading layers as keep the halo recompute under a quarter
+	Tiling planTiling(long cacheBytes = 0) const;
+	//FLOPs of the tiled layers summed over all tiles, against the untiled count
+	double tilingOverhead(Tiling tiling) const;
+
+	//queues one image (inputSize() doubles) for the Async dispatcher and returns at once
+	Inference submit(std::vector<double> planes) const;
+
+	static Tensor fromPlanes(const double* planes, LayerShape const &shape);
+	static void toPlanes(Tensor const &tensor, double* planes);
+
+private:
+	Network network;
+	std::vector<LayerShape> shapes;
+	std::vector<Filters> weights;
+	WeightFormat format;
+	std::vector<std::vector<unsigned short> > halfWeights; //[o][k][i][j] of each layer in 16-bit formats
+	std::vector<ConvPlan> plans;
+	Tiling tiling;
+
+	void checkInput(Tensor const &input, int first) const;
+	HalfFilters halfFilters(int l) const;
+	Tensor runLayer(Tensor &volume, int l, int padding, ConvPlan plan) const;
+	Tensor forwardTiled(Tensor const &input) const;
+};
+
+#endif
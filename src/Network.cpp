@@ -0,0 +1,182 @@
+#include <sstream>
+#include <stdexcept>
+#include "Network.h"
+
+using namespace std;
+
+Network::Network(){}
+
+Network Network::vgg16()
+{
+    Network network;
+    int blocks[5][2] = {{2, 64}, {2, 128}, {3, 256}, {3, 512}, {3, 512}};
+
+    for (int b = 0; b < 5; b++) {
+        for (int c = 0; c < blocks[b][0]; c++) {
+            ostringstream name;
+            name << "conv" << b+1 << "_" << c+1;
+            network.addConv(name.str(), 3, blocks[b][1], 1, 1);
+        }
+        ostringstream name;
+        name << "pool" << b+1;
+        network.addMaxPool(name.str(), 2, 2);
+    }
+
+    network.addFullyConnected("fc6", 4096);
+    network.addFullyConnected("fc7", 4096);
+    network.addFullyConnected("fc8", 1000);
+
+    return network;
+}
+
+Network Network::tiny()
+{
+    Network network;
+    int filters[3] = {16, 32, 64};
+
+    for (int b = 0; b < 3; b++) {
+        ostringstream conv, pool;
+        conv << "conv" << b+1;
+        pool << "pool" << b+1;
+        network.addConv(conv.str(), 3, filters[b], 1, 1);
+        network.addMaxPool(pool.str(), 2, 2);
+    }
+    network.addFullyConnected("fc", 10);
+
+    return network;
+}
+
+Network Network::mobilenet()
+{
+    Network network;
+    //output channels and stride of every depthwise/pointwise block
+    int blocks[13][2] = {{64, 1}, {128, 2}, {128, 1}, {256, 2}, {256, 1}, {512, 2},
+                         {512, 1}, {512, 1}, {512, 1}, {512, 1}, {512, 1}, {1024, 2}, {1024, 1}};
+
+    network.addConv("conv1", 3, 32, 2, 1);
+    int channels = 32;
+    for (int b = 0; b < 13; b++) {
+        ostringstream dw, pw;
+        dw << "conv" << b+2 << "_dw";
+        pw << "conv" << b+2 << "_pw";
+        network.addConv(dw.str(), 3, channels, blocks[b][1], 1, channels);
+        network.addConv(pw.str(), 1, blocks[b][0], 1, 0);
+        channels = blocks[b][0];
+    }
+    network.addFullyConnected("fc", 1000);
+
+    return network;
+}
+
+Network Network::byName(string const &name)
+{
+    if (name == "vgg16")
+        return vgg16();
+    if (name == "tiny")
+        return tiny();
+    if (name == "mobilenet")
+        return mobilenet();
+    throw logic_error("Invalid: unknown network " + name + " (vgg16, tiny, mobilenet).");
+}
+
+void Network::addConv(string const &name, int F, int numberOfFilters, int stride, int padding, int groups)
+{
+    if (groups < 1 || numberOfFilters % groups != 0)
+        throw logic_error("Invalid: " + name + " cannot split " + to_string(numberOfFilters) + " filters into "
+                          + to_string(groups) + " groups.");
+    LayerSpec layer = {name, LAYER_CONV, F, stride, padding, numberOfFilters, groups};
+    layers.push_back(layer);
+}
+
+void Network::addMaxPool(string const &name, int F, int stride)
+{
+    LayerSpec layer = {name, LAYER_MAXPOOL, F, stride, 0, 0, 1};
+    layers.push_back(layer);
+}
+
+void Network::addFullyConnected(string const &name, int outputs)
+{
+    LayerSpec layer = {name, LAYER_FULLY_CONNECTED, 0, 1, 0, outputs, 1};
+    layers.push_back(layer);
+}
+
+vector<LayerSpec> const &Network::getLayers() const
+{
+    return layers;
+}
+
+LayerShape Network::outputShape(LayerSpec const &layer, LayerShape const &input)
+{
+    LayerShape output;
+
+    switch (layer.type) {
+        case LAYER_CONV:
+            if (input.depth % layer.groups != 0)
+                throw logic_error("Invalid: " + layer.name + " cannot split " + to_string(input.depth)
+                                  + " input channels into " + to_string(layer.groups) + " groups.");
+            //windows past the padded edge are dropped, as the packed engines do
+            output.height = (input.height-layer.F+2*layer.padding)/layer.stride+1;
+            output.width = (input.width-layer.F+2*layer.padding)/layer.stride+1;
+            output.depth = layer.outputs;
+            break;
+        case LAYER_MAXPOOL:
+            output.height = (input.height-layer.F)/layer.stride+1;
+            output.width = (input.width-layer.F)/layer.stride+1;
+            output.depth = input.depth;
+            break;
+        case LAYER_FULLY_CONNECTED:
+            output.height = 1;
+            output.width = 1;
+            output.depth = layer.outputs;
+            break;
+    }
+
+    if (output.height < 1 || output.width < 1)
+        throw logic_error("Invalid: Output matrix size 0 in layer " + layer.name + ".");
+
+    return output;
+}
+
+vector<LayerShape> Network::shapesFor(int height, int width, int depth) const
+{
+    vector<LayerShape> shapes;
+    LayerShape shape = {height, width, depth};
+    shapes.push_back(shape);
+
+    for (size_t l = 0; l < layers.size(); l++) {
+        shape = outputShape(layers[l], shape);
+        shapes.push_back(shape);
+    }
+
+    return shapes;
+}
+
+double Network::flops(LayerSpec const &layer, LayerShape const &input)
+{
+    LayerShape output = outputShape(layer, input);
+    double outputs = (double)output.height*output.width*output.depth;
+
+    switch (layer.type) {
+        case LAYER_CONV:
+            //every filter sees the channels of its own group
+            return 2.0*outputs*layer.F*layer.F*(input.depth/layer.groups);
+        case LAYER_MAXPOOL:
+            return outputs*(layer.F*layer.F-1);
+        case LAYER_FULLY_CONNECTED:
+            return 2.0*outputs*input.height*input.width*input.depth;
+    }
+    return 0;
+}
+
+long long Network::weightCount(LayerSpec const &layer, LayerShape const &input)
+{
+    switch (layer.type) {
+        case LAYER_CONV:
+            return (long long)layer.outputs*layer.F*layer.F*(input.depth/layer.groups);
+        case LAYER_MAXPOOL:
+            return 0;
+        case LAYER_FULLY_CONNECTED:
+            return (long long)layer.outputs*input.height*input.width*input.depth;
+    }
+    return 0;
+}
@@ -0,0 +1,71 @@
+#ifndef DEF_NETWORK
+#define DEF_NETWORK
+
+#include <string>
+#include <vector>
+
+enum LayerType
+{
+	LAYER_CONV,
+	LAYER_MAXPOOL,
+	LAYER_FULLY_CONNECTED
+};
+
+//shape parameters of one layer; outputs is the filter count for conv and FC.
+//A conv with groups > 1 splits input and output channels into that many
+//groups and convolves each group on its own (groups == input channels ==
+//outputs is a depthwise conv).
+struct LayerSpec
+{
+	std::string name;
+	LayerType type;
+	int F;
+	int stride;
+	int padding;
+	int outputs;
+	int groups;
+};
+
+struct LayerShape
+{
+	int height;
+	int width;
+	int depth;
+};
+
+//ordered list of layers, shared by the benchmarks and tools that walk a model
+class Network
+{
+public:
+	Network();
+
+	//VGG-16 (configuration D): 13 3x3 convs in 5 blocks, 2x2 pools, fc6-fc8
+	static Network vgg16();
+	//three conv/pool blocks (16, 32, 64 filters) and a 10-way FC, small enough to
+	//run with random weights in demos and end-to-end tools
+	static Network tiny();
+	//MobileNet v1: a 3x3 stem and 13 depthwise 3x3 + pointwise 1x1 blocks up to
+	//1024 channels at 1/32 of the input, then fc 1000
+	static Network mobilenet();
+	//"vgg16", "tiny" or "mobilenet"
+	static Network byName(std::string const &name);
+
+	void addConv(std::string const &name, int F, int numberOfFilters, int stride, int padding, int groups = 1);
+	void addMaxPool(std::string const &name, int F, int stride);
+	void addFullyConnected(std::string const &name, int outputs);
+
+	std::vector<LayerSpec> const &getLayers() const;
+
+	//input volume of every layer, followed by the output of the last one
+	std::vector<LayerShape> shapesFor(int height, int width, int depth) const;
+
+	static LayerShape outputShape(LayerSpec const &layer, LayerShape const &input);
+	//multiply-adds count as 2 FLOPs, comparisons as 1
+	static double flops(LayerSpec const &layer, LayerShape const &input);
+	static long long weightCount(LayerSpec const &layer, LayerShape const &input);
+
+protected:
+	std::vector<LayerSpec> layers;
+};
+
+#endif
@@ -0,0 +1,316 @@
+#include <cerrno>
+#include <cpuid.h>
+#include <cstring>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <omp.h>
+#include "PerfCounters.h"
+
+using namespace std;
+
+namespace
+{
+    struct CounterSpec
+    {
+        const char* name;
+        unsigned type;
+        unsigned long long config;
+        bool intelOnly;
+    };
+
+    #define CACHE_EVENT(cache) ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+    //same order as PerfCounters::Counter
+    const CounterSpec specs[PerfCounters::COUNTER_COUNT] = {
+        {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, false},
+        {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, false},
+        {"llc-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, false},
+        {"l1d-misses", PERF_TYPE_HW_CACHE, CACHE_EVENT(PERF_COUNT_HW_CACHE_L1D), false},
+        {"dtlb-misses", PERF_TYPE_HW_CACHE, CACHE_EVENT(PERF_COUNT_HW_CACHE_DTLB), false},
+        {"backend-stalls", PERF_TYPE_HARDWARE, PERF_COUNT_HW_STALLED_CYCLES_BACKEND, false},
+        {"fp-scalar", PERF_TYPE_RAW, 0x01c7, true},
+        {"fp-128", PERF_TYPE_RAW, 0x04c7, true},
+        {"fp-256", PERF_TYPE_RAW, 0x10c7, true},
+        {"fp-512", PERF_TYPE_RAW, 0x40c7, true},
+        {"task-clock", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, false},
+        {"page-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, false},
+        {"context-switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, false}
+    };
+
+    //Counters of one group are scheduled onto the PMU together, so when the
+    //kernel multiplexes they share one time window and ratios between them
+    //(IPC, stalls per cycle, FLOPs by width) compare counts of the same
+    //instructions. Hardware groups stay within 4 events, the general-purpose
+    //counters a core has with hyperthreading on.
+    const int GROUP_MAX = 4;
+
+    struct GroupSpec
+    {
+        int size;
+        PerfCounters::Counter members[GROUP_MAX];
+    };
+
+    const GroupSpec groups[] = {
+        {4, {PerfCounters::COUNTER_CYCLES, PerfCounters::COUNTER_INSTRUCTIONS, PerfCounters::COUNTER_BACKEND_STALLS,
+             PerfCounters::COUNTER_LLC_MISSES}},
+        {2, {PerfCounters::COUNTER_L1D_MISSES, PerfCounters::COUNTER_DTLB_MISSES}},
+        {4, {PerfCounters::COUNTER_FP_SCALAR, PerfCounters::COUNTER_FP_128, PerfCounters::COUNTER_FP_256,
+             PerfCounters::COUNTER_FP_512}},
+        {3, {PerfCounters::COUNTER_TASK_CLOCK, PerfCounters::COUNTER_PAGE_FAULTS, PerfCounters::COUNTER_CONTEXT_SWITCHES}}
+    };
+    const int GROUP_COUNT = sizeof(groups)/sizeof(groups[0]);
+
+    struct Row
+    {
+        long calls;
+        int threads;
+        double totals[PerfCounters::COUNTER_COUNT];
+    };
+
+    mutex rowsLock;
+    map<string, Row> rows;
+    string firstError;
+
+    bool isIntel()
+    {
+        unsigned eax, ebx, ecx, edx;
+        if (!__get_cpuid(0, &eax, &ebx, &ecx, &edx))
+            return false;
+        return ebx == 0x756e6547 && edx == 0x49656e69 && ecx == 0x6c65746e; // "GenuineIntel"
+    }
+
+    //counters of the owning thread, opened on first use and closed when it exits
+    struct ThreadCounters
+    {
+        int fd[PerfCounters::COUNTER_COUNT];
+        unsigned long long id[PerfCounters::COUNTER_COUNT];
+        int leader[GROUP_COUNT];
+
+        //the first counter of a group that opens leads it, the others join it;
+        //one that fails is left out without taking the group down
+        ThreadCounters()
+        {
+            static const bool intel = isIntel();
+
+            for (int c = 0; c < PerfCounters::COUNTER_COUNT; c++)
+                fd[c] = -1;
+
+            for (int g = 0; g < GROUP_COUNT; g++) {
+                leader[g] = -1;
+                for (int m = 0; m < groups[g].size; m++) {
+                    int c = groups[g].members[m];
+                    if (specs[c].intelOnly && !intel)
+                        continue;
+
+                    struct perf_event_attr attr;
+                    memset(&attr, 0, sizeof(attr));
+                    attr.size = sizeof(attr);
+                    attr.type = specs[c].type;
+                    attr.config = specs[c].config;
+                    attr.exclude_kernel = 1;
+                    attr.exclude_hv = 1;
+                    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_ID
+                                     | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+                    fd[c] = syscall(SYS_perf_event_open, &attr, 0, -1, leader[g], 0);
+                    if (fd[c] >= 0 && ioctl(fd[c], PERF_EVENT_IOC_ID, &id[c]) < 0) {
+                        close(fd[c]);
+                        fd[c] = -1;
+                    }
+                    if (fd[c] < 0) {
+                        lock_guard<mutex> guard(rowsLock);
+                        if (firstError.empty())
+                            firstError = string(specs[c].name) + ": " + strerror(errno);
+                        continue;
+                    }
+                    if (leader[g] < 0)
+                        leader[g] = fd[c];
+                }
+            }
+        }
+
+        ~ThreadCounters()
+        {
+            //members before their leader
+            for (int c = PerfCounters::COUNTER_COUNT - 1; c >= 0; c--) {
+                if (fd[c] >= 0)
+                    close(fd[c]);
+            }
+        }
+
+        //one read per group: {nr, time enabled, time running, {value, id} x nr},
+        //scaled up together when the kernel had to multiplex the group
+        void read(double* values)
+        {
+            for (int c = 0; c < PerfCounters::COUNTER_COUNT; c++)
+                values[c] = 0;
+
+            for (int g = 0; g < GROUP_COUNT; g++) {
+                unsigned long long data[3 + 2*GROUP_MAX];
+                if (leader[g] < 0 || ::read(leader[g], data, sizeof(data)) < (ssize_t)(3*sizeof(data[0])))
+                    continue;
+
+                double scale = data[2] > 0 && data[2] < data[1] ? (double)data[1] / data[2] : 1;
+                for (unsigned long long n = 0; n < data[0] && n < (unsigned long long)GROUP_MAX; n++) {
+                    for (int m = 0; m < groups[g].size; m++) {
+                        int c = groups[g].members[m];
+                        if (fd[c] >= 0 && id[c] == data[4 + 2*n])
+                            values[c] = data[3 + 2*n] * scale;
+                    }
+                }
+            }
+        }
+    };
+
+    ThreadCounters &threadCounters()
+    {
+        static thread_local ThreadCounters counters;
+        return counters;
+    }
+
+    void snapshot(vector<double> &values)
+    {
+        #pragma omp parallel
+        {
+            int t = omp_get_thread_num();
+            if ((t+1)*PerfCounters::COUNTER_COUNT <= (int)values.size())
+                threadCounters().read(&values[t*PerfCounters::COUNTER_COUNT]);
+        }
+    }
+}
+
+namespace PerfCounters
+{
+    const char* counterName(Counter counter)
+    {
+        return specs[counter].name;
+    }
+
+    bool isAvailable(Counter counter)
+    {
+        return threadCounters().fd[counter] >= 0;
+    }
+
+    bool anyAvailable()
+    {
+        for (int c = 0; c < COUNTER_COUNT; c++) {
+            if (isAvailable((Counter)c))
+                return true;
+        }
+        return false;
+    }
+
+    Scope::Scope(string const &layer, string const &engine)
+    {
+        key = layer + "\t" + engine;
+        active = anyAvailable();
+        if (!active)
+            return;
+
+        begin.assign(omp_get_max_threads()*COUNTER_COUNT, 0);
+        snapshot(begin);
+    }
+
+    Scope::~Scope()
+    {
+        if (!active)
+            return;
+
+        vector<double> end(begin.size(), 0);
+        snapshot(end);
+
+        lock_guard<mutex> guard(rowsLock);
+        map<string, Row>::iterator it = rows.find(key);
+        if (it == rows.end()) {
+            Row row;
+            memset(&row, 0, sizeof(row));
+            it = rows.insert(make_pair(key, row)).first;
+        }
+
+        Row &row = it->second;
+        int threads = begin.size()/COUNTER_COUNT;
+        row.calls++;
+        row.threads = max(row.threads, threads);
+        for (int t = 0; t < threads; t++) {
+            for (int c = 0; c < COUNTER_COUNT; c++)
+                row.totals[c] += end[t*COUNTER_COUNT + c] - begin[t*COUNTER_COUNT + c];
+        }
+    }
+
+    void report(ostream &out)
+    {
+        bool available[COUNTER_COUNT];
+        for (int c = 0; c < COUNTER_COUNT; c++)
+            available[c] = isAvailable((Counter)c);
+        bool flops = available[COUNTER_FP_SCALAR] || available[COUNTER_FP_128] || available[COUNTER_FP_256] || available[COUNTER_FP_512];
+
+        lock_guard<mutex> guard(rowsLock);
+
+        if (!anyAvailable()) {
+            out << "perf counters unavailable (" << (firstError.empty() ? "no counters" : firstError) << ")" << endl;
+            return;
+        }
+
+        ostringstream missing;
+        for (int c = 0; c < COUNTER_COUNT; c++) {
+            if (!available[c])
+                missing << " " << specs[c].name;
+        }
+        if (!missing.str().empty())
+            out << "n/a:" << missing.str() << (firstError.empty() ? "" : " (" + firstError + ")") << endl;
+
+        const Counter columns[] = {COUNTER_CYCLES, COUNTER_INSTRUCTIONS, COUNTER_LLC_MISSES, COUNTER_L1D_MISSES,
+                                   COUNTER_DTLB_MISSES, COUNTER_BACKEND_STALLS, COUNTER_PAGE_FAULTS, COUNTER_CONTEXT_SWITCHES};
+
+        out << left << setw(16) << "layer" << setw(13) << "engine" << right << setw(6) << "calls" << setw(4) << "thr";
+        for (Counter column : columns)
+            out << setw(17) << specs[column].name;
+        out << setw(7) << "IPC" << setw(12) << "GFLOP" << setw(12) << "task ms" << endl;
+
+        for (map<string, Row>::const_iterator it = rows.begin(); it != rows.end(); ++it) {
+            Row const &row = it->second;
+            size_t tab = it->first.find('\t');
+
+            out << left << setw(16) << it->first.substr(0, tab) << setw(13) << it->first.substr(tab + 1)
+                << right << setw(6) << row.calls << setw(4) << row.threads;
+
+            for (Counter column : columns) {
+                if (available[column])
+                    out << setw(17) << (unsigned long long)row.totals[column];
+                else
+                    out << setw(17) << "n/a";
+            }
+
+            out << fixed << setprecision(2);
+            if (available[COUNTER_CYCLES] && available[COUNTER_INSTRUCTIONS] && row.totals[COUNTER_CYCLES] > 0)
+                out << setw(7) << row.totals[COUNTER_INSTRUCTIONS] / row.totals[COUNTER_CYCLES];
+            else
+                out << setw(7) << "n/a";
+
+            double flopCount = row.totals[COUNTER_FP_SCALAR] + 2*row.totals[COUNTER_FP_128]
+                             + 4*row.totals[COUNTER_FP_256] + 8*row.totals[COUNTER_FP_512];
+            if (flops)
+                out << setw(12) << flopCount/1e9;
+            else
+                out << setw(12) << "n/a";
+
+            if (available[COUNTER_TASK_CLOCK])
+                out << setw(12) << row.totals[COUNTER_TASK_CLOCK]/1e6;
+            else
+                out << setw(12) << "n/a";
+            out << defaultfloat << endl;
+        }
+    }
+
+    void reset()
+    {
+        lock_guard<mutex> guard(rowsLock);
+        rows.clear();
+    }
+}
@@ -0,0 +1,63 @@
+#ifndef DEF_PERF_COUNTERS
+#define DEF_PERF_COUNTERS
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+//Hardware (and software) counters per layer/engine invocation via
+//perf_event_open. Every OpenMP worker opens its own counters on first use and
+//a Scope adds the per-thread deltas to a report row. The counters are opened
+//as perf groups (core: cycles, instructions, backend stalls, LLC misses;
+//L1D and DTLB misses; the FP widths; the software counters), each read at
+//once and scaled as a unit, so ratios within a group are never mixed from
+//different multiplexing windows. Counters the kernel or the container does
+//not expose are reported as n/a; when none can be opened a Scope does nothing.
+//
+//  { PerfCounters::Scope counters("conv3_1", "simd_openmp"); input.fwdConv(...); }
+//  PerfCounters::report(std::cout);
+namespace PerfCounters
+{
+	enum Counter
+	{
+		COUNTER_CYCLES,
+		COUNTER_INSTRUCTIONS,
+		COUNTER_LLC_MISSES,
+		COUNTER_L1D_MISSES,
+		COUNTER_DTLB_MISSES,
+		COUNTER_BACKEND_STALLS,
+		//Intel FP_ARITH_INST_RETIRED.*_DOUBLE by vector width (FMAs count twice)
+		COUNTER_FP_SCALAR,
+		COUNTER_FP_128,
+		COUNTER_FP_256,
+		COUNTER_FP_512,
+		COUNTER_TASK_CLOCK,
+		COUNTER_PAGE_FAULTS,
+		COUNTER_CONTEXT_SWITCHES,
+		COUNTER_COUNT
+	};
+
+	const char* counterName(Counter counter);
+
+	//whether the calling thread could open the counter
+	bool isAvailable(Counter counter);
+	bool anyAvailable();
+
+	class Scope
+	{
+	public:
+		Scope(std::string const &layer, std::string const &engine);
+		~Scope();
+
+	private:
+		std::string key;
+		bool active;
+		std::vector<double> begin; //per thread snapshot, COUNTER_COUNT values each
+	};
+
+	//one row per layer/engine, totals over all invocations and threads
+	void report(std::ostream &out);
+	void reset();
+}
+
+#endif
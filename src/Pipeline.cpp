@@ -0,0 +1,451 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <dirent.h>
+#include <fcntl.h>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+#include "BoundedQueue.h"
+#include "Pipeline.h"
+#include "Stats.h"
+#include "Timer.h"
+#include "Trace.h"
+
+using namespace std;
+
+//one image on its way through the stages; each stage frees what the next no longer needs
+struct Job
+{
+    Job(string const &path) : path(path), pixels(NULL), height(0), width(0), planes(NULL) {}
+
+    ~Job()
+    {
+        if (pixels)
+            Image::release(pixels);
+        free(planes);
+    }
+
+    string path;
+    vector<unsigned char> bytes;
+    unsigned char* pixels;
+    int height;
+    int width;
+    double* planes;
+    vector<double> scores;
+    string error; //set by the first stage that fails, the rest pass the job through
+};
+
+typedef BoundedQueue<Job*> JobQueue;
+
+//what a stage does to the jobs it popped together
+typedef function<void(vector<Job*> const &)> BatchWork;
+
+struct Stage
+{
+    Stage(string const &name, int threads) : name(name), threads(threads), running(threads),
+                                             items(0), busy(0), starved(0), blocked(0) {}
+
+    string name;
+    int threads;
+    atomic<int> running;
+    atomic<long> items;
+    atomic<unsigned long long> busy;
+    atomic<unsigned long long> starved;
+    atomic<unsigned long long> blocked;
+
+    Pipeline::StageReport report() const
+    {
+        Pipeline::StageReport stage = {name, threads, items.load(), Timer::seconds(busy.load()),
+                                       Timer::seconds(starved.load()), Timer::seconds(blocked.load())};
+        return stage;
+    }
+};
+
+//the nice value is per thread on Linux, so only the calling thread drops
+static void lowerPriority(int nice)
+{
+    if (nice <= 0)
+        return;
+    id_t thread = (id_t) syscall(SYS_gettid);
+    errno = 0;
+    int current = getpriority(PRIO_PROCESS, thread);
+    if (errno == 0)
+        setpriority(PRIO_PROCESS, thread, current + nice);
+}
+
+static bool isImage(string const &name)
+{
+    size_t dot = name.rfind('.');
+    if (dot == string::npos)
+        return false;
+    string extension = name.substr(dot + 1);
+    transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    return extension == "jpg" || extension == "jpeg" || extension == "png";
+}
+
+//------------------------------------------------------------------- stages
+
+class Lister
+{
+public:
+    Lister(Stage &stage, JobQueue &out) : stage(stage), out(out), blocked(0) {}
+
+    void run(vector<string> const &inputs)
+    {
+        for (size_t i = 0; i < inputs.size(); i++)
+            walk(inputs[i], true);
+
+        stage.blocked += blocked;
+        stage.running--;
+        out.close();
+    }
+
+private:
+    Stage &stage;
+    JobQueue &out;
+    unsigned long long blocked;
+    set<pair<dev_t, ino_t> > visited; //directories walked, by what stat sees through links
+
+    void emit(Job* job)
+    {
+        unsigned long long begin = Timer::rdtsc();
+        out.push(job);
+        blocked += Timer::rdtsc() - begin;
+        stage.items++;
+    }
+
+    //directories are read one at a time and sorted, so repeated runs see the
+    //same order; one seen before (a symlink loop, or two links to it) is skipped
+    void walk(string const &path, bool explicitly)
+    {
+        unsigned long long begin = Timer::rdtsc();
+        struct stat info;
+        if (stat(path.c_str(), &info) != 0) {
+            Job* job = new Job(path);
+            job->error = "cannot stat";
+            stage.busy += Timer::rdtsc() - begin;
+            emit(job);
+            return;
+        }
+
+        if (!S_ISDIR(info.st_mode)) {
+            stage.busy += Timer::rdtsc() - begin;
+            if (explicitly || isImage(path))
+                emit(new Job(path));
+            return;
+        }
+
+        if (!visited.insert(make_pair(info.st_dev, info.st_ino)).second) {
+            stage.busy += Timer::rdtsc() - begin;
+            return;
+        }
+
+        DIR* directory = opendir(path.c_str());
+        if (!directory) {
+            Job* job = new Job(path);
+            job->error = "cannot open directory";
+            stage.busy += Timer::rdtsc() - begin;
+            emit(job);
+            return;
+        }
+
+        vector<string> files;
+        vector<string> directories;
+        while (struct dirent* entry = readdir(directory)) {
+            string name = entry->d_name;
+            if (name == "." || name == "..")
+                continue;
+
+            string child = path + "/" + name;
+            bool isDirectory = entry->d_type == DT_DIR;
+            if (entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK)
+                isDirectory = stat(child.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+
+            if (isDirectory)
+                directories.push_back(child);
+            else if (isImage(name))
+                files.push_back(child);
+        }
+        closedir(directory);
+        sort(files.begin(), files.end());
+        sort(directories.begin(), directories.end());
+        stage.busy += Timer::rdtsc() - begin;
+
+        for (size_t f = 0; f < files.size(); f++)
+            emit(new Job(files[f]));
+        for (size_t d = 0; d < directories.size(); d++)
+            walk(directories[d], false);
+    }
+};
+
+//work on one job at a time, so a failure only marks that job
+static BatchWork eachJob(function<void(Job*)> work)
+{
+    return [work](vector<Job*> const &jobs) {
+        for (size_t j = 0; j < jobs.size(); j++) {
+            try {
+                work(jobs[j]);
+            } catch (exception const &error) {
+                jobs[j]->error = error.what();
+            }
+        }
+    };
+}
+
+//pops up to batch ready jobs (waiting only for the first), runs work on them
+//and passes them on; the last thread out closes the next queue
+static void runStage(Stage &stage, JobQueue &in, JobQueue* out, int batch, BatchWork work)
+{
+    unsigned long long busy = 0, starved = 0, blocked = 0;
+    long items = 0;
+    vector<Job*> jobs;
+    vector<Job*> live;
+
+    for (;;) {
+        unsigned long long begin = Timer::rdtsc();
+        Job* job;
+        if (!in.pop(job))
+            break;
+        jobs.assign(1, job);
+        while ((int)jobs.size() < batch && in.tryPop(job))
+            jobs.push_back(job);
+
+        unsigned long long popped = Timer::rdtsc();
+        //failed jobs skip every stage but the last, which reports them
+        live.clear();
+        for (size_t j = 0; j < jobs.size(); j++) {
+            if (jobs[j]->error.empty() || !out)
+                live.push_back(jobs[j]);
+        }
+        if (!live.empty()) {
+            try {
+                work(live);
+            } catch (exception const &error) {
+                //a batch that fails as a whole fails every job in it
+                for (size_t j = 0; j < live.size(); j++) {
+                    if (live[j]->error.empty())
+                        live[j]->error = error.what();
+                }
+            }
+        }
+
+        unsigned long long done = Timer::rdtsc();
+        for (size_t j = 0; j < jobs.size(); j++) {
+            if (out)
+                out->push(jobs[j]);
+            else
+                delete jobs[j];
+        }
+
+        unsigned long long end = Timer::rdtsc();
+        starved += popped - begin;
+        busy += done - popped;
+        blocked += end - done;
+        items += jobs.size();
+    }
+
+    stage.busy += busy;
+    stage.starved += starved;
+    stage.blocked += blocked;
+    stage.items += items;
+    if (--stage.running == 0 && out)
+        out->close();
+}
+
+static void readFile(Job* job)
+{
+    TRACE_SCOPE("pipeline", "read");
+    int fd = open(job->path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        throw runtime_error("Pipeline: cannot open " + job->path);
+
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        throw runtime_error("Pipeline: cannot stat " + job->path);
+    }
+
+    job->bytes.resize(info.st_size);
+    size_t done = 0;
+    while (done < job->bytes.size()) {
+        ssize_t count = read(fd, job->bytes.data() + done, job->bytes.size() - done);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0) {
+            close(fd);
+            throw runtime_error("Pipeline: short read from " + job->path);
+        }
+        done += count;
+    }
+    close(fd);
+}
+
+//----------------------------------------------------------------- Pipeline
+
+namespace Pipeline
+{
+    Settings defaults()
+    {
+        Settings settings;
+        settings.readers = 2;
+        settings.decoders = max(1, (int)thread::hardware_concurrency()/4);
+        settings.preprocessors = 1;
+        settings.writers = 1;
+        settings.queueDepth = 32;
+        settings.batch = 8;
+        settings.resizeTo = 256;
+        settings.feederNice = 5;
+        settings.preprocess = Image::caffeVgg();
+        settings.output = "-";
+        return settings;
+    }
+
+    Report run(Model const &model, vector<string> const &inputs, Settings const &settings)
+    {
+        LayerShape input = model.getInputShape();
+        if (input.depth != 3 || input.height != input.width)
+            throw logic_error("Invalid: the pipeline feeds square 3-channel models.");
+        if (settings.readers < 1 || settings.decoders < 1 || settings.preprocessors < 1 || settings.writers < 1
+            || settings.queueDepth < 1 || settings.batch < 1)
+            throw logic_error("Invalid: every pipeline stage needs a thread, a queue slot and a batch of at least 1.");
+        int size = input.height;
+
+        ofstream file;
+        ostream* results = &cout;
+        if (settings.output != "-") {
+            file.open(settings.output.c_str());
+            if (!file)
+                throw runtime_error("Pipeline: cannot write " + settings.output);
+            results = &file;
+        }
+
+        JobQueue toRead(settings.queueDepth), toDecode(settings.queueDepth), toPreprocess(settings.queueDepth),
+                 toForward(settings.queueDepth), toWrite(settings.queueDepth);
+
+        Stage list("list", 1), reading("read", settings.readers), decoding("decode", settings.decoders),
+              preprocessing("preprocess", settings.preprocessors), forwarding("forward", 1),
+              writing("write", settings.writers);
+
+        atomic<long> images(0), failed(0);
+        mutex resultsLock;
+
+        function<void(Job*)> decode = [](Job* job) {
+            job->pixels = Image::decode(job->bytes.data(), job->bytes.size(), job->path, job->height, job->width);
+            vector<unsigned char>().swap(job->bytes);
+        };
+        function<void(Job*)> preprocess = [&](Job* job) {
+            TRACE_SCOPE("pipeline", "preprocess");
+            if (posix_memalign((void**) &job->planes, 64, 3L*size*size*sizeof(double)) != 0) {
+                job->planes = NULL;
+                throw bad_alloc();
+            }
+            Image::prepare(job->planes, Image::view(job->pixels, job->height, job->width), settings.resizeTo,
+                           size, settings.preprocess);
+            Image::release(job->pixels);
+            job->pixels = NULL;
+            Stats::enqueued();
+        };
+        //the whole batch in one Model::forward, one image per thread
+        BatchWork forward = [&](vector<Job*> const &jobs) {
+            TRACE_SCOPE("pipeline", "forward");
+            int count = (int)jobs.size();
+            vector<const double*> planes(count);
+            vector<double*> scores(count);
+            for (int j = 0; j < count; j++) {
+                Stats::dequeued();
+                jobs[j]->scores.resize(model.outputSize());
+                planes[j] = jobs[j]->planes;
+                scores[j] = jobs[j]->scores.data();
+            }
+
+            unsigned long long begin = Timer::rdtsc();
+            model.forward(planes.data(), scores.data(), count);
+            unsigned long long cycles = Timer::rdtsc() - begin;
+
+            for (int j = 0; j < count; j++) {
+                Stats::page().requests.latency.record(cycles);
+                free(jobs[j]->planes);
+                jobs[j]->planes = NULL;
+            }
+        };
+        function<void(Job*)> write = [&](Job* job) {
+            ostringstream line;
+            if (job->error.empty()) {
+                long best = max_element(job->scores.begin(), job->scores.end()) - job->scores.begin();
+                line << job->path << "\t" << best << "\t" << job->scores[best] << "\n";
+            } else {
+                line << job->path << "\terror\t" << job->error << "\n";
+                failed++;
+            }
+            images++;
+
+            lock_guard<mutex> guard(resultsLock);
+            *results << line.str();
+        };
+
+        unsigned long long begin = Timer::rdtsc();
+        vector<thread> threads;
+        Lister lister(list, toRead);
+        int nice = settings.feederNice;
+
+        threads.push_back(thread([&]() { lowerPriority(nice); lister.run(inputs); }));
+        for (int t = 0; t < settings.readers; t++)
+            threads.push_back(thread([&]() { lowerPriority(nice); runStage(reading, toRead, &toDecode, 1, eachJob(readFile)); }));
+        for (int t = 0; t < settings.decoders; t++)
+            threads.push_back(thread([&]() { lowerPriority(nice); runStage(decoding, toDecode, &toPreprocess, 1, eachJob(decode)); }));
+        for (int t = 0; t < settings.preprocessors; t++)
+            threads.push_back(thread([&]() { lowerPriority(nice); runStage(preprocessing, toPreprocess, &toForward, 1, eachJob(preprocess)); }));
+        threads.push_back(thread([&]() { runStage(forwarding, toForward, &toWrite, settings.batch, forward); }));
+        for (int t = 0; t < settings.writers; t++)
+            threads.push_back(thread([&]() { lowerPriority(nice); runStage(writing, toWrite, NULL, 1, eachJob(write)); }));
+
+        for (size_t t = 0; t < threads.size(); t++)
+            threads[t].join();
+        results->flush();
+
+        Report report;
+        report.seconds = Timer::seconds(Timer::rdtsc() - begin);
+        report.images = images;
+        report.failed = failed;
+        Stage* stages[] = {&list, &reading, &decoding, &preprocessing, &forwarding, &writing};
+        for (Stage* stage : stages)
+            report.stages.push_back(stage->report());
+        return report;
+    }
+
+    void writeReport(ostream &out, Report const &report)
+    {
+        out << left << setw(12) << "stage" << right << setw(8) << "threads" << setw(10) << "items"
+            << setw(9) << "busy%" << setw(10) << "starved%" << setw(10) << "blocked%"
+            << setw(14) << "img/s/thread" << setw(10) << "img/s" << "\n";
+
+        for (size_t s = 0; s < report.stages.size(); s++) {
+            StageReport const &stage = report.stages[s];
+            double threadSeconds = stage.threads*report.seconds;
+            double perThread = stage.busySeconds > 0 ? stage.items/stage.busySeconds : 0;
+
+            out << left << setw(12) << stage.name << right << setw(8) << stage.threads << setw(10) << stage.items
+                << fixed << setprecision(1)
+                << setw(9) << 100*stage.busySeconds/threadSeconds
+                << setw(10) << 100*stage.starvedSeconds/threadSeconds
+                << setw(10) << 100*stage.blockedSeconds/threadSeconds
+                << setw(14) << perThread
+                << setw(10) << stage.items/report.seconds << defaultfloat << "\n";
+        }
+
+        out << report.images << " images (" << report.failed << " failed) in " << setprecision(3)
+            << report.seconds << " s, " << setprecision(1) << fixed << report.images/report.seconds
+            << " images/s" << defaultfloat << endl;
+    }
+}
@@ -0,0 +1,73 @@
+#ifndef DEF_PIPELINE
+#define DEF_PIPELINE
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include "Image.h"
+#include "Model.h"
+
+//Offline inference over directories of JPEG/PNG files as six overlapped
+//stages, each on its own thread group and joined by BoundedQueues:
+//
+//  list -> read -> decode -> preprocess -> forward -> write
+//
+//list walks the directories as it goes (no up-front listing), read loads the
+//encoded bytes, decode runs stb_image, preprocess resizes the shorter side,
+//centre-crops to the model input and writes planes, forward runs the Model on
+//batches of ready images with the OpenMP engines, write appends one line per
+//image (path, top-1 class, score or the error). Full queues hold the stages
+//upstream back, so memory stays bounded at queueDepth images per queue. The
+//feeding stages run at a lower priority (feederNice) so the forward team
+//wins the cores when the machine is saturated; the report shows how long
+//forward waited for input.
+//
+//  Pipeline::Report report = Pipeline::run(model, inputs, Pipeline::defaults());
+//  Pipeline::writeReport(std::cerr, report);
+namespace Pipeline
+{
+	struct Settings
+	{
+		int readers;
+		int decoders;
+		int preprocessors;
+		int writers;
+		int queueDepth;     //images between two stages
+		int batch;          //most images forward takes per pass
+		int resizeTo;       //shorter side before the centre crop
+		int feederNice;     //added to the nice value of every thread but forward's
+		Image::Preprocess preprocess;
+		std::string output; //results file, "-" for stdout
+	};
+
+	struct StageReport
+	{
+		std::string name;
+		int threads;
+		long items;
+		double busySeconds;    //summed over the stage's threads
+		double starvedSeconds; //waiting on the queue before it
+		double blockedSeconds; //waiting on a full queue after it
+	};
+
+	struct Report
+	{
+		double seconds;
+		long images;
+		long failed;
+		std::vector<StageReport> stages;
+	};
+
+	Settings defaults();
+
+	//inputs are image files or directories, searched recursively for
+	//.jpg/.jpeg/.png; symlinked directories are followed, each directory
+	//once, so a link loop ends. The model input must be square with 3 channels
+	Report run(Model const &model, std::vector<std::string> const &inputs, Settings const &settings);
+
+	//per stage: threads, items, busy/starved/blocked share and images/sec,
+	//both per busy thread-second (capacity) and over the wall time
+	void writeReport(std::ostream &out, Report const &report);
+}
+
+#endif
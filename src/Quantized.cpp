@@ -0,0 +1,502 @@
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include "Kernels.h"
+#include "Quantized.h"
+#include "Stats.h"
+#include "Trace.h"
+
+using namespace std;
+
+//a ReLU follows the conv and fully connected layers but the last when asked for
+static bool reluAfter(vector<LayerSpec> const &layers, int l, bool relu)
+{
+    return relu && layers[l].type != LAYER_MAXPOOL && l + 1 < (int)layers.size();
+}
+
+static void applyRelu(Tensor &volume)
+{
+    for (int d = 0; d < volume.getDepth(); d++) {
+        for (vector<double> &row : volume.layers[d].matrix) {
+            for (double &value : row)
+                value = max(value, 0.0);
+        }
+    }
+}
+
+static int roundUp(int n, int multiple)
+{
+    return (n + multiple - 1)/multiple*multiple;
+}
+
+//------------------------------------------------------------ Calibration
+
+Calibration::Calibration(){}
+
+Calibration::Calibration(int tensors)
+{
+    channels = vector<vector<ChannelRange> >(tensors);
+}
+
+Calibration Calibration::collect(Model const &model, vector<Tensor> const &samples, bool relu)
+{
+    vector<LayerSpec> const &layers = model.getNetwork().getLayers();
+    Calibration calibration((int)layers.size() + 1);
+
+    for (size_t s = 0; s < samples.size(); s++) {
+        Tensor volume = samples[s];
+        calibration.observe(0, volume);
+        for (int l = 0; l < (int)layers.size(); l++) {
+            volume = model.forward(volume, l, l + 1);
+            if (reluAfter(layers, l, relu))
+                applyRelu(volume);
+            calibration.observe(l + 1, volume);
+        }
+    }
+    return calibration;
+}
+
+void Calibration::observe(int t, Tensor const &volume)
+{
+    if (t < 0 || t >= tensors())
+        throw logic_error("Invalid: tensor " + to_string(t) + " of a calibration with " + to_string(tensors()) + ".");
+
+    vector<ChannelRange> &ranges = channels[t];
+    if (ranges.empty()) {
+        ChannelRange empty = {numeric_limits<double>::infinity(), -numeric_limits<double>::infinity()};
+        ranges.assign(volume.getDepth(), empty);
+    }
+    if ((int)ranges.size() != volume.getDepth())
+        throw logic_error("Invalid: tensor " + to_string(t) + " has " + to_string(ranges.size())
+                          + " channels, the volume " + to_string(volume.getDepth()) + ".");
+
+    for (int d = 0; d < volume.getDepth(); d++) {
+        for (vector<double> const &row : volume.layers[d].matrix) {
+            for (double value : row) {
+                ranges[d].low = min(ranges[d].low, value);
+                ranges[d].high = max(ranges[d].high, value);
+            }
+        }
+    }
+}
+
+vector<ChannelRange> const &Calibration::ranges(int t) const
+{
+    return channels[t];
+}
+
+int Calibration::tensors() const
+{
+    return (int)channels.size();
+}
+
+void Calibration::save(string const &path) const
+{
+    ofstream output(path);
+    if (!output)
+        throw runtime_error("Calibration: cannot write " + path);
+
+    output << "# tensor channel low high" << endl << setprecision(17);
+    for (int t = 0; t < tensors(); t++) {
+        for (size_t c = 0; c < channels[t].size(); c++)
+            output << t << ' ' << c << ' ' << channels[t][c].low << ' ' << channels[t][c].high << '\n';
+    }
+    if (!output)
+        throw runtime_error("Calibration: short write to " + path);
+}
+
+Calibration Calibration::load(string const &path)
+{
+    ifstream input(path);
+    if (!input)
+        throw runtime_error("Calibration: cannot open " + path);
+
+    Calibration calibration;
+    ChannelRange empty = {numeric_limits<double>::infinity(), -numeric_limits<double>::infinity()};
+    string line;
+    int number = 0;
+    while (getline(input, line)) {
+        number++;
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        istringstream fields(line);
+        int t, c;
+        ChannelRange range;
+        if (!(fields >> t >> c >> range.low >> range.high) || t < 0 || c < 0)
+            throw runtime_error("Calibration: " + path + " line " + to_string(number) + " is not \"tensor channel low high\".");
+
+        if (t >= calibration.tensors())
+            calibration.channels.resize(t + 1);
+        if (c >= (int)calibration.channels[t].size())
+            calibration.channels[t].resize(c + 1, empty);
+        calibration.channels[t][c] = range;
+    }
+    return calibration;
+}
+
+//--------------------------------------------------------------- bytes
+
+//an HWC volume of uint8 values, depth padded as QuantizedModel lays it out
+struct ByteVolume
+{
+    int height;
+    int width;
+    int depth;
+    vector<unsigned char> data;
+};
+
+//asymmetric: the range is widened to hold 0, which then is a whole byte;
+//padding channels and channels that never moved get scale 1, zero point 0
+static ChannelQuantization quantizationOf(vector<ChannelRange> const &ranges, int channels)
+{
+    ChannelQuantization q;
+    q.scale.assign(channels, 1.0f);
+    q.zeroPoint.assign(channels, 0);
+    for (size_t c = 0; c < ranges.size(); c++) {
+        double low = min(ranges[c].low, 0.0), high = max(ranges[c].high, 0.0);
+        if (!(high > low))
+            continue;
+        double scale = (high - low)/255;
+        q.scale[c] = (float)scale;
+        q.zeroPoint[c] = min(max((int)lrint(-low/scale), 0), 255);
+    }
+    return q;
+}
+
+static ByteVolume quantize(Tensor const &volume, ChannelQuantization const &q)
+{
+    TRACE_SCOPE("pack", "quantize");
+    int height = volume.getHeight(), width = volume.getWidth(), depth = (int)q.scale.size();
+    ByteVolume bytes = {height, width, depth, vector<unsigned char>((long)height*width*depth)};
+
+    for (int k = 0; k < depth; k++) {
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                int value = q.zeroPoint[k];
+                if (k < volume.getDepth()) {
+                    //clamped first so values far outside the range cannot overflow the conversion
+                    double scaled = min(max(volume.layers[k].matrix[y][x]/q.scale[k], -1024.0), 1024.0);
+                    value = min(max((int)lrint(scaled) + q.zeroPoint[k], 0), 255);
+                }
+                bytes.data[((long)width*y + x)*depth + k] = (unsigned char)value;
+            }
+        }
+    }
+    return bytes;
+}
+
+//the first depth channels back to doubles
+static Tensor dequantize(ByteVolume const &bytes, ChannelQuantization const &q, int depth)
+{
+    TRACE_SCOPE("unpack", "dequantize");
+    Tensor volume = Tensor(bytes.height, bytes.width);
+    for (int k = 0; k < depth; k++) {
+        Matrix layer = Matrix(bytes.height, bytes.width);
+        for (int y = 0; y < bytes.height; y++) {
+            for (int x = 0; x < bytes.width; x++) {
+                int value = bytes.data[((long)bytes.width*y + x)*bytes.depth + k];
+                layer.matrix[y][x] = (double)q.scale[k]*(value - q.zeroPoint[k]);
+            }
+        }
+        volume.addLayer(layer);
+    }
+    return volume;
+}
+
+//the same rounding as the kernels' fused epilogue
+static unsigned char requantize(int sum, QuantizedLayer const &q, int z)
+{
+    float scaled = min(max((float)sum*q.multiplier[z], -65536.0f), 65536.0f);
+    int value = (int)lrintf(scaled) + q.zeroPoint[z];
+    return (unsigned char)min(max(value, q.lower[z]), 255);
+}
+
+//filter with the input scales folded in, quantized to +-QUANT_WEIGHT_MAX
+//with its own scale (returned); place(i, j, k) is where weight (i, j, k)
+//goes in packed, and correction is the sum of weight*zero point, the part of
+//the int32 sum that the zero points of the inputs contribute
+template <typename Place>
+static double quantizeFilter(vector<signed char> &packed, Tensor const &filter, ChannelQuantization const &in,
+                             int &correction, Place place)
+{
+    double largest = 0;
+    for (int k = 0; k < filter.getDepth(); k++) {
+        for (int i = 0; i < filter.getHeight(); i++) {
+            for (int j = 0; j < filter.getWidth(); j++)
+                largest = max(largest, fabs(filter.layers[k].matrix[i][j]*in.scale[k]));
+        }
+    }
+    double scale = largest > 0 ? largest/Kernels::QUANT_WEIGHT_MAX : 1;
+
+    correction = 0;
+    for (int k = 0; k < filter.getDepth(); k++) {
+        for (int i = 0; i < filter.getHeight(); i++) {
+            for (int j = 0; j < filter.getWidth(); j++) {
+                int weight = (int)lrint(filter.layers[k].matrix[i][j]*in.scale[k]/scale);
+                weight = min(max(weight, -Kernels::QUANT_WEIGHT_MAX), Kernels::QUANT_WEIGHT_MAX);
+                packed[place(i, j, k)] = (signed char)weight;
+                correction += weight*in.zeroPoint[k];
+            }
+        }
+    }
+    return scale;
+}
+
+//requantization of output channel z to out, ReLU included when lower is the zero point
+static void setOutput(QuantizedLayer &q, int z, double filterScale, int correction,
+                      ChannelQuantization const &out, bool relu)
+{
+    q.bias[z] = -correction;
+    q.filterScale[z] = (float)filterScale;
+    q.multiplier[z] = (float)(filterScale/out.scale[z]);
+    q.zeroPoint[z] = out.zeroPoint[z];
+    q.lower[z] = relu ? out.zeroPoint[z] : 0;
+}
+
+//outputs channels of which the first filters are real
+static void allocate(QuantizedLayer &q, long weights, int outputs)
+{
+    q.weights.assign(weights, 0);
+    q.bias.assign(outputs, 0);
+    q.multiplier.assign(outputs, 0.0f);
+    q.zeroPoint.assign(outputs, 0);
+    q.lower.assign(outputs, 0);
+    q.filterScale.assign(outputs, 0.0f);
+}
+
+static ByteVolume convU8(ByteVolume const &input, LayerSpec const &layer, QuantizedLayer const &q,
+                         ChannelQuantization const &in, int channels)
+{
+    int pad = layer.padding;
+    Kernels::ConvShape shape;
+    shape.Fh = shape.Fw = layer.F;
+    shape.strideY = shape.strideX = layer.stride;
+    shape.dilationY = shape.dilationX = 1;
+    shape.paddedHeight = input.height + 2*pad;
+    shape.paddedWidth = input.width + 2*pad;
+    shape.outHeight = (shape.paddedHeight - layer.F)/layer.stride + 1;
+    shape.outWidth = (shape.paddedWidth - layer.F)/layer.stride + 1;
+    shape.numberOfFilters = channels;
+    shape.depth = input.depth;
+
+    // A, the border holds every channel's zero point so it reads as real zeros
+    vector<unsigned char> padded;
+    const unsigned char* A = input.data.data();
+    if (pad > 0) {
+        TRACE_SCOPE("pack", "int8 inputs");
+        padded.resize((long)shape.paddedHeight*shape.paddedWidth*input.depth);
+        for (long p = 0; p < (long)shape.paddedHeight*shape.paddedWidth; p++) {
+            for (int k = 0; k < input.depth; k++)
+                padded[p*input.depth + k] = (unsigned char)in.zeroPoint[k];
+        }
+        long row = (long)input.width*input.depth;
+        for (int y = 0; y < input.height; y++)
+            copy(input.data.begin() + row*y, input.data.begin() + row*(y + 1),
+                 padded.begin() + ((long)shape.paddedWidth*(y + pad) + pad)*input.depth);
+        A = padded.data();
+    }
+
+    ByteVolume output = {shape.outHeight, shape.outWidth, channels,
+                         vector<unsigned char>((long)shape.outHeight*shape.outWidth*channels)};
+    Kernels::Requantize requantize = {q.bias.data(), q.multiplier.data(), q.zeroPoint.data(), q.lower.data()};
+    Kernels::ConvRowU8Fn convRow = Kernels::active().convRowU8;
+
+    TRACE_CAPTURE_LAYER(traceLayer);
+    #pragma omp parallel
+    {
+        TRACE_INHERIT_LAYER(traceLayer);
+        TRACE_SCOPE("kernel", "conv int8 rows");
+        #pragma omp for schedule(static)
+        for (int y = 0; y < shape.outHeight; y++)
+            convRow(output.data.data(), A, q.weights.data(), shape, requantize, y);
+    }
+    return output;
+}
+
+//windows that would run past the edge are dropped, as in Tensor::fwdMaxPool
+static ByteVolume maxPoolU8(ByteVolume const &input, LayerSpec const &layer)
+{
+    int F = layer.F, stride = layer.stride, depth = input.depth;
+    int outHeight = (input.height - F)/stride + 1, outWidth = (input.width - F)/stride + 1;
+    ByteVolume output = {outHeight, outWidth, depth, vector<unsigned char>((long)outHeight*outWidth*depth)};
+
+    #pragma omp parallel for
+    for (int y = 0; y < outHeight; y++) {
+        TRACE_SCOPE("kernel", "max pool int8");
+        for (int x = 0; x < outWidth; x++) {
+            unsigned char* out = output.data.data() + ((long)outWidth*y + x)*depth;
+            fill(out, out + depth, 0);
+            for (int i = 0; i < F; i++) {
+                for (int j = 0; j < F; j++) {
+                    const unsigned char* in = input.data.data() + ((long)input.width*(y*stride + i) + x*stride + j)*depth;
+                    for (int k = 0; k < depth; k++)
+                        out[k] = max(out[k], in[k]);
+                }
+            }
+        }
+    }
+    return output;
+}
+
+//------------------------------------------------------------ QuantizedModel
+
+QuantizedModel::QuantizedModel(Model const &model, Calibration const &calibration, bool relu)
+{
+    this->network = model.getNetwork();
+    this->relu = relu;
+    vector<LayerSpec> const &specs = network.getLayers();
+    LayerShape input = model.getInputShape();
+    shapes = network.shapesFor(input.height, input.width, input.depth);
+
+    int count = (int)specs.size();
+    if (calibration.tensors() != count + 1)
+        throw logic_error("Invalid: the calibration covers " + to_string(calibration.tensors()) + " tensors, the model has "
+                          + to_string(count + 1) + ".");
+    for (int t = 0; t <= count; t++) {
+        if ((int)calibration.ranges(t).size() != shapes[t].depth)
+            throw logic_error("Invalid: the calibration has " + to_string(calibration.ranges(t).size()) + " channels for tensor "
+                              + to_string(t) + ", the model " + to_string(shapes[t].depth) + ".");
+    }
+
+    //bytes per pixel of every tensor: dense conv outputs are whole filter
+    //groups, everything else whole QUANT_K channel groups; pools keep the
+    //quantization of their input, the max of bytes is the byte of the max
+    activations.push_back(quantizationOf(calibration.ranges(0), roundUp(shapes[0].depth, Kernels::QUANT_K)));
+    for (int l = 0; l < count; l++) {
+        LayerSpec const &layer = specs[l];
+        if (layer.type == LAYER_MAXPOOL) {
+            activations.push_back(activations[l]);
+            continue;
+        }
+        int multiple = layer.type == LAYER_CONV && layer.groups == 1 ? Kernels::QUANT_FILTERS : Kernels::QUANT_K;
+        activations.push_back(quantizationOf(calibration.ranges(l + 1), roundUp(shapes[l + 1].depth, multiple)));
+    }
+
+    for (int l = 0; l < count; l++) {
+        LayerSpec const &layer = specs[l];
+        Filters filters = model.getWeights(l);
+        ChannelQuantization const &in = activations[l];
+        ChannelQuantization const &out = activations[l + 1];
+        bool fused = reluAfter(specs, l, relu);
+        int depth = (int)in.scale.size(), outputs = (int)out.scale.size();
+        QuantizedLayer q;
+
+        if (layer.type == LAYER_CONV && layer.groups != 1) {
+            q.grouped = filters;
+        } else if (layer.type == LAYER_CONV) {
+            //[group][i][j][k/QUANT_K][filter][k%QUANT_K], see Kernels::ConvRowU8Fn
+            const int N = Kernels::QUANT_FILTERS, K = Kernels::QUANT_K;
+            int F = layer.F;
+            allocate(q, (long)outputs*F*F*depth, outputs);
+            for (int z = 0; z < layer.outputs; z++) {
+                int correction;
+                double scale = quantizeFilter(q.weights, filters.filters[z], in, correction, [&](int i, int j, int k) {
+                    return ((((long)(z/N)*F + i)*F + j)*(depth/K) + k/K)*N*K + (z%N)*K + k%K;
+                });
+                setOutput(q, z, scale, correction, out, fused);
+            }
+        } else if (layer.type == LAYER_FULLY_CONNECTED) {
+            //rows in the HWC order of the byte volume
+            int width = shapes[l].width;
+            long inputs = (long)shapes[l].height*width*depth;
+            allocate(q, inputs*layer.outputs, outputs);
+            for (int o = 0; o < layer.outputs; o++) {
+                int correction;
+                double scale = quantizeFilter(q.weights, filters.filters[o], in, correction, [&](int i, int j, int k) {
+                    return inputs*o + ((long)width*i + j)*depth + k;
+                });
+                setOutput(q, o, scale, correction, out, fused);
+            }
+        }
+        layers.push_back(q);
+    }
+}
+
+Tensor QuantizedModel::forward(Tensor const &input) const
+{
+    vector<LayerSpec> const &specs = network.getLayers();
+    LayerShape const &shape = shapes.front();
+    if (input.getHeight() != shape.height || input.getWidth() != shape.width || input.getDepth() != shape.depth) {
+        ostringstream message;
+        message << "Invalid: the model takes " << shape.height << "x" << shape.width << "x" << shape.depth
+                << " inputs, got " << input.getHeight() << "x" << input.getWidth() << "x" << input.getDepth() << ".";
+        throw logic_error(message.str());
+    }
+
+    ByteVolume volume = quantize(input, activations[0]);
+    for (int l = 0; l < (int)specs.size(); l++) {
+        LayerSpec const &layer = specs[l];
+        QuantizedLayer const &q = layers[l];
+        ChannelQuantization const &out = activations[l + 1];
+        Stats::LayerScope scope(layer.name.c_str());
+        TRACE_LAYER(layer.name);
+
+        if (layer.type == LAYER_CONV && layer.groups != 1) {
+            Tensor real = dequantize(volume, activations[l], shapes[l].depth);
+            ConvPlan plan = {ENGINE_SIMD_OPENMP, 1};
+            real = real.fwdConv(q.grouped, convParams(layer.stride, layer.padding, 1, layer.groups), 0, plan);
+            if (reluAfter(specs, l, relu))
+                applyRelu(real);
+            volume = quantize(real, out);
+        } else if (layer.type == LAYER_CONV) {
+            volume = convU8(volume, layer, q, activations[l], (int)out.scale.size());
+        } else if (layer.type == LAYER_MAXPOOL) {
+            volume = maxPoolU8(volume, layer);
+        } else {
+            vector<int> sums(layer.outputs);
+            {
+                TRACE_SCOPE("kernel", "fully connected int8");
+                Kernels::active().fullyConnectedU8(sums.data(), volume.data.data(), q.weights.data(),
+                                                   (int)volume.data.size(), layer.outputs);
+            }
+
+            //the model output comes straight from the int32 sums
+            if (l + 1 == (int)specs.size()) {
+                Tensor result = Tensor(1, 1);
+                for (int o = 0; o < layer.outputs; o++) {
+                    Matrix value = Matrix(1, 1);
+                    value.matrix[0][0] = (double)q.filterScale[o]*(sums[o] + q.bias[o]);
+                    result.addLayer(value);
+                }
+                return result;
+            }
+
+            ByteVolume next = {1, 1, (int)out.scale.size(), vector<unsigned char>(out.scale.size())};
+            for (int o = 0; o < layer.outputs; o++)
+                next.data[o] = requantize(sums[o] + q.bias[o], q, o);
+            volume = next;
+        }
+    }
+    return dequantize(volume, activations.back(), shapes.back().depth);
+}
+
+Tensor QuantizedModel::reference(Model const &model, Tensor const &input, bool relu)
+{
+    vector<LayerSpec> const &layers = model.getNetwork().getLayers();
+    if (!relu)
+        return model.forward(input);
+
+    Tensor volume = input;
+    for (int l = 0; l < (int)layers.size(); l++) {
+        volume = model.forward(volume, l, l + 1);
+        if (reluAfter(layers, l, relu))
+            applyRelu(volume);
+    }
+    return volume;
+}
+
+long QuantizedModel::weightBytes() const
+{
+    long bytes = 0;
+    for (QuantizedLayer const &q : layers) {
+        bytes += q.weights.size();
+        for (Tensor const &filter : q.grouped.filters)
+            bytes += sizeof(double)*filter.getHeight()*filter.getWidth()*filter.getDepth();
+    }
+    return bytes;
+}
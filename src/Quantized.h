@@ -0,0 +1,101 @@
+#ifndef DEF_QUANTIZED
+#define DEF_QUANTIZED
+
+#include <string>
+#include <vector>
+#include "Model.h"
+
+//Int8 inference for a Model. Calibration runs sample inputs through the
+//double layers and keeps the range of every channel of every activation:
+//tensor l is the input of layer l, the last tensor the output of the model.
+//QuantizedModel turns each range into an asymmetric uint8 scale and zero
+//point, folds the input scales into the weights and quantizes those per
+//filter to signed bytes (Kernels::QUANT_WEIGHT_MAX). Dense conv and fully
+//connected layers then run the Kernels convRowU8 / fullyConnectedU8 kernels
+//with int32 accumulation. The requantization to the next layer's bytes, and
+//the ReLU when one is asked for, are fused into the conv store. Pools take
+//the max of the bytes, since every channel's scale is positive. The last
+//fully connected layer is dequantized straight from int32.
+//
+//  Calibration calibration = Calibration::collect(model, samples, relu);
+//  calibration.save("tiny.calibration");
+//  QuantizedModel quantized(model, calibration, relu);
+//  Tensor scores = quantized.forward(image);
+//
+//The networks here have no activation layers. With relu set, a ReLU follows
+//every conv and fully connected layer but the last, both in the double
+//reference (QuantizedModel::reference) and in the int8 layers. Grouped
+//convolutions run in double between a dequantize and a quantize.
+struct ChannelRange
+{
+	double low;
+	double high;
+};
+
+class Calibration
+{
+public:
+	Calibration();
+	//tensors activations (layers + 1 for a model), every range still empty
+	Calibration(int tensors);
+
+	//the ranges of sample inputs through the double layers of the model
+	static Calibration collect(Model const &model, std::vector<Tensor> const &samples, bool relu);
+
+	//widens the ranges of tensor t to cover volume (one range per layer of it)
+	void observe(int t, Tensor const &volume);
+	std::vector<ChannelRange> const &ranges(int t) const;
+	int tensors() const;
+
+	//text, one "tensor channel low high" line per channel
+	void save(std::string const &path) const;
+	static Calibration load(std::string const &path);
+
+private:
+	std::vector<std::vector<ChannelRange> > channels;
+};
+
+//uint8 value q stands for scale*(q - zeroPoint), per channel of a byte volume
+struct ChannelQuantization
+{
+	std::vector<float> scale;
+	std::vector<int> zeroPoint;
+};
+
+//one layer ready for the int8 kernels; the Requantize arrays are per output
+//channel (padded to whole filter groups), filterScale takes a fully connected
+//sum back to the real value
+struct QuantizedLayer
+{
+	std::vector<signed char> weights;
+	std::vector<int> bias;
+	std::vector<float> multiplier;
+	std::vector<int> zeroPoint;
+	std::vector<int> lower;
+	std::vector<float> filterScale;
+	Filters grouped; //double weights of a grouped conv
+};
+
+class QuantizedModel
+{
+public:
+	//logic_error unless the calibration has a range for every channel of every tensor of the model
+	QuantizedModel(Model const &model, Calibration const &calibration, bool relu = false);
+
+	//quantizes the input with the ranges of tensor 0 and returns the output as doubles
+	Tensor forward(Tensor const &input) const;
+	//the double model with the same ReLUs, what forward() approximates
+	static Tensor reference(Model const &model, Tensor const &input, bool relu);
+
+	//bytes of int8 weights (double weights of grouped layers included)
+	long weightBytes() const;
+
+private:
+	Network network;
+	std::vector<LayerShape> shapes;
+	bool relu;
+	std::vector<ChannelQuantization> activations;
+	std::vector<QuantizedLayer> layers;
+};
+
+#endif
@@ -0,0 +1,511 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <linux/futex.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "Server.h"
+#include "Stats.h"
+#include "Timer.h"
+#include "Trace.h"
+
+using namespace std;
+
+static_assert(sizeof(ServerHeader) == 24, "Server: the wire header must stay 24 bytes.");
+
+static const char REQUEST_MAGIC[4] = {'F', 'C', 'R', 'Q'};
+static const char RESPONSE_MAGIC[4] = {'F', 'C', 'R', 'S'};
+
+struct ServerConnection
+{
+    ServerConnection(int fd, int number, int outboxDepth)
+        : fd(fd), number(number), outbox(outboxDepth), inFlight(0), broken(false), posted(0), writerWaiting(false) {}
+    ~ServerConnection()
+    {
+        string* response;
+        while (outbox.tryPop(response))
+            delete response;
+        close(fd);
+    }
+
+    int fd;
+    int number;
+    BoundedQueue<string*> outbox; //encoded responses, header and payload
+    atomic<int> inFlight;         //admitted requests not answered yet
+    atomic<bool> broken;          //nothing more is written once set
+    atomic<unsigned int> posted;  //futex word, bumped after every push to the outbox and its close
+    atomic<bool> writerWaiting;   //the writer found the outbox empty and may sleep on posted
+};
+
+struct ServerRequest
+{
+    ServerRequest(shared_ptr<ServerConnection> const &connection, unsigned long long id)
+        : connection(connection), id(id), planes(NULL), arrival(Timer::rdtsc()) {}
+    ~ServerRequest() { free(planes); }
+
+    shared_ptr<ServerConnection> connection;
+    unsigned long long id;
+    double* planes;
+    unsigned long long arrival;
+};
+
+//false once the peer is gone
+static bool readFully(int fd, void* buffer, size_t bytes)
+{
+    char* out = (char*) buffer;
+    while (bytes > 0) {
+        ssize_t count = recv(fd, out, bytes, 0);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            return false;
+        out += count;
+        bytes -= count;
+    }
+    return true;
+}
+
+static bool writeFully(int fd, const void* buffer, size_t bytes)
+{
+    const char* in = (const char*) buffer;
+    while (bytes > 0) {
+        //a client that hung up must not take the server down with SIGPIPE
+        ssize_t count = send(fd, in, bytes, MSG_NOSIGNAL);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            return false;
+        in += count;
+        bytes -= count;
+    }
+    return true;
+}
+
+//the writer sleeps in the kernel while its outbox is empty, the way a
+//ShmRing server sleeps on its slots, so an idle connection costs no polling
+static void futexWait(atomic<unsigned int> &word, unsigned int expected)
+{
+    syscall(SYS_futex, (unsigned int*) &word, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+static void futexWake(atomic<unsigned int> &word)
+{
+    syscall(SYS_futex, (unsigned int*) &word, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+//after a push to the outbox or its close; the syscall only when the writer may be asleep
+static void wakeWriter(ServerConnection &connection)
+{
+    connection.posted++;
+    if (connection.writerWaiting)
+        futexWake(connection.posted);
+}
+
+//the next response in order, false once the outbox is closed and drained.
+//writerWaiting is set before posted is read: a pusher that misses the flag
+//bumped posted first, so the wait sees the new value and returns at once
+static bool nextResponse(ServerConnection* connection, string* &response)
+{
+    for (;;) {
+        if (connection->outbox.tryPop(response))
+            return true;
+
+        connection->writerWaiting = true;
+        unsigned int seen = connection->posted;
+        bool closed = connection->outbox.isClosed();
+        bool popped = connection->outbox.tryPop(response);
+        if (popped || closed) {
+            connection->writerWaiting = false;
+            return popped;
+        }
+        futexWait(connection->posted, seen);
+        connection->writerWaiting = false;
+    }
+}
+
+//the connection's writer: sends the outbox in order until serve() closes it,
+//blocking only this connection on a slow reader
+static void writeLoop(ServerConnection* connection)
+{
+    string* response;
+    while (nextResponse(connection, response)) {
+        if (!connection->broken && !writeFully(connection->fd, response->data(), response->size()))
+            connection->broken = true;
+        delete response;
+    }
+}
+
+static sockaddr_un addressOf(string const &socketPath)
+{
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socketPath.empty() || socketPath.size() >= sizeof(address.sun_path))
+        throw logic_error("Invalid: socket path must be 1 to " + to_string(sizeof(address.sun_path) - 1) + " characters.");
+    memcpy(address.sun_path, socketPath.c_str(), socketPath.size());
+    return address;
+}
+
+//-------------------------------------------------------------------- Server
+
+Server::Settings Server::defaults()
+{
+    Settings settings;
+    settings.socketPath = "/tmp/fastcode-server.sock";
+    settings.maxBatch = 8;
+    settings.maxDelayUs = 2000;
+    settings.queueDepth = 64;
+    settings.outboxDepth = 64;
+    settings.resizeTo = 256;
+    settings.preprocess = Image::caffeVgg();
+    return settings;
+}
+
+Server::Server(Model const &model, Settings const &settings)
+    : model(model), settings(settings), listener(-1), running(false), queue(max(1, settings.queueDepth)),
+      liveConnections(0), requests(0), rejected(0), failed(0), batches(0), batchedRequests(0), dropped(0)
+{
+    if (settings.maxBatch < 1 || settings.maxDelayUs < 0 || settings.queueDepth < 1 || settings.outboxDepth < 1)
+        throw logic_error("Invalid: the server needs a batch, a queue and an outbox of at least 1 and a delay of at least 0.");
+}
+
+Server::~Server()
+{
+    stop();
+}
+
+void Server::start()
+{
+    if (running)
+        return;
+
+    sockaddr_un address = addressOf(settings.socketPath);
+    listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0)
+        throw runtime_error("Server: cannot create a socket.");
+
+    unlink(settings.socketPath.c_str());
+    if (bind(listener, (sockaddr*) &address, sizeof(address)) != 0 || listen(listener, 128) != 0) {
+        close(listener);
+        listener = -1;
+        throw runtime_error("Server: cannot listen on " + settings.socketPath);
+    }
+
+    running = true;
+    acceptor = thread(&Server::acceptLoop, this);
+    batcher = thread(&Server::batchLoop, this);
+}
+
+//connections stop reading before the queue closes, so every admitted request is answered
+void Server::stop()
+{
+    if (!running.exchange(false))
+        return;
+
+    shutdown(listener, SHUT_RDWR);
+    acceptor.join();
+    close(listener);
+    listener = -1;
+    unlink(settings.socketPath.c_str());
+
+    {
+        lock_guard<mutex> guard(connectionsLock);
+        for (map<int, weak_ptr<ServerConnection> >::iterator it = connections.begin(); it != connections.end(); ++it) {
+            shared_ptr<ServerConnection> connection = it->second.lock();
+            if (connection)
+                shutdown(connection->fd, SHUT_RD);
+        }
+    }
+    while (liveConnections > 0)
+        this_thread::sleep_for(chrono::milliseconds(1));
+
+    queue.close();
+    batcher.join();
+}
+
+Server::Counters Server::counters() const
+{
+    Counters counters = {requests, rejected, failed, batches, batchedRequests, dropped};
+    return counters;
+}
+
+void Server::acceptLoop()
+{
+    int number = 0;
+    while (running) {
+        int client = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+        if (client < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            break; //the listener was shut down
+        }
+
+        shared_ptr<ServerConnection> connection = make_shared<ServerConnection>(client, number++, settings.outboxDepth);
+        {
+            lock_guard<mutex> guard(connectionsLock);
+            connections[connection->number] = connection;
+        }
+        liveConnections++;
+        thread(&Server::serve, this, connection).detach();
+    }
+}
+
+//decoding and preprocessing happen here, one thread per connection, so the
+//batcher only ever runs the network
+void Server::serve(shared_ptr<ServerConnection> connection)
+{
+    LayerShape input = model.getInputShape();
+    ServerHeader header;
+    thread writer(writeLoop, connection.get());
+
+    while (readFully(connection->fd, &header, sizeof(header))) {
+        requests++;
+        if (memcmp(header.magic, REQUEST_MAGIC, sizeof(REQUEST_MAGIC)) != 0 || header.bytes > MAX_PAYLOAD) {
+            //the stream cannot be resynchronised after a bad header
+            const char message[] = "not a request header, or the payload is too large";
+            failed++;
+            reply(*connection, header.id, STATUS_BAD_REQUEST, message, sizeof(message) - 1);
+            break;
+        }
+
+        vector<unsigned char> payload(header.bytes);
+        if (!readFully(connection->fd, payload.data(), payload.size()))
+            break;
+
+        ServerRequest* request = new ServerRequest(connection, header.id);
+        string problem;
+        ServerStatus status = STATUS_OK;
+        try {
+            if (posix_memalign((void**) &request->planes, 64, model.inputSize()*sizeof(double)) != 0) {
+                request->planes = NULL;
+                throw bad_alloc();
+            }
+
+            if (header.code == REQUEST_PLANES) {
+                if (header.bytes != model.inputSize()*sizeof(double))
+                    throw logic_error("Invalid: the planes must be " + to_string(model.inputSize()) + " doubles.");
+                memcpy(request->planes, payload.data(), payload.size());
+            } else if (header.code == REQUEST_IMAGE) {
+                if (input.depth != 3 || input.height != input.width)
+                    throw logic_error("Invalid: images need a square 3-channel model.");
+                int height, width;
+                unsigned char* pixels = Image::decode(payload.data(), payload.size(), "the request", height, width);
+                try {
+                    Image::prepare(request->planes, Image::view(pixels, height, width),
+                                   max(settings.resizeTo, input.height), input.height, settings.preprocess);
+                } catch (...) {
+                    Image::release(pixels);
+                    throw;
+                }
+                Image::release(pixels);
+            } else {
+                throw logic_error("Invalid: unknown request kind " + to_string(header.code) + ".");
+            }
+        } catch (bad_alloc const &) {
+            status = STATUS_FAILED;
+            problem = "out of memory";
+        } catch (exception const &error) {
+            status = STATUS_BAD_REQUEST;
+            problem = error.what();
+        }
+
+        if (status == STATUS_OK && !running) {
+            status = STATUS_OVERLOADED;
+            problem = "the server is stopping";
+        } else if (status == STATUS_OK) {
+            connection->inFlight++;
+            if (!queue.tryPush(request)) {
+                connection->inFlight--;
+                status = STATUS_OVERLOADED;
+                problem = "the queue is full";
+            }
+        }
+
+        if (status == STATUS_OK) {
+            Stats::enqueued();
+            continue;
+        }
+
+        if (status == STATUS_OVERLOADED)
+            rejected++;
+        else
+            failed++;
+        reply(*connection, header.id, status, problem.data(), problem.size());
+        delete request;
+    }
+
+    //requests still queued are answered before the writer stops; the batcher
+    //runs until every connection is done, so this ends
+    while (connection->inFlight > 0)
+        this_thread::sleep_for(chrono::milliseconds(1));
+    connection->outbox.close();
+    wakeWriter(*connection);
+    writer.join();
+
+    {
+        lock_guard<mutex> guard(connectionsLock);
+        connections.erase(connection->number);
+    }
+    liveConnections--;
+}
+
+//the oldest request opens a window of maxDelayUs; the batch runs when it is
+//full or the window closes, whichever comes first
+void Server::batchLoop()
+{
+    long inputSize = model.inputSize();
+    long outputSize = model.outputSize();
+    unsigned long long window = (unsigned long long)(settings.maxDelayUs*1e-6*Timer::tscHz());
+
+    vector<double> inputs(settings.maxBatch*inputSize);
+    vector<double> outputs(settings.maxBatch*outputSize);
+    vector<ServerRequest*> batch;
+
+    ServerRequest* request;
+    while (queue.pop(request)) {
+        Stats::dequeued();
+        batch.assign(1, request);
+        unsigned long long deadline = request->arrival + window;
+
+        while ((int)batch.size() < settings.maxBatch) {
+            if (queue.tryPop(request)) {
+                Stats::dequeued();
+                batch.push_back(request);
+                continue;
+            }
+
+            unsigned long long now = Timer::rdtsc();
+            if (now >= deadline || queue.isClosed())
+                break;
+            //sleep through most of a long window, yield through the end of it
+            if (Timer::seconds(deadline - now) > 100e-6)
+                this_thread::sleep_for(chrono::microseconds(20));
+            else
+                this_thread::yield();
+        }
+
+        int count = batch.size();
+        for (int i = 0; i < count; i++)
+            memcpy(inputs.data() + i*inputSize, batch[i]->planes, inputSize*sizeof(double));
+
+        string problem;
+        try {
+            TRACE_SCOPE("server", "batch");
+            model.forward(inputs.data(), count, outputs.data());
+        } catch (exception const &error) {
+            problem = error.what();
+        }
+
+        for (int i = 0; i < count; i++) {
+            if (problem.empty())
+                reply(*batch[i]->connection, batch[i]->id, STATUS_OK, outputs.data() + i*outputSize, outputSize*sizeof(double));
+            else
+                reply(*batch[i]->connection, batch[i]->id, STATUS_FAILED, problem.data(), problem.size());
+            Stats::page().requests.latency.record(Timer::rdtsc() - batch[i]->arrival);
+            batch[i]->connection->inFlight--;
+            delete batch[i];
+        }
+
+        if (!problem.empty())
+            failed += count;
+        batches++;
+        batchedRequests += count;
+    }
+}
+
+void Server::reply(ServerConnection &connection, unsigned long long id, ServerStatus status,
+                   const void* payload, unsigned long long bytes)
+{
+    ServerHeader header;
+    memcpy(header.magic, RESPONSE_MAGIC, sizeof(RESPONSE_MAGIC));
+    header.code = status;
+    header.id = id;
+    header.bytes = bytes;
+
+    //a client that went away only loses its own responses
+    if (connection.broken)
+        return;
+
+    string* response = new string((const char*) &header, sizeof(header));
+    response->append((const char*) payload, bytes);
+    if (connection.outbox.tryPush(response)) {
+        wakeWriter(connection);
+        return;
+    }
+
+    //the client stopped reading: shutting the socket down fails the writer's
+    //send and the connection thread's recv, and the connection winds down
+    delete response;
+    if (!connection.broken.exchange(true)) {
+        dropped++;
+        shutdown(connection.fd, SHUT_RDWR);
+    }
+}
+
+//-------------------------------------------------------------- ServerClient
+
+ServerClient::ServerClient(string const &socketPath) : fd(-1), nextId(0)
+{
+    sockaddr_un address = addressOf(socketPath);
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (sockaddr*) &address, sizeof(address)) != 0) {
+        if (fd >= 0)
+            close(fd);
+        throw runtime_error("ServerClient: cannot connect to " + socketPath);
+    }
+}
+
+ServerClient::~ServerClient()
+{
+    close(fd);
+}
+
+unsigned long long ServerClient::send(ServerRequestKind kind, const void* payload, unsigned long long bytes)
+{
+    ServerHeader header;
+    memcpy(header.magic, REQUEST_MAGIC, sizeof(REQUEST_MAGIC));
+    header.code = kind;
+    header.id = nextId++;
+    header.bytes = bytes;
+
+    if (!writeFully(fd, &header, sizeof(header)) || !writeFully(fd, payload, bytes))
+        throw runtime_error("ServerClient: the server closed the connection.");
+    return header.id;
+}
+
+ServerStatus ServerClient::receive(unsigned long long &id, vector<double> &outputs, string &error)
+{
+    ServerHeader header;
+    if (!readFully(fd, &header, sizeof(header)) || memcmp(header.magic, RESPONSE_MAGIC, sizeof(RESPONSE_MAGIC)) != 0
+        || header.bytes > Server::MAX_PAYLOAD)
+        throw runtime_error("ServerClient: the server closed the connection.");
+
+    vector<char> payload(header.bytes);
+    if (!readFully(fd, payload.data(), payload.size()))
+        throw runtime_error("ServerClient: the server closed the connection.");
+
+    id = header.id;
+    if (header.code == STATUS_OK) {
+        outputs.resize(header.bytes/sizeof(double));
+        memcpy(outputs.data(), payload.data(), outputs.size()*sizeof(double));
+        error.clear();
+    } else {
+        outputs.clear();
+        error.assign(payload.begin(), payload.end());
+    }
+    return (ServerStatus) header.code;
+}
+
+ServerStatus ServerClient::infer(ServerRequestKind kind, const void* payload, unsigned long long bytes,
+                                 vector<double> &outputs, string &error)
+{
+    unsigned long long id;
+    send(kind, payload, bytes);
+    return receive(id, outputs, error);
+}
@@ -0,0 +1,164 @@
+#ifndef DEF_SERVER
+#define DEF_SERVER
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "BoundedQueue.h"
+#include "Image.h"
+#include "Model.h"
+
+//Local inference server on a Unix stream socket with dynamic batching.
+//Connection threads read requests, decode and preprocess images, then
+//admit them to a bounded queue. When the queue is full they answer
+//STATUS_OVERLOADED right away instead of letting latency grow. One batcher
+//thread takes the oldest request and gathers more until maxBatch are ready
+//or maxDelayUs has passed since the oldest arrived. It runs
+//Model::forward on the whole batch, one image per core, and hands each
+//result to the outbox of the connection it came from; a writer thread per
+//connection drains it, so a client that reads slowly only delays itself.
+//One that lets outboxDepth responses pile up is disconnected. Clients may
+//pipeline requests; responses carry the request id and can arrive out of
+//order across batches.
+//
+//Every message is a 24 byte header, then `bytes` of payload (little endian):
+//
+//  offset  field
+//       0  magic "FCRQ" (requests) or "FCRS" (responses)
+//       4  uint32 kind (ServerRequestKind) or status (ServerStatus)
+//       8  uint64 id, chosen by the client and echoed back
+//      16  uint64 payload bytes
+//
+//A REQUEST_PLANES payload is the model input as CHW doubles; REQUEST_IMAGE
+//is an encoded JPEG/PNG, resized and centre-cropped like Pipeline does. An
+//OK response carries the output as doubles; the other statuses carry a
+//message.
+//
+//  Server server(model, Server::defaults());
+//  server.start();  //returns once the socket is listening
+//  ...
+//  server.stop();
+enum ServerRequestKind
+{
+	REQUEST_PLANES,
+	REQUEST_IMAGE
+};
+
+enum ServerStatus
+{
+	STATUS_OK,
+	STATUS_OVERLOADED, //admission control refused the request, retry later
+	STATUS_BAD_REQUEST,
+	STATUS_FAILED
+};
+
+struct ServerHeader
+{
+	char magic[4];
+	unsigned int code;
+	unsigned long long id;
+	unsigned long long bytes;
+};
+
+struct ServerConnection;
+struct ServerRequest;
+
+class Server
+{
+public:
+	struct Settings
+	{
+		std::string socketPath;
+		int maxBatch;        //most requests in one forward pass
+		int maxDelayUs;      //longest the oldest request waits for the batch to fill
+		int queueDepth;      //admitted requests waiting for the batcher
+		int outboxDepth;     //responses a client may leave unread before it is dropped
+		int resizeTo;        //shorter side of REQUEST_IMAGE before the centre crop
+		Image::Preprocess preprocess;
+	};
+
+	struct Counters
+	{
+		unsigned long long requests;
+		unsigned long long rejected; //STATUS_OVERLOADED
+		unsigned long long failed;   //bad requests and forward errors
+		unsigned long long batches;
+		unsigned long long batchedRequests;
+		unsigned long long dropped;  //connections closed for not reading their responses
+	};
+
+	static Settings defaults();
+	static const unsigned long long MAX_PAYLOAD = 64ULL << 20;
+
+	Server(Model const &model, Settings const &settings);
+	~Server();
+
+	Server(Server const &) = delete;
+	Server& operator=(Server const &) = delete;
+
+	//binds the socket (replacing a stale one) and starts the threads;
+	//throws runtime_error when the socket cannot be bound
+	void start();
+	//refuses new work, finishes the batch in flight and joins every thread
+	void stop();
+
+	Counters counters() const;
+
+private:
+	Model const &model;
+	Settings settings;
+	int listener;
+	std::atomic<bool> running;
+	BoundedQueue<ServerRequest*> queue;
+	std::thread acceptor;
+	std::thread batcher;
+
+	std::mutex connectionsLock;
+	std::map<int, std::weak_ptr<ServerConnection> > connections;
+	std::atomic<int> liveConnections;
+
+	std::atomic<unsigned long long> requests;
+	std::atomic<unsigned long long> rejected;
+	std::atomic<unsigned long long> failed;
+	std::atomic<unsigned long long> batches;
+	std::atomic<unsigned long long> batchedRequests;
+	std::atomic<unsigned long long> dropped;
+
+	void acceptLoop();
+	void serve(std::shared_ptr<ServerConnection> connection);
+	void batchLoop();
+	void reply(ServerConnection &connection, unsigned long long id, ServerStatus status,
+	           const void* payload, unsigned long long bytes);
+};
+
+//Blocking client for the Server protocol; send() and receive() may be
+//interleaved to keep several requests in flight on one connection.
+class ServerClient
+{
+public:
+	//throws runtime_error when nothing listens on socketPath
+	explicit ServerClient(std::string const &socketPath);
+	~ServerClient();
+
+	ServerClient(ServerClient const &) = delete;
+	ServerClient& operator=(ServerClient const &) = delete;
+
+	//returns the id the response will carry
+	unsigned long long send(ServerRequestKind kind, const void* payload, unsigned long long bytes);
+	//next response; outputs on STATUS_OK, the message in error otherwise;
+	//throws runtime_error when the server closed the connection
+	ServerStatus receive(unsigned long long &id, std::vector<double> &outputs, std::string &error);
+	//send() then receive(), for one request at a time
+	ServerStatus infer(ServerRequestKind kind, const void* payload, unsigned long long bytes,
+	                   std::vector<double> &outputs, std::string &error);
+
+private:
+	int fd;
+	unsigned long long nextId;
+};
+
+#endif
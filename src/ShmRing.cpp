@@ -0,0 +1,383 @@
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+#include "ShmRing.h"
+#include "Stats.h"
+#include "Timer.h"
+#include "Trace.h"
+
+using namespace std;
+
+static const char RING_MAGIC[8] = "FCSHRNG";
+static const unsigned int RING_VERSION = 1;
+
+static_assert(sizeof(ShmRingSlot) <= 64, "ShmRing: the slot header must fit the 64 bytes before the input.");
+
+static size_t roundUp(size_t bytes)
+{
+    return (bytes + 63) & ~(size_t)63;
+}
+
+//shared (not FUTEX_PRIVATE) waits, the word lives in another process's mapping too
+static void futexWait(atomic<unsigned int> &word, unsigned int expected, long timeoutMs)
+{
+    timespec timeout = {timeoutMs/1000, (timeoutMs%1000)*1000000};
+    syscall(SYS_futex, (unsigned int*) &word, FUTEX_WAIT, expected, &timeout, NULL, 0);
+}
+
+static void futexWake(atomic<unsigned int> &word)
+{
+    syscall(SYS_futex, (unsigned int*) &word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+//-------------------------------------------------------------------- ShmRing
+
+ShmRing::ShmRing() : owner(false), mapping(NULL), mappedBytes(0) {}
+
+ShmRing::ShmRing(ShmRing &&other) : name(other.name), owner(other.owner), mapping(other.mapping),
+                                    mappedBytes(other.mappedBytes)
+{
+    other.owner = false;
+    other.mapping = NULL;
+}
+
+ShmRing& ShmRing::operator=(ShmRing &&other)
+{
+    if (this != &other) {
+        release();
+        name = other.name;
+        owner = other.owner;
+        mapping = other.mapping;
+        mappedBytes = other.mappedBytes;
+        other.owner = false;
+        other.mapping = NULL;
+    }
+    return *this;
+}
+
+ShmRing::~ShmRing()
+{
+    release();
+}
+
+void ShmRing::release()
+{
+    if (mapping)
+        munmap(mapping, mappedBytes);
+    if (owner)
+        shm_unlink(name.c_str());
+    mapping = NULL;
+    owner = false;
+}
+
+ShmRing ShmRing::create(string const &name, int slots, long inputDoubles, long outputDoubles)
+{
+    if (name.empty() || slots < 1 || inputDoubles < 1 || outputDoubles < 1)
+        throw logic_error("Invalid: a ring needs a name, at least one slot and non-empty buffers.");
+
+    size_t slotBytes = 64 + roundUp(inputDoubles*sizeof(double)) + roundUp(outputDoubles*sizeof(double));
+    size_t slotsOffset = roundUp(sizeof(ShmRingHeader));
+    size_t bytes = slotsOffset + slots*slotBytes;
+
+    ShmRing ring;
+    ring.name = name[0] == '/' ? name : "/" + name;
+    shm_unlink(ring.name.c_str());
+    int fd = shm_open(ring.name.c_str(), O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, 0600);
+    if (fd < 0)
+        throw runtime_error("ShmRing: cannot create " + ring.name);
+    ring.owner = true;
+
+    if (ftruncate(fd, bytes) != 0) {
+        close(fd);
+        throw runtime_error("ShmRing: cannot size " + ring.name);
+    }
+    ring.mapping = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ring.mapping == MAP_FAILED) {
+        ring.mapping = NULL;
+        throw runtime_error("ShmRing: cannot map " + ring.name);
+    }
+    ring.mappedBytes = bytes;
+
+    //the object starts zeroed, which is SLOT_FREE everywhere; magic goes last
+    ShmRingHeader &header = ring.header();
+    header.version = RING_VERSION;
+    header.slots = slots;
+    header.inputDoubles = inputDoubles;
+    header.outputDoubles = outputDoubles;
+    header.slotBytes = slotBytes;
+    header.slotsOffset = slotsOffset;
+    header.serverPid = getpid();
+    atomic_thread_fence(memory_order_release);
+    memcpy(header.magic, RING_MAGIC, sizeof(RING_MAGIC));
+    return ring;
+}
+
+ShmRing ShmRing::open(string const &name)
+{
+    if (name.empty())
+        throw logic_error("Invalid: a ring needs a name.");
+
+    ShmRing ring;
+    ring.name = name[0] == '/' ? name : "/" + name;
+    int fd = shm_open(ring.name.c_str(), O_RDWR | O_CLOEXEC, 0);
+    if (fd < 0)
+        throw runtime_error("ShmRing: no ring named " + ring.name);
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(ShmRingHeader)) {
+        close(fd);
+        throw runtime_error("ShmRing: " + ring.name + " is too short for a ring header.");
+    }
+    ring.mapping = mmap(NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ring.mapping == MAP_FAILED) {
+        ring.mapping = NULL;
+        throw runtime_error("ShmRing: cannot map " + ring.name);
+    }
+    ring.mappedBytes = info.st_size;
+
+    ShmRingHeader &header = ring.header();
+    if (memcmp(header.magic, RING_MAGIC, sizeof(RING_MAGIC)) != 0 || header.version != RING_VERSION
+        || header.slotsOffset + header.slots*header.slotBytes > ring.mappedBytes)
+        throw runtime_error("ShmRing: " + ring.name + " is not a ring of this version.");
+    return ring;
+}
+
+ShmRingHeader& ShmRing::header() const
+{
+    return *(ShmRingHeader*) mapping;
+}
+
+int ShmRing::getSlots() const
+{
+    return header().slots;
+}
+
+ShmRingSlot& ShmRing::slot(int index) const
+{
+    return *(ShmRingSlot*) ((char*) mapping + header().slotsOffset + index*header().slotBytes);
+}
+
+double* ShmRing::input(int index) const
+{
+    return (double*) ((char*) &slot(index) + 64);
+}
+
+double* ShmRing::output(int index) const
+{
+    return (double*) ((char*) input(index) + roundUp(header().inputDoubles*sizeof(double)));
+}
+
+//-------------------------------------------------------------- ShmRingServer
+
+ShmRingServer::ShmRingServer(Model const &model, string const &name, int slots, int maxBatch)
+    : model(model), ring(ShmRing::create(name, slots, model.inputSize(), model.outputSize())),
+      maxBatch(maxBatch), running(false), requests(0), batches(0)
+{
+    if (maxBatch < 1)
+        throw logic_error("Invalid: the ring server needs a batch of at least 1.");
+}
+
+ShmRingServer::~ShmRingServer()
+{
+    stop();
+}
+
+void ShmRingServer::start()
+{
+    if (running.exchange(true))
+        return;
+    worker = thread(&ShmRingServer::run, this);
+}
+
+void ShmRingServer::stop()
+{
+    if (!running.exchange(false))
+        return;
+
+    ShmRingHeader &header = ring.header();
+    header.stopping.store(1, memory_order_release);
+    header.doorbell.fetch_add(1, memory_order_release);
+    futexWake(header.doorbell);
+    worker.join();
+
+    //nobody will run what is still waiting
+    for (int s = 0; s < ring.getSlots(); s++) {
+        ShmRingSlot &slot = ring.slot(s);
+        unsigned int ready = SLOT_READY;
+        if (slot.state.compare_exchange_strong(ready, SLOT_RUNNING, memory_order_acquire)) {
+            slot.status = STATUS_OVERLOADED;
+            slot.state.store(SLOT_DONE, memory_order_release);
+            futexWake(slot.state);
+        }
+    }
+}
+
+unsigned long long ShmRingServer::getRequests() const
+{
+    return requests;
+}
+
+unsigned long long ShmRingServer::getBatches() const
+{
+    return batches;
+}
+
+void ShmRingServer::run()
+{
+    ShmRingHeader &header = ring.header();
+    int slots = ring.getSlots();
+    int next = 0;
+    vector<int> batch;
+    vector<const double*> inputs;
+    vector<double*> outputs;
+
+    while (running) {
+        //read the doorbell before scanning, so a submit during the scan changes it
+        unsigned int rung = header.doorbell.load(memory_order_acquire);
+
+        //start where the last scan stopped, so busy low slots cannot starve the rest
+        batch.clear();
+        for (int k = 0; k < slots && (int)batch.size() < maxBatch; k++) {
+            int s = (next + k)%slots;
+            unsigned int ready = SLOT_READY;
+            if (ring.slot(s).state.compare_exchange_strong(ready, SLOT_RUNNING, memory_order_acquire))
+                batch.push_back(s);
+        }
+
+        if (batch.empty()) {
+            futexWait(header.doorbell, rung, 100);
+            continue;
+        }
+        next = (batch.back() + 1)%slots;
+
+        inputs.clear();
+        outputs.clear();
+        for (size_t b = 0; b < batch.size(); b++) {
+            inputs.push_back(ring.input(batch[b]));
+            outputs.push_back(ring.output(batch[b]));
+        }
+
+        ServerStatus status = STATUS_OK;
+        try {
+            TRACE_SCOPE("server", "ring batch");
+            model.forward(inputs.data(), outputs.data(), batch.size());
+        } catch (exception const &) {
+            status = STATUS_FAILED;
+        }
+
+        for (size_t b = 0; b < batch.size(); b++) {
+            ShmRingSlot &slot = ring.slot(batch[b]);
+            slot.status = status;
+            Stats::page().requests.latency.record(Timer::rdtsc() - slot.submitted);
+            slot.state.store(SLOT_DONE, memory_order_release);
+            futexWake(slot.state);
+        }
+        requests += batch.size();
+        batches++;
+    }
+}
+
+//-------------------------------------------------------------- ShmRingClient
+
+ShmRingClient::ShmRingClient(string const &name) : ring(ShmRing::open(name)) {}
+
+long ShmRingClient::inputSize() const
+{
+    return ring.header().inputDoubles;
+}
+
+long ShmRingClient::outputSize() const
+{
+    return ring.header().outputDoubles;
+}
+
+int ShmRingClient::tryAcquire()
+{
+    ShmRingHeader &header = ring.header();
+    int slots = ring.getSlots();
+    unsigned int start = header.claimHint.fetch_add(1, memory_order_relaxed);
+
+    for (int k = 0; k < slots; k++) {
+        int s = (start + k)%slots;
+        unsigned int free = SLOT_FREE;
+        if (ring.slot(s).state.compare_exchange_strong(free, SLOT_CLAIMED, memory_order_acquire))
+            return s;
+    }
+    return -1;
+}
+
+int ShmRingClient::acquire()
+{
+    for (int attempt = 0; ; attempt++) {
+        if (ring.header().stopping.load(memory_order_acquire))
+            throw runtime_error("ShmRingClient: the server has stopped.");
+        int slot = tryAcquire();
+        if (slot >= 0)
+            return slot;
+        if (attempt < 64)
+            this_thread::yield();
+        else
+            this_thread::sleep_for(chrono::microseconds(50));
+    }
+}
+
+double* ShmRingClient::input(int slot)
+{
+    return ring.input(slot);
+}
+
+void ShmRingClient::submit(int slot)
+{
+    ShmRingHeader &header = ring.header();
+    ShmRingSlot &entry = ring.slot(slot);
+    entry.submitted = Timer::rdtsc();
+    entry.state.store(SLOT_READY, memory_order_release);
+    header.doorbell.fetch_add(1, memory_order_release);
+    futexWake(header.doorbell);
+}
+
+ServerStatus ShmRingClient::wait(int slot)
+{
+    ShmRingSlot &entry = ring.slot(slot);
+    for (;;) {
+        unsigned int state = entry.state.load(memory_order_acquire);
+        if (state == SLOT_DONE)
+            return (ServerStatus) entry.status;
+
+        //submitted after stop() answered the waiting slots: nobody will run it,
+        //so take it back unless the server got to it first
+        if (state == SLOT_READY && ring.header().stopping.load(memory_order_acquire)) {
+            unsigned int ready = SLOT_READY;
+            if (entry.state.compare_exchange_strong(ready, SLOT_CLAIMED, memory_order_acquire))
+                return STATUS_OVERLOADED;
+            continue;
+        }
+
+        //timed waits so a server that died without answering is noticed
+        futexWait(entry.state, state, 100);
+        if (entry.state.load(memory_order_acquire) != SLOT_DONE && kill(ring.header().serverPid, 0) != 0 && errno == ESRCH)
+            throw runtime_error("ShmRingClient: the server exited without answering.");
+    }
+}
+
+const double* ShmRingClient::output(int slot)
+{
+    return ring.output(slot);
+}
+
+void ShmRingClient::release(int slot)
+{
+    ring.slot(slot).state.store(SLOT_FREE, memory_order_release);
+}
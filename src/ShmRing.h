@@ -0,0 +1,151 @@
+#ifndef DEF_SHM_RING
+#define DEF_SHM_RING
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include "Model.h"
+#include "Server.h"
+
+//Zero-copy requests for clients on the same host. The server creates a POSIX
+//shared-memory object (/dev/shm/<name>) holding a fixed number of slots, each
+//sized for one model input and one output. A client claims a free slot,
+//writes its input straight into the slot, marks it ready and rings the
+//doorbell. The server runs the model with the slot buffers as its input and
+//output pointers, marks the slot done and wakes the waiter. Doorbell and
+//slot states are futex words in the shared page, so nothing crosses the
+//kernel except the wake-ups and no request is serialised.
+//
+//  //server process                       //client process
+//  ShmRingServer ring(model, "fastcode");  ShmRingClient client("fastcode");
+//  ring.start();                           int slot = client.acquire();
+//                                          fill(client.input(slot));
+//                                          client.submit(slot);
+//                                          if (client.wait(slot) == STATUS_OK) use(client.output(slot));
+//                                          client.release(slot);
+//
+//A slot goes FREE -> CLAIMED (client writing) -> READY -> RUNNING -> DONE -> FREE.
+enum ShmSlotState
+{
+	SLOT_FREE,
+	SLOT_CLAIMED,
+	SLOT_READY,
+	SLOT_RUNNING,
+	SLOT_DONE
+};
+
+static_assert(ATOMIC_INT_LOCK_FREE == 2, "ShmRing: futex words need lock-free 32-bit atomics.");
+
+struct ShmRingHeader
+{
+	char magic[8];
+	unsigned int version;
+	unsigned int slots;
+	unsigned long long inputDoubles;
+	unsigned long long outputDoubles;
+	unsigned long long slotBytes;
+	unsigned long long slotsOffset;
+	int serverPid;
+	std::atomic<unsigned int> doorbell; //bumped on every submit, the server sleeps on it
+	std::atomic<unsigned int> stopping;
+	std::atomic<unsigned int> claimHint;
+};
+
+//input doubles start 64 bytes into the slot, the output follows on a cache line
+struct ShmRingSlot
+{
+	std::atomic<unsigned int> state;
+	unsigned int status; //ServerStatus, valid in SLOT_DONE
+	unsigned long long submitted; //TSC at submit, for the Stats request latency
+};
+
+//The mapped object; created by the server (and unlinked when it goes away)
+//or opened by a client. Move-only, like TensorView.
+class ShmRing
+{
+public:
+	ShmRing();
+	ShmRing(ShmRing &&other);
+	ShmRing& operator=(ShmRing &&other);
+	~ShmRing();
+
+	ShmRing(ShmRing const &) = delete;
+	ShmRing& operator=(ShmRing const &) = delete;
+
+	//replaces a stale object of the same name; throws runtime_error when it cannot
+	static ShmRing create(std::string const &name, int slots, long inputDoubles, long outputDoubles);
+	//throws runtime_error when there is no ring of that name or it is not one
+	static ShmRing open(std::string const &name);
+
+	ShmRingHeader& header() const;
+	int getSlots() const;
+	ShmRingSlot& slot(int index) const;
+	double* input(int index) const;
+	double* output(int index) const;
+
+private:
+	std::string name;
+	bool owner;
+	void* mapping;
+	size_t mappedBytes;
+
+	void release();
+};
+
+//Serves one ring from a single thread: every pass takes the ready slots
+//(up to maxBatch, whatever arrived while the last batch ran) and runs them
+//as one Model::forward batch, so there is no batching window to wait out.
+class ShmRingServer
+{
+public:
+	ShmRingServer(Model const &model, std::string const &name, int slots, int maxBatch);
+	~ShmRingServer();
+
+	ShmRingServer(ShmRingServer const &) = delete;
+	ShmRingServer& operator=(ShmRingServer const &) = delete;
+
+	void start();
+	//finishes the batch in flight; slots still waiting are answered STATUS_OVERLOADED
+	void stop();
+
+	unsigned long long getRequests() const;
+	unsigned long long getBatches() const;
+
+private:
+	Model const &model;
+	ShmRing ring;
+	int maxBatch;
+	std::atomic<bool> running;
+	std::thread worker;
+	std::atomic<unsigned long long> requests;
+	std::atomic<unsigned long long> batches;
+
+	void run();
+};
+
+class ShmRingClient
+{
+public:
+	explicit ShmRingClient(std::string const &name);
+
+	long inputSize() const;
+	long outputSize() const;
+
+	//claims a free slot, -1 when all are taken
+	int tryAcquire();
+	//waits for a free slot; throws runtime_error once the server has stopped
+	int acquire();
+	double* input(int slot);
+	void submit(int slot);
+	//sleeps until the slot is done; STATUS_OVERLOADED when the server stopped
+	//without taking it, runtime_error if the server dies meanwhile
+	ServerStatus wait(int slot);
+	//valid until release()
+	const double* output(int slot);
+	void release(int slot);
+
+private:
+	ShmRing ring;
+};
+
+#endif
@@ -0,0 +1,339 @@
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <new>
+#include <sstream>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include "Stats.h"
+
+using namespace std;
+
+namespace Stats
+{
+    //------------------------------------------------------------- histogram
+
+    int bucketOf(unsigned long long cycles)
+    {
+        if (cycles < (unsigned long long)SUB_BUCKETS)
+            return (int)cycles;
+
+        int exponent = 63 - __builtin_clzll(cycles);
+        if (exponent >= MAX_EXPONENT)
+            return BUCKETS - 1;
+
+        int shift = exponent - SUB_BUCKET_BITS;
+        return (shift + 1)*SUB_BUCKETS + (int)(cycles >> shift) - SUB_BUCKETS;
+    }
+
+    unsigned long long bucketUpperBound(int bucket)
+    {
+        if (bucket < SUB_BUCKETS)
+            return bucket;
+
+        int shift = bucket/SUB_BUCKETS - 1;
+        unsigned long long lower = (unsigned long long)(SUB_BUCKETS + bucket%SUB_BUCKETS) << shift;
+        return lower + (1ULL << shift) - 1;
+    }
+
+    void Histogram::record(unsigned long long cycles)
+    {
+        counts[bucketOf(cycles)].fetch_add(1, memory_order_relaxed);
+        total.fetch_add(1, memory_order_relaxed);
+        sum.fetch_add(cycles, memory_order_relaxed);
+
+        unsigned long long seen = max.load(memory_order_relaxed);
+        while (cycles > seen && !max.compare_exchange_weak(seen, cycles, memory_order_relaxed)) {}
+    }
+
+    //writers keep going while this runs, so the result is a consistent-enough snapshot
+    unsigned long long Histogram::percentile(double p) const
+    {
+        unsigned long long count = total.load(memory_order_relaxed);
+        if (count == 0)
+            return 0;
+
+        unsigned long long rank = (unsigned long long)(p/100*count + 0.5);
+        if (rank < 1)
+            rank = 1;
+
+        unsigned long long seen = 0;
+        for (int b = 0; b < BUCKETS; b++) {
+            seen += counts[b].load(memory_order_relaxed);
+            if (seen >= rank) {
+                unsigned long long upper = bucketUpperBound(b);
+                unsigned long long largest = max.load(memory_order_relaxed);
+                return upper < largest ? upper : largest;
+            }
+        }
+        return max.load(memory_order_relaxed);
+    }
+
+    //------------------------------------------------------------------ page
+
+    static string shmName;
+    static bool ownsShm = false;
+
+    static void unlinkPage()
+    {
+        if (ownsShm)
+            shm_unlink(shmName.c_str());
+    }
+
+    static void setName(Slot &slot, const char* name)
+    {
+        strncpy(slot.name, name, NAME_SIZE - 1);
+        slot.name[NAME_SIZE - 1] = '\0';
+    }
+
+    //shared memory when the system allows it, private memory otherwise, so
+    //recording never has to check
+    static Page* createPage()
+    {
+        const char* requested = getenv("FASTCODE_STATS_SHM");
+        if (requested && *requested) {
+            shmName = requested;
+        } else {
+            ostringstream name;
+            name << "/fastcode-stats-" << getpid();
+            shmName = name.str();
+        }
+
+        void* memory = MAP_FAILED;
+        int fd = shm_open(shmName.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644);
+        if (fd >= 0) {
+            if (ftruncate(fd, sizeof(Page)) == 0)
+                memory = mmap(NULL, sizeof(Page), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            close(fd);
+            if (memory == MAP_FAILED)
+                shm_unlink(shmName.c_str());
+        }
+
+        if (memory != MAP_FAILED) {
+            ownsShm = true;
+            atexit(unlinkPage);
+        } else {
+            shmName.clear();
+            memory = mmap(NULL, sizeof(Page), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (memory == MAP_FAILED)
+                throw bad_alloc();
+        }
+
+        Page* stats = new (memory) Page();
+        stats->version = PAGE_VERSION;
+        stats->bytes = sizeof(Page);
+        stats->pid = getpid();
+        stats->buckets = BUCKETS;
+        stats->tscHz = Timer::tscHz();
+        stats->startTsc = Timer::rdtsc();
+        setName(stats->requests, "request");
+        stats->requests.ready.store(2, memory_order_relaxed);
+        setName(stats->layers[MAX_LAYERS - 1], "other");
+        stats->layers[MAX_LAYERS - 1].ready.store(2, memory_order_relaxed);
+
+        //readers only trust the page once the magic is there
+        atomic_thread_fence(memory_order_release);
+        memcpy(stats->magic, PAGE_MAGIC, sizeof(PAGE_MAGIC));
+
+        const char* socketPath = getenv("FASTCODE_STATS_SOCKET");
+        if (socketPath && *socketPath && !serve(socketPath))
+            cerr << "Stats: cannot serve on " << socketPath << endl;
+
+        return stats;
+    }
+
+    Page& page()
+    {
+        static Page* stats = createPage();
+        return *stats;
+    }
+
+    string pageName()
+    {
+        page();
+        return shmName;
+    }
+
+    //--------------------------------------------------------------- counters
+
+    void allocation(size_t bytes)
+    {
+        Page &stats = page();
+        stats.allocations.fetch_add(1, memory_order_relaxed);
+        stats.allocatedBytes.fetch_add(bytes, memory_order_relaxed);
+    }
+
+    void enqueued()
+    {
+        Page &stats = page();
+        long long depth = stats.queueDepth.fetch_add(1, memory_order_relaxed) + 1;
+        long long seen = stats.maxQueueDepth.load(memory_order_relaxed);
+        while (depth > seen && !stats.maxQueueDepth.compare_exchange_weak(seen, depth, memory_order_relaxed)) {}
+    }
+
+    void dequeued()
+    {
+        page().queueDepth.fetch_sub(1, memory_order_relaxed);
+    }
+
+    void parallelRegion(unsigned long long wallCycles, int threads)
+    {
+        page().parallelCycles.fetch_add(wallCycles*threads, memory_order_relaxed);
+    }
+
+    void threadBusy(int thread, unsigned long long cycles)
+    {
+        if (thread >= MAX_THREADS)
+            thread = MAX_THREADS - 1;
+        page().threadBusy[thread].fetch_add(cycles, memory_order_relaxed);
+    }
+
+    //slots are claimed 0 -> 1 (name being written) -> 2 (published) and never released
+    Slot& layer(const char* name)
+    {
+        Page &stats = page();
+
+        for (int i = 0; i < MAX_LAYERS - 1; i++) {
+            Slot &slot = stats.layers[i];
+            int state = slot.ready.load(memory_order_acquire);
+
+            if (state == 0) {
+                if (slot.ready.compare_exchange_strong(state, 1, memory_order_acquire)) {
+                    setName(slot, name);
+                    slot.ready.store(2, memory_order_release);
+                    stats.layerCount.fetch_add(1, memory_order_relaxed);
+                    return slot;
+                }
+            }
+            while (state != 2)
+                state = slot.ready.load(memory_order_acquire);
+
+            if (strncmp(slot.name, name, NAME_SIZE - 1) == 0)
+                return slot;
+        }
+        return stats.layers[MAX_LAYERS - 1];
+    }
+
+    //------------------------------------------------------------------ text
+
+    static void writeHistogram(ostream &out, string const &metric, string const &labels, Histogram const &histogram, double tscHz)
+    {
+        const double quantiles[] = {50, 90, 99, 99.9};
+        string prefix = labels.empty() ? "{" : "{" + labels + ",";
+        double us = 1e6/tscHz;
+        unsigned long long count = histogram.total.load(memory_order_relaxed);
+
+        for (double q : quantiles)
+            out << metric << prefix << "quantile=\"" << q/100 << "\"} " << histogram.percentile(q)*us << "\n";
+        out << metric << "_max" << (labels.empty() ? "" : "{" + labels + "}") << " "
+            << histogram.max.load(memory_order_relaxed)*us << "\n";
+        out << metric << "_mean" << (labels.empty() ? "" : "{" + labels + "}") << " "
+            << (count ? histogram.sum.load(memory_order_relaxed)*us/count : 0) << "\n";
+        out << metric << "_count" << (labels.empty() ? "" : "{" + labels + "}") << " " << count << "\n";
+    }
+
+    void writeText(ostream &out, Page const &stats)
+    {
+        double uptime = (Timer::rdtsc() - stats.startTsc)/stats.tscHz;
+
+        out << "fastcode_pid " << stats.pid << "\n";
+        out << "fastcode_uptime_seconds " << uptime << "\n";
+
+        writeHistogram(out, "fastcode_request_latency_us", "", stats.requests.latency, stats.tscHz);
+
+        for (int i = 0; i < MAX_LAYERS; i++) {
+            Slot const &slot = stats.layers[i];
+            if (slot.ready.load(memory_order_acquire) != 2 || slot.latency.total.load(memory_order_relaxed) == 0)
+                continue;
+            writeHistogram(out, "fastcode_layer_latency_us", "layer=\"" + string(slot.name) + "\"", slot.latency, stats.tscHz);
+        }
+
+        out << "fastcode_allocations_total " << stats.allocations.load(memory_order_relaxed) << "\n";
+        out << "fastcode_allocated_bytes_total " << stats.allocatedBytes.load(memory_order_relaxed) << "\n";
+        out << "fastcode_queue_depth " << stats.queueDepth.load(memory_order_relaxed) << "\n";
+        out << "fastcode_queue_depth_max " << stats.maxQueueDepth.load(memory_order_relaxed) << "\n";
+
+        unsigned long long busy = 0;
+        for (int t = 0; t < MAX_THREADS; t++) {
+            unsigned long long cycles = stats.threadBusy[t].load(memory_order_relaxed);
+            if (cycles == 0)
+                continue;
+            busy += cycles;
+            out << "fastcode_thread_busy_seconds{thread=\"" << t << "\"} " << cycles/stats.tscHz << "\n";
+        }
+
+        unsigned long long available = stats.parallelCycles.load(memory_order_relaxed);
+        out << "fastcode_thread_utilization " << (available ? (double)busy/available : 0) << "\n";
+    }
+
+    void writeText(ostream &out)
+    {
+        writeText(out, page());
+    }
+
+    //---------------------------------------------------------------- endpoint
+
+    static void acceptLoop(int server)
+    {
+        for (;;) {
+            int client = accept(server, NULL, NULL);
+            if (client < 0) {
+                if (errno == EINTR || errno == ECONNABORTED)
+                    continue;
+                //out of descriptors or memory: wait for some to be freed instead of spinning
+                if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+                    this_thread::sleep_for(chrono::milliseconds(100));
+                    continue;
+                }
+                cerr << "Stats: accept failed (" << strerror(errno) << "), the endpoint stops" << endl;
+                close(server);
+                return;
+            }
+
+            ostringstream text;
+            writeText(text);
+            string body = text.str();
+
+            size_t written = 0;
+            while (written < body.size()) {
+                //a reader that hung up must not take the process down with SIGPIPE
+                ssize_t n = send(client, body.data() + written, body.size() - written, MSG_NOSIGNAL);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n <= 0)
+                    break;
+                written += n;
+            }
+            close(client);
+        }
+    }
+
+    bool serve(string const &socketPath)
+    {
+        sockaddr_un address;
+        if (socketPath.size() >= sizeof(address.sun_path))
+            return false;
+
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        strcpy(address.sun_path, socketPath.c_str());
+
+        int server = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (server < 0)
+            return false;
+
+        unlink(socketPath.c_str());
+        if (bind(server, (sockaddr*) &address, sizeof(address)) != 0 || listen(server, 16) != 0) {
+            close(server);
+            return false;
+        }
+
+        thread(acceptLoop, server).detach();
+        return true;
+    }
+}
@@ -0,0 +1,127 @@
+#ifndef DEF_STATS
+#define DEF_STATS
+
+#include <atomic>
+#include <iostream>
+#include <string>
+#include "Timer.h"
+
+//Always-on serving statistics: HDR-style latency histograms per layer and per
+//request, allocation counts, queue depth and OpenMP thread utilisation. All
+//of it lives in one shared-memory page (/dev/shm/fastcode-stats-<pid>, or
+//FASTCODE_STATS_SHM) updated with relaxed atomics only, so a sidecar can map
+//the page read-only (tools/stats) while the process keeps serving.
+//FASTCODE_STATS_SOCKET=path additionally serves the text form on a Unix socket.
+//
+//  { Stats::RequestScope request; { Stats::LayerScope layer("conv1_1"); ... } }
+//  Stats::writeText(std::cout);
+namespace Stats
+{
+	//log-linear buckets over TSC cycles: 2^SUB_BUCKET_BITS linear sub-buckets per
+	//power of two (about 3% relative error), up to 2^MAX_EXPONENT cycles
+	const int SUB_BUCKET_BITS = 5;
+	const int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+	const int MAX_EXPONENT = 44;
+	const int BUCKETS = (MAX_EXPONENT - SUB_BUCKET_BITS + 1)*SUB_BUCKETS;
+
+	const int MAX_LAYERS = 64;
+	const int MAX_THREADS = 64;
+	const int NAME_SIZE = 32;
+
+	static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "Stats: the shared page needs lock-free 64-bit atomics.");
+
+	struct Histogram
+	{
+		std::atomic<unsigned long long> counts[BUCKETS];
+		std::atomic<unsigned long long> total;
+		std::atomic<unsigned long long> sum;
+		std::atomic<unsigned long long> max;
+
+		void record(unsigned long long cycles);
+		//upper bound of the bucket holding the p-th percentile (0-100), in cycles
+		unsigned long long percentile(double p) const;
+	};
+
+	int bucketOf(unsigned long long cycles);
+	unsigned long long bucketUpperBound(int bucket);
+
+	struct Slot
+	{
+		std::atomic<int> ready; //name is written before ready is published
+		char name[NAME_SIZE];
+		Histogram latency;
+	};
+
+	//layout of the shared page, a reader checks magic, version and bytes
+	struct Page
+	{
+		char magic[8];
+		int version;
+		int bytes;
+		int pid;
+		int buckets;
+		double tscHz;
+		unsigned long long startTsc;
+
+		std::atomic<unsigned long long> allocations;
+		std::atomic<unsigned long long> allocatedBytes;
+		std::atomic<long long> queueDepth;
+		std::atomic<long long> maxQueueDepth;
+
+		//busy cycles inside parallel kernels against wall cycles x team size
+		std::atomic<unsigned long long> parallelCycles;
+		std::atomic<unsigned long long> threadBusy[MAX_THREADS];
+
+		Slot requests;
+		std::atomic<int> layerCount;
+		Slot layers[MAX_LAYERS];
+	};
+
+	const char PAGE_MAGIC[8] = "FCSTATS";
+	const int PAGE_VERSION = 1;
+
+	//the process page, created on first use
+	Page& page();
+	std::string pageName();
+
+	void allocation(size_t bytes);
+	void enqueued();
+	void dequeued();
+	//a parallel region that ran wallCycles on a team of threads
+	void parallelRegion(unsigned long long wallCycles, int threads);
+	void threadBusy(int thread, unsigned long long cycles);
+
+	//slot for a layer name, registered on first use; the last slot absorbs overflow
+	Slot& layer(const char* name);
+
+	class LayerScope
+	{
+	public:
+		LayerScope(const char* name) : slot(layer(name)), begin(Timer::rdtsc()) {}
+		~LayerScope() { slot.latency.record(Timer::rdtsc() - begin); }
+
+	private:
+		Slot &slot;
+		unsigned long long begin;
+	};
+
+	class RequestScope
+	{
+	public:
+		RequestScope() : begin(Timer::rdtsc()) {}
+		~RequestScope() { page().requests.latency.record(Timer::rdtsc() - begin); }
+
+	private:
+		unsigned long long begin;
+	};
+
+	//one "name{labels} value" line per metric, latencies in microseconds
+	void writeText(std::ostream &out, Page const &stats);
+	void writeText(std::ostream &out);
+
+	//serves writeText to every connection on a Unix socket from a background
+	//thread; returns false when the socket cannot be bound
+	bool serve(std::string const &socketPath);
+}
+
+#endif
@@ -1,605 +1,1065 @@
-#include <vector>
-#include <ctime>
-#include <stdexcept>
-#include <cmath>
-#include "Filters.h"
-#include "Tensor.h"
-#include <omp.h>
-
-#include <x86intrin.h>
-#include <immintrin.h>
-
-#define MAX_FREQ 3.4
-#define BASE_FREQ 2.4
-
-static __inline__ unsigned long long rdtsc(void) {
-    unsigned hi, lo;
-    __asm__ __volatile__ ("rdtsc" : "=a"(lo), "=d"(hi));
-    return ( (unsigned long long)lo)|( ((unsigned long long)hi)<<32 );
-}
-
-using namespace std;
-
-Tensor::Tensor(){}
-
-Tensor::Tensor(int height, int width)
-{
-    this->height = height;
-    this->width = width;
-    this->depth = 0;
-    this->layers = vector<Matrix> (depth);
-}
-
-Tensor::Tensor(int height, int width, int depth)
-{
-    this->height = height;
-    this->width = width;
-    this->depth = depth;
-    this->layers = vector<Matrix> (depth);
-}
-
-Tensor::Tensor(vector<Matrix> const &layers)
-{
-    this->height = layers[0].getHeight();
-    this->width = layers[0].getWidth();
-    this->depth = layers.size();
-    this->layers = layers;
-}
-
-int Tensor::getHeight() const
-{   
-    return height;
-}       
-        
-int Tensor::getWidth() const
-{           
-    return width;
-}
-
-int Tensor::getDepth() const
-{
-    return depth;
-}
-
-void Tensor::addLayer(Matrix layer)
-{
-    layers.push_back(layer);
-    depth++;
-}
-
-Matrix Tensor::getLayer(int index) const
-{
-    return layers[index];
-}
-
-void Tensor::randomValueInit(int low, int high)
-{
-
-    for (int i=0; i<depth; i++){
-        vector<vector<double>> layer;
-        for (int y=0; y<height; y++){
-            vector<double> rows;
-            for (int x=0; x<width; x++){
-                double temp = low + (rand() % (high - low + 1));
-                rows.push_back(temp);
-            }
-            layer.push_back(rows);
-        }
-        layers[i] = layer;
-    }
-}
-
-Tensor Tensor::fwdConv(Filters setOfFilters, int stride, int bias)
-{
-    int F = setOfFilters.getWidth();
-    float f_W = (float)width;
-    float f_F = (float)F;
-    float f_S = (float)stride;
-    int output_size = ceil((f_W-f_F)/f_S)+1;
-    
-    if (output_size < 1)
-        throw logic_error("Invalid: Output matrix size 0.");    
-    
-    Tensor outputVolume = Tensor(output_size, output_size);
-    
-    for (int filterNumber=0; filterNumber<setOfFilters.getNumberOfFilters(); filterNumber++) {
-        //temporarily doing addition of blank matrix in first iteration -- will fix later
-        Matrix result = Matrix(output_size, output_size);
-        for (int i=0; i<depth; i++){
-            result.add(layers[i].filterSlide(setOfFilters.getFilter(filterNumber).getLayer(i), stride, bias));
-        }
-
-        if (bias > 0) {
-            vector<vector<double>> bias_filter(output_size, vector<double>(output_size, bias));
-            result.add(bias_filter);
-        }
-
-        cout << "Convolution->[Tensor layer]: " << filterNumber << endl;
-
-        outputVolume.addLayer(result);                
-    }
-
-    return outputVolume;
-}
-
-Tensor Tensor::fwdConv(Filters setOfFilters, int stride, int bias, int padding)
-{
-    int F = setOfFilters.getWidth();
-    float f_W = (float)width;
-    float f_F = (float)F;
-    float f_S = (float)stride;
-    float f_P = (float)padding;
-    int output_size = ceil((f_W-f_F+2*f_P)/f_S)+1;
-
-    if (output_size < 1)
-        throw logic_error("Invalid: Output matrix size 0.");    
-    
-    Tensor outputVolume = Tensor(output_size, output_size);
-    
-    for (int filterNumber=0; filterNumber<setOfFilters.getNumberOfFilters(); filterNumber++) {
-        //temporarily doing addition of blank matrix in first iteration -- will fix later
-        Matrix result = Matrix(output_size, output_size);
-        for (int i=0; i<depth; i++){
-            Matrix filter = setOfFilters.getFilter(filterNumber).getLayer(i);
-            Matrix result_depth_i = layers[i].filterSlide(filter, stride, bias, padding);
-            result.add(result_depth_i);
-        }
-
-        if (bias > 0) {
-            vector<vector<double>> bias_filter(output_size, vector<double>(output_size, bias));
-            result.add(bias_filter);
-        }
-
-        outputVolume.addLayer(result);                
-    }
-
-    return outputVolume;
-}
-
-double Tensor::kernel(double* C, double* A, double* B, int F, int f_W_padded, int output_size, int numberOfFilters)
-{
-    unsigned long long t0, t1, t3, t4;
-    t0 = rdtsc();
-    for (int y = 0; y < output_size; y++) {
-        for (int x = 0; x < output_size; x++) {
-            for (int z = 0; z < numberOfFilters; z++) {
-                double output = 0;
-
-                for (int k = 0; k < depth; k++) {
-                    for (int i = y; i < (y+F); i++) {
-                        for (int j = x; j < (x+F); j++) {
-                            t3 = rdtsc();
-                            double a = A[f_W_padded*f_W_padded*k + f_W_padded*i + j];
-                            t4 = rdtsc();
-                            // printf("load a: %lf\n\r", (double)(t4-t3)*MAX_FREQ/BASE_FREQ);
-
-                            t3 = rdtsc();
-                            double b = B[F*F*depth*z + F*F*k + F*(i-y) + (j-x)];
-                            t4 = rdtsc();
-                            // printf("load b: %lf\n\r", (double)(t4-t3)*MAX_FREQ/BASE_FREQ);
-
-                            t3 = rdtsc();
-                            output += a*b;
-                            t4 = rdtsc();
-                            // printf("output += a*b: %lf\n\r", (double)(t4-t3)*MAX_FREQ/BASE_FREQ);
-                        }
-                    }
-                }
-
-                t3 = rdtsc();
-                C[numberOfFilters*output_size*y + numberOfFilters*x + z] = output;
-                t4 = rdtsc();
-                // printf("save C: %lf\n\r", (double)(t4-t3)*MAX_FREQ/BASE_FREQ);
-            }
-        }
-    }
-    t1 = rdtsc();
-    printf("TURBO Cycles Taken for Baseline: %lf\n\r", (double)(t1-t0)*MAX_FREQ/BASE_FREQ);
-}
-
-double Tensor::kernel_simd(double* C, double* A, double* B, int F, int f_W_padded, int output_size, int numberOfFilters)
-{
-    unsigned long long t0, t1, t3, t4;
-    __m256d a;
-    __m256d b;
-
-    t0 = rdtsc();
-    for (int y = 0; y < output_size; y++) {
-        for (int x = 0; x < output_size; x++) {
-            for (int z = 0; z < numberOfFilters; z += 4) {
-                __m256d output = _mm256_setzero_pd();
-
-                for (int k = 0; k < depth; k++) {
-                    for (int i = y; i < (y+F); i++) {
-                        for (int j = x; j < (x+F); j++) {
-                            t3 = rdtsc();
-                            a = _mm256_broadcast_sd(A + (f_W_padded*f_W_padded*k + f_W_padded*i + j));
-                            t4 = rdtsc();
-                            // printf("_mm256_broadcast_sd: %lf\n\r", (double)(t4-t3)*MAX_FREQ/BASE_FREQ);
-
-                            t3 = rdtsc();
-                            b = _mm256_load_pd(B + (F*F*depth*z*4 + F*F*k*4 + F*(i-y)*4 + (j-x)*4));
-                            t4 = rdtsc();
-                            // printf("_mm256_load_pd: %lf\n\r", (double)(t4-t3)*MAX_FREQ/BASE_FREQ);
-
-                            t3 = rdtsc();
-                            output = _mm256_fmadd_pd(a, b, output);
-                            t4 = rdtsc();
-                            // printf("_mm256_fmadd_pd: %lf\n\r", (double)(t4-t3)*MAX_FREQ/BASE_FREQ);
-                        }
-                    }
-                }
-
-                t3 = rdtsc();
-                _mm256_store_pd(C + (numberOfFilters*output_size*y + numberOfFilters*x + z), output);
-                t4 = rdtsc();
-                // printf("_mm256_store_pd: %lf\n\r", (double)(t4-t3)*MAX_FREQ/BASE_FREQ);
-            }
-        }
-    }
-    t1 = rdtsc();
-    printf("TURBO Cycles Taken for SIMD: %lf\n\r", (double)(t1-t0)*MAX_FREQ/BASE_FREQ);
-}
-
-double Tensor::kernel_simd_openmp(double* C, double* A, double* B, int F, int f_W_padded, int output_size, int numberOfFilters)
-{
-    unsigned long long t0, t1, t3, t4;
-    __m256d a;
-    __m256d b;
-
-    t0 = rdtsc();
-    for (int y = 0; y < output_size; y++) {
-        for (int x = 0; x < output_size; x++) {
-            for (int z = 0; z < numberOfFilters; z += 4) {
-                __m256d output = _mm256_setzero_pd();
-
-                omp_set_num_threads(omp_get_max_threads());
-                #pragma omp parallel for reduction(+:output)
-                for (int k = 0; k < depth; k++) {
-                    for (int i = y; i < (y+F); i++) {
-                        for (int j = x; j < (x+F); j++) {
-                            t3 = rdtsc();
-                            a = _mm256_broadcast_sd(A + (f_W_padded*f_W_padded*k + f_W_padded*i + j));
-                            t4 = rdtsc();
-                            // printf("_mm256_broadcast_sd: %lf\n\r", (double)(t4-t3)*MAX_FREQ/BASE_FREQ);
-
-                            t3 = rdtsc();
-                            b = _mm256_load_pd(B + (F*F*depth*z*4 + F*F*k*4 + F*(i-y)*4 + (j-x)*4));
-                            t4 = rdtsc();
-                            // printf("_mm256_load_pd: %lf\n\r", (double)(t4-t3)*MAX_FREQ/BASE_FREQ);
-
-                            t3 = rdtsc();
-                            output = _mm256_fmadd_pd(a, b, output);
-                            t4 = rdtsc();
-                            // printf("_mm256_fmadd_pd: %lf\n\r", (double)(t4-t3)*MAX_FREQ/BASE_FREQ);
-                        }
-                    }
-                }
-                #pragma omp barrier
-
-                t3 = rdtsc();
-                _mm256_store_pd(C + (numberOfFilters*output_size*y + numberOfFilters*x + z), output);
-                t4 = rdtsc();
-                // printf("_mm256_store_pd: %lf\n\r", (double)(t4-t3)*MAX_FREQ/BASE_FREQ);
-            }
-        }
-    }
-    t1 = rdtsc();
-    printf("TURBO Cycles Taken for SIMD+OpenMP: %lf\n\r", (double)(t1-t0)*MAX_FREQ/BASE_FREQ);
-}
-
-void Tensor::pack_inputs(double* inputs, int padding, int f_W_padded)
-{
-    for (int k = 0; k < depth; k++) {
-        std::vector<std::vector<double>> padded_matrix;
-        if (padding > 0) {
-            padded_matrix = layers[k].getPadMatrix(padding);
-        } else {
-            padded_matrix = layers[k].matrix;
-        }
-
-        for (int i = 0; i < f_W_padded; i++) {
-            for (int j = 0; j < f_W_padded; j++) {
-                inputs[f_W_padded*f_W_padded*k + f_W_padded*i + j] = (double)padded_matrix[i][j];
-            }
-        }
-    }
-}
-
-void Tensor::pack_inputs_openmp(double* inputs, int padding, int f_W_padded)
-{
-    omp_set_num_threads(4);
-    #pragma omp parallel for
-    for (int k = 0; k < depth; k++) {
-        std::vector<std::vector<double>> padded_matrix;
-        #pragma omp critical
-        {
-            if (padding > 0) {
-            padded_matrix = layers[k].getPadMatrix(padding);
-            } else {
-            padded_matrix = layers[k].matrix;
-            }
-
-        }
-        for (int i = 0; i < f_W_padded; i++) {
-            for (int j = 0; j < f_W_padded; j++) {
-                inputs[f_W_padded*f_W_padded*k + f_W_padded*i + j] = (double)padded_matrix[i][j];
-            }
-        }
-    }
-    
-}
-
-void Tensor::pack_filters(double* filters, Filters setOfFilters, int numberOfFilters, int F)
-{
-    for (int l = 0; l < numberOfFilters/4; l++) {
-        for (int k = 0; k < depth; k++) {
-            Matrix filter1 = setOfFilters.getFilter(l*4).getLayer(k);
-            Matrix filter2 = setOfFilters.getFilter(l*4+1).getLayer(k);
-            Matrix filter3 = setOfFilters.getFilter(l*4+2).getLayer(k);
-            Matrix filter4 = setOfFilters.getFilter(l*4+3).getLayer(k);
-            
-            for (int i = 0; i < F; i++) {
-                for (int j = 0; j < F; j++) {
-                    filters[F*F*depth*l*4 + F*F*k*4 + F*i*4 + j*4] = (double)filter1.getIndexValue(i, j); // matrix[i][j]
-                    filters[F*F*depth*l*4 + F*F*k*4 + F*i*4 + j*4+1] = (double)filter2.getIndexValue(i, j); // matrix[i][j]
-                    filters[F*F*depth*l*4 + F*F*k*4 + F*i*4 + j*4+2] = (double)filter3.getIndexValue(i, j); // matrix[i][j]
-                    filters[F*F*depth*l*4 + F*F*k*4 + F*i*4 + j*4+3] = (double)filter4.getIndexValue(i, j); // matrix[i][j]
-                }
-            }
-        }
-    }
-}
-
-void Tensor::pack_filters_openmp(double* filters, Filters setOfFilters, int numberOfFilters, int F)
-{
-    for (int l = 0; l < numberOfFilters/4; l++) {
-        for (int k = 0; k < depth; k++) {
-            Matrix filter1 = setOfFilters.getFilter(l*4).getLayer(k);
-            Matrix filter2 = setOfFilters.getFilter(l*4+1).getLayer(k);
-            Matrix filter3 = setOfFilters.getFilter(l*4+2).getLayer(k);
-            Matrix filter4 = setOfFilters.getFilter(l*4+3).getLayer(k);
-            omp_set_num_threads(4);
-            #pragma omp parallel sections
-            {
-                #pragma omp section
-                {
-                    for (int i = 0; i < F; i++) {
-                        for (int j = 0; j < F; j++) {
-                    filters[F*F*depth*l*4 + F*F*k*4 + F*i*4 + j*4] = (double)filter1.getIndexValue(i, j); // matrix[i][j]
-                        }
-                    }
-                }
-                #pragma omp section
-                {
-                    for (int i = 0; i < F; i++) {
-                        for (int j = 0; j < F; j++) {
-                    filters[F*F*depth*l*4 + F*F*k*4 + F*i*4 + j*4+1] = (double)filter2.getIndexValue(i, j); // matrix[i][j]
-                        }
-                    }
-                }  
-                #pragma omp section
-                {
-                    for (int i = 0; i < F; i++) {
-                        for (int j = 0; j < F; j++) {
-                    filters[F*F*depth*l*4 + F*F*k*4 + F*i*4 + j*4+2] = (double)filter3.getIndexValue(i, j); // matrix[i][j]
-                        }
-                    }
-                }  
-                #pragma omp section
-                {
-                    for (int i = 0; i < F; i++) {
-                        for (int j = 0; j < F; j++) {
-                    filters[F*F*depth*l*4 + F*F*k*4 + F*i*4 + j*4+3] = (double)filter4.getIndexValue(i, j); // matrix[i][j]
-                        }
-                    }
-                }      
-            }
-            // for (int i = 0; i < F; i++) {
-            //     for (int j = 0; j < F; j++) {
-            //         filters[F*F*depth*l*4 + F*F*k*4 + F*i*4 + j*4] = (double)filter1.getIndexValue(i, j); // matrix[i][j]
-            //         filters[F*F*depth*l*4 + F*F*k*4 + F*i*4 + j*4+1] = (double)filter2.getIndexValue(i, j); // matrix[i][j]
-            //         filters[F*F*depth*l*4 + F*F*k*4 + F*i*4 + j*4+2] = (double)filter3.getIndexValue(i, j); // matrix[i][j]
-            //         filters[F*F*depth*l*4 + F*F*k*4 + F*i*4 + j*4+3] = (double)filter4.getIndexValue(i, j); // matrix[i][j]
-            //     }
-            // }
-        }
-    }
-}
-
-Tensor Tensor::fwdConv_baseline(Filters setOfFilters, int stride, int bias, int padding)
-{
-    int F = setOfFilters.getWidth(); // filter_size
-    float f_W = (float)width;
-    float f_F = (float)F;
-    float f_S = (float)stride;
-    float f_P = (float)padding;
-    int output_size = ceil((f_W-f_F+2*f_P)/f_S)+1;
-
-    if (output_size < 1)
-        throw logic_error("Invalid: Output matrix size 0.");    
-    
-    Tensor outputVolume = Tensor(output_size, output_size);
-
-    int numberOfFilters = setOfFilters.getNumberOfFilters();
-
-    // A
-    int f_W_padded = f_W+2*f_P;
-    double* inputs = new double[depth*f_W_padded*f_W_padded];
-
-    for (int k = 0; k < depth; k++) {
-        std::vector<std::vector<double>> padded_matrix;
-        if (padding > 0) {
-            padded_matrix = layers[k].getPadMatrix(padding);
-        } else {
-            padded_matrix = layers[k].matrix;
-        }
-
-        for (int i = 0; i < f_W_padded; i++) {
-            for (int j = 0; j < f_W_padded; j++) {
-                inputs[f_W_padded*f_W_padded*k + f_W_padded*i + j] = (double)padded_matrix[i][j];
-            }
-        }
-    }
-
-    // B
-    double* filters = new double[numberOfFilters*depth*F*F]; // 64x3x3x3
-    for (int l = 0; l < numberOfFilters; l++) {
-        for (int k = 0; k < depth; k++) {
-            Matrix filter = setOfFilters.getFilter(l).getLayer(k);
-
-            for (int i = 0; i < F; i++) {
-                for (int j = 0; j < F; j++) {
-                    filters[F*F*depth*l + F*F*k + F*i + j] = (double)filter.getIndexValue(i, j); // matrix[i][j]
-                }
-            }
-        }
-    }
-
-    // C
-    double* flatten_output_tensor = new double[output_size*output_size*numberOfFilters]; // 224x224x64
-
-    kernel(flatten_output_tensor, inputs, filters, F, f_W_padded, output_size, numberOfFilters);
-
-    // unpack C
-    for (int z = 0; z < numberOfFilters; z++) {
-        Matrix result = Matrix(output_size, output_size);
-
-        for (int y = 0; y < output_size; y++) {
-            for (int x = 0; x < output_size; x++) {
-                result.matrix[y][x] = flatten_output_tensor[numberOfFilters*output_size*y + numberOfFilters*x + z];
-            }
-        }
-
-        outputVolume.addLayer(result);
-    }
-
-    return outputVolume;
-}
-
-Tensor Tensor::fwdConv_simd(Filters setOfFilters, int stride, int bias, int padding)
-{
-    int F = setOfFilters.getWidth(); // filter_size
-    float f_W = (float)width;
-    float f_F = (float)F;
-    float f_S = (float)stride;
-    float f_P = (float)padding;
-    int output_size = ceil((f_W-f_F+2*f_P)/f_S)+1;
-
-    if (output_size < 1)
-        throw logic_error("Invalid: Output matrix size 0.");    
-    
-    Tensor outputVolume = Tensor(output_size, output_size);
-
-    int numberOfFilters = setOfFilters.getNumberOfFilters();
-
-    // A
-    int f_W_padded = f_W+2*f_P;
-    double* inputs;
-    posix_memalign((void**) &inputs, 64, depth*f_W_padded*f_W_padded*sizeof(double));
-    pack_inputs(inputs, padding, f_W_padded);
-
-    // B
-    double* filters;
-    posix_memalign((void**) &filters, 64, numberOfFilters*depth*F*F*sizeof(double));
-    pack_filters(filters, setOfFilters, numberOfFilters, F);
-
-    // C
-    double* flatten_output_tensor;
-    posix_memalign((void**) &flatten_output_tensor, 64, output_size*output_size*numberOfFilters*sizeof(double));
-
-    kernel_simd(flatten_output_tensor, inputs, filters, F, f_W_padded, output_size, numberOfFilters);
-
-    // unpack C
-    for (int z = 0; z < numberOfFilters; z++) {
-        Matrix result = Matrix(output_size, output_size);
-
-        for (int y = 0; y < output_size; y++) {
-            for (int x = 0; x < output_size; x++) {
-                result.matrix[y][x] = flatten_output_tensor[numberOfFilters*output_size*y + numberOfFilters*x + z];
-            }
-        }
-
-        outputVolume.addLayer(result);
-    }
-
-    return outputVolume;
-}
-
-Tensor Tensor::fwdConv_simd_openmp(Filters setOfFilters, int stride, int bias, int padding)
-{
-    int F = setOfFilters.getWidth(); // filter_size
-    float f_W = (float)width;
-    float f_F = (float)F;
-    float f_S = (float)stride;
-    float f_P = (float)padding;
-    int output_size = ceil((f_W-f_F+2*f_P)/f_S)+1;
-
-    if (output_size < 1)
-        throw logic_error("Invalid: Output matrix size 0.");    
-    
-    Tensor outputVolume = Tensor(output_size, output_size);
-
-    int numberOfFilters = setOfFilters.getNumberOfFilters();
-
-    // A
-    int f_W_padded = f_W+2*f_P;
-    double* inputs;
-    posix_memalign((void**) &inputs, 64, depth*f_W_padded*f_W_padded*sizeof(double));
-    pack_inputs_openmp(inputs, padding, f_W_padded);
-
-    // B
-    double* filters;
-    posix_memalign((void**) &filters, 64, numberOfFilters*depth*F*F*sizeof(double));
-    pack_filters_openmp(filters, setOfFilters, numberOfFilters, F);
-
-    // C
-    double* flatten_output_tensor;
-    posix_memalign((void**) &flatten_output_tensor, 64, output_size*output_size*numberOfFilters*sizeof(double));
-
-    kernel_simd_openmp(flatten_output_tensor, inputs, filters, F, f_W_padded, output_size, numberOfFilters);
-
-    // unpack C
-    for (int z = 0; z < numberOfFilters; z++) {
-        Matrix result = Matrix(output_size, output_size);
-        // omp_set_num_threads(2);
-        #pragma omp simd collapse(2)
-        for (int y = 0; y < output_size; y++) {
-            for (int x = 0; x < output_size; x++) {
-                result.matrix[y][x] = flatten_output_tensor[numberOfFilters*output_size*y + numberOfFilters*x + z];
-            }
-        }
-
-        outputVolume.addLayer(result);
-    }
-
-    return outputVolume;
-}
-
-Tensor Tensor::fwdMaxPool(int pool_filter_height, int pool_filter_width, int stride, int bias)
-{
-    float f_W = (float)width;
-    float f_P = (float)pool_filter_width;
-    float f_S = (float)stride;
-    int pool_output_size = ceil((f_W-f_P)/f_S)+1;
-    
-    if (pool_output_size < 1)
-        throw logic_error("Invalid: Output matrix size 0.");    
-    
-    Tensor output_volume = Tensor(pool_output_size, pool_output_size);
-
-    for (int i=0; i<depth; i++){
-        Matrix result = Matrix(pool_output_size, pool_output_size);
-        result = layers[i].maxSlide(pool_filter_height, pool_filter_width, stride, bias);
-
-        output_volume.addLayer(result);
-
-        if (bias > 0) {
-            vector<vector<double>> bias_filter(pool_output_size, vector<double>(pool_output_size, bias));
-            result.add(bias_filter);
-        }
-    }
-
-    return output_volume;
-}
-
+#include <algorithm>
+#include <vector>
+#include <ctime>
+#include <stdexcept>
+#include <cmath>
+#include "Filters.h"
+#include "Tensor.h"
+#include "Kernels.h"
+#include "Jit.h"
+#include "Timer.h"
+#include "Stats.h"
+#include "Trace.h"
+#include <omp.h>
+
+using namespace std;
+
+//every packed buffer comes from here, so the allocations show up in Stats
+static double* alignedDoubles(long count)
+{
+    double* buffer;
+    posix_memalign((void**) &buffer, 64, count*sizeof(double));
+    Stats::allocation(count*sizeof(double));
+    return buffer;
+}
+
+Tensor::Tensor(){}
+
+Tensor::Tensor(int height, int width)
+{
+    this->height = height;
+    this->width = width;
+    this->depth = 0;
+    this->layers = vector<Matrix> (depth);
+}
+
+Tensor::Tensor(int height, int width, int depth)
+{
+    this->height = height;
+    this->width = width;
+    this->depth = depth;
+    this->layers = vector<Matrix> (depth);
+}
+
+Tensor::Tensor(vector<Matrix> const &layers)
+{
+    this->height = layers[0].getHeight();
+    this->width = layers[0].getWidth();
+    this->depth = layers.size();
+    this->layers = layers;
+}
+
+int Tensor::getHeight() const
+{   
+    return height;
+}       
+        
+int Tensor::getWidth() const
+{           
+    return width;
+}
+
+int Tensor::getDepth() const
+{
+    return depth;
+}
+
+void Tensor::addLayer(Matrix layer)
+{
+    layers.push_back(layer);
+    depth++;
+}
+
+Matrix Tensor::getLayer(int index) const
+{
+    return layers[index];
+}
+
+void Tensor::randomValueInit(int low, int high)
+{
+
+    for (int i=0; i<depth; i++){
+        vector<vector<double>> layer;
+        for (int y=0; y<height; y++){
+            vector<double> rows;
+            for (int x=0; x<width; x++){
+                double temp = low + (rand() % (high - low + 1));
+                rows.push_back(temp);
+            }
+            layer.push_back(rows);
+        }
+        layers[i] = layer;
+    }
+}
+
+//windows that would run past the padded edge are dropped, as in Matrix::filterSlide
+Kernels::ConvShape Tensor::convShape(Filters const &setOfFilters, ConvParams const &params) const
+{
+    return convShape(setOfFilters.getHeight(), setOfFilters.getWidth(), setOfFilters.getDepth(),
+                     setOfFilters.getNumberOfFilters(), params);
+}
+
+Kernels::ConvShape Tensor::convShape(int Fh, int Fw, int filterDepth, int numberOfFilters, ConvParams const &params) const
+{
+    Kernels::ConvShape shape;
+    shape.Fh = Fh;
+    shape.Fw = Fw;
+    shape.strideY = params.strideY;
+    shape.strideX = params.strideX;
+    shape.dilationY = params.dilationY;
+    shape.dilationX = params.dilationX;
+    shape.paddedHeight = height + 2*params.padY;
+    shape.paddedWidth = width + 2*params.padX;
+    shape.numberOfFilters = numberOfFilters;
+    //channels every filter sees
+    shape.depth = depth/max(params.groups, 1);
+
+    if (params.dilationY < 1 || params.dilationX < 1)
+        throw logic_error("Invalid: dilation must be at least 1.");
+    if (params.groups < 1 || depth % params.groups != 0 || shape.numberOfFilters % params.groups != 0)
+        throw logic_error("Invalid: cannot split " + to_string(depth) + " channels and " + to_string(shape.numberOfFilters)
+                          + " filters into " + to_string(params.groups) + " groups.");
+    if (filterDepth != shape.depth)
+        throw logic_error("Invalid: filters are " + to_string(filterDepth) + " deep, the convolution needs "
+                          + to_string(shape.depth) + ".");
+
+    //extent of the dilated window
+    int spanY = (shape.Fh - 1)*params.dilationY + 1;
+    int spanX = (shape.Fw - 1)*params.dilationX + 1;
+    if (params.strideY < 1 || params.strideX < 1 || shape.paddedHeight < spanY || shape.paddedWidth < spanX)
+        throw logic_error("Invalid: Output matrix size 0.");
+
+    shape.outHeight = (shape.paddedHeight - spanY)/params.strideY + 1;
+    shape.outWidth = (shape.paddedWidth - spanX)/params.strideX + 1;
+    return shape;
+}
+
+//the dense engines read every channel with every filter
+static Kernels::ConvShape denseShape(Tensor const &input, Filters const &setOfFilters, ConvParams const &params)
+{
+    if (params.groups != 1)
+        throw logic_error("Invalid: grouped convolutions run through fwdConv(filters, params, bias, plan).");
+    return input.convShape(setOfFilters, params);
+}
+
+Tensor Tensor::fwdConv(Filters const &setOfFilters, int stride, int bias)
+{
+    return fwdConv_naive(setOfFilters, convParams(stride, 0), bias);
+}
+
+Tensor Tensor::fwdConv(Filters const &setOfFilters, int stride, int bias, int padding)
+{
+    return fwdConv_naive(setOfFilters, convParams(stride, padding), bias);
+}
+
+//the filter with dilation-1 zero rows/columns between its taps, so the
+//naive engine can slide it like any other
+static Matrix dilate(Matrix const &filter, int dilationY, int dilationX)
+{
+    if (dilationY == 1 && dilationX == 1)
+        return filter;
+
+    Matrix dilated = Matrix((filter.getHeight() - 1)*dilationY + 1, (filter.getWidth() - 1)*dilationX + 1);
+    for (int i = 0; i < filter.getHeight(); i++) {
+        for (int j = 0; j < filter.getWidth(); j++)
+            dilated.matrix[i*dilationY][j*dilationX] = filter.matrix[i][j];
+    }
+    return dilated;
+}
+
+Tensor Tensor::fwdConv_naive(Filters const &setOfFilters, ConvParams const &params, int bias)
+{
+    Kernels::ConvShape shape = denseShape(*this, setOfFilters, params);
+
+    Tensor outputVolume = Tensor(shape.outHeight, shape.outWidth);
+    
+    for (int filterNumber=0; filterNumber<setOfFilters.getNumberOfFilters(); filterNumber++) {
+        TRACE_SCOPE("kernel", "conv naive filter");
+        //temporarily doing addition of blank matrix in first iteration -- will fix later
+        Matrix result = Matrix(shape.outHeight, shape.outWidth);
+        for (int i=0; i<depth; i++){
+            Matrix filter = dilate(setOfFilters.filters[filterNumber].layers[i], params.dilationY, params.dilationX);
+            Matrix result_depth_i = layers[i].filterSlide(filter, params.strideY, params.strideX, bias, params.padY, params.padX);
+            result.add(result_depth_i);
+        }
+
+        if (bias > 0) {
+            vector<vector<double>> bias_filter(shape.outHeight, vector<double>(shape.outWidth, bias));
+            result.add(bias_filter);
+        }
+
+        outputVolume.addLayer(result);                
+    }
+
+    return outputVolume;
+}
+
+//kernels return their own run time in seconds (pack/unpack excluded)
+double Tensor::kernel(double* C, double* A, double* B, Kernels::ConvShape const &shape)
+{
+    TRACE_SCOPE("kernel", "conv baseline");
+    int Fh = shape.Fh, Fw = shape.Fw, W = shape.paddedWidth;
+    long plane = (long)shape.paddedHeight*W;
+    int numberOfFilters = shape.numberOfFilters;
+
+    unsigned long long t0 = Timer::rdtsc();
+    for (int y = 0; y < shape.outHeight; y++) {
+        for (int x = 0; x < shape.outWidth; x++) {
+            for (int z = 0; z < numberOfFilters; z++) {
+                double output = 0;
+
+                for (int k = 0; k < depth; k++) {
+                    for (int i = 0; i < Fh; i++) {
+                        for (int j = 0; j < Fw; j++) {
+                            double a = A[plane*k + W*(y*shape.strideY + i*shape.dilationY) + x*shape.strideX + j*shape.dilationX];
+                            double b = B[Fh*Fw*depth*z + Fh*Fw*k + Fw*i + j];
+                            output += a*b;
+                        }
+                    }
+                }
+
+                C[numberOfFilters*shape.outWidth*y + numberOfFilters*x + z] = output;
+            }
+        }
+    }
+    return Timer::seconds(Timer::rdtsc() - t0);
+}
+
+double Tensor::kernel_simd(double* C, double* A, double* B, Kernels::ConvShape const &shape)
+{
+    TRACE_SCOPE("kernel", "conv simd");
+    Kernels::ConvRowFn convRow = Kernels::active().convRowFor(shape);
+
+    unsigned long long t0 = Timer::rdtsc();
+    for (int y = 0; y < shape.outHeight; y++)
+        convRow(C, A, B, shape, y, 1);
+    return Timer::seconds(Timer::rdtsc() - t0);
+}
+
+double Tensor::kernel_simd_blocked(double* C, double* A, double* B, Kernels::ConvShape const &shape, int xBlock)
+{
+    TRACE_SCOPE("kernel", "conv simd");
+    Kernels::ConvRowFn convRow = Kernels::active().convRowFor(shape);
+
+    unsigned long long t0 = Timer::rdtsc();
+    for (int y = 0; y < shape.outHeight; y++)
+        convRow(C, A, B, shape, y, xBlock);
+    return Timer::seconds(Timer::rdtsc() - t0);
+}
+
+double Tensor::kernel_simd_openmp(double* C, double* A, double* B, Kernels::ConvShape const &shape, int xBlock)
+{
+    Kernels::ConvRowFn convRow = Kernels::active().convRowFor(shape);
+
+    int team = 1;
+    unsigned long long t0 = Timer::rdtsc();
+    //output rows are independent, so they are split between the threads
+    TRACE_CAPTURE_LAYER(traceLayer);
+    #pragma omp parallel
+    {
+        TRACE_INHERIT_LAYER(traceLayer);
+        //one span per thread, stragglers show up as the longest bar
+        TRACE_SCOPE("kernel", "conv simd_openmp rows");
+        unsigned long long busy = Timer::rdtsc();
+        #pragma omp for schedule(static) nowait
+        for (int y = 0; y < shape.outHeight; y++)
+            convRow(C, A, B, shape, y, xBlock);
+        Stats::threadBusy(omp_get_thread_num(), Timer::rdtsc() - busy);
+        if (omp_get_thread_num() == 0)
+            team = omp_get_num_threads();
+    }
+    unsigned long long wall = Timer::rdtsc() - t0;
+    Stats::parallelRegion(wall, team);
+    return Timer::seconds(wall);
+}
+
+double Tensor::kernel_jit(double* C, double* A, double* B, Kernels::ConvShape const &shape)
+{
+    JitConvShape jitShape = {shape.Fh, shape.Fw, shape.strideX, shape.dilationY, shape.dilationX,
+                             shape.paddedHeight, shape.paddedWidth, shape.outWidth, shape.numberOfFilters, depth};
+    JitConvFn convRow = Jit::convKernel(jitShape);
+
+    int team = 1;
+    unsigned long long t0 = Timer::rdtsc();
+    TRACE_CAPTURE_LAYER(traceLayer);
+    #pragma omp parallel
+    {
+        TRACE_INHERIT_LAYER(traceLayer);
+        TRACE_SCOPE("kernel", "conv jit rows");
+        unsigned long long busy = Timer::rdtsc();
+        #pragma omp for schedule(static) nowait
+        for (int y = 0; y < shape.outHeight; y++)
+            convRow(C + (long)shape.numberOfFilters*shape.outWidth*y, A + (long)shape.paddedWidth*y*shape.strideY, B);
+        Stats::threadBusy(omp_get_thread_num(), Timer::rdtsc() - busy);
+        if (omp_get_thread_num() == 0)
+            team = omp_get_num_threads();
+    }
+    unsigned long long wall = Timer::rdtsc() - t0;
+    Stats::parallelRegion(wall, team);
+    return Timer::seconds(wall);
+}
+
+void Tensor::pack_inputs(double* inputs, int padY, int padX)
+{
+    TRACE_SCOPE("pack", "inputs");
+    int paddedHeight = height + 2*padY, paddedWidth = width + 2*padX;
+    for (int k = 0; k < depth; k++) {
+        std::vector<std::vector<double>> padded_matrix;
+        if (padY > 0 || padX > 0) {
+            padded_matrix = layers[k].getPadMatrix(padY, padX);
+        } else {
+            padded_matrix = layers[k].matrix;
+        }
+
+        for (int i = 0; i < paddedHeight; i++) {
+            for (int j = 0; j < paddedWidth; j++) {
+                inputs[(long)paddedHeight*paddedWidth*k + paddedWidth*i + j] = (double)padded_matrix[i][j];
+            }
+        }
+    }
+}
+
+void Tensor::pack_inputs_openmp(double* inputs, int padY, int padX)
+{
+    TRACE_SCOPE("pack", "inputs");
+    int paddedHeight = height + 2*padY, paddedWidth = width + 2*padX;
+    #pragma omp parallel for
+    for (int k = 0; k < depth; k++) {
+        std::vector<std::vector<double>> padded_matrix;
+        #pragma omp critical
+        {
+            if (padY > 0 || padX > 0) {
+            padded_matrix = layers[k].getPadMatrix(padY, padX);
+            } else {
+            padded_matrix = layers[k].matrix;
+            }
+
+        }
+        for (int i = 0; i < paddedHeight; i++) {
+            for (int j = 0; j < paddedWidth; j++) {
+                inputs[(long)paddedHeight*paddedWidth*k + paddedWidth*i + j] = (double)padded_matrix[i][j];
+            }
+        }
+    }
+    
+}
+
+//the bias every engine adds to its outputs: the naive engine's rule, where
+//only a positive bias counts
+static double outputBias(int bias)
+{
+    return bias > 0 ? bias : 0;
+}
+
+//C is HWC, every filter becomes one layer of the output volume
+void Tensor::unpack_outputs(Tensor &outputVolume, double* C, int outHeight, int outWidth, int numberOfFilters, double bias)
+{
+    TRACE_SCOPE("unpack", "outputs");
+
+    for (int z = 0; z < numberOfFilters; z++) {
+        Matrix result = Matrix(outHeight, outWidth);
+
+        for (int y = 0; y < outHeight; y++) {
+            for (int x = 0; x < outWidth; x++) {
+                result.matrix[y][x] = C[(long)numberOfFilters*outWidth*y + numberOfFilters*x + z] + bias;
+            }
+        }
+
+        outputVolume.addLayer(result);
+    }
+}
+
+//one filter after another, [z][k][i][j], as kernel() reads them
+void Tensor::pack_filters_flat(double* filters, Filters const &setOfFilters, int numberOfFilters)
+{
+    TRACE_SCOPE("pack", "filters");
+    int Fh = setOfFilters.getHeight(), Fw = setOfFilters.getWidth();
+    for (int l = 0; l < numberOfFilters; l++) {
+        for (int k = 0; k < depth; k++) {
+            Matrix const &filter = setOfFilters.filters[l].layers[k];
+
+            for (int i = 0; i < Fh; i++) {
+                for (int j = 0; j < Fw; j++) {
+                    filters[Fh*Fw*depth*l + Fh*Fw*k + Fw*i + j] = filter.matrix[i][j];
+                }
+            }
+        }
+    }
+}
+
+void Tensor::pack_filters(double* filters, Filters const &setOfFilters, int numberOfFilters)
+{
+    TRACE_SCOPE("pack", "filters");
+    Kernels::Pack4Fn pack4 = Kernels::active().pack4;
+    int Fh = setOfFilters.getHeight(), Fw = setOfFilters.getWidth();
+    //a trailing partial group is padded with zero filters
+    vector<double> zeros(Fw, 0.0);
+
+    for (int l = 0; l < (numberOfFilters+3)/4; l++) {
+        for (int k = 0; k < depth; k++) {
+            for (int i = 0; i < Fh; i++) {
+                const double* rows[4];
+                for (int n = 0; n < 4; n++)
+                    rows[n] = (l*4+n < numberOfFilters) ? setOfFilters.filters[l*4+n].layers[k].matrix[i].data() : zeros.data();
+
+                pack4(filters + (Fh*Fw*depth*l*4 + Fh*Fw*k*4 + Fw*i*4), rows[0], rows[1], rows[2], rows[3], Fw);
+            }
+        }
+    }
+}
+
+void Tensor::pack_filters_openmp(double* filters, Filters const &setOfFilters, int numberOfFilters)
+{
+    TRACE_SCOPE("pack", "filters");
+    Kernels::Pack4Fn pack4 = Kernels::active().pack4;
+    int Fh = setOfFilters.getHeight(), Fw = setOfFilters.getWidth();
+    vector<double> zeros(Fw, 0.0);
+
+    //every group of 4 filters lands in its own slice of the packed buffer
+    #pragma omp parallel for
+    for (int l = 0; l < (numberOfFilters+3)/4; l++) {
+        for (int k = 0; k < depth; k++) {
+            for (int i = 0; i < Fh; i++) {
+                const double* rows[4];
+                for (int n = 0; n < 4; n++)
+                    rows[n] = (l*4+n < numberOfFilters) ? setOfFilters.filters[l*4+n].layers[k].matrix[i].data() : zeros.data();
+
+                pack4(filters + (Fh*Fw*depth*l*4 + Fh*Fw*k*4 + Fw*i*4), rows[0], rows[1], rows[2], rows[3], Fw);
+            }
+        }
+    }
+}
+
+//the pack_filters layout, [group][k][i][j][4 filters]: for one group that is
+//4 whole filters interleaved, so each group is one 16-bit pack4 call
+void Tensor::pack_filters_half(double* filters, HalfFilters const &half)
+{
+    TRACE_SCOPE("pack", "filters 16-bit");
+    Kernels::Table const &kernels = Kernels::active();
+    Kernels::Pack4HalfFn pack4 = half.format == WEIGHTS_FP16 ? kernels.pack4F16 : kernels.pack4BF16;
+    int size = half.height*half.width*half.depth;
+    //a trailing partial group is padded with zero filters, +0 in either format
+    vector<unsigned short> zeros(size, 0);
+
+    #pragma omp parallel for
+    for (int l = 0; l < (half.numberOfFilters+3)/4; l++) {
+        const unsigned short* rows[4];
+        for (int n = 0; n < 4; n++)
+            rows[n] = (l*4+n < half.numberOfFilters) ? half.bits + (long)size*(l*4+n) : zeros.data();
+
+        pack4(filters + (long)size*l*4, rows[0], rows[1], rows[2], rows[3], size);
+    }
+}
+
+Tensor Tensor::fwdConv_baseline(Filters const &setOfFilters, int stride, int bias, int padding)
+{
+    return fwdConv_baseline(setOfFilters, convParams(stride, padding), bias);
+}
+
+Tensor Tensor::fwdConv_baseline(Filters const &setOfFilters, ConvParams const &params, int bias)
+{
+    Kernels::ConvShape shape = denseShape(*this, setOfFilters, params);
+    Tensor outputVolume = Tensor(shape.outHeight, shape.outWidth);
+
+    // A
+    double* inputs = new double[(long)depth*shape.paddedHeight*shape.paddedWidth];
+    pack_inputs(inputs, params.padY, params.padX);
+
+    // B
+    double* filters = new double[shape.numberOfFilters*depth*shape.Fh*shape.Fw]; // 64x3x3x3
+    pack_filters_flat(filters, setOfFilters, shape.numberOfFilters);
+
+    // C
+    double* flatten_output_tensor = new double[(long)shape.outHeight*shape.outWidth*shape.numberOfFilters]; // 224x224x64
+
+    kernel(flatten_output_tensor, inputs, filters, shape);
+
+    // unpack C
+    unpack_outputs(outputVolume, flatten_output_tensor, shape.outHeight, shape.outWidth, shape.numberOfFilters, outputBias(bias));
+
+    delete[] inputs;
+    delete[] filters;
+    delete[] flatten_output_tensor;
+
+    return outputVolume;
+}
+
+Tensor Tensor::fwdConv_simd(Filters const &setOfFilters, int stride, int bias, int padding)
+{
+    return fwdConv_simd(setOfFilters, convParams(stride, padding), bias, 1);
+}
+
+Tensor Tensor::fwdConv_simd(Filters const &setOfFilters, int stride, int bias, int padding, int xBlock)
+{
+    return fwdConv_simd(setOfFilters, convParams(stride, padding), bias, xBlock);
+}
+
+Tensor Tensor::fwdConv_simd(Filters const &setOfFilters, ConvParams const &params, int bias, int xBlock)
+{
+    Kernels::ConvShape shape = denseShape(*this, setOfFilters, params);
+
+    // B
+    double* filters = alignedDoubles(((shape.numberOfFilters+3)/4)*4*depth*shape.Fh*shape.Fw);
+    pack_filters(filters, setOfFilters, shape.numberOfFilters);
+
+    ConvPlan plan = {ENGINE_SIMD, xBlock};
+    Tensor outputVolume = fwdConv_packed(filters, shape, params, bias, plan);
+    free(filters);
+    return outputVolume;
+}
+
+Tensor Tensor::fwdConv_simd_openmp(Filters const &setOfFilters, int stride, int bias, int padding)
+{
+    return fwdConv_simd_openmp(setOfFilters, convParams(stride, padding), bias, 1);
+}
+
+Tensor Tensor::fwdConv_simd_openmp(Filters const &setOfFilters, int stride, int bias, int padding, int xBlock)
+{
+    return fwdConv_simd_openmp(setOfFilters, convParams(stride, padding), bias, xBlock);
+}
+
+Tensor Tensor::fwdConv_simd_openmp(Filters const &setOfFilters, ConvParams const &params, int bias, int xBlock)
+{
+    Kernels::ConvShape shape = denseShape(*this, setOfFilters, params);
+
+    // B
+    double* filters = alignedDoubles(((shape.numberOfFilters+3)/4)*4*depth*shape.Fh*shape.Fw);
+    pack_filters_openmp(filters, setOfFilters, shape.numberOfFilters);
+
+    ConvPlan plan = {ENGINE_SIMD_OPENMP, xBlock};
+    Tensor outputVolume = fwdConv_packed(filters, shape, params, bias, plan);
+    free(filters);
+    return outputVolume;
+}
+
+Tensor Tensor::fwdConv_jit(Filters const &setOfFilters, int stride, int bias, int padding)
+{
+    return fwdConv_jit(setOfFilters, convParams(stride, padding), bias);
+}
+
+Tensor Tensor::fwdConv_jit(Filters const &setOfFilters, ConvParams const &params, int bias)
+{
+    if (!Jit::isAvailable())
+        throw logic_error("Invalid: JIT convolution needs AVX2 and FMA.");
+
+    Kernels::ConvShape shape = denseShape(*this, setOfFilters, params);
+
+    // B, the last group is zero-padded so the generated code can always load 4 filters
+    double* filters = alignedDoubles(((shape.numberOfFilters+3)/4)*4*depth*shape.Fh*shape.Fw);
+    pack_filters_openmp(filters, setOfFilters, shape.numberOfFilters);
+
+    ConvPlan plan = {ENGINE_JIT, 1};
+    Tensor outputVolume = fwdConv_packed(filters, shape, params, bias, plan);
+    free(filters);
+    return outputVolume;
+}
+
+//The activation is already depth planes of height x width, i.e. the
+//depth x pixels matrix a 1x1 filter multiplies, so there is no im2col: A is
+//the planes (subsampled when strided), B the usual groups of 4 filters and C
+//comes out planar, one plane per filter.
+Tensor Tensor::fwdConv_gemm(Filters const &setOfFilters, ConvParams const &params, int bias)
+{
+    Kernels::ConvShape shape = denseShape(*this, setOfFilters, params);
+
+    // B, the 1x1 case of pack_filters: panels of [k][4 filters]
+    double* filters = alignedDoubles(((shape.numberOfFilters+3)/4)*4*depth*shape.Fh*shape.Fw);
+    pack_filters(filters, setOfFilters, shape.numberOfFilters);
+
+    ConvPlan plan = {ENGINE_GEMM, 1};
+    Tensor outputVolume = fwdConv_packed(filters, shape, params, bias, plan);
+    free(filters);
+    return outputVolume;
+}
+
+Tensor Tensor::fwdConv_packed(double* B, Kernels::ConvShape const &shape, ConvParams const &params, int bias, ConvPlan plan)
+{
+    if (plan.engine == ENGINE_NAIVE || plan.engine == ENGINE_BASELINE)
+        throw logic_error("Invalid: only the SIMD, SIMD + OpenMP, JIT and GEMM engines read packed filters.");
+
+    Tensor outputVolume = Tensor(shape.outHeight, shape.outWidth);
+    int numberOfFilters = shape.numberOfFilters;
+
+    if (plan.engine == ENGINE_GEMM) {
+        if (shape.Fh != 1 || shape.Fw != 1 || params.padY != 0 || params.padX != 0)
+            throw logic_error("Invalid: the GEMM engine runs 1x1 convolutions without padding.");
+
+        Kernels::GemmShape gemm = {shape.outHeight*shape.outWidth, depth, numberOfFilters};
+
+        // A
+        double* inputs = alignedDoubles((long)depth*gemm.pixels);
+        pack_planes(inputs, params.strideY, params.strideX);
+
+        // C
+        double* flatten_output_tensor = alignedDoubles((long)numberOfFilters*gemm.pixels);
+
+        kernel_gemm(flatten_output_tensor, inputs, B, gemm, outputBias(bias));
+
+        // unpack C
+        unpack_planes(outputVolume, flatten_output_tensor, shape.outHeight, shape.outWidth, numberOfFilters);
+
+        free(inputs);
+        free(flatten_output_tensor);
+        return outputVolume;
+    }
+
+    if (plan.engine == ENGINE_JIT && !Jit::isAvailable())
+        throw logic_error("Invalid: JIT convolution needs AVX2 and FMA.");
+
+    // A
+    double* inputs = alignedDoubles((long)depth*shape.paddedHeight*shape.paddedWidth);
+    if (plan.engine == ENGINE_SIMD)
+        pack_inputs(inputs, params.padY, params.padX);
+    else
+        pack_inputs_openmp(inputs, params.padY, params.padX);
+
+    // C
+    double* flatten_output_tensor = alignedDoubles((long)shape.outHeight*shape.outWidth*numberOfFilters);
+
+    switch (plan.engine) {
+        case ENGINE_SIMD:
+            if (plan.xBlock > 1)
+                kernel_simd_blocked(flatten_output_tensor, inputs, B, shape, plan.xBlock);
+            else
+                kernel_simd(flatten_output_tensor, inputs, B, shape);
+            break;
+        case ENGINE_SIMD_OPENMP:
+            kernel_simd_openmp(flatten_output_tensor, inputs, B, shape, plan.xBlock);
+            break;
+        default:
+            kernel_jit(flatten_output_tensor, inputs, B, shape);
+            break;
+    }
+
+    // unpack C
+    unpack_outputs(outputVolume, flatten_output_tensor, shape.outHeight, shape.outWidth, numberOfFilters, outputBias(bias));
+
+    free(inputs);
+    free(flatten_output_tensor);
+
+    return outputVolume;
+}
+
+double Tensor::kernel_gemm(double* C, double* A, double* B, Kernels::GemmShape const &shape, double bias)
+{
+    Kernels::PointwiseFn pointwise = Kernels::active().pointwise;
+    //columns per work item: a multiple of every kernel's strip width
+    const int chunk = 96;
+    int chunks = (shape.pixels + chunk - 1)/chunk;
+
+    int team = 1;
+    unsigned long long t0 = Timer::rdtsc();
+    TRACE_CAPTURE_LAYER(traceLayer);
+    #pragma omp parallel
+    {
+        TRACE_INHERIT_LAYER(traceLayer);
+        TRACE_SCOPE("kernel", "conv gemm columns");
+        unsigned long long busy = Timer::rdtsc();
+        #pragma omp for schedule(static) nowait
+        for (int c = 0; c < chunks; c++)
+            pointwise(C, A, B, shape, c*chunk, min(chunk, shape.pixels - c*chunk), bias);
+        Stats::threadBusy(omp_get_thread_num(), Timer::rdtsc() - busy);
+        if (omp_get_thread_num() == 0)
+            team = omp_get_num_threads();
+    }
+    unsigned long long wall = Timer::rdtsc() - t0;
+    Stats::parallelRegion(wall, team);
+    return Timer::seconds(wall);
+}
+
+void Tensor::pack_planes(double* inputs, int strideY, int strideX)
+{
+    TRACE_SCOPE("pack", "inputs");
+    int outHeight = (height - 1)/strideY + 1, outWidth = (width - 1)/strideX + 1;
+    long plane = (long)outHeight*outWidth;
+
+    #pragma omp parallel for
+    for (int k = 0; k < depth; k++) {
+        vector<vector<double> > const &rows = layers[k].matrix;
+        for (int y = 0; y < outHeight; y++) {
+            const double* row = rows[y*strideY].data();
+            double* out = inputs + plane*k + (long)outWidth*y;
+            if (strideX == 1) {
+                copy(row, row + outWidth, out);
+            } else {
+                for (int x = 0; x < outWidth; x++)
+                    out[x] = row[x*strideX];
+            }
+        }
+    }
+}
+
+void Tensor::unpack_planes(Tensor &outputVolume, double* C, int outHeight, int outWidth, int numberOfFilters)
+{
+    TRACE_SCOPE("unpack", "outputs");
+    long plane = (long)outHeight*outWidth;
+
+    for (int z = 0; z < numberOfFilters; z++) {
+        Matrix result = Matrix(outHeight, outWidth);
+        for (int y = 0; y < outHeight; y++) {
+            const double* row = C + plane*z + (long)outWidth*y;
+            copy(row, row + outWidth, result.matrix[y].begin());
+        }
+        outputVolume.addLayer(result);
+    }
+}
+
+Tensor Tensor::channels(int first, int count) const
+{
+    return Tensor(vector<Matrix>(layers.begin() + first, layers.begin() + first + count));
+}
+
+Tensor Tensor::fwdConv_grouped(Filters const &setOfFilters, ConvParams const &params, int bias, ConvPlan plan)
+{
+    Kernels::ConvShape shape = convShape(setOfFilters, params);
+
+    bool depthwise = params.groups == depth && shape.numberOfFilters == depth;
+    if (depthwise && plan.engine != ENGINE_NAIVE && plan.engine != ENGINE_BASELINE)
+        return fwdConv_depthwise(setOfFilters, params, bias);
+
+    int inputsPerGroup = depth/params.groups;
+    int filtersPerGroup = shape.numberOfFilters/params.groups;
+    ConvParams dense = params;
+    dense.groups = 1;
+
+    Tensor outputVolume = Tensor(shape.outHeight, shape.outWidth);
+    for (int g = 0; g < params.groups; g++) {
+        Filters group = Filters(vector<Tensor>(setOfFilters.filters.begin() + g*filtersPerGroup,
+                                               setOfFilters.filters.begin() + (g + 1)*filtersPerGroup));
+        Tensor result = channels(g*inputsPerGroup, inputsPerGroup).fwdConv(group, dense, bias, plan);
+        for (int d = 0; d < result.getDepth(); d++)
+            outputVolume.addLayer(result.layers[d]);
+    }
+    return outputVolume;
+}
+
+//one filter per channel, vectorised across channels: every layout is blocks
+//of Kernels::DEPTHWISE_BLOCK channels with the channel innermost
+Tensor Tensor::fwdConv_depthwise(Filters const &setOfFilters, ConvParams const &params, int bias)
+{
+    Kernels::ConvShape shape = convShape(setOfFilters, params);
+    if (params.groups != depth || shape.numberOfFilters != depth)
+        throw logic_error("Invalid: a depthwise convolution needs one filter per channel.");
+
+    const int L = Kernels::DEPTHWISE_BLOCK;
+    long blocks = (depth + L - 1)/L;
+    Tensor outputVolume = Tensor(shape.outHeight, shape.outWidth);
+
+    // A
+    double* inputs = alignedDoubles(blocks*shape.paddedHeight*shape.paddedWidth*L);
+    pack_inputs_blocked(inputs, params.padY, params.padX);
+
+    // B
+    double* filters = alignedDoubles(blocks*shape.Fh*shape.Fw*L);
+    pack_filters_depthwise(filters, setOfFilters);
+
+    // C
+    double* flatten_output_tensor = alignedDoubles(blocks*shape.outHeight*shape.outWidth*L);
+
+    kernel_depthwise(flatten_output_tensor, inputs, filters, shape);
+
+    // unpack C
+    unpack_outputs_blocked(outputVolume, flatten_output_tensor, shape.outHeight, shape.outWidth, depth, outputBias(bias));
+
+    free(inputs);
+    free(filters);
+    free(flatten_output_tensor);
+
+    return outputVolume;
+}
+
+double Tensor::kernel_depthwise(double* C, double* A, double* B, Kernels::ConvShape const &shape)
+{
+    Kernels::DepthwiseRowFn depthwiseRow = Kernels::active().depthwiseRow;
+
+    int team = 1;
+    unsigned long long t0 = Timer::rdtsc();
+    TRACE_CAPTURE_LAYER(traceLayer);
+    #pragma omp parallel
+    {
+        TRACE_INHERIT_LAYER(traceLayer);
+        TRACE_SCOPE("kernel", "conv depthwise rows");
+        unsigned long long busy = Timer::rdtsc();
+        #pragma omp for schedule(static) nowait
+        for (int y = 0; y < shape.outHeight; y++)
+            depthwiseRow(C, A, B, shape, y);
+        Stats::threadBusy(omp_get_thread_num(), Timer::rdtsc() - busy);
+        if (omp_get_thread_num() == 0)
+            team = omp_get_num_threads();
+    }
+    unsigned long long wall = Timer::rdtsc() - t0;
+    Stats::parallelRegion(wall, team);
+    return Timer::seconds(wall);
+}
+
+//the border and the lanes past the last channel stay zero
+void Tensor::pack_inputs_blocked(double* inputs, int padY, int padX)
+{
+    TRACE_SCOPE("pack", "inputs");
+    const int L = Kernels::DEPTHWISE_BLOCK;
+    int paddedHeight = height + 2*padY, paddedWidth = width + 2*padX;
+    int blocks = (depth + L - 1)/L;
+    long block = (long)paddedHeight*paddedWidth*L;
+
+    #pragma omp parallel for
+    for (int cb = 0; cb < blocks; cb++) {
+        double* out = inputs + block*cb;
+        fill(out, out + block, 0.0);
+        for (int l = 0; l < L && cb*L + l < depth; l++) {
+            vector<vector<double> > const &rows = layers[cb*L + l].matrix;
+            for (int y = 0; y < height; y++) {
+                for (int x = 0; x < width; x++)
+                    out[((long)paddedWidth*(y + padY) + x + padX)*L + l] = rows[y][x];
+            }
+        }
+    }
+}
+
+void Tensor::pack_filters_depthwise(double* filters, Filters const &setOfFilters)
+{
+    TRACE_SCOPE("pack", "filters");
+    const int L = Kernels::DEPTHWISE_BLOCK;
+    int Fh = setOfFilters.getHeight(), Fw = setOfFilters.getWidth();
+    int blocks = (depth + L - 1)/L;
+    fill(filters, filters + (long)blocks*Fh*Fw*L, 0.0);
+
+    for (int c = 0; c < depth; c++) {
+        Matrix const &filter = setOfFilters.filters[c].layers[0];
+        for (int i = 0; i < Fh; i++) {
+            for (int j = 0; j < Fw; j++)
+                filters[((c/L)*Fh*Fw + Fw*i + j)*L + c%L] = filter.matrix[i][j];
+        }
+    }
+}
+
+void Tensor::unpack_outputs_blocked(Tensor &outputVolume, double* C, int outHeight, int outWidth, int channels, double bias)
+{
+    TRACE_SCOPE("unpack", "outputs");
+    const int L = Kernels::DEPTHWISE_BLOCK;
+    long block = (long)outHeight*outWidth*L;
+
+    for (int c = 0; c < channels; c++) {
+        Matrix result = Matrix(outHeight, outWidth);
+        const double* in = C + block*(c/L) + c%L;
+        for (int y = 0; y < outHeight; y++) {
+            for (int x = 0; x < outWidth; x++)
+                result.matrix[y][x] = in[((long)outWidth*y + x)*L] + bias;
+        }
+        outputVolume.addLayer(result);
+    }
+}
+
+Tensor Tensor::fwdConv(Filters const &setOfFilters, int stride, int bias, int padding, ConvPlan plan)
+{
+    return fwdConv(setOfFilters, convParams(stride, padding), bias, plan);
+}
+
+Tensor Tensor::fwdConv(Filters const &setOfFilters, ConvParams const &params, int bias, ConvPlan plan)
+{
+    if (params.groups != 1)
+        return fwdConv_grouped(setOfFilters, params, bias, plan);
+
+    switch (plan.engine) {
+        case ENGINE_NAIVE:
+            return fwdConv_naive(setOfFilters, params, bias);
+        case ENGINE_BASELINE:
+            return fwdConv_baseline(setOfFilters, params, bias);
+        case ENGINE_SIMD:
+            return fwdConv_simd(setOfFilters, params, bias, plan.xBlock);
+        case ENGINE_SIMD_OPENMP:
+            return fwdConv_simd_openmp(setOfFilters, params, bias, plan.xBlock);
+        case ENGINE_JIT:
+            return fwdConv_jit(setOfFilters, params, bias);
+        case ENGINE_GEMM:
+            return fwdConv_gemm(setOfFilters, params, bias);
+    }
+    throw logic_error("Invalid: Unknown convolution engine.");
+}
+
+Filters widenFilters(HalfFilters const &half)
+{
+    const unsigned short* bits = half.bits;
+    vector<Tensor> filters(half.numberOfFilters);
+    for (int z = 0; z < half.numberOfFilters; z++) {
+        filters[z] = Tensor(half.height, half.width);
+        for (int k = 0; k < half.depth; k++) {
+            Matrix plane = Matrix(half.height, half.width);
+            for (int i = 0; i < half.height; i++) {
+                for (int j = 0; j < half.width; j++, bits++)
+                    plane.matrix[i][j] = half.format == WEIGHTS_FP16 ? Kernels::fromHalf(*bits) : Kernels::fromBfloat16(*bits);
+            }
+            filters[z].addLayer(plane);
+        }
+    }
+    return Filters(filters);
+}
+
+Tensor Tensor::fwdConv(HalfFilters const &filters, ConvParams const &params, int bias, ConvPlan plan)
+{
+    if (filters.format != WEIGHTS_FP16 && filters.format != WEIGHTS_BF16)
+        throw logic_error("Invalid: 16-bit filters must be fp16 or bf16.");
+    if (params.groups != 1 || plan.engine == ENGINE_NAIVE || plan.engine == ENGINE_BASELINE)
+        return fwdConv(widenFilters(filters), params, bias, plan);
+
+    Kernels::ConvShape shape = convShape(filters.height, filters.width, filters.depth, filters.numberOfFilters, params);
+
+    // B, widened from the 16-bit words as it is packed
+    double* packed = alignedDoubles(((shape.numberOfFilters+3)/4)*4*depth*shape.Fh*shape.Fw);
+    pack_filters_half(packed, filters);
+
+    Tensor outputVolume = fwdConv_packed(packed, shape, params, bias, plan);
+    free(packed);
+    return outputVolume;
+}
+
+Tensor Tensor::fwdMaxPool(int pool_filter_height, int pool_filter_width, int stride, int bias)
+{
+    return fwdMaxPool(pool_filter_height, pool_filter_width, stride, stride, bias);
+}
+
+Tensor Tensor::fwdMaxPool(int pool_filter_height, int pool_filter_width, int strideY, int strideX, int bias)
+{
+    //windows that would run past the edge are dropped, as in Matrix::maxSlide
+    //and Network::outputShape, so the volume is as wide as the windows
+    int Fh = pool_filter_height, Fw = pool_filter_width;
+
+    if (height < Fh || width < Fw || strideY < 1 || strideX < 1)
+        throw logic_error("Invalid: Output matrix size 0.");
+
+    int outHeight = (height-Fh)/strideY+1;
+    int outWidth = (width-Fw)/strideX+1;
+    Tensor output_volume = Tensor(outHeight, outWidth);
+
+    // pack layers to HWC so the kernel vectorises across channels
+    double* inputs = alignedDoubles((long)height*width*depth);
+    {
+        TRACE_SCOPE("pack", "pool inputs");
+        for (int k = 0; k < depth; k++) {
+            for (int i = 0; i < height; i++) {
+                for (int j = 0; j < width; j++) {
+                    inputs[(width*i + j)*depth + k] = layers[k].matrix[i][j];
+                }
+            }
+        }
+    }
+
+    double* outputs = alignedDoubles((long)outHeight*outWidth*depth);
+    {
+        TRACE_SCOPE("kernel", "max pool");
+        Kernels::active().maxPool(outputs, inputs, width, depth, Fh, Fw, strideY, strideX, outHeight, outWidth);
+    }
+
+    {
+        TRACE_SCOPE("unpack", "pool outputs");
+        for (int k = 0; k < depth; k++) {
+            Matrix result = Matrix(outHeight, outWidth);
+
+            for (int y = 0; y < outHeight; y++) {
+                for (int x = 0; x < outWidth; x++) {
+                    result.matrix[y][x] = outputs[((long)outWidth*y + x)*depth + k];
+                }
+            }
+
+            output_volume.addLayer(result);
+        }
+    }
+
+    free(inputs);
+    free(outputs);
+
+    return output_volume;
+}
+
+//the 1x1xN volume of fully connected outputs
+static Tensor fullyConnectedVolume(const double* outputs, int numberOfOutputs, int bias)
+{
+    Tensor output_volume = Tensor(1, 1);
+    for (int o = 0; o < numberOfOutputs; o++) {
+        Matrix result = Matrix(1, 1);
+        result.matrix[0][0] = outputs[o];
+        if (bias > 0)
+            result.matrix[0][0] += bias;
+        output_volume.addLayer(result);
+    }
+    return output_volume;
+}
+
+void Tensor::pack_fc_inputs(double* inputs)
+{
+    TRACE_SCOPE("pack", "fc inputs");
+    for (int k = 0; k < depth; k++) {
+        for (int i = 0; i < height; i++) {
+            for (int j = 0; j < width; j++) {
+                inputs[height*width*k + width*i + j] = layers[k].matrix[i][j];
+            }
+        }
+    }
+}
+
+Tensor Tensor::fwdFullyConnected(Filters const &setOfFilters, int bias)
+{
+    if (setOfFilters.getHeight() != height || setOfFilters.getWidth() != width || setOfFilters.getDepth() != depth)
+        throw logic_error("Invalid: Fully connected weights do not match the input volume.");
+
+    int numberOfOutputs = setOfFilters.getNumberOfFilters();
+    int inputs_size = depth*height*width;
+
+    // flatten input and every filter in the same (depth, row, column) order
+    double* inputs = alignedDoubles(inputs_size);
+    pack_fc_inputs(inputs);
+
+    double* weights = alignedDoubles((long)numberOfOutputs*inputs_size);
+    {
+        TRACE_SCOPE("pack", "fc weights");
+        for (int o = 0; o < numberOfOutputs; o++) {
+            for (int k = 0; k < depth; k++) {
+                Matrix const &filter = setOfFilters.filters[o].layers[k];
+                for (int i = 0; i < height; i++) {
+                    for (int j = 0; j < width; j++) {
+                        weights[(long)inputs_size*o + height*width*k + width*i + j] = filter.matrix[i][j];
+                    }
+                }
+            }
+        }
+    }
+
+    double* outputs = new double[numberOfOutputs];
+    {
+        TRACE_SCOPE("kernel", "fully connected");
+        Kernels::active().fullyConnected(outputs, inputs, weights, inputs_size, numberOfOutputs);
+    }
+
+    Tensor output_volume = fullyConnectedVolume(outputs, numberOfOutputs, bias);
+
+    free(inputs);
+    free(weights);
+    delete[] outputs;
+
+    return output_volume;
+}
+
+Tensor Tensor::fwdFullyConnected(const unsigned short* weights, WeightFormat format, int numberOfOutputs, int bias)
+{
+    if (format != WEIGHTS_FP16 && format != WEIGHTS_BF16)
+        throw logic_error("Invalid: 16-bit fully connected weights must be fp16 or bf16.");
+
+    int inputs_size = depth*height*width;
+    double* inputs = alignedDoubles(inputs_size);
+    pack_fc_inputs(inputs);
+
+    //the weights are read where they are, already in the kernel's layout
+    double* outputs = new double[numberOfOutputs];
+    {
+        TRACE_SCOPE("kernel", "fully connected 16-bit");
+        Kernels::Table const &kernels = Kernels::active();
+        Kernels::FullyConnectedHalfFn kernel = format == WEIGHTS_FP16 ? kernels.fullyConnectedF16 : kernels.fullyConnectedBF16;
+        kernel(outputs, inputs, weights, inputs_size, numberOfOutputs);
+    }
+
+    Tensor output_volume = fullyConnectedVolume(outputs, numberOfOutputs, bias);
+
+    free(inputs);
+    delete[] outputs;
+
+    return output_volume;
+}
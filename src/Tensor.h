@@ -1,52 +1,176 @@
-#ifndef DEF_TENSOR
-#define DEF_TENSOR
-
-#include <vector>
-#include <iostream>
-#include "Matrix.h"
-#include "Filters.h"
-
-class Filters;
-
-class Tensor
-{
-public:
-	Tensor();
-	Tensor(int height, int width);
-	Tensor(int height, int width, int depth);
-	Tensor(std::vector<Matrix> const &layers);
-
-	//vector storing matrices (3D volume of matrices)
-	std::vector<Matrix> layers;
-
-	int getDepth() const;
-	int getHeight() const;
-	int getWidth() const;
-	void addLayer(Matrix layer);
-	void randomValueInit(int low, int high);
-	Matrix getLayer(int index) const;
-	Tensor fwdConv(Filters setOfFilters, int stride, int bias);
-    Tensor SIMD(Filters setOfFilters, int stride, int bias);
-	Tensor fwdConv(Filters setOfFilters, int stride, int bias, int padding);
-	Tensor fwdMaxPool(int pool_filter_height, int pool_filter_width, int stride, int bias);
-
-	double kernel(double* C, double* A, double* B, int F, int f_W_padded, int output_size, int numberOfFilters);
-	double kernel_simd(double* C, double* A, double* B, int F, int f_W_padded, int output_size, int numberOfFilters);
-	double kernel_simd_openmp(double* C, double* A, double* B, int F, int f_W_padded, int output_size, int numberOfFilters);
-	Tensor fwdConv_baseline(Filters setOfFilters, int stride, int bias, int padding);
-	Tensor fwdConv_simd(Filters setOfFilters, int stride, int bias, int padding);
-	Tensor fwdConv_simd_openmp(Filters setOfFilters, int stride, int bias, int padding);
-
-	void pack_inputs(double* inputs, int padding, int f_W_padded);
-	void pack_inputs_openmp(double* inputs, int padding, int f_W_padded);
-	void pack_filters(double* filters, Filters setOfFilters, int numberOfFilters, int F);
-	void pack_filters_openmp(double* filters, Filters setOfFilters, int numberOfFilters, int F);
-
-protected:
-	int height;
-	int width;
-	int depth;
-
-};
-
-#endif
+#ifndef DEF_TENSOR
+#define DEF_TENSOR
+
+#include <vector>
+#include <iostream>
+#include "Matrix.h"
+#include "Filters.h"
+#include "Kernels.h"
+
+class Filters;
+
+//convolution engines the caller (or the Autotuner) can pick from
+enum ConvEngine
+{
+	ENGINE_NAIVE,
+	ENGINE_BASELINE,
+	ENGINE_SIMD,
+	ENGINE_SIMD_OPENMP,
+	ENGINE_JIT,
+	ENGINE_GEMM
+};
+
+//engine + blocking parameters chosen for one layer signature
+struct ConvPlan
+{
+	ConvEngine engine;
+	int xBlock; //output pixels computed per pass over the packed filters (SIMD engines)
+};
+
+//per-axis stride, zero padding and dilation of a convolution; the filter
+//height and width come from the Filters. A dilated F-tap filter spans
+//(F-1)*dilation+1 input pixels with its taps dilation apart. With groups > 1
+//the input channels and the filters are split into that many groups, filter
+//n sees the channels of group n/(filters/groups) only and the Filters are
+//depth/groups deep.
+struct ConvParams
+{
+	int strideY;
+	int strideX;
+	int padY;
+	int padX;
+	int dilationY;
+	int dilationX;
+	int groups;
+};
+
+inline ConvParams convParams(int stride, int padding, int dilation = 1, int groups = 1)
+{
+	ConvParams const &params = {stride, stride, padding, padding, dilation, dilation, groups};
+	return params;
+}
+
+//how weights are held: doubles, or 16-bit IEEE half / bfloat16 that the
+//Kernels widen to float in registers
+enum WeightFormat
+{
+	WEIGHTS_DOUBLE,
+	WEIGHTS_FP16,
+	WEIGHTS_BF16
+};
+
+//16-bit filters as a Model keeps them: numberOfFilters filters of depth x
+//height x width words, [z][k][i][j], in WEIGHTS_FP16 or WEIGHTS_BF16
+struct HalfFilters
+{
+	const unsigned short* bits;
+	WeightFormat format;
+	int height, width, depth;
+	int numberOfFilters;
+};
+
+//the same filters widened to doubles
+Filters widenFilters(HalfFilters const &half);
+
+//Volumes are height x width x depth with height and width independent; the
+//(stride, padding) overloads are the square case of the ConvParams ones.
+class Tensor
+{
+public:
+	Tensor();
+	Tensor(int height, int width);
+	Tensor(int height, int width, int depth);
+	Tensor(std::vector<Matrix> const &layers);
+
+	//vector storing matrices (3D volume of matrices)
+	std::vector<Matrix> layers;
+
+	int getDepth() const;
+	int getHeight() const;
+	int getWidth() const;
+	void addLayer(Matrix layer);
+	void randomValueInit(int low, int high);
+	Matrix getLayer(int index) const;
+	Tensor fwdConv(Filters const &setOfFilters, int stride, int bias);
+    Tensor SIMD(Filters const &setOfFilters, int stride, int bias);
+	Tensor fwdConv(Filters const &setOfFilters, int stride, int bias, int padding);
+	Tensor fwdConv(Filters const &setOfFilters, int stride, int bias, int padding, ConvPlan plan);
+	Tensor fwdConv(Filters const &setOfFilters, ConvParams const &params, int bias, ConvPlan plan);
+	//the same over 16-bit filters: the engines that read packed groups of 4
+	//filters (SIMD, SIMD + OpenMP, JIT, GEMM) get them widened straight into
+	//their B; grouped layers and the naive and baseline engines widen them
+	//to Filters first
+	Tensor fwdConv(HalfFilters const &filters, ConvParams const &params, int bias, ConvPlan plan);
+	Tensor fwdMaxPool(int pool_filter_height, int pool_filter_width, int stride, int bias);
+	Tensor fwdMaxPool(int pool_filter_height, int pool_filter_width, int strideY, int strideX, int bias);
+	Tensor fwdFullyConnected(Filters const &setOfFilters, int bias);
+	//the same over 16-bit weights (WEIGHTS_FP16 or WEIGHTS_BF16): numberOfOutputs
+	//rows of depth*height*width, in the (depth, row, column) order of the input
+	Tensor fwdFullyConnected(const unsigned short* weights, WeightFormat format, int numberOfOutputs, int bias);
+
+	//output size and packed A/B/C layout of one convolution of this volume
+	Kernels::ConvShape convShape(Filters const &setOfFilters, ConvParams const &params) const;
+	Kernels::ConvShape convShape(int Fh, int Fw, int filterDepth, int numberOfFilters, ConvParams const &params) const;
+	//A, C, the kernel and the unpack of the engines that read packed groups of
+	//4 filters (SIMD, SIMD + OpenMP, JIT, GEMM), around a B the caller packed;
+	//the bias is added as fwdConv_naive adds it, whatever the engine
+	Tensor fwdConv_packed(double* B, Kernels::ConvShape const &shape, ConvParams const &params, int bias, ConvPlan plan);
+	double kernel(double* C, double* A, double* B, Kernels::ConvShape const &shape);
+	double kernel_simd(double* C, double* A, double* B, Kernels::ConvShape const &shape);
+	double kernel_simd_blocked(double* C, double* A, double* B, Kernels::ConvShape const &shape, int xBlock);
+	double kernel_simd_openmp(double* C, double* A, double* B, Kernels::ConvShape const &shape, int xBlock);
+	double kernel_jit(double* C, double* A, double* B, Kernels::ConvShape const &shape);
+	Tensor fwdConv_naive(Filters const &setOfFilters, ConvParams const &params, int bias);
+	Tensor fwdConv_baseline(Filters const &setOfFilters, int stride, int bias, int padding);
+	Tensor fwdConv_baseline(Filters const &setOfFilters, ConvParams const &params, int bias);
+	Tensor fwdConv_simd(Filters const &setOfFilters, int stride, int bias, int padding);
+	Tensor fwdConv_simd(Filters const &setOfFilters, int stride, int bias, int padding, int xBlock);
+	Tensor fwdConv_simd(Filters const &setOfFilters, ConvParams const &params, int bias, int xBlock);
+	Tensor fwdConv_simd_openmp(Filters const &setOfFilters, int stride, int bias, int padding);
+	Tensor fwdConv_simd_openmp(Filters const &setOfFilters, int stride, int bias, int padding, int xBlock);
+	Tensor fwdConv_simd_openmp(Filters const &setOfFilters, ConvParams const &params, int bias, int xBlock);
+	Tensor fwdConv_jit(Filters const &setOfFilters, int stride, int bias, int padding);
+	Tensor fwdConv_jit(Filters const &setOfFilters, ConvParams const &params, int bias);
+	//each group through the dense engine of the plan; depthwise layers
+	//(groups == depth == filters) take fwdConv_depthwise unless the plan is
+	//naive or baseline, which stay the reference
+	Tensor fwdConv_grouped(Filters const &setOfFilters, ConvParams const &params, int bias, ConvPlan plan);
+	Tensor fwdConv_depthwise(Filters const &setOfFilters, ConvParams const &params, int bias);
+	double kernel_depthwise(double* C, double* A, double* B, Kernels::ConvShape const &shape);
+	//1x1 convolutions without padding as one GEMM over the planar volume
+	//(filters x depth times depth x pixels), any stride, bias added in the
+	//kernel's epilogue
+	Tensor fwdConv_gemm(Filters const &setOfFilters, ConvParams const &params, int bias);
+	double kernel_gemm(double* C, double* A, double* B, Kernels::GemmShape const &shape, double bias);
+	//layers [first, first + count) as a volume of their own
+	Tensor channels(int first, int count) const;
+
+	//depth planes of (height + 2*padY) x (width + 2*padX), zeros in the border
+	void pack_inputs(double* inputs, int padY, int padX);
+	void pack_inputs_openmp(double* inputs, int padY, int padX);
+	//C back to layers, bias added to every output
+	void unpack_outputs(Tensor &outputVolume, double* C, int outHeight, int outWidth, int numberOfFilters, double bias);
+	void pack_filters_flat(double* filters, Filters const &setOfFilters, int numberOfFilters);
+	void pack_filters(double* filters, Filters const &setOfFilters, int numberOfFilters);
+	void pack_filters_openmp(double* filters, Filters const &setOfFilters, int numberOfFilters);
+	//the pack_filters layout widened from 16-bit filters, in parallel over groups of 4
+	void pack_filters_half(double* filters, HalfFilters const &half);
+	//the input in the (depth, row, column) order of the fully connected weights
+	void pack_fc_inputs(double* inputs);
+	//depth planes of the pixels a strided 1x1 filter reads, every strideY-th
+	//row and strideX-th column, and the planar C of kernel_gemm back to layers
+	void pack_planes(double* inputs, int strideY, int strideX);
+	void unpack_planes(Tensor &outputVolume, double* C, int outHeight, int outWidth, int numberOfFilters);
+	//channel-blocked layouts of the depthwise kernel (Kernels::DepthwiseRowFn)
+	void pack_inputs_blocked(double* inputs, int padY, int padX);
+	void pack_filters_depthwise(double* filters, Filters const &setOfFilters);
+	void unpack_outputs_blocked(Tensor &outputVolume, double* C, int outHeight, int outWidth, int channels, double bias);
+
+protected:
+	int height;
+	int width;
+	int depth;
+
+};
+
+#endif
@@ -0,0 +1,237 @@
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+#include "TensorFile.h"
+
+using namespace std;
+
+static_assert(sizeof(TensorFileHeader) == 128, "TensorFile: the header must stay 128 bytes.");
+
+static size_t dtypeSize(unsigned int dtype)
+{
+    return dtype == DTYPE_FLOAT32 ? sizeof(float) : sizeof(double);
+}
+
+//index of (d, y, x) in the stored order
+static size_t offsetOf(TensorFileHeader const &header, int d, int y, int x)
+{
+    if (header.layout == LAYOUT_HWC)
+        return ((size_t)y*header.width + x)*header.depth + d;
+    return ((size_t)d*header.height + y)*header.width + x;
+}
+
+//------------------------------------------------------------------ TensorView
+
+TensorView::TensorView() : mapping(NULL), mappedBytes(0), values(NULL)
+{
+    memset(&header, 0, sizeof(header));
+}
+
+TensorView::TensorView(string const &path) : mapping(NULL), mappedBytes(0), values(NULL)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        throw runtime_error("TensorFile: cannot open " + path);
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(TensorFileHeader)) {
+        close(fd);
+        throw runtime_error("TensorFile: " + path + " is too short for a tensor header.");
+    }
+
+    mappedBytes = info.st_size;
+    mapping = mmap(NULL, mappedBytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        mapping = NULL;
+        throw runtime_error("TensorFile: cannot map " + path);
+    }
+
+    memcpy(&header, mapping, sizeof(header));
+
+    const char* problem = NULL;
+    if (memcmp(header.magic, TensorFile::MAGIC, sizeof(TensorFile::MAGIC)) != 0)
+        problem = "is not a tensor file";
+    else if (header.version != TensorFile::VERSION)
+        problem = "has an unsupported version";
+    else if (header.dtype > DTYPE_FLOAT32 || header.layout > LAYOUT_HWC)
+        problem = "has an unknown dtype or layout";
+    else if (header.alignment < 64 || (header.alignment & (header.alignment - 1)) || header.dataOffset % header.alignment)
+        problem = "has a misaligned data offset";
+    else if (header.dataBytes != header.height*header.width*header.depth*dtypeSize(header.dtype)
+             || header.dataOffset + header.dataBytes > mappedBytes)
+        problem = "is truncated or its shape does not match its size";
+
+    if (problem) {
+        release();
+        throw runtime_error("TensorFile: " + path + " " + problem + ".");
+    }
+
+    values = (const unsigned char*) mapping + header.dataOffset;
+
+    //the whole tensor is read right away, start the page-in now
+    madvise(mapping, mappedBytes, MADV_WILLNEED);
+}
+
+TensorView::TensorView(TensorView &&other) : mapping(other.mapping), mappedBytes(other.mappedBytes),
+                                             header(other.header), values(other.values)
+{
+    other.mapping = NULL;
+    other.values = NULL;
+}
+
+TensorView& TensorView::operator=(TensorView &&other)
+{
+    if (this != &other) {
+        release();
+        mapping = other.mapping;
+        mappedBytes = other.mappedBytes;
+        header = other.header;
+        values = other.values;
+        other.mapping = NULL;
+        other.values = NULL;
+    }
+    return *this;
+}
+
+TensorView::~TensorView()
+{
+    release();
+}
+
+void TensorView::release()
+{
+    if (mapping)
+        munmap(mapping, mappedBytes);
+    mapping = NULL;
+    values = NULL;
+}
+
+int TensorView::getHeight() const
+{
+    return (int)header.height;
+}
+
+int TensorView::getWidth() const
+{
+    return (int)header.width;
+}
+
+int TensorView::getDepth() const
+{
+    return (int)header.depth;
+}
+
+TensorDtype TensorView::getDtype() const
+{
+    return (TensorDtype)header.dtype;
+}
+
+TensorLayout TensorView::getLayout() const
+{
+    return (TensorLayout)header.layout;
+}
+
+const void* TensorView::data() const
+{
+    return values;
+}
+
+const double* TensorView::doubles() const
+{
+    return header.dtype == DTYPE_FLOAT64 ? (const double*) values : NULL;
+}
+
+double TensorView::at(int d, int y, int x) const
+{
+    size_t index = offsetOf(header, d, y, x);
+    if (header.dtype == DTYPE_FLOAT32)
+        return ((const float*) values)[index];
+    return ((const double*) values)[index];
+}
+
+Tensor TensorView::toTensor() const
+{
+    Tensor tensor = Tensor(getHeight(), getWidth());
+
+    for (int d = 0; d < getDepth(); d++) {
+        vector<vector<double> > plane(getHeight(), vector<double>(getWidth()));
+        for (int y = 0; y < getHeight(); y++) {
+            //CHW float64 rows are contiguous, everything else goes value by value
+            if (header.layout == LAYOUT_CHW && header.dtype == DTYPE_FLOAT64) {
+                const double* row = (const double*) values + offsetOf(header, d, y, 0);
+                plane[y].assign(row, row + getWidth());
+            } else {
+                for (int x = 0; x < getWidth(); x++)
+                    plane[y][x] = at(d, y, x);
+            }
+        }
+        tensor.addLayer(Matrix(plane));
+    }
+    return tensor;
+}
+
+//------------------------------------------------------------------ TensorFile
+
+namespace TensorFile
+{
+    void write(string const &path, Tensor const &tensor, TensorDtype dtype, TensorLayout layout)
+    {
+        int height = tensor.getHeight();
+        int width = tensor.getWidth();
+        int depth = tensor.getDepth();
+
+        vector<double> values((size_t)height*width*depth);
+        for (int d = 0; d < depth; d++) {
+            for (int y = 0; y < height; y++) {
+                for (int x = 0; x < width; x++) {
+                    size_t index = layout == LAYOUT_HWC ? ((size_t)y*width + x)*depth + d : ((size_t)d*height + y)*width + x;
+                    values[index] = tensor.layers[d].matrix[y][x];
+                }
+            }
+        }
+
+        write(path, values.data(), height, width, depth, dtype, layout);
+    }
+
+    void write(string const &path, const double* values, int height, int width, int depth,
+               TensorDtype dtype, TensorLayout layout)
+    {
+        if (height < 1 || width < 1 || depth < 1)
+            throw logic_error("Invalid: tensor files need a non-empty shape.");
+
+        TensorFileHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = VERSION;
+        header.dtype = dtype;
+        header.layout = layout;
+        header.alignment = 64;
+        header.height = height;
+        header.width = width;
+        header.depth = depth;
+        header.dataOffset = sizeof(header);
+        header.dataBytes = (unsigned long long)height*width*depth*dtypeSize(dtype);
+
+        ofstream out(path.c_str(), ios::binary | ios::trunc);
+        if (!out)
+            throw runtime_error("TensorFile: cannot write " + path);
+
+        out.write((const char*) &header, sizeof(header));
+        size_t count = (size_t)height*width*depth;
+        if (dtype == DTYPE_FLOAT32) {
+            vector<float> narrowed(values, values + count);
+            out.write((const char*) narrowed.data(), count*sizeof(float));
+        } else {
+            out.write((const char*) values, count*sizeof(double));
+        }
+
+        if (!out)
+            throw runtime_error("TensorFile: short write to " + path);
+    }
+}
@@ -0,0 +1,102 @@
+#ifndef DEF_TENSOR_FILE
+#define DEF_TENSOR_FILE
+
+#include <string>
+#include "Tensor.h"
+
+//Versioned binary tensor files, read by mapping them: a 128 byte header
+//followed by the raw values at an aligned offset, so loading is an mmap and a
+//header check with no parsing and no copies. tools/convert turns the
+//whitespace text layers into this format.
+//
+//  offset  field
+//       0  magic "FCTENSOR"
+//       8  uint32 version (1)
+//      12  uint32 dtype (Dtype)
+//      16  uint32 layout (Layout)
+//      20  uint32 alignment of the data offset, a power of two >= 64
+//      24  uint64 height, width, depth
+//      48  uint64 data offset
+//      56  uint64 data bytes
+//  64-127  reserved, zero
+//
+//Values are little endian, as on every host the kernels run on.
+enum TensorDtype
+{
+	DTYPE_FLOAT64,
+	DTYPE_FLOAT32
+};
+
+enum TensorLayout
+{
+	LAYOUT_CHW, //depth planes of height x width, the order Tensor::pack_inputs reads
+	LAYOUT_HWC  //channels innermost, the order the conv kernels write
+};
+
+struct TensorFileHeader
+{
+	char magic[8];
+	unsigned int version;
+	unsigned int dtype;
+	unsigned int layout;
+	unsigned int alignment;
+	unsigned long long height;
+	unsigned long long width;
+	unsigned long long depth;
+	unsigned long long dataOffset;
+	unsigned long long dataBytes;
+	unsigned char reserved[64];
+};
+
+//Read-only view of a mapped tensor file. The mapping lives as long as the
+//view; moving transfers it, copying is not allowed.
+class TensorView
+{
+public:
+	TensorView();
+	//throws runtime_error when the file cannot be mapped or is not a tensor file
+	explicit TensorView(std::string const &path);
+	TensorView(TensorView &&other);
+	TensorView& operator=(TensorView &&other);
+	~TensorView();
+
+	TensorView(TensorView const &) = delete;
+	TensorView& operator=(TensorView const &) = delete;
+
+	int getHeight() const;
+	int getWidth() const;
+	int getDepth() const;
+	TensorDtype getDtype() const;
+	TensorLayout getLayout() const;
+
+	//the mapped values, aligned to the header's alignment
+	const void* data() const;
+	//null unless the dtype is DTYPE_FLOAT64
+	const double* doubles() const;
+	double at(int d, int y, int x) const;
+
+	//copies into the vector-of-matrices Tensor the engines take
+	Tensor toTensor() const;
+
+private:
+	void* mapping;
+	size_t mappedBytes;
+	TensorFileHeader header;
+	const unsigned char* values;
+
+	void release();
+};
+
+namespace TensorFile
+{
+	const char MAGIC[8] = {'F', 'C', 'T', 'E', 'N', 'S', 'O', 'R'};
+	const unsigned int VERSION = 1;
+
+	//throws runtime_error when the file cannot be written
+	void write(std::string const &path, Tensor const &tensor, TensorDtype dtype, TensorLayout layout);
+	//values holds height*width*depth doubles in the given layout
+	void write(std::string const &path, const double* values, int height, int width, int depth,
+	           TensorDtype dtype, TensorLayout layout);
+}
+
+#endif
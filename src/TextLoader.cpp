@@ -0,0 +1,362 @@
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <locale.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <omp.h>
+#include "TextLoader.h"
+
+using namespace std;
+
+//files below this are parsed by one thread, splitting would cost more than it saves
+static const size_t MIN_CHUNK_BYTES = 64*1024;
+
+//powers of ten that are exact in a double
+static const double exactPowers[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static inline bool isBlank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v';
+}
+
+static inline bool isDigit(char c)
+{
+    return (unsigned)(c - '0') < 10;
+}
+
+//strtod for whatever the fast path cannot convert exactly, pinned to the C
+//locale; returns the characters consumed
+static int slowParse(const char* text, size_t length, double &value)
+{
+    static locale_t cLocale = newlocale(LC_ALL_MASK, "C", (locale_t) 0);
+
+    //the mapping is not NUL terminated, numbers are copied out first
+    char buffer[64];
+    string longer;
+    const char* copy = buffer;
+    if (length < sizeof(buffer)) {
+        memcpy(buffer, text, length);
+        buffer[length] = '\0';
+    } else {
+        longer.assign(text, length);
+        copy = longer.c_str();
+    }
+
+    char* parsedEnd;
+    value = strtod_l(copy, &parsedEnd, cLocale);
+    return (int)(parsedEnd - copy);
+}
+
+//whitespace-separated values on one line: every non-blank byte that follows a
+//blank one starts a token, a branch-free loop the compiler vectorises
+static int countTokens(const char* line, const char* end)
+{
+    if (line == end)
+        return 0;
+
+    int starts = !isBlank(line[0]);
+    long length = end - line;
+    for (long i = 1; i < length; i++)
+        starts += !isBlank(line[i]) & isBlank(line[i - 1]);
+    return starts;
+}
+
+struct Chunk
+{
+    const char* begin;
+    const char* end;
+    long rows;
+    long values;
+    int minWidth;
+    int maxWidth;
+    const char* error; //first token that is not a number
+};
+
+//maps the file and counts rows and values per chunk, so parse() can write
+//every chunk straight into its slice of the output
+class TextFile
+{
+public:
+    TextFile(string const &path) : path(path), mapping(NULL), size(0), height(0), width(0)
+    {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            throw runtime_error("TextLoader: cannot open " + path);
+
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+            close(fd);
+            throw runtime_error("TextLoader: cannot stat " + path);
+        }
+
+        size = info.st_size;
+        if (size > 0) {
+            mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping == MAP_FAILED) {
+                close(fd);
+                throw runtime_error("TextLoader: cannot map " + path);
+            }
+            madvise(mapping, size, MADV_SEQUENTIAL);
+        }
+        close(fd);
+
+        split();
+        count();
+    }
+
+    ~TextFile()
+    {
+        if (mapping)
+            munmap(mapping, size);
+    }
+
+    void parse(double* out)
+    {
+        vector<long> offsets(chunks.size());
+        long offset = 0;
+        for (size_t c = 0; c < chunks.size(); c++) {
+            offsets[c] = offset;
+            offset += chunks[c].values;
+        }
+
+        #pragma omp parallel for schedule(dynamic, 1) if (chunks.size() > 1)
+        for (size_t c = 0; c < chunks.size(); c++)
+            parseChunk(chunks[c], out + offsets[c]);
+
+        for (size_t c = 0; c < chunks.size(); c++) {
+            if (chunks[c].error) {
+                const char* token = chunks[c].error;
+                const char* tokenEnd = token;
+                while (tokenEnd < chunks[c].end && tokenEnd - token < 32 && !isBlank(*tokenEnd) && *tokenEnd != '\n')
+                    tokenEnd++;
+                throw runtime_error("TextLoader: " + path + " has a token that is not a number: '" + string(token, tokenEnd) + "'");
+            }
+        }
+    }
+
+    string path;
+    void* mapping;
+    size_t size;
+    int height;
+    int width;
+    vector<Chunk> chunks;
+
+private:
+    //chunk boundaries move forward to the next line start
+    void split()
+    {
+        const char* text = (const char*) mapping;
+        size_t count = size/MIN_CHUNK_BYTES;
+        size_t wanted = 4*omp_get_max_threads();
+        if (count > wanted)
+            count = wanted;
+        if (count < 1)
+            count = 1;
+
+        const char* begin = text;
+        for (size_t c = 1; c <= count && begin < text + size; c++) {
+            const char* end = text + size*c/count;
+            if (end < begin)
+                end = begin;
+            if (c < count) {
+                const char* newline = (const char*) memchr(end, '\n', text + size - end);
+                end = newline ? newline + 1 : text + size;
+            }
+
+            Chunk chunk = {begin, end, 0, 0, 0, 0, NULL};
+            chunks.push_back(chunk);
+            begin = end;
+        }
+    }
+
+    void count()
+    {
+        #pragma omp parallel for schedule(dynamic, 1) if (chunks.size() > 1)
+        for (size_t c = 0; c < chunks.size(); c++) {
+            Chunk &chunk = chunks[c];
+            const char* line = chunk.begin;
+            while (line < chunk.end) {
+                const char* newline = (const char*) memchr(line, '\n', chunk.end - line);
+                const char* lineEnd = newline ? newline : chunk.end;
+
+                int tokens = countTokens(line, lineEnd);
+                if (tokens > 0) {
+                    if (chunk.rows == 0 || tokens < chunk.minWidth)
+                        chunk.minWidth = tokens;
+                    if (tokens > chunk.maxWidth)
+                        chunk.maxWidth = tokens;
+                    chunk.rows++;
+                    chunk.values += tokens;
+                }
+                line = lineEnd + 1;
+            }
+        }
+
+        long rows = 0;
+        for (size_t c = 0; c < chunks.size(); c++) {
+            if (chunks[c].rows == 0)
+                continue;
+            if (rows == 0)
+                width = chunks[c].minWidth;
+            if (chunks[c].minWidth != width || chunks[c].maxWidth != width)
+                throw runtime_error("TextLoader: " + path + " has rows of different lengths.");
+            rows += chunks[c].rows;
+        }
+
+        if (rows == 0)
+            throw runtime_error("TextLoader: " + path + " has no values.");
+        height = (int)rows;
+    }
+
+    static void parseChunk(Chunk &chunk, double* out)
+    {
+        const char* p = chunk.begin;
+        const char* end = chunk.end;
+
+        while (p < end) {
+            while (p < end && (isBlank(*p) || *p == '\n'))
+                p++;
+            if (p == end)
+                break;
+
+            int consumed = TextLoader::parseDouble(p, end, *out);
+            if (consumed == 0 || (p + consumed < end && !isBlank(p[consumed]) && p[consumed] != '\n')) {
+                chunk.error = p;
+                return;
+            }
+            out++;
+            p += consumed;
+        }
+    }
+};
+
+namespace TextLoader
+{
+    //Clinger's fast path: up to 19 significant digits and a power of ten that
+    //is exact in a double give a correctly rounded result with one multiply or
+    //divide; everything else (long mantissas, large exponents, inf, nan) goes to strtod
+    int parseDouble(const char* text, const char* end, double &value)
+    {
+        const char* p = text;
+        bool negative = false;
+        if (p < end && (*p == '-' || *p == '+')) {
+            negative = *p == '-';
+            p++;
+        }
+
+        unsigned long long mantissa = 0;
+        int significant = 0;
+        int exponent = 0;
+        bool digits = false;
+        bool exact = true;
+
+        for (; p < end && isDigit(*p); p++) {
+            digits = true;
+            if (mantissa == 0 && *p == '0')
+                continue;
+            if (significant++ < 19)
+                mantissa = mantissa*10 + (*p - '0');
+            else
+                exact = false;
+        }
+        if (p < end && *p == '.') {
+            p++;
+            for (; p < end && isDigit(*p); p++) {
+                digits = true;
+                if (mantissa == 0 && *p == '0') {
+                    exponent--;
+                    continue;
+                }
+                if (significant++ < 19) {
+                    mantissa = mantissa*10 + (*p - '0');
+                    exponent--;
+                } else {
+                    exact = false;
+                }
+            }
+        }
+
+        if (!digits) {
+            //inf, nan and friends
+            const char* word = p;
+            while (p < end && ((*p | 0x20) >= 'a' && (*p | 0x20) <= 'z'))
+                p++;
+            if (p == word)
+                return 0;
+            return slowParse(text, p - text, value);
+        }
+
+        if (p < end && (*p == 'e' || *p == 'E')) {
+            const char* q = p + 1;
+            bool negativeExponent = false;
+            if (q < end && (*q == '-' || *q == '+')) {
+                negativeExponent = *q == '-';
+                q++;
+            }
+            if (q < end && isDigit(*q)) {
+                int e = 0;
+                for (; q < end && isDigit(*q); q++) {
+                    if (e < 100000)
+                        e = e*10 + (*q - '0');
+                }
+                exponent += negativeExponent ? -e : e;
+                p = q;
+            }
+        }
+
+        if (mantissa == 0) {
+            value = negative ? -0.0 : 0.0;
+        } else if (exact && mantissa <= (1ULL << 53) && exponent >= -22 && exponent <= 22) {
+            double v = (double)mantissa;
+            v = exponent < 0 ? v/exactPowers[-exponent] : v*exactPowers[exponent];
+            value = negative ? -v : v;
+        } else {
+            slowParse(text, p - text, value);
+        }
+        return (int)(p - text);
+    }
+
+    void load(string const &path, vector<double> &values, int &height, int &width)
+    {
+        TextFile file(path);
+        values.resize((size_t)file.height*file.width);
+        file.parse(values.data());
+        height = file.height;
+        width = file.width;
+    }
+
+    double* loadChannels(vector<string> const &paths, int &height, int &width)
+    {
+        if (paths.empty())
+            throw logic_error("Invalid: loadChannels needs at least one file.");
+
+        height = width = 0;
+        double* out = NULL;
+        for (size_t c = 0; c < paths.size(); c++) {
+            TextFile file(paths[c]);
+            if (c == 0) {
+                height = file.height;
+                width = file.width;
+                if (posix_memalign((void**) &out, 64, paths.size()*height*width*sizeof(double)) != 0)
+                    throw bad_alloc();
+            } else if (file.height != height || file.width != width) {
+                free(out);
+                throw runtime_error("TextLoader: " + paths[c] + " does not match the shape of " + paths[0]);
+            }
+
+            try {
+                file.parse(out + c*height*width);
+            } catch (...) {
+                free(out);
+                throw;
+            }
+        }
+        return out;
+    }
+}
@@ -0,0 +1,29 @@
+#ifndef DEF_TEXT_LOADER
+#define DEF_TEXT_LOADER
+
+#include <string>
+#include <vector>
+
+//Parser for the whitespace-delimited matrices upstream tools produce (one
+//row per line). The file is mapped, split at line boundaries into chunks and
+//parsed on every OpenMP thread in two passes: count the values per chunk,
+//then parse each chunk straight into its slice of the output. Numbers go
+//through a locale-free scanner; the few it cannot convert exactly fall back
+//to strtod in the C locale.
+//
+//  int height, width;
+//  double* chw = TextLoader::loadChannels(paths, height, width); //64-byte aligned, free() it
+namespace TextLoader
+{
+	//parses one number at text, returns the characters consumed or 0 when there is none
+	int parseDouble(const char* text, const char* end, double &value);
+
+	//row-major values of one file; throws runtime_error when it cannot be read,
+	//a token is not a number or the rows differ in length (blank lines are skipped)
+	void load(std::string const &path, std::vector<double> &values, int &height, int &width);
+
+	//one file per channel into a contiguous, 64-byte aligned CHW buffer
+	double* loadChannels(std::vector<std::string> const &paths, int &height, int &width);
+}
+
+#endif
@@ -0,0 +1,45 @@
+#include <chrono>
+#include <cpuid.h>
+#include "Timer.h"
+
+using namespace std;
+
+#define CALIBRATION_MS 50
+
+static double calibrate()
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    unsigned long long c0 = Timer::rdtsc();
+    chrono::steady_clock::time_point now;
+
+    do {
+        now = chrono::steady_clock::now();
+    } while (now - start < chrono::milliseconds(CALIBRATION_MS));
+
+    unsigned long long c1 = Timer::rdtsc();
+    return (double)(c1 - c0) / chrono::duration<double>(now - start).count();
+}
+
+namespace Timer
+{
+    double tscHz()
+    {
+        //measured on first use, thread safe in C++11
+        static const double hz = calibrate();
+        return hz;
+    }
+
+    //CPUID 0x80000007 EDX bit 8: the TSC ticks at a constant rate in every P/C-state
+    bool invariantTsc()
+    {
+        unsigned eax, ebx, ecx, edx;
+        if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx))
+            return false;
+        return (edx >> 8) & 1;
+    }
+
+    double seconds(unsigned long long cycles)
+    {
+        return (double)cycles / tscHz();
+    }
+}
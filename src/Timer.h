@@ -0,0 +1,21 @@
+#ifndef DEF_TIMER
+#define DEF_TIMER
+
+//Cycle timing without hard-coded clock constants: the TSC is read directly and
+//converted with a frequency calibrated against steady_clock once per process.
+namespace Timer
+{
+	inline unsigned long long rdtsc()
+	{
+		unsigned hi, lo;
+		//lfence keeps earlier loads/FMAs from drifting past the timestamp
+		__asm__ __volatile__ ("lfence\n\trdtsc" : "=a"(lo), "=d"(hi) :: "memory");
+		return ((unsigned long long)lo) | (((unsigned long long)hi) << 32);
+	}
+
+	double tscHz();
+	bool invariantTsc();
+	double seconds(unsigned long long cycles);
+}
+
+#endif
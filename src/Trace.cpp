@@ -0,0 +1,168 @@
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <mutex>
+#include <set>
+#include <vector>
+#include "Trace.h"
+
+using namespace std;
+
+#define TRACE_RING_EVENTS (1 << 16)
+#define TRACE_FILE_ENV "FASTCODE_TRACE_FILE"
+
+namespace
+{
+    //single writer (the owning thread), read by the exporter
+    struct Ring
+    {
+        int tid;
+        atomic<unsigned long> head;
+        Trace::Event events[TRACE_RING_EVENTS];
+    };
+
+    //only touched when a thread records its first event or on export
+    mutex registryLock;
+    vector<Ring*> rings;
+    set<string> names;
+    //timestamps are exported relative to program start
+    unsigned long long origin = Timer::rdtsc();
+
+    //set by LayerScope on the thread that runs the layer
+    thread_local const char* currentLayer = NULL;
+
+    void exportAtExit()
+    {
+        const char* path = getenv(TRACE_FILE_ENV);
+        if (path != NULL)
+            Trace::writeChrome(path);
+    }
+
+    Ring* registerThread()
+    {
+        //rings outlive their threads so the exporter never reads freed memory
+        Ring* ring = new Ring();
+        ring->head.store(0);
+
+        lock_guard<mutex> guard(registryLock);
+        if (rings.empty())
+            atexit(exportAtExit);
+        ring->tid = rings.size();
+        rings.push_back(ring);
+        return ring;
+    }
+
+    Ring* threadRing()
+    {
+        static thread_local Ring* ring = registerThread();
+        return ring;
+    }
+
+    string escape(const char* text)
+    {
+        string escaped;
+        for (; text != NULL && *text; text++) {
+            if (*text == '"' || *text == '\\')
+                escaped += '\\';
+            escaped += *text;
+        }
+        return escaped;
+    }
+}
+
+namespace Trace
+{
+    void record(const char* category, const char* name, unsigned long long begin, unsigned long long end)
+    {
+        Ring* ring = threadRing();
+        unsigned long head = ring->head.load(memory_order_relaxed);
+
+        Event &event = ring->events[head % TRACE_RING_EVENTS];
+        event.category = category;
+        event.name = name;
+        event.layer = currentLayer;
+        event.begin = begin;
+        event.end = end;
+
+        ring->head.store(head + 1, memory_order_release);
+    }
+
+    const char* intern(string const &name)
+    {
+        lock_guard<mutex> guard(registryLock);
+        return names.insert(name).first->c_str();
+    }
+
+    const char* layer()
+    {
+        return currentLayer;
+    }
+
+    bool writeChrome(string const &path)
+    {
+        ofstream out(path.c_str());
+        if (!out)
+            return false;
+
+        lock_guard<mutex> guard(registryLock);
+        double microseconds = 1e6 / Timer::tscHz();
+
+        out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+        bool first = true;
+
+        for (size_t r = 0; r < rings.size(); r++) {
+            Ring* ring = rings[r];
+            out << (first ? "" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << ring->tid
+                << ", \"args\": {\"name\": \"thread " << ring->tid << "\"}}";
+            first = false;
+
+            unsigned long head = ring->head.load(memory_order_acquire);
+            unsigned long start = head > TRACE_RING_EVENTS ? head - TRACE_RING_EVENTS : 0;
+
+            for (unsigned long i = start; i < head; i++) {
+                Event const &event = ring->events[i % TRACE_RING_EVENTS];
+                out << ",\n{\"name\": \"" << escape(event.name) << "\", \"cat\": \"" << escape(event.category)
+                    << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << ring->tid
+                    << ", \"ts\": " << (double)(event.begin - origin) * microseconds
+                    << ", \"dur\": " << (double)(event.end - event.begin) * microseconds;
+                if (event.layer != NULL)
+                    out << ", \"args\": {\"layer\": \"" << escape(event.layer) << "\"}";
+                out << "}";
+            }
+        }
+
+        out << "\n]}\n";
+        return (bool)out;
+    }
+
+    void clear()
+    {
+        lock_guard<mutex> guard(registryLock);
+        for (size_t r = 0; r < rings.size(); r++)
+            rings[r]->head.store(0, memory_order_release);
+    }
+
+    LayerScope::LayerScope(string const &name)
+    {
+        layer = intern(name);
+        previous = currentLayer;
+        currentLayer = layer;
+        begin = Timer::rdtsc();
+    }
+
+    LayerScope::~LayerScope()
+    {
+        record("layer", layer, begin, Timer::rdtsc());
+        currentLayer = previous;
+    }
+
+    InheritLayer::InheritLayer(const char* layer) : previous(currentLayer)
+    {
+        currentLayer = layer;
+    }
+
+    InheritLayer::~InheritLayer()
+    {
+        currentLayer = previous;
+    }
+}
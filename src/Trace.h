@@ -0,0 +1,98 @@
+#ifndef DEF_TRACE
+#define DEF_TRACE
+
+#include <string>
+#include "Timer.h"
+
+//Scoped spans recorded into per-thread ring buffers and exported as Chrome
+//trace JSON (chrome://tracing, Perfetto). Build with `make TRACE=1` (defines
+//FASTCODE_TRACE); otherwise the macros expand to nothing and cost nothing.
+//
+//  TRACE_SCOPE("pack", "inputs");   //span until the end of the enclosing block
+//  TRACE_LAYER("conv1_1");          //attributes the calling thread's spans to a layer
+//
+//The layer is per thread, so images or pipeline stages running different
+//layers at once are attributed correctly. A parallel region hands its
+//layer to the workers:
+//
+//  TRACE_CAPTURE_LAYER(traceLayer);
+//  #pragma omp parallel
+//  { TRACE_INHERIT_LAYER(traceLayer); TRACE_SCOPE("kernel", "rows"); ... }
+//
+//FASTCODE_TRACE_FILE=trace.json writes the trace at exit.
+namespace Trace
+{
+	struct Event
+	{
+		const char* category;
+		const char* name;
+		const char* layer;
+		unsigned long long begin;
+		unsigned long long end;
+	};
+
+	//appends to the calling thread's ring, the oldest events are overwritten when it is full
+	void record(const char* category, const char* name, unsigned long long begin, unsigned long long end);
+
+	//stable pointer for a name built at run time
+	const char* intern(std::string const &name);
+
+	//the calling thread's layer, NULL outside a LayerScope
+	const char* layer();
+
+	//call while no spans are open; returns false when the file cannot be written
+	bool writeChrome(std::string const &path);
+	void clear();
+
+	class Span
+	{
+	public:
+		Span(const char* category, const char* name) : category(category), name(name), begin(Timer::rdtsc()) {}
+		~Span() { record(category, name, begin, Timer::rdtsc()); }
+
+	private:
+		const char* category;
+		const char* name;
+		unsigned long long begin;
+	};
+
+	class LayerScope
+	{
+	public:
+		LayerScope(std::string const &name);
+		~LayerScope();
+
+	private:
+		const char* layer;
+		const char* previous;
+		unsigned long long begin;
+	};
+
+	//sets the calling thread's layer for a block without recording a span
+	class InheritLayer
+	{
+	public:
+		InheritLayer(const char* layer);
+		~InheritLayer();
+
+	private:
+		const char* previous;
+	};
+}
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+#ifdef FASTCODE_TRACE
+#define TRACE_SCOPE(category, name) Trace::Span TRACE_CONCAT(traceSpan, __LINE__)(category, name)
+#define TRACE_LAYER(name) Trace::LayerScope TRACE_CONCAT(traceLayer, __LINE__)(name)
+#define TRACE_CAPTURE_LAYER(variable) const char* variable = Trace::layer()
+#define TRACE_INHERIT_LAYER(variable) Trace::InheritLayer TRACE_CONCAT(traceInherit, __LINE__)(variable)
+#else
+#define TRACE_SCOPE(category, name) ((void)0)
+#define TRACE_LAYER(name) ((void)0)
+#define TRACE_CAPTURE_LAYER(variable) ((void)0)
+#define TRACE_INHERIT_LAYER(variable) ((void)0)
+#endif
+
+#endif
@@ -1,120 +1,771 @@
-#include <iostream>
-#include <vector>
-#include <fstream>
-#include <sstream>
-#include <iterator>
-#include <time.h>
-#include "Matrix.h"
-#include "Tensor.h"
-#include "Filters.h"
-#include "Utility.h"
-
-using namespace std;
-
-void test_pack_filters(){
-    // 224x224x3 input layer
-    Tensor data_layer = Tensor(64, 64);
-    data_layer.addLayer(Utility::createMatrixFromFile("layers/input_layer_64x64"));
-    data_layer.addLayer(Utility::createMatrixFromFile("layers/input_layer_64x64"));
-    data_layer.addLayer(Utility::createMatrixFromFile("layers/input_layer_64x64"));
-
-    // // 3x3x3 x 64 filters
-    Filters kernel_conv1_1 = Filters(3, 3, 3, 64);
-
-    cout << "______test_224x224_Conv Test Start_______________________\n" << endl;
-    cout << "---- Test [Fwd Convolution] ----" << endl;
-
-    double* output = new double[3*3*3*64];
-
-    data_layer.pack_filters(output,kernel_conv1_1,64,3);
-
-    for(int i = 0; i < 4; i++){
-        cout<<"---this is the "<<i<< "kernel----"<<endl;
-        for(int j = 0; j < 3; j++){
-            Matrix matrix = kernel_conv1_1.getFilter(i).getLayer(j);
-            cout<<matrix.getIndexValue(0,0)<<matrix.getIndexValue(0,1)<<matrix.getIndexValue(0,2)<<endl;
-            cout<<matrix.getIndexValue(1,0)<<matrix.getIndexValue(1,1)<<matrix.getIndexValue(1,2)<<endl;
-            cout<<matrix.getIndexValue(2,0)<<matrix.getIndexValue(2,1)<<matrix.getIndexValue(2,2)<<endl;
-        }
-        
-        
-    }
-    cout<<"---this is the output----"<<endl;
-    for(int i = 0; i<27; i++){
-        cout<<output[i*4]<<output[i*4+1]<<output[i*4+2]<<output[i*4+3]<<endl;
-    }
-}
-
-//Testing convolution on 224x224x3 Tensor with 64 filters: 3x3x3 and stride 1, pad 1
-void test_224x224_Conv() {
-    int padding = 1;
-    int stride = 1;
-    int bias = 0;
-
-    // 224x224x3 input layer
-    Tensor data_layer = Tensor(64, 64);
-    data_layer.addLayer(Utility::createMatrixFromFile("layers/input_layer_64x64"));
-    data_layer.addLayer(Utility::createMatrixFromFile("layers/input_layer_64x64"));
-    data_layer.addLayer(Utility::createMatrixFromFile("layers/input_layer_64x64"));
-
-    // // 3x3x3 x 64 filters
-    Filters kernel_conv1_1 = Filters(3, 3, 3, 64);
-
-    cout << "______test_224x224_Conv Test Start_______________________\n" << endl;
-    cout << "---- Test [Fwd Convolution] ----" << endl;
-
-    Tensor conv1_1_layer = data_layer.fwdConv(kernel_conv1_1, stride, bias, padding);
-    Tensor conv1_1_layer_baseline = data_layer.fwdConv_baseline(kernel_conv1_1, stride, bias, padding); // TURBO Cycles Taken for Baseline: 1494804815.000000
-    Tensor conv1_1_layer_simd = data_layer.fwdConv_simd(kernel_conv1_1, stride, bias, padding); // TURBO Cycles Taken for SIMD: 484215675.000000
-    Tensor conv1_1_layer_simd_openmp = data_layer.fwdConv_simd_openmp(kernel_conv1_1, stride, bias, padding);
-
-    cout << "conv1_1_layer output: " << endl;
-    conv1_1_layer.getLayer(3).print();
-    cout << "== end conv1_1_layer output: " << endl;
-
-    cout << "conv1_1_layer_baseline output: " << endl;
-    conv1_1_layer_baseline.getLayer(3).print();
-    cout << "== end conv1_1_layer_baseline output: " << endl;
-
-    cout << "conv1_1_layer_simd output: " << endl;
-    conv1_1_layer_simd.getLayer(3).print();
-    cout << "== end conv1_1_layer_simd output: " << endl;
-
-    cout << "conv1_1_layer_simd_openmp output: " << endl;
-    conv1_1_layer_simd_openmp.getLayer(3).print();
-    cout << "== end conv1_1_layer_simd_openmp output: " << endl;
-
-    cout << "\n[Input volume]: 224x224x3 --> Convolution (filter: 3x3x3 * 64 @ stride=1, padding=1) --> [Output volume]: "
-         << conv1_1_layer.getHeight() << "x"
-         << conv1_1_layer.getWidth() << "x"
-         << conv1_1_layer.getDepth() << endl;
-
-    // printing first layer of output volume to see if it actually convolved input layer
-    cout << "---- [Input matrix layer 0] ----" << endl;
-    data_layer.getLayer(0).print();
-    // cout << "---- [Input matrix layer 1] ----" << endl;
-    // data_layer.getLayer(1).print();
-    // cout << "---- [Input matrix layer 2] ----" << endl;
-    // data_layer.getLayer(2).print();
-
-    cout << "###### FILTER 0  #####" << endl;
-    kernel_conv1_1.getFilter(0).getLayer(0).print();
-    // cout << "###### FILTER 0  #####" << endl;
-    // kernel_conv1_1.getFilter(0).getLayer(1).print();
-    // cout << "###### FILTER 0  #####" << endl;
-    // kernel_conv1_1.getFilter(0).getLayer(2).print();
-
-    cout << "######################" << endl;
-    conv1_1_layer.getLayer(0).print();
-    cout << "Output volume ->  " << conv1_1_layer.getHeight() << "x" << conv1_1_layer.getWidth() << "x" << conv1_1_layer.getDepth() << endl;
-
-    cout << "\n___________________Test End_________________________\n" << endl;
-}
-
-int main(int argc, char* argv[]) {
-    // srand(time(0)); //used for setting random values for filters
-    srand(1); //used for setting random values for filters
-    test_224x224_Conv();
-    // test_pack_filters();
-    return 0;
-}	
+#include <iostream>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iterator>
+#include <time.h>
+#include <cmath>
+#include <cstring>
+#include <unistd.h>
+#include "Matrix.h"
+#include "Tensor.h"
+#include "Filters.h"
+#include "Utility.h"
+#include "Autotuner.h"
+#include "Jit.h"
+#include "Image.h"
+#include "LayerPipeline.h"
+#include "Model.h"
+#include "Network.h"
+#include "Quantized.h"
+#include "Stats.h"
+#include "Trace.h"
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+using namespace std;
+
+void test_pack_filters(){
+    // 224x224x3 input layer
+    Tensor data_layer = Tensor(64, 64);
+    data_layer.addLayer(Utility::createMatrixFromFile("layers/input_layer_64x64"));
+    data_layer.addLayer(Utility::createMatrixFromFile("layers/input_layer_64x64"));
+    data_layer.addLayer(Utility::createMatrixFromFile("layers/input_layer_64x64"));
+
+    // // 3x3x3 x 64 filters
+    Filters kernel_conv1_1 = Filters(3, 3, 3, 64);
+
+    cout << "______test_224x224_Conv Test Start_______________________\n" << endl;
+    cout << "---- Test [Fwd Convolution] ----" << endl;
+
+    double* output = new double[3*3*3*64];
+
+    data_layer.pack_filters(output,kernel_conv1_1,64);
+
+    for(int i = 0; i < 4; i++){
+        cout<<"---this is the "<<i<< "kernel----"<<endl;
+        for(int j = 0; j < 3; j++){
+            Matrix matrix = kernel_conv1_1.getFilter(i).getLayer(j);
+            cout<<matrix.getIndexValue(0,0)<<matrix.getIndexValue(0,1)<<matrix.getIndexValue(0,2)<<endl;
+            cout<<matrix.getIndexValue(1,0)<<matrix.getIndexValue(1,1)<<matrix.getIndexValue(1,2)<<endl;
+            cout<<matrix.getIndexValue(2,0)<<matrix.getIndexValue(2,1)<<matrix.getIndexValue(2,2)<<endl;
+        }
+        
+        
+    }
+    cout<<"---this is the output----"<<endl;
+    for(int i = 0; i<27; i++){
+        cout<<output[i*4]<<output[i*4+1]<<output[i*4+2]<<output[i*4+3]<<endl;
+    }
+}
+
+//Testing convolution on 224x224x3 Tensor with 64 filters: 3x3x3 and stride 1, pad 1
+void test_224x224_Conv() {
+    int padding = 1;
+    int stride = 1;
+    int bias = 0;
+
+    // 224x224x3 input layer
+    Tensor data_layer = Tensor(64, 64);
+    data_layer.addLayer(Utility::createMatrixFromFile("layers/input_layer_64x64"));
+    data_layer.addLayer(Utility::createMatrixFromFile("layers/input_layer_64x64"));
+    data_layer.addLayer(Utility::createMatrixFromFile("layers/input_layer_64x64"));
+
+    // // 3x3x3 x 64 filters
+    Filters kernel_conv1_1 = Filters(3, 3, 3, 64);
+
+    cout << "______test_224x224_Conv Test Start_______________________\n" << endl;
+    cout << "---- Test [Fwd Convolution] ----" << endl;
+
+    Tensor conv1_1_layer = data_layer.fwdConv(kernel_conv1_1, stride, bias, padding);
+    Tensor conv1_1_layer_baseline = data_layer.fwdConv_baseline(kernel_conv1_1, stride, bias, padding); // TURBO Cycles Taken for Baseline: 1494804815.000000
+    Tensor conv1_1_layer_simd = data_layer.fwdConv_simd(kernel_conv1_1, stride, bias, padding); // TURBO Cycles Taken for SIMD: 484215675.000000
+    Tensor conv1_1_layer_simd_openmp = data_layer.fwdConv_simd_openmp(kernel_conv1_1, stride, bias, padding);
+
+    cout << "conv1_1_layer output: " << endl;
+    conv1_1_layer.getLayer(3).print();
+    cout << "== end conv1_1_layer output: " << endl;
+
+    cout << "conv1_1_layer_baseline output: " << endl;
+    conv1_1_layer_baseline.getLayer(3).print();
+    cout << "== end conv1_1_layer_baseline output: " << endl;
+
+    cout << "conv1_1_layer_simd output: " << endl;
+    conv1_1_layer_simd.getLayer(3).print();
+    cout << "== end conv1_1_layer_simd output: " << endl;
+
+    cout << "conv1_1_layer_simd_openmp output: " << endl;
+    conv1_1_layer_simd_openmp.getLayer(3).print();
+    cout << "== end conv1_1_layer_simd_openmp output: " << endl;
+
+    cout << "\n[Input volume]: 224x224x3 --> Convolution (filter: 3x3x3 * 64 @ stride=1, padding=1) --> [Output volume]: "
+         << conv1_1_layer.getHeight() << "x"
+         << conv1_1_layer.getWidth() << "x"
+         << conv1_1_layer.getDepth() << endl;
+
+    // printing first layer of output volume to see if it actually convolved input layer
+    cout << "---- [Input matrix layer 0] ----" << endl;
+    data_layer.getLayer(0).print();
+    // cout << "---- [Input matrix layer 1] ----" << endl;
+    // data_layer.getLayer(1).print();
+    // cout << "---- [Input matrix layer 2] ----" << endl;
+    // data_layer.getLayer(2).print();
+
+    cout << "###### FILTER 0  #####" << endl;
+    kernel_conv1_1.getFilter(0).getLayer(0).print();
+    // cout << "###### FILTER 0  #####" << endl;
+    // kernel_conv1_1.getFilter(0).getLayer(1).print();
+    // cout << "###### FILTER 0  #####" << endl;
+    // kernel_conv1_1.getFilter(0).getLayer(2).print();
+
+    cout << "######################" << endl;
+    conv1_1_layer.getLayer(0).print();
+    cout << "Output volume ->  " << conv1_1_layer.getHeight() << "x" << conv1_1_layer.getWidth() << "x" << conv1_1_layer.getDepth() << endl;
+
+    cout << "\n___________________Test End_________________________\n" << endl;
+}
+
+//Picks the fastest engine for conv1_1 once, later runs load the plan from the tuning cache
+void test_autotuner() {
+    int padding = 1;
+    int stride = 1;
+    int bias = 0;
+
+    Tensor data_layer = Tensor(64, 64);
+    data_layer.addLayer(Utility::createMatrixFromFile("layers/input_layer_64x64"));
+    data_layer.addLayer(Utility::createMatrixFromFile("layers/input_layer_64x64"));
+    data_layer.addLayer(Utility::createMatrixFromFile("layers/input_layer_64x64"));
+
+    Filters kernel_conv1_1 = Filters(3, 3, 3, 64);
+
+    cout << "______test_autotuner Test Start_______________________\n" << endl;
+
+    Autotuner tuner;
+    ConvPlan plan = tuner.tune(data_layer, kernel_conv1_1, stride, bias, padding);
+    cout << "Tuned plan: " << Autotuner::engineName(plan.engine) << " xBlock=" << plan.xBlock
+         << " (cache: " << tuner.getCacheFile() << ")" << endl;
+
+    Tensor conv1_1_layer = data_layer.fwdConv(kernel_conv1_1, stride, bias, padding, plan);
+    cout << "Output volume ->  " << conv1_1_layer.getHeight() << "x" << conv1_1_layer.getWidth() << "x" << conv1_1_layer.getDepth() << endl;
+
+    //filters of the same width but different heights are different layers
+    Filters kernel_5x3 = Filters(5, 3, 3, 64);
+    cout << "3x3 key: " << Autotuner::signatureOf(data_layer, kernel_conv1_1, convParams(stride, padding), 1).key() << endl;
+    cout << "5x3 key: " << Autotuner::signatureOf(data_layer, kernel_5x3, convParams(stride, padding), 1).key() << endl;
+
+    //a 7x1 layer is not 1x1, so it must not be tuned onto the GEMM engine
+    Filters kernel_7x1 = Filters(7, 1, 3, 16);
+    ConvParams tall = convParams(1, 0);
+    tall.padY = 3;
+    ConvPlan tallPlan = tuner.tune(data_layer, kernel_7x1, tall, bias, 1);
+    Tensor tall_layer = data_layer.fwdConv(kernel_7x1, tall, bias, tallPlan);
+    cout << "7x1 plan: " << Autotuner::engineName(tallPlan.engine) << " xBlock=" << tallPlan.xBlock << ", output "
+         << tall_layer.getHeight() << "x" << tall_layer.getWidth() << "x" << tall_layer.getDepth() << endl;
+
+    cout << "\n___________________Test End_________________________\n" << endl;
+}
+
+void test_jit() {
+    int bias = 0;
+
+    Tensor data_layer = Tensor(64, 64);
+    data_layer.addLayer(Utility::createMatrixFromFile("layers/input_layer_64x64"));
+    data_layer.addLayer(Utility::createMatrixFromFile("layers/input_layer_64x64"));
+    data_layer.addLayer(Utility::createMatrixFromFile("layers/input_layer_64x64"));
+
+    cout << "______test_jit Test Start_______________________\n" << endl;
+
+    //11x11 stride 4, checked against the intrinsics engine
+    Filters kernel_conv1 = Filters(11, 11, 3, 96);
+    Tensor jit_layer = data_layer.fwdConv_jit(kernel_conv1, 4, bias, 0);
+    Tensor simd_layer = data_layer.fwdConv_simd(kernel_conv1, 4, bias, 0);
+
+    double maxDiff = 0;
+    for (int z = 0; z < jit_layer.getDepth(); z++)
+        for (int y = 0; y < jit_layer.getHeight(); y++)
+            for (int x = 0; x < jit_layer.getWidth(); x++)
+                maxDiff = max(maxDiff, fabs(jit_layer.layers[z].matrix[y][x] - simd_layer.layers[z].matrix[y][x]));
+    cout << "11x11/4 x96: max difference to SIMD " << maxDiff << endl;
+
+    //filter counts that are not a multiple of 4 use masked stores
+    Filters kernel_conv2 = Filters(7, 7, 3, 10);
+    Tensor masked_layer = data_layer.fwdConv_jit(kernel_conv2, 2, bias, 3);
+    cout << "7x7/2 x10: output volume ->  " << masked_layer.getHeight() << "x" << masked_layer.getWidth() << "x" << masked_layer.getDepth() << endl;
+
+    cout << "Generated kernels: " << Jit::cachedKernels() << endl;
+    cout << "\n___________________Test End_________________________\n" << endl;
+}
+
+//conv -> pool -> fc with every layer traced; open the file in chrome://tracing (needs make TRACE=1)
+void test_trace() {
+    int bias = 0;
+
+    Tensor data_layer = Tensor(64, 64);
+    data_layer.addLayer(Utility::createMatrixFromFile("layers/input_layer_64x64"));
+    data_layer.addLayer(Utility::createMatrixFromFile("layers/input_layer_64x64"));
+    data_layer.addLayer(Utility::createMatrixFromFile("layers/input_layer_64x64"));
+
+    cout << "______test_trace Test Start_______________________\n" << endl;
+
+    Filters kernel_conv1_1 = Filters(3, 3, 3, 64);
+    Tensor conv1_1_layer;
+    {
+        TRACE_LAYER("conv1_1");
+        conv1_1_layer = data_layer.fwdConv_simd_openmp(kernel_conv1_1, 1, bias, 1);
+    }
+
+    Tensor pool1_layer;
+    {
+        TRACE_LAYER("pool1");
+        pool1_layer = conv1_1_layer.fwdMaxPool(2, 2, 2, bias);
+    }
+
+    Filters kernel_fc = Filters(pool1_layer.getHeight(), pool1_layer.getWidth(), pool1_layer.getDepth(), 16);
+    Tensor fc_layer;
+    {
+        TRACE_LAYER("fc");
+        fc_layer = pool1_layer.fwdFullyConnected(kernel_fc, bias);
+    }
+
+    if (Trace::writeChrome("fastcode_trace.json"))
+        cout << "Trace written to fastcode_trace.json" << endl;
+
+    cout << "\n___________________Test End_________________________\n" << endl;
+}
+
+//repeated conv -> pool -> fc requests, then the live stats the sidecar would scrape
+void test_stats() {
+    int bias = 0;
+
+    Tensor data_layer = Tensor(64, 64);
+    data_layer.addLayer(Utility::createMatrixFromFile("layers/input_layer_64x64"));
+    data_layer.addLayer(Utility::createMatrixFromFile("layers/input_layer_64x64"));
+    data_layer.addLayer(Utility::createMatrixFromFile("layers/input_layer_64x64"));
+
+    cout << "______test_stats Test Start_______________________\n" << endl;
+
+    Filters kernel_conv1_1 = Filters(3, 3, 3, 64);
+    Filters kernel_fc = Filters(32, 32, 64, 16);
+
+    for (int request = 0; request < 20; request++) {
+        Stats::enqueued();
+        Stats::RequestScope scope;
+        Stats::dequeued();
+
+        Tensor conv1_1_layer;
+        {
+            Stats::LayerScope layer("conv1_1");
+            conv1_1_layer = data_layer.fwdConv_simd_openmp(kernel_conv1_1, 1, bias, 1);
+        }
+        Tensor pool1_layer;
+        {
+            Stats::LayerScope layer("pool1");
+            pool1_layer = conv1_1_layer.fwdMaxPool(2, 2, 2, bias);
+        }
+        {
+            Stats::LayerScope layer("fc");
+            pool1_layer.fwdFullyConnected(kernel_fc, bias);
+        }
+    }
+
+    cout << "Shared page: " << Stats::pageName() << " (./tools/stats " << getpid() << ")" << endl;
+    Stats::writeText(cout);
+
+    cout << "\n___________________Test End_________________________\n" << endl;
+}
+
+//a generated 64x64 PNG decoded and preprocessed the way the Caffe reference does, then conv1_1
+void test_image() {
+    int bias = 0;
+
+    cout << "______test_image Test Start_______________________\n" << endl;
+
+    vector<unsigned char> pixels(64*64*3);
+    for (int y = 0; y < 64; y++) {
+        for (int x = 0; x < 64; x++) {
+            pixels[3*(64*y + x)] = 4*x;
+            pixels[3*(64*y + x) + 1] = 4*y;
+            pixels[3*(64*y + x) + 2] = 128;
+        }
+    }
+    stbi_write_png("test_image.png", 64, 64, 3, pixels.data(), 64*3);
+
+    Tensor data_layer = Image::loadTensor("test_image.png", Image::caffeVgg());
+    cout << "Input " << data_layer.getHeight() << "x" << data_layer.getWidth() << "x" << data_layer.getDepth()
+         << ", blue plane starts at " << data_layer.layers[0].matrix[0][0] << endl;
+
+    Filters kernel_conv1_1 = Filters(3, 3, 3, 64);
+    Tensor conv1_1_layer = data_layer.fwdConv_simd_openmp(kernel_conv1_1, 1, bias, 1);
+    cout << "conv1_1 " << conv1_1_layer.getHeight() << "x" << conv1_1_layer.getWidth() << "x" << conv1_1_layer.getDepth() << endl;
+
+    //the same image enlarged to 256 and cut into the ten 224x224 crops of the VGG evaluation
+    int height, width;
+    Image::shorterSideTo(256, 64, 64, height, width);
+    vector<unsigned char> resized(3*height*width);
+    Image::resize(resized.data(), height, width, Image::view(pixels.data(), 64, 64), Image::FILTER_BILINEAR);
+
+    Image::View crops[10];
+    vector<unsigned char> flipped(5*224*224*3);
+    Image::tenCrop(crops, Image::view(resized.data(), height, width), 224, flipped.data());
+    vector<double> planes(10*3*224*224);
+    for (int k = 0; k < 10; k++)
+        Image::toPlanes(planes.data() + 3*224*224*k, crops[k], Image::caffeVgg());
+    cout << "Ten crops of " << height << "x" << width << ", red of the first pixel " << (int)crops[0].pixels[0]
+         << " and of its mirror " << (int)crops[5].pixels[3*223] << endl;
+
+    //the active ISA's resampler against the scalar one on noise, which
+    //exercises every tap and the rounding: shrinking by 3.3 gives uneven area
+    //tap counts, enlarging by 2 the bilinear ones
+    vector<unsigned char> noise(97*131*3);
+    for (size_t i = 0; i < noise.size(); i++)
+        noise[i] = rand()%256;
+    Image::View source = Image::view(noise.data(), 97, 131);
+    struct Resize { const char* label; int height, width; Image::Filter filter; };
+    Resize resizes[] = {{"area 97x131 to 29x40", 29, 40, Image::FILTER_AREA}, {"bilinear 97x131 to 211x263", 211, 263, Image::FILTER_BILINEAR}};
+    for (Resize r : resizes) {
+        vector<unsigned char> expected(3*r.height*r.width), output(3*r.height*r.width);
+        Image::resize(expected.data(), r.height, r.width, source, r.filter, Kernels::table(Kernels::ISA_SCALAR));
+        Image::resize(output.data(), r.height, r.width, source, r.filter);
+        int maxDiff = 0;
+        for (size_t i = 0; i < output.size(); i++)
+            maxDiff = max(maxDiff, abs((int)output[i] - (int)expected[i]));
+        cout << r.label << ", " << Kernels::active().name << " against scalar: "
+             << (memcmp(output.data(), expected.data(), output.size()) == 0 ? "identical" : "DIFFERENT")
+             << ", max difference " << maxDiff << endl;
+    }
+
+    cout << "\n___________________Test End_________________________\n" << endl;
+}
+
+//eight inferences in flight from one thread; the dispatcher batches whatever is queued
+void test_async() {
+    cout << "______test_async Test Start_______________________\n" << endl;
+
+    LayerShape input = {64, 64, 3};
+    Model model = Model(Network::tiny(), input);
+
+    vector<Inference> inferences;
+    for (int request = 0; request < 8; request++)
+        inferences.push_back(model.submit(vector<double>(model.inputSize(), request)));
+    cout << "Submitted 8 images without waiting" << endl;
+
+    for (size_t i = 0; i < inferences.size(); i++)
+        cout << "Image " << i << ": " << inferences[i].get().size() << " scores, first " << inferences[i].get()[0] << endl;
+
+    unsigned long long images, batches;
+    Async::counts(images, batches);
+    cout << images << " images in " << batches << " batches" << endl;
+
+    cout << "\n___________________Test End_________________________\n" << endl;
+}
+
+//largest absolute difference between two volumes, -1 when their shapes differ
+double maxDifference(Tensor const &a, Tensor const &b) {
+    if (a.getHeight() != b.getHeight() || a.getWidth() != b.getWidth() || a.getDepth() != b.getDepth())
+        return -1;
+
+    double maxDiff = 0;
+    for (int z = 0; z < a.getDepth(); z++)
+        for (int y = 0; y < a.getHeight(); y++)
+            for (int x = 0; x < a.getWidth(); x++)
+                maxDiff = max(maxDiff, fabs(a.layers[z].matrix[y][x] - b.layers[z].matrix[y][x]));
+    return maxDiff;
+}
+
+//small random integers like the Filters, so every engine's sums are exact and
+//any difference to the naive engine is a bug, not rounding
+Tensor randomVolume(int height, int width, int depth) {
+    Tensor volume = Tensor(height, width, depth);
+    volume.randomValueInit(-3, 3);
+    return volume;
+}
+
+//every engine that packs filters (plus baseline, and GEMM on unpadded 1x1
+//layers) on one layer, against fwdConv_naive
+void compareEngines(string const &label, Tensor &input, Filters &filters, ConvParams params, int bias = 0) {
+    ConvPlan reference = {ENGINE_NAIVE, 1};
+    Tensor expected = input.fwdConv(filters, params, bias, reference);
+
+    vector<ConvPlan> plans;
+    ConvPlan baseline = {ENGINE_BASELINE, 1};
+    plans.push_back(baseline);
+    for (int xBlock : {1, 3, 4}) {
+        ConvPlan simd = {ENGINE_SIMD, xBlock};
+        ConvPlan simd_openmp = {ENGINE_SIMD_OPENMP, xBlock};
+        plans.push_back(simd);
+        plans.push_back(simd_openmp);
+    }
+    if (Jit::isAvailable()) {
+        ConvPlan jit = {ENGINE_JIT, 1};
+        plans.push_back(jit);
+    }
+    if (filters.getHeight() == 1 && filters.getWidth() == 1 && params.padY == 0 && params.padX == 0) {
+        ConvPlan gemm = {ENGINE_GEMM, 1};
+        plans.push_back(gemm);
+    }
+
+    cout << label << ": naive output " << expected.getHeight() << "x" << expected.getWidth() << "x" << expected.getDepth() << endl;
+    for (ConvPlan plan : plans) {
+        Tensor output = input.fwdConv(filters, params, bias, plan);
+        cout << "  " << Autotuner::engineName(plan.engine) << " xBlock=" << plan.xBlock
+             << ": max difference to naive " << maxDifference(output, expected) << endl;
+    }
+}
+
+//height and width, filter height and width, and the two strides and paddings all differ
+void test_rectangular_conv() {
+    cout << "______test_rectangular_conv Test Start_______________________\n" << endl;
+
+    Tensor data_layer = randomVolume(13, 22, 3);
+
+    //5 filters: the last group of 4 is partial
+    Filters kernel_3x5 = Filters(3, 5, 3, 5);
+    ConvParams params = convParams(1, 1);
+    params.strideY = 2;
+    params.padX = 2;
+    compareEngines("13x22x3 * 3x5 x5, stride 2x1, pad 1x2", data_layer, kernel_3x5, params);
+
+    Filters kernel_7x2 = Filters(7, 2, 3, 8);
+    ConvParams tall = convParams(1, 0);
+    tall.strideX = 3;
+    tall.padY = 3;
+    compareEngines("13x22x3 * 7x2 x8, stride 1x3, pad 3x0", data_layer, kernel_7x2, tall);
+    compareEngines("13x22x3 * 7x2 x8, stride 1x3, pad 3x0, bias 3", data_layer, kernel_7x2, tall, 3);
+
+    cout << "\n___________________Test End_________________________\n" << endl;
+}
+
+//dilated taps with filter counts that leave the last group of 4 partial
+void test_dilated_conv() {
+    cout << "______test_dilated_conv Test Start_______________________\n" << endl;
+
+    Tensor data_layer = randomVolume(17, 20, 5);
+
+    Filters kernel_3x3 = Filters(3, 3, 5, 7);
+    ConvParams params = convParams(1, 2);
+    params.strideX = 2;
+    params.padX = 3;
+    params.dilationY = 2;
+    params.dilationX = 3;
+    compareEngines("17x20x5 * 3x3 x7, stride 1x2, pad 2x3, dilation 2x3", data_layer, kernel_3x3, params);
+
+    Filters kernel_2x3 = Filters(2, 3, 5, 6);
+    ConvParams wide = convParams(2, 0);
+    wide.strideX = 1;
+    wide.padX = 1;
+    wide.dilationY = 4;
+    wide.dilationX = 2;
+    compareEngines("17x20x5 * 2x3 x6, stride 2x1, pad 0x1, dilation 4x2", data_layer, kernel_2x3, wide);
+
+    cout << "\n___________________Test End_________________________\n" << endl;
+}
+
+//grouped layers run each group through the plan's engine and depthwise ones
+//(one filter per channel) through fwdConv_depthwise; naive per group is the reference
+void test_grouped_conv() {
+    cout << "______test_grouped_conv Test Start_______________________\n" << endl;
+
+    //3 groups of 2 channels and 3 filters each, so every group of 4 filters is partial
+    Tensor data_layer = randomVolume(11, 16, 6);
+    Filters kernel_grouped = Filters(3, 3, 2, 9);
+    ConvParams params = convParams(1, 1, 1, 3);
+    params.strideY = 2;
+    params.padX = 2;
+    params.dilationX = 2;
+    compareEngines("11x16x6 * 3x3x2 x9, 3 groups, stride 2x1, pad 1x2, dilation 1x2", data_layer, kernel_grouped, params);
+    compareEngines("11x16x6 * 3x3x2 x9, 3 groups, bias 4", data_layer, kernel_grouped, params, 4);
+
+    //7 channels leave the last block of 4 channels partial
+    Tensor depthwise_layer = randomVolume(15, 9, 7);
+    Filters kernel_depthwise = Filters(3, 3, 1, 7);
+    ConvParams depthwise = convParams(1, 1, 1, 7);
+    depthwise.strideY = 2;
+    compareEngines("15x9x7 depthwise 3x3, stride 2x1, pad 1", depthwise_layer, kernel_depthwise, depthwise);
+    compareEngines("15x9x7 depthwise 3x3, stride 2x1, pad 1, bias 2", depthwise_layer, kernel_depthwise, depthwise, 2);
+
+    Filters kernel_depthwise_5x3 = Filters(5, 3, 1, 7);
+    ConvParams dilated = convParams(1, 2, 2, 7);
+    dilated.strideX = 2;
+    dilated.padY = 4;
+    compareEngines("15x9x7 depthwise 5x3, stride 1x2, pad 4x2, dilation 2", depthwise_layer, kernel_depthwise_5x3, dilated);
+
+    cout << "\n___________________Test End_________________________\n" << endl;
+}
+
+//1x1 layers as one GEMM over the planar volume, strided, grouped and with the bias in the epilogue
+void test_gemm_conv() {
+    cout << "______test_gemm_conv Test Start_______________________\n" << endl;
+
+    Tensor data_layer = randomVolume(9, 14, 10);
+    Filters kernel_1x1 = Filters(1, 1, 10, 7);
+    ConvParams params = convParams(2, 0);
+    params.strideX = 3;
+    compareEngines("9x14x10 * 1x1 x7, stride 2x3", data_layer, kernel_1x1, params);
+
+    Tensor wide_layer = randomVolume(5, 31, 3);
+    Filters kernel_wide = Filters(1, 1, 3, 13);
+    compareEngines("5x31x3 * 1x1 x13", wide_layer, kernel_wide, convParams(1, 0));
+
+    Tensor grouped_layer = randomVolume(7, 6, 8);
+    Filters kernel_grouped = Filters(1, 1, 4, 6);
+    compareEngines("7x6x8 * 1x1x4 x6, 2 groups", grouped_layer, kernel_grouped, convParams(1, 0, 1, 2));
+
+    compareEngines("9x14x10 * 1x1 x7, stride 2x3, bias 2", data_layer, kernel_1x1, params, 2);
+
+    cout << "\n___________________Test End_________________________\n" << endl;
+}
+
+//single conv layers through the int8 kernels, against fwdConv_naive on the
+//model's own weights; rounding to bytes bounds the error by a few output
+//steps (the output range over 255) rather than zero
+void test_int8_conv() {
+    cout << "______test_int8_conv Test Start_______________________\n" << endl;
+
+    //3 channels pad to a whole QUANT_K, 5 and 11 filters to whole QUANT_FILTERS groups
+    struct Case { int height, width, F, filters, stride, padding; };
+    Case cases[] = {{13, 21, 3, 5, 1, 1}, {19, 10, 5, 11, 2, 2}, {9, 17, 1, 8, 3, 0}};
+
+    for (Case c : cases) {
+        Network network;
+        network.addConv("conv", c.F, c.filters, c.stride, c.padding);
+        LayerShape shape = {c.height, c.width, 3};
+        Model model = Model(network, shape);
+
+        Tensor data_layer = randomVolume(c.height, c.width, 3);
+        vector<Tensor> samples(1, data_layer);
+        QuantizedModel quantized = QuantizedModel(model, Calibration::collect(model, samples, false));
+
+        Tensor expected = data_layer.fwdConv_naive(model.getWeights(0), convParams(c.stride, c.padding), 0);
+        Tensor output = quantized.forward(data_layer);
+
+        double low = expected.layers[0].matrix[0][0], high = low;
+        for (int z = 0; z < expected.getDepth(); z++)
+            for (int y = 0; y < expected.getHeight(); y++)
+                for (int x = 0; x < expected.getWidth(); x++) {
+                    low = min(low, expected.layers[z].matrix[y][x]);
+                    high = max(high, expected.layers[z].matrix[y][x]);
+                }
+        double difference = maxDifference(output, expected);
+
+        cout << c.height << "x" << c.width << "x3 * " << c.F << "x" << c.F << " x" << c.filters << ", stride " << c.stride
+             << ", pad " << c.padding << ": max difference to naive " << difference
+             << " (" << difference/((high - low)/255) << " output steps)" << endl;
+    }
+
+    cout << "\n___________________Test End_________________________\n" << endl;
+}
+
+//the forward of one fractional input with and without the tiling, compared
+//with memcmp: fractional values keep exact integer sums from hiding a
+//different summation order
+bool tilingMatches(Model &model, Tiling tiling) {
+    vector<double> input(model.inputSize());
+    for (size_t i = 0; i < input.size(); i++)
+        input[i] = 255.0*rand()/RAND_MAX;
+
+    vector<double> untiled(model.outputSize()), tiled(model.outputSize());
+    Tiling none = {0, 0};
+    model.setTiling(none);
+    model.forward(input.data(), untiled.data());
+    model.setTiling(tiling);
+    model.forward(input.data(), tiled.data());
+    return memcmp(untiled.data(), tiled.data(), untiled.size()*sizeof(double)) == 0;
+}
+
+//the tiles run the same engines on windows of the same volumes, so the
+//stitched output is claimed to match the untiled one bit for bit
+void test_tiling() {
+    cout << "______test_tiling Test Start_______________________\n" << endl;
+
+    struct Case { const char* network; Tiling tiling; };
+    Case cases[] = {{"vgg16", {2, 7}}, {"vgg16", {3, 5}}, {"vgg16", {7, 3}}, {"mobilenet", {4, 5}}, {"mobilenet", {9, 2}}};
+    LayerShape shape = {36, 52, 3};
+
+    for (Case c : cases) {
+        Model model = Model(Network::byName(c.network), shape);
+        bool same = tilingMatches(model, c.tiling);
+        cout << c.network << " 36x52, " << c.tiling.layers << " layers in tiles of " << c.tiling.tile
+             << ": " << (same ? "identical" : "DIFFERENT") << endl;
+    }
+
+    //whatever planTiling picks for a small cache
+    Model model = Model(Network::vgg16(), shape);
+    Tiling planned = model.planTiling(64*1024);
+    bool same = tilingMatches(model, planned);
+    cout << "vgg16 36x52, planned for 64 KB: " << planned.layers << " layers in tiles of " << planned.tile
+         << ": " << (same ? "identical" : "DIFFERENT") << endl;
+
+    cout << "\n___________________Test End_________________________\n" << endl;
+}
+
+//volumes compared with memcmp, row by row
+bool identical(Tensor const &a, Tensor const &b) {
+    if (a.getHeight() != b.getHeight() || a.getWidth() != b.getWidth() || a.getDepth() != b.getDepth())
+        return false;
+    for (int z = 0; z < a.getDepth(); z++)
+        for (int y = 0; y < a.getHeight(); y++)
+            if (memcmp(a.layers[z].matrix[y].data(), b.layers[z].matrix[y].data(), a.getWidth()*sizeof(double)) != 0)
+                return false;
+    return true;
+}
+
+//random eighths in [-3, 3], exact in fp16 and bfloat16, as Filters and as
+//16-bit words in the [z][k][i][j] order of HalfFilters
+Filters eighthFilters(int height, int width, int depth, int numberOfFilters, WeightFormat format, vector<unsigned short> &words) {
+    vector<Tensor> filters(numberOfFilters);
+    words.clear();
+    for (int z = 0; z < numberOfFilters; z++) {
+        filters[z] = Tensor(height, width);
+        for (int k = 0; k < depth; k++) {
+            Matrix plane = Matrix(height, width);
+            for (int i = 0; i < height; i++)
+                for (int j = 0; j < width; j++) {
+                    plane.matrix[i][j] = (rand()%49 - 24)/8.0;
+                    float weight = (float)plane.matrix[i][j];
+                    words.push_back(format == WEIGHTS_FP16 ? Kernels::toHalf(weight) : Kernels::toBfloat16(weight));
+                }
+            filters[z].addLayer(plane);
+        }
+    }
+    return Filters(filters);
+}
+
+//16-bit weights are widened to the doubles they stand for and then run the
+//double kernels' sums in the same order, so with exactly representable
+//weights and fractional inputs the outputs are claimed to match bit for bit
+void test_half_weights() {
+    cout << "______test_half_weights Test Start_______________________\n" << endl;
+
+    struct Case { const char* label; int height, width, depth, Fh, Fw, filters; ConvParams params; };
+    Case cases[] = {{"13x22x5 * 3x5 x7, stride 1, pad 1", 13, 22, 5, 3, 5, 7, convParams(1, 1)},
+                    {"17x20x6 * 3x3 x9, stride 2, pad 2, dilation 2", 17, 20, 6, 3, 3, 9, convParams(2, 2, 2)},
+                    {"9x14x10 * 1x1 x6", 9, 14, 10, 1, 1, 6, convParams(1, 0)},
+                    {"11x16x6 * 3x3x2 x9, 3 groups", 11, 16, 6, 3, 3, 9, convParams(1, 1, 1, 3)}};
+    WeightFormat formats[] = {WEIGHTS_FP16, WEIGHTS_BF16};
+
+    for (WeightFormat format : formats) {
+        const char* name = format == WEIGHTS_FP16 ? "fp16" : "bf16";
+
+        for (Case c : cases) {
+            Tensor data_layer = Tensor(c.height, c.width, c.depth);
+            data_layer.randomValueInit(-3, 3);
+            for (int z = 0; z < c.depth; z++)
+                for (int y = 0; y < c.height; y++)
+                    for (int x = 0; x < c.width; x++)
+                        data_layer.layers[z].matrix[y][x] += (double)rand()/RAND_MAX;
+
+            vector<unsigned short> words;
+            Filters filters = eighthFilters(c.Fh, c.Fw, c.depth/c.params.groups, c.filters, format, words);
+            HalfFilters half = {words.data(), format, c.Fh, c.Fw, c.depth/c.params.groups, c.filters};
+
+            vector<ConvPlan> plans;
+            for (ConvEngine engine : {ENGINE_NAIVE, ENGINE_BASELINE, ENGINE_SIMD, ENGINE_SIMD_OPENMP}) {
+                ConvPlan plan = {engine, 3};
+                plans.push_back(plan);
+            }
+            if (Jit::isAvailable()) {
+                ConvPlan jit = {ENGINE_JIT, 1};
+                plans.push_back(jit);
+            }
+            if (c.Fh == 1 && c.Fw == 1) {
+                ConvPlan gemm = {ENGINE_GEMM, 1};
+                plans.push_back(gemm);
+            }
+
+            cout << name << " " << c.label << ":";
+            for (ConvPlan plan : plans) {
+                bool same = identical(data_layer.fwdConv(half, c.params, 1, plan), data_layer.fwdConv(filters, c.params, 1, plan));
+                cout << " " << Autotuner::engineName(plan.engine) << " " << (same ? "identical" : "DIFFERENT");
+            }
+            cout << endl;
+        }
+
+        //odd input sizes leave a tail after the kernels' 8-wide loop
+        Tensor fc_layer = Tensor(3, 5, 7);
+        fc_layer.randomValueInit(-3, 3);
+        for (int z = 0; z < 7; z++)
+            for (int y = 0; y < 3; y++)
+                for (int x = 0; x < 5; x++)
+                    fc_layer.layers[z].matrix[y][x] += (double)rand()/RAND_MAX;
+        vector<unsigned short> words;
+        Filters weights = eighthFilters(3, 5, 7, 10, format, words);
+        bool same = identical(fc_layer.fwdFullyConnected(words.data(), format, 10, 1), fc_layer.fwdFullyConnected(weights, 1));
+        cout << name << " fully connected 3x5x7 -> 10: " << (same ? "identical" : "DIFFERENT") << endl;
+    }
+
+    cout << "\n___________________Test End_________________________\n" << endl;
+}
+
+//a small network cut into 1 to 4 stages, every frame's scores against one
+//Model::forward of the same input, compared with memcmp
+void test_layer_pipeline() {
+    cout << "______test_layer_pipeline Test Start_______________________\n" << endl;
+
+    Network network;
+    network.addConv("conv1", 3, 8, 1, 1);
+    network.addMaxPool("pool1", 2, 2);
+    network.addConv("conv2", 3, 12, 1, 1);
+    network.addConv("conv3", 1, 6, 1, 0);
+    network.addMaxPool("pool2", 2, 2);
+    network.addFullyConnected("fc", 10);
+    LayerShape shape = {20, 28, 3};
+    Model model = Model(network, shape);
+
+    int frames = 9;
+    vector<vector<double> > inputs(frames, vector<double>(model.inputSize()));
+    vector<vector<double> > expected(frames, vector<double>(model.outputSize()));
+    for (int f = 0; f < frames; f++) {
+        for (size_t i = 0; i < inputs[f].size(); i++)
+            inputs[f][i] = 255.0*rand()/RAND_MAX;
+        model.forward(inputs[f].data(), expected[f].data());
+    }
+
+    for (int stages = 1; stages <= 4; stages++) {
+        LayerPipeline pipeline(model, stages, 2);
+        pipeline.start();
+        thread producer([&]() {
+            for (int f = 0; f < frames; f++)
+                pipeline.push(inputs[f].data());
+            pipeline.close();
+        });
+
+        int matching = 0, received = 0;
+        vector<double> scores(model.outputSize());
+        while (pipeline.pop(scores.data())) {
+            if (received < frames && memcmp(scores.data(), expected[received].data(), scores.size()*sizeof(double)) == 0)
+                matching++;
+            received++;
+        }
+        producer.join();
+
+        cout << pipeline.getStages().size() << " stages:";
+        for (LayerPipeline::Stage const &stage : pipeline.getStages())
+            cout << " [" << stage.first << ", " << stage.end << ")";
+        cout << ", " << matching << " of " << received << " frames identical to Model::forward" << endl;
+    }
+
+    cout << "\n___________________Test End_________________________\n" << endl;
+}
+
+int main(int argc, char* argv[]) {
+    // srand(time(0)); //used for setting random values for filters
+    srand(1); //used for setting random values for filters
+    test_224x224_Conv();
+    // test_pack_filters();
+    // test_autotuner();
+    // test_jit();
+    // test_trace();
+    // test_stats();
+    // test_image();
+    // test_async();
+    // test_rectangular_conv();
+    // test_dilated_conv();
+    // test_grouped_conv();
+    // test_gemm_conv();
+    // test_int8_conv();
+    // test_tiling();
+    // test_half_weights();
+    // test_layer_pipeline();
+    return 0;
+}	
@@ -1,9 +1,7 @@
 #include <iostream>
-#include <sstream>
-#include <iterator>
-#include <fstream>
 #include "Utility.h"
 #include "Matrix.h"
+#include "TextLoader.h"
 
 namespace Utility
 {
@@ -16,39 +14,27 @@ namespace Utility
         }
     }
 
+    static std::vector<std::vector<double> > readRows(std::string const &filename)
+    {
+        std::vector<double> values;
+        int height, width;
+        TextLoader::load(filename, values, height, width);
+
+        std::vector<std::vector<double> > matrix(height);
+        for (int i = 0; i < height; i++)
+            matrix[i].assign(values.begin() + (long)i*width, values.begin() + (long)(i + 1)*width);
+        return matrix;
+    }
+
     //used for tests to create a matrix out of a file for first layer of CNN
     Matrix createMatrixFromFile(std::string filename)
     {
-        std::vector<std::vector<double> > matrix;
-        std::ifstream inputFile(filename);
-        std::string temp;
-
-        while (std::getline(inputFile, temp)) {
-            std::istringstream buffer(temp);
-
-            std::vector<double> line{std::istream_iterator<double>(buffer), std::istream_iterator<double>()};
-
-            matrix.push_back(line);
-        }
-
-        return Matrix(matrix);
+        return Matrix(readRows(filename));
     }
 
     //used for tests to create a matrix out of a file for first layer of CNN
     Matrix createMatrixFromFile(std::string filename, int padding)
     {
-        std::vector<std::vector<double> > matrix;
-        std::ifstream inputFile(filename);
-        std::string temp;
-
-        while (std::getline(inputFile, temp)) {
-            std::istringstream buffer(temp);
-
-            std::vector<double> line{std::istream_iterator<double>(buffer), std::istream_iterator<double>()};
-
-            matrix.push_back(line);
-        }
-
-        return Matrix(matrix, padding);
+        return Matrix(readRows(filename), padding);
     }
 }
@@ -10,6 +10,7 @@ namespace Utility
 {
 	void printVec(std::vector<std::vector<double> > matrix);
 
+    //whitespace text, one row per line (TextLoader); throws runtime_error when unreadable
     Matrix createMatrixFromFile(std::string filename);
 
     Matrix createMatrixFromFile(std::string filename, int padding);
@@ -0,0 +1,179 @@
+//Benchmark suite: every VGG-16 layer shape for the 64/128/224 inputs in
+//layers/, every engine, warm-up + repetitions, median/p99, GFLOP/s and GB/s
+//from a calibrated TSC, with optional JSON output for tracking over time.
+//
+//  make bench && ./tools/bench [--inputs 64,128,224] [--engines baseline,simd,simd_openmp,jit,gemm]
+//                              [--layers conv3] [--warmup 1] [--reps 5] [--xblock 1]
+//                              [--end-to-end] [--counters] [--max-weights-mb 1024] [--json bench.json]
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <omp.h>
+#include "Autotuner.h"
+#include "Benchmark.h"
+#include "Kernels.h"
+#include "Network.h"
+#include "PerfCounters.h"
+#include "Timer.h"
+#include "Trace.h"
+
+using namespace std;
+
+static void usage()
+{
+    cerr << "usage: bench [--inputs 64,128,224] [--engines naive,baseline,simd,simd_openmp,jit,gemm]\n"
+         << "             [--layers SUBSTRING] [--warmup N] [--reps N] [--xblock N] [--end-to-end] [--counters]\n"
+         << "             [--max-weights-mb MB] [--layers-dir DIR] [--json FILE]" << endl;
+    exit(2);
+}
+
+static Benchmark::Options parseOptions(int argc, char* argv[])
+{
+    Benchmark::Options options;
+    options.inputs.push_back(64);
+    options.inputs.push_back(128);
+    options.inputs.push_back(224);
+    options.settings = Benchmark::defaults();
+
+    bool valid = Benchmark::parseOptions(argc, argv, options, [&](string const &arg, int &i) -> bool {
+        if (arg == "--end-to-end")
+            options.settings.endToEnd = true;
+        else if (arg == "--counters")
+            options.settings.counters = true;
+        else
+            return false;
+        return true;
+    });
+    if (!valid)
+        usage();
+
+    return options;
+}
+
+static string escape(string const &text)
+{
+    string escaped;
+    for (size_t i = 0; i < text.size(); i++) {
+        if (text[i] == '"' || text[i] == '\\')
+            escaped += '\\';
+        escaped += text[i];
+    }
+    return escaped;
+}
+
+static void writeStats(ostream &out, string const &prefix, Benchmark::Stats const &stats, Benchmark::Record const &record)
+{
+    out << ", \"" << prefix << "median_s\": " << stats.median
+        << ", \"" << prefix << "p99_s\": " << stats.p99
+        << ", \"" << prefix << "min_s\": " << stats.min
+        << ", \"" << prefix << "mean_s\": " << stats.mean
+        << ", \"" << prefix << "gflops\": " << record.flops/stats.median/1e9
+        << ", \"" << prefix << "gbps\": " << record.bytes/stats.median/1e9;
+}
+
+static void writeJson(ostream &out, vector<Benchmark::Record> const &records, Benchmark::Options const &options)
+{
+    char timestamp[32];
+    time_t now = time(NULL);
+    strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+
+    out << setprecision(9);
+    out << "{\n  \"timestamp\": \"" << timestamp << "\",\n"
+        << "  \"host\": {\"cpu\": \"" << escape(Autotuner::cpuModel()) << "\", \"isa\": \"" << Kernels::active().name
+        << "\", \"threads\": " << omp_get_max_threads() << ", \"tsc_hz\": " << Timer::tscHz()
+        << ", \"invariant_tsc\": " << (Timer::invariantTsc() ? "true" : "false") << "},\n"
+        << "  \"config\": {\"warmup\": " << options.settings.warmup << ", \"reps\": " << options.settings.reps
+        << ", \"xblock\": " << options.settings.xBlock << "},\n"
+        << "  \"results\": [";
+
+    for (size_t r = 0; r < records.size(); r++) {
+        Benchmark::Record const &record = records[r];
+        out << (r ? ",\n" : "\n") << "    {\"input\": " << record.input
+            << ", \"layer\": \"" << record.layer << "\", \"type\": \"" << record.type
+            << "\", \"engine\": \"" << escape(record.engine) << "\""
+            << ", \"in\": [" << record.in.height << ", " << record.in.width << ", " << record.in.depth << "]"
+            << ", \"out\": [" << record.out.height << ", " << record.out.width << ", " << record.out.depth << "]"
+            << ", \"F\": " << record.F << ", \"stride\": " << record.stride << ", \"padding\": " << record.padding
+            << ", \"flops\": " << record.flops << ", \"bytes\": " << record.bytes;
+
+        if (!record.skipped.empty()) {
+            out << ", \"skipped\": \"" << escape(record.skipped) << "\"}";
+            continue;
+        }
+
+        writeStats(out, "", record.kernel, record);
+        if (record.hasEndToEnd)
+            writeStats(out, "e2e_", record.endToEnd, record);
+        out << "}";
+    }
+
+    out << "\n  ]\n}\n";
+}
+
+static void printRecord(Benchmark::Record const &record)
+{
+    cout << setw(4) << record.input << "  " << left << setw(9) << record.layer << setw(13) << record.engine << right;
+
+    if (!record.skipped.empty()) {
+        cout << "  skipped: " << record.skipped << endl;
+        return;
+    }
+
+    cout << fixed << setprecision(3)
+         << setw(11) << record.kernel.median*1e3 << setw(11) << record.kernel.p99*1e3
+         << setw(10) << record.flops/record.kernel.median/1e9
+         << setw(10) << record.bytes/record.kernel.median/1e9;
+    if (record.hasEndToEnd)
+        cout << setw(11) << record.endToEnd.median*1e3;
+    cout << defaultfloat << endl;
+}
+
+int main(int argc, char* argv[])
+{
+    Benchmark::Options options = parseOptions(argc, argv);
+    Network network = Network::vgg16();
+    vector<Benchmark::Record> records;
+
+    cout << "cpu " << Autotuner::cpuModel() << ", isa " << Kernels::active().name
+         << ", " << omp_get_max_threads() << " threads, TSC " << Timer::tscHz()/1e9 << " GHz"
+         << (Timer::invariantTsc() ? "" : " (not invariant)") << endl;
+    cout << "input  layer    engine        median ms     p99 ms   GFLOP/s      GB/s"
+         << (options.settings.endToEnd ? "     e2e ms" : "") << endl;
+
+    for (size_t i = 0; i < options.inputs.size(); i++) {
+        int inputSize = options.inputs[i];
+        vector<LayerShape> shapes = network.shapesFor(inputSize, inputSize, 3);
+        vector<LayerSpec> const &layers = network.getLayers();
+
+        for (size_t l = 0; l < layers.size(); l++) {
+            if (layers[l].name.find(options.layerFilter) == string::npos)
+                continue;
+
+            size_t first = records.size();
+            TRACE_LAYER(layers[l].name);
+            Benchmark::runLayer(inputSize, layers[l], shapes[l], l == 0, options.settings, records);
+            for (size_t r = first; r < records.size(); r++)
+                printRecord(records[r]);
+        }
+    }
+
+    if (options.settings.counters) {
+        cout << endl;
+        PerfCounters::report(cout);
+    }
+
+    if (!options.json.empty()) {
+        ofstream out(options.json.c_str());
+        if (!out) {
+            cerr << "bench: cannot write " << options.json << endl;
+            return 1;
+        }
+        writeJson(out, records, options);
+        cout << "wrote " << options.json << endl;
+    }
+
+    return 0;
+}
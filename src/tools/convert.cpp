@@ -0,0 +1,79 @@
+//Converts whitespace text matrices into the binary TensorFile format, one
+//text file per channel, or prints the header of an existing tensor file.
+//
+//  make tools && ./tools/convert out.tensor layers/input_layer_64x64 layers/input_layer_64x64 layers/input_layer_64x64
+//                ./tools/convert out.tensor --layout hwc --dtype f32 a.txt b.txt c.txt
+//                ./tools/convert --info out.tensor
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include "TensorFile.h"
+#include "Utility.h"
+
+using namespace std;
+
+static void usage()
+{
+    cerr << "usage: convert OUTPUT [--layout chw|hwc] [--dtype f64|f32] CHANNEL_FILE...\n"
+         << "       convert --info TENSOR_FILE" << endl;
+    exit(2);
+}
+
+static int info(string const &path)
+{
+    TensorView view(path);
+    cout << path << ": " << view.getHeight() << "x" << view.getWidth() << "x" << view.getDepth()
+         << ", " << (view.getDtype() == DTYPE_FLOAT32 ? "f32" : "f64")
+         << ", " << (view.getLayout() == LAYOUT_HWC ? "hwc" : "chw") << endl;
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 3)
+        usage();
+
+    try {
+        if (string(argv[1]) == "--info")
+            return info(argv[2]);
+
+        string output = argv[1];
+        TensorDtype dtype = DTYPE_FLOAT64;
+        TensorLayout layout = LAYOUT_CHW;
+        Tensor tensor;
+        int channels = 0;
+
+        for (int i = 2; i < argc; i++) {
+            string arg = argv[i];
+            if (arg == "--layout" && i + 1 < argc) {
+                string value = argv[++i];
+                if (value != "chw" && value != "hwc")
+                    usage();
+                layout = value == "hwc" ? LAYOUT_HWC : LAYOUT_CHW;
+            } else if (arg == "--dtype" && i + 1 < argc) {
+                string value = argv[++i];
+                if (value != "f64" && value != "f32")
+                    usage();
+                dtype = value == "f32" ? DTYPE_FLOAT32 : DTYPE_FLOAT64;
+            } else {
+                Matrix channel = Utility::createMatrixFromFile(arg);
+                if (channel.getHeight() == 0)
+                    throw runtime_error("convert: " + arg + " is empty or missing");
+                if (channels++ == 0)
+                    tensor = Tensor(channel.getHeight(), channel.getWidth());
+                else if (channel.getHeight() != tensor.getHeight() || channel.getWidth() != tensor.getWidth())
+                    throw runtime_error("convert: " + arg + " does not match the shape of the first channel");
+                tensor.addLayer(channel);
+            }
+        }
+
+        if (channels == 0)
+            usage();
+
+        TensorFile::write(output, tensor, dtype, layout);
+        return info(output);
+    } catch (exception const &error) {
+        cerr << error.what() << endl;
+        return 1;
+    }
+}
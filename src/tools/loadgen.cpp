@@ -0,0 +1,225 @@
+//Load generator for tools/server: each connection keeps --inflight requests
+//pipelined until it has sent --requests, then the latencies of the answered
+//ones are summarised with the refused and failed counts. --shm NAME sends the
+//same load through the server's shared-memory ring instead of the socket.
+//
+//  ./tools/loadgen [--socket /tmp/fastcode-server.sock] [--connections 4] [--requests 100]
+//                  [--inflight 2] [--input 64] [--image cat.jpg] [--shm NAME]
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Benchmark.h"
+#include "Server.h"
+#include "ShmRing.h"
+#include "Timer.h"
+
+using namespace std;
+
+struct Totals
+{
+    mutex lock;
+    vector<double> latencies;
+    long ok;
+    long refused;
+    long failed;
+    string lastError;
+};
+
+static void usage()
+{
+    cerr << "usage: loadgen [--socket PATH] [--connections N] [--requests N] [--inflight N]\n"
+         << "               [--input N] [--image FILE] [--shm NAME]" << endl;
+    exit(2);
+}
+
+static void drive(string const &socketPath, ServerRequestKind kind, vector<unsigned char> const &payload,
+                  int requests, int inflight, Totals &totals)
+{
+    vector<double> latencies;
+    long ok = 0, refused = 0, failed = 0;
+    string lastError;
+
+    try {
+        ServerClient client(socketPath);
+        map<unsigned long long, unsigned long long> sentAt;
+        vector<double> outputs;
+        int sent = 0, received = 0;
+
+        while (received < requests) {
+            while (sent < requests && sent - received < inflight) {
+                unsigned long long begin = Timer::rdtsc();
+                sentAt[client.send(kind, payload.data(), payload.size())] = begin;
+                sent++;
+            }
+
+            unsigned long long id;
+            string error;
+            ServerStatus status = client.receive(id, outputs, error);
+            latencies.push_back(Timer::seconds(Timer::rdtsc() - sentAt[id]));
+            sentAt.erase(id);
+            received++;
+
+            if (status == STATUS_OK) {
+                ok++;
+            } else if (status == STATUS_OVERLOADED) {
+                refused++;
+                latencies.pop_back();
+            } else {
+                failed++;
+                latencies.pop_back();
+                lastError = error;
+            }
+        }
+    } catch (exception const &error) {
+        lastError = error.what();
+        failed++;
+    }
+
+    lock_guard<mutex> guard(totals.lock);
+    totals.latencies.insert(totals.latencies.end(), latencies.begin(), latencies.end());
+    totals.ok += ok;
+    totals.refused += refused;
+    totals.failed += failed;
+    if (!lastError.empty())
+        totals.lastError = lastError;
+}
+
+//the inputs are written in place in the slots, the outputs read in place
+static void driveRing(string const &name, int requests, int inflight, Totals &totals)
+{
+    vector<double> latencies;
+    long ok = 0, refused = 0, failed = 0;
+    string lastError;
+
+    try {
+        ShmRingClient client(name);
+        deque<pair<int, unsigned long long> > pending;
+        int sent = 0, received = 0;
+
+        while (received < requests) {
+            while (sent < requests && (int)pending.size() < inflight) {
+                unsigned long long begin = Timer::rdtsc();
+                int slot = client.acquire();
+                double* input = client.input(slot);
+                for (long p = 0; p < client.inputSize(); p++)
+                    input[p] = (p*7 + sent)%256 - 128;
+                client.submit(slot);
+                pending.push_back(make_pair(slot, begin));
+                sent++;
+            }
+
+            int slot = pending.front().first;
+            ServerStatus status = client.wait(slot);
+            double seconds = Timer::seconds(Timer::rdtsc() - pending.front().second);
+            pending.pop_front();
+            received++;
+
+            if (status == STATUS_OK) {
+                ok++;
+                latencies.push_back(seconds);
+            } else if (status == STATUS_OVERLOADED) {
+                refused++;
+            } else {
+                failed++;
+                lastError = "the server could not run a request";
+            }
+            client.release(slot);
+        }
+    } catch (exception const &error) {
+        lastError = error.what();
+        failed++;
+    }
+
+    lock_guard<mutex> guard(totals.lock);
+    totals.latencies.insert(totals.latencies.end(), latencies.begin(), latencies.end());
+    totals.ok += ok;
+    totals.refused += refused;
+    totals.failed += failed;
+    if (!lastError.empty())
+        totals.lastError = lastError;
+}
+
+int main(int argc, char* argv[])
+{
+    string socketPath = Server::defaults().socketPath;
+    int connections = 4, requests = 100, inflight = 2, input = 64;
+    string image;
+    string shm;
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (i + 1 >= argc)
+            usage();
+        else if (arg == "--socket")
+            socketPath = argv[++i];
+        else if (arg == "--connections")
+            connections = atoi(argv[++i]);
+        else if (arg == "--requests")
+            requests = atoi(argv[++i]);
+        else if (arg == "--inflight")
+            inflight = atoi(argv[++i]);
+        else if (arg == "--input")
+            input = atoi(argv[++i]);
+        else if (arg == "--image")
+            image = argv[++i];
+        else if (arg == "--shm")
+            shm = argv[++i];
+        else
+            usage();
+    }
+
+    if (connections < 1 || requests < 1 || inflight < 1 || input < 1)
+        usage();
+
+    //one payload for every request: the encoded file, or planes of the model input size
+    ServerRequestKind kind = REQUEST_PLANES;
+    vector<unsigned char> payload;
+    if (!image.empty()) {
+        ifstream file(image.c_str(), ios::binary);
+        if (!file) {
+            cerr << "loadgen: cannot read " << image << endl;
+            return 1;
+        }
+        payload.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+        kind = REQUEST_IMAGE;
+    } else {
+        vector<double> planes(3L*input*input);
+        for (size_t p = 0; p < planes.size(); p++)
+            planes[p] = rand()%256 - 128;
+        payload.assign((unsigned char*) planes.data(), (unsigned char*) (planes.data() + planes.size()));
+    }
+
+    Totals totals;
+    totals.ok = totals.refused = totals.failed = 0;
+    unsigned long long begin = Timer::rdtsc();
+
+    vector<thread> threads;
+    for (int c = 0; c < connections; c++) {
+        if (shm.empty())
+            threads.push_back(thread(drive, socketPath, kind, payload, requests, inflight, ref(totals)));
+        else
+            threads.push_back(thread(driveRing, shm, requests, inflight, ref(totals)));
+    }
+    for (size_t t = 0; t < threads.size(); t++)
+        threads[t].join();
+
+    double seconds = Timer::seconds(Timer::rdtsc() - begin);
+    cout << totals.ok << " ok, " << totals.refused << " refused, " << totals.failed << " failed in "
+         << setprecision(3) << seconds << " s, " << fixed << setprecision(1) << totals.ok/seconds << " req/s" << defaultfloat << endl;
+    if (!totals.latencies.empty()) {
+        Benchmark::Stats latency = Benchmark::summarize(totals.latencies);
+        cout << "latency ms: median " << fixed << setprecision(3) << latency.median*1e3 << ", p99 " << latency.p99*1e3
+             << ", min " << latency.min*1e3 << ", mean " << latency.mean*1e3 << defaultfloat << endl;
+    }
+    if (!totals.lastError.empty())
+        cout << "last error: " << totals.lastError << endl;
+    return totals.failed ? 1 : 0;
+}
@@ -0,0 +1,106 @@
+//Offline batch inference over directories of JPEG/PNG files through the
+//overlapped Pipeline stages; one result line per image on stdout (or --output)
+//and the per-stage report on stderr.
+//
+//  make tools && ./tools/pipeline images/ [--network tiny|vgg16|mobilenet] [--input 64] [--tune] [--tiled]
+//                 [--readers N] [--decoders N] [--preprocessors N] [--writers N]
+//                 [--queue N] [--batch N] [--resize N] [--nice N] [--output FILE]
+//                 [--weights double|fp16|bf16]
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "Autotuner.h"
+#include "Model.h"
+#include "Network.h"
+#include "Pipeline.h"
+
+using namespace std;
+
+static void usage()
+{
+    cerr << "usage: pipeline DIR|FILE... [--network tiny|vgg16|mobilenet] [--input N] [--tune] [--tiled]\n"
+         << "                [--readers N] [--decoders N] [--preprocessors N] [--writers N]\n"
+         << "                [--queue N] [--batch N] [--resize N] [--nice N] [--output FILE]\n"
+         << "                [--weights double|fp16|bf16]" << endl;
+    exit(2);
+}
+
+int main(int argc, char* argv[])
+{
+    Pipeline::Settings settings = Pipeline::defaults();
+    string networkName = "tiny", weights = "double";
+    int input = 64;
+    bool tune = false, tiled = false;
+    vector<string> inputs;
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (arg == "--tune") {
+            tune = true;
+        } else if (arg == "--tiled") {
+            tiled = true;
+        } else if (arg.compare(0, 2, "--") != 0) {
+            inputs.push_back(arg);
+        } else if (!hasValue) {
+            usage();
+        } else if (arg == "--network") {
+            networkName = argv[++i];
+        } else if (arg == "--input") {
+            input = atoi(argv[++i]);
+        } else if (arg == "--readers") {
+            settings.readers = atoi(argv[++i]);
+        } else if (arg == "--decoders") {
+            settings.decoders = atoi(argv[++i]);
+        } else if (arg == "--preprocessors") {
+            settings.preprocessors = atoi(argv[++i]);
+        } else if (arg == "--writers") {
+            settings.writers = atoi(argv[++i]);
+        } else if (arg == "--queue") {
+            settings.queueDepth = atoi(argv[++i]);
+        } else if (arg == "--batch") {
+            settings.batch = atoi(argv[++i]);
+        } else if (arg == "--resize") {
+            settings.resizeTo = atoi(argv[++i]);
+        } else if (arg == "--nice") {
+            settings.feederNice = atoi(argv[++i]);
+        } else if (arg == "--weights") {
+            weights = argv[++i];
+        } else if (arg == "--output") {
+            settings.output = argv[++i];
+        } else {
+            usage();
+        }
+    }
+
+    if (inputs.empty() || input < 1)
+        usage();
+    if (settings.resizeTo < input)
+        settings.resizeTo = input;
+
+    try {
+        LayerShape shape = {input, input, 3};
+        Model model(Network::byName(networkName), shape);
+        model.setWeightFormat(Model::weightFormatFromName(weights));
+        if (tune) {
+            Autotuner autotuner;
+            model.tune(autotuner);
+        }
+        if (tiled) {
+            Tiling tiling = model.planTiling();
+            model.setTiling(tiling);
+            if (tiling.layers > 0)
+                cerr << "tiling " << tiling.layers << " layers with " << tiling.tile << "x" << tiling.tile
+                     << " tiles, " << model.tilingOverhead(tiling) << "x the FLOPs" << endl;
+        }
+
+        Pipeline::Report report = Pipeline::run(model, inputs, settings);
+        Pipeline::writeReport(cerr, report);
+        return report.failed ? 1 : 0;
+    } catch (exception const &error) {
+        cerr << "pipeline: " << error.what() << endl;
+        return 1;
+    }
+}
@@ -0,0 +1,157 @@
+//Int8 calibration and accuracy drift: runs sample inputs (images, or random
+//volumes when none are given) through the double model to collect the range
+//of every activation channel, quantizes the model with those ranges and
+//compares the int8 outputs with the double reference on the same inputs.
+//Prints per-sample drift, the summary, the time per image of both and the
+//weight bytes of both.
+//
+//  make tools && ./tools/quantize [IMAGE...] [--network tiny|vgg16|mobilenet] [--input 64]
+//                                 [--samples 8] [--relu] [--save FILE] [--load FILE]
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "Image.h"
+#include "Model.h"
+#include "Network.h"
+#include "Quantized.h"
+#include "Timer.h"
+
+using namespace std;
+
+static void usage()
+{
+    cerr << "usage: quantize [IMAGE...] [--network tiny|vgg16|mobilenet] [--input N] [--samples N]\n"
+         << "                [--relu] [--save FILE] [--load FILE]" << endl;
+    exit(2);
+}
+
+static vector<double> flatten(Tensor const &volume)
+{
+    vector<double> values((long)volume.getHeight()*volume.getWidth()*volume.getDepth());
+    Model::toPlanes(volume, values.data());
+    return values;
+}
+
+int main(int argc, char* argv[])
+{
+    string networkName = "tiny", savePath, loadPath;
+    int input = 64, samples = 8;
+    bool relu = false;
+    vector<string> images;
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (arg == "--relu") {
+            relu = true;
+        } else if (arg.compare(0, 2, "--") != 0) {
+            images.push_back(arg);
+        } else if (!hasValue) {
+            usage();
+        } else if (arg == "--network") {
+            networkName = argv[++i];
+        } else if (arg == "--input") {
+            input = atoi(argv[++i]);
+        } else if (arg == "--samples") {
+            samples = atoi(argv[++i]);
+        } else if (arg == "--save") {
+            savePath = argv[++i];
+        } else if (arg == "--load") {
+            loadPath = argv[++i];
+        } else {
+            usage();
+        }
+    }
+
+    if (input < 1 || samples < 1)
+        usage();
+
+    try {
+        LayerShape shape = {input, input, 3};
+        Model model(Network::byName(networkName), shape);
+
+        vector<Tensor> inputs;
+        if (!images.empty()) {
+            vector<double> batch(images.size()*model.inputSize());
+            Image::loadBatch(batch.data(), images, input, input, Image::caffeVgg());
+            for (size_t i = 0; i < images.size(); i++)
+                inputs.push_back(Model::fromPlanes(batch.data() + i*model.inputSize(), shape));
+        } else {
+            for (int s = 0; s < samples; s++) {
+                Tensor volume = Tensor(input, input, 3);
+                volume.randomValueInit(0, 255);
+                inputs.push_back(volume);
+            }
+        }
+
+        Calibration calibration = loadPath.empty() ? Calibration::collect(model, inputs, relu)
+                                                   : Calibration::load(loadPath);
+        if (!savePath.empty())
+            calibration.save(savePath);
+        QuantizedModel quantized(model, calibration, relu);
+
+        cout << networkName << " " << input << "x" << input << (relu ? " with ReLU" : "") << ", "
+             << inputs.size() << " samples, calibration " << (loadPath.empty() ? "from the samples" : loadPath) << endl;
+        cout << left << setw(8) << "sample" << right << setw(14) << "rel. L2" << setw(14) << "max abs/max"
+             << setw(8) << "top-1" << endl;
+
+        //first calls pay for JIT compilation and page faults, keep them out of the timings
+        QuantizedModel::reference(model, inputs[0], relu);
+        quantized.forward(inputs[0]);
+
+        double doubleSeconds = 0, int8Seconds = 0, worstL2 = 0, sumL2 = 0, worstMax = 0;
+        int agree = 0;
+        for (size_t s = 0; s < inputs.size(); s++) {
+            unsigned long long begin = Timer::rdtsc();
+            vector<double> reference = flatten(QuantizedModel::reference(model, inputs[s], relu));
+            doubleSeconds += Timer::seconds(Timer::rdtsc() - begin);
+
+            begin = Timer::rdtsc();
+            vector<double> output = flatten(quantized.forward(inputs[s]));
+            int8Seconds += Timer::seconds(Timer::rdtsc() - begin);
+
+            double error = 0, norm = 0, largestError = 0, largest = 0;
+            for (size_t i = 0; i < reference.size(); i++) {
+                double difference = output[i] - reference[i];
+                error += difference*difference;
+                norm += reference[i]*reference[i];
+                largestError = max(largestError, fabs(difference));
+                largest = max(largest, fabs(reference[i]));
+            }
+            double l2 = norm > 0 ? sqrt(error/norm) : sqrt(error);
+            double relativeMax = largest > 0 ? largestError/largest : largestError;
+            bool same = max_element(output.begin(), output.end()) - output.begin()
+                        == max_element(reference.begin(), reference.end()) - reference.begin();
+
+            worstL2 = max(worstL2, l2);
+            worstMax = max(worstMax, relativeMax);
+            sumL2 += l2;
+            agree += same;
+            cout << left << setw(8) << s << right << scientific << setprecision(3) << setw(14) << l2
+                 << setw(14) << relativeMax << setw(8) << (same ? "same" : "diff") << endl;
+        }
+
+        long doubleBytes = 0;
+        vector<LayerSpec> const &layers = model.getNetwork().getLayers();
+        vector<LayerShape> shapes = model.getNetwork().shapesFor(input, input, 3);
+        for (size_t l = 0; l < layers.size(); l++)
+            doubleBytes += sizeof(double)*Network::weightCount(layers[l], shapes[l]);
+
+        int count = (int)inputs.size();
+        cout << "rel. L2 mean " << scientific << setprecision(3) << sumL2/count << ", worst " << worstL2
+             << "; max abs/max worst " << worstMax << "; top-1 agreement " << agree << "/" << count << endl;
+        cout << fixed << setprecision(2)
+             << "double " << 1000*doubleSeconds/count << " ms/image, int8 " << 1000*int8Seconds/count
+             << " ms/image (" << doubleSeconds/int8Seconds << "x); weights " << doubleBytes/1048576.0
+             << " MiB double, " << quantized.weightBytes()/1048576.0 << " MiB int8" << endl;
+        return 0;
+    } catch (exception const &error) {
+        cerr << "quantize: " << error.what() << endl;
+        return 1;
+    }
+}
@@ -0,0 +1,363 @@
+//Roofline analyzer: measures the host's peak FLOP/s (register-only FMA chains
+//per Kernels ISA) and memory bandwidth (STREAM triad), then places every
+//VGG-16 layer and engine under its roof: arithmetic intensity from the layer
+//shape, attained GFLOP/s, the roof min(peak, AI * bandwidth) for the ISA and
+//thread count the engine actually uses, and whether it is compute- or
+//memory-bound. The bandwidth roof is the triad of the innermost cache level
+//the layer's compulsory traffic fits in, DRAM otherwise.
+//
+//  make tools && ./tools/roofline [--inputs 64] [--engines baseline,simd,simd_openmp,jit,gemm]
+//                                 [--layers conv5] [--reps 3] [--stream-mb 256] [--json roofline.json]
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <omp.h>
+#include <unistd.h>
+#include "Autotuner.h"
+#include "Benchmark.h"
+#include "Kernels.h"
+#include "Network.h"
+#include "Timer.h"
+
+using namespace std;
+
+//ceilings for one ISA
+struct Peak
+{
+    bool supported;
+    double single; //FLOP/s on one thread
+    double all;    //FLOP/s on every OpenMP thread
+};
+
+//triad bandwidth out of one level of the hierarchy
+struct Level
+{
+    string name;
+    long bytes;    //capacity, 0 for DRAM
+    double single; //bytes/s on one thread
+    double all;    //bytes/s on every OpenMP thread
+};
+
+struct Machine
+{
+    Peak peaks[4]; //indexed by Kernels::Isa
+    vector<Level> levels; //innermost first, DRAM last
+};
+
+static void usage()
+{
+    cerr << "usage: roofline [--inputs 64,128,224] [--engines naive,baseline,simd,simd_openmp,jit,gemm]\n"
+         << "                [--layers SUBSTRING] [--warmup N] [--reps N] [--xblock N] [--stream-mb MB]\n"
+         << "                [--max-weights-mb MB] [--layers-dir DIR] [--json FILE]" << endl;
+    exit(2);
+}
+
+//the Benchmark options plus the size of the STREAM arrays
+static Benchmark::Options parseOptions(int argc, char* argv[], double &streamMb)
+{
+    Benchmark::Options options;
+    options.inputs.push_back(64);
+    options.settings = Benchmark::defaults();
+    options.settings.reps = 3;
+    streamMb = 256;
+
+    bool valid = Benchmark::parseOptions(argc, argv, options, [&](string const &arg, int &i) -> bool {
+        if (arg != "--stream-mb" || i + 1 >= argc)
+            return false;
+        streamMb = atof(argv[++i]);
+        return true;
+    });
+    if (!valid || streamMb <= 0)
+        usage();
+
+    return options;
+}
+
+//----------------------------------------------------------- microbenchmarks
+
+//best of a few runs, each long enough (~50 ms) to hide the frequency ramp
+static double peakFlops(Kernels::Table const &kernels, int threads)
+{
+    const long iterations = 4000000;
+    double best = 0;
+
+    for (int run = 0; run < 5; run++) {
+        double flops = 0;
+        unsigned long long start = Timer::rdtsc();
+        #pragma omp parallel num_threads(threads) reduction(+:flops)
+        flops += kernels.peakFlops(iterations);
+        double seconds = Timer::seconds(Timer::rdtsc() - start);
+
+        if (flops/seconds > best)
+            best = flops/seconds;
+    }
+    return best;
+}
+
+//STREAM triad a[i] = b[i] + s*c[i]: 24 bytes per element, counted without
+//the write-allocate read STREAM also leaves out
+static double triadBandwidth(double megabytes, int threads, int runs)
+{
+    long n = (long)(megabytes*1024*1024/24);
+    double *a, *b, *c;
+    posix_memalign((void**) &a, 64, n*sizeof(double));
+    posix_memalign((void**) &b, 64, n*sizeof(double));
+    posix_memalign((void**) &c, 64, n*sizeof(double));
+
+    //first touch from the threads that will stream the arrays
+    #pragma omp parallel for num_threads(threads) schedule(static)
+    for (long i = 0; i < n; i++) {
+        a[i] = 0;
+        b[i] = 1;
+        c[i] = 2;
+    }
+
+    double best = 0;
+    for (int run = 0; run < runs; run++) {
+        const double s = 3.0;
+        unsigned long long start = Timer::rdtsc();
+        #pragma omp parallel for num_threads(threads) schedule(static)
+        for (long i = 0; i < n; i++)
+            a[i] = b[i] + s*c[i];
+        double seconds = Timer::seconds(Timer::rdtsc() - start);
+
+        if (24.0*n/seconds > best)
+            best = 24.0*n/seconds;
+    }
+
+    free(a);
+    free(b);
+    free(c);
+    return best;
+}
+
+static Machine measureMachine(double streamMb)
+{
+    Machine machine;
+    int threads = omp_get_max_threads();
+
+    Kernels::Isa isas[] = {Kernels::ISA_SCALAR, Kernels::ISA_SSE4, Kernels::ISA_AVX2, Kernels::ISA_AVX512};
+    for (Kernels::Isa isa : isas) {
+        Peak &peak = machine.peaks[isa];
+        peak.supported = Kernels::isSupported(isa);
+        peak.single = peak.all = 0;
+        if (!peak.supported)
+            continue;
+
+        Kernels::Table const &kernels = Kernels::table(isa);
+        peak.single = peakFlops(kernels, 1);
+        peak.all = threads > 1 ? peakFlops(kernels, threads) : peak.single;
+    }
+
+    //cache levels are streamed at half their size so the three arrays stay
+    //resident between runs; levels the system does not report are left out
+    const char* names[] = {"L2", "L3"};
+    long sizes[] = {sysconf(_SC_LEVEL2_CACHE_SIZE), sysconf(_SC_LEVEL3_CACHE_SIZE)};
+    for (int c = 0; c < 2; c++) {
+        if (sizes[c] <= 0)
+            continue;
+        Level level;
+        level.name = names[c];
+        level.bytes = sizes[c];
+        level.single = triadBandwidth(sizes[c]/2.0/1024/1024, 1, 50);
+        level.all = threads > 1 ? triadBandwidth(sizes[c]/2.0/1024/1024, threads, 50) : level.single;
+        machine.levels.push_back(level);
+    }
+
+    Level dram;
+    dram.name = "DRAM";
+    dram.bytes = 0;
+    dram.single = triadBandwidth(streamMb, 1, 5);
+    dram.all = threads > 1 ? triadBandwidth(streamMb, threads, 5) : dram.single;
+    machine.levels.push_back(dram);
+    return machine;
+}
+
+//------------------------------------------------------------------- ceilings
+
+//the ISA and thread count an engine's hot loop runs with
+static void engineCeiling(Benchmark::Record const &record, Machine const &machine, double &peak, Level &level)
+{
+    Kernels::Isa isa = Kernels::active().isa;
+    bool parallel = false;
+
+    if (record.type != "conv") {
+        //pool and FC records are named after the Kernels ISA they ran, FC
+        //16-bit weight records with a -fp16 / -bf16 suffix
+        string name = record.engine.substr(0, record.engine.find('-'));
+        Kernels::Isa isas[] = {Kernels::ISA_SCALAR, Kernels::ISA_SSE4, Kernels::ISA_AVX2, Kernels::ISA_AVX512};
+        for (Kernels::Isa candidate : isas) {
+            if (name == Kernels::isaName(candidate))
+                isa = candidate;
+        }
+    } else if (record.engine == "naive" || record.engine == "baseline") {
+        isa = Kernels::ISA_SCALAR;
+    } else if (record.engine == "simd_openmp" || record.engine == "gemm") {
+        parallel = true;
+    } else if (record.engine == "jit") {
+        //the generated code is AVX2/FMA whatever the active table is
+        isa = Kernels::ISA_AVX2;
+        parallel = true;
+    }
+
+    peak = parallel ? machine.peaks[isa].all : machine.peaks[isa].single;
+
+    //the innermost level the compulsory traffic fits in
+    size_t l = 0;
+    while (machine.levels[l].bytes > 0 && record.bytes > machine.levels[l].bytes)
+        l++;
+    level = machine.levels[l];
+    if (!parallel)
+        level.all = level.single;
+}
+
+struct Point
+{
+    double intensity; //FLOPs per byte of compulsory traffic
+    double attained;  //FLOP/s
+    double peak;
+    Level level; //level.all is the bandwidth for the engine's thread count
+    double roof;
+    bool computeBound; //the ridge point lies left of the layer
+};
+
+static Point place(Benchmark::Record const &record, Machine const &machine)
+{
+    Point point;
+    engineCeiling(record, machine, point.peak, point.level);
+    point.intensity = record.flops/record.bytes;
+    point.attained = record.flops/record.kernel.median;
+    point.roof = min(point.peak, point.intensity*point.level.all);
+    point.computeBound = point.intensity*point.level.all >= point.peak;
+    return point;
+}
+
+//--------------------------------------------------------------------- output
+
+static void printMachine(Machine const &machine)
+{
+    cout << fixed << setprecision(2);
+    cout << "peak GFLOP/s (1 thread / " << omp_get_max_threads() << " threads):";
+    Kernels::Isa isas[] = {Kernels::ISA_SCALAR, Kernels::ISA_SSE4, Kernels::ISA_AVX2, Kernels::ISA_AVX512};
+    for (Kernels::Isa isa : isas) {
+        if (machine.peaks[isa].supported)
+            cout << "  " << Kernels::isaName(isa) << " " << machine.peaks[isa].single/1e9 << " / " << machine.peaks[isa].all/1e9;
+    }
+    cout << endl << "triad GB/s (1 thread / " << omp_get_max_threads() << " threads):";
+    for (size_t l = 0; l < machine.levels.size(); l++)
+        cout << "  " << machine.levels[l].name << " " << machine.levels[l].single/1e9 << " / " << machine.levels[l].all/1e9;
+    cout << endl;
+    cout << defaultfloat;
+}
+
+static void printPoint(Benchmark::Record const &record, Point const &point)
+{
+    cout << setw(4) << record.input << "  " << left << setw(9) << record.layer << setw(13) << record.engine << right;
+
+    if (!record.skipped.empty()) {
+        cout << "  skipped: " << record.skipped << endl;
+        return;
+    }
+
+    cout << fixed << setprecision(2)
+         << setw(9) << point.intensity
+         << setw(11) << point.attained/1e9
+         << setw(10) << point.roof/1e9
+         << setw(9) << setprecision(1) << 100*point.attained/point.roof << "%"
+         << "  " << (point.computeBound ? "compute" : point.level.name) << defaultfloat << endl;
+}
+
+static void writeJson(ostream &out, Machine const &machine, vector<Benchmark::Record> const &records)
+{
+    out << setprecision(9);
+    out << "{\n  \"host\": {\"cpu\": \"" << Autotuner::cpuModel() << "\", \"isa\": \"" << Kernels::active().name
+        << "\", \"threads\": " << omp_get_max_threads()
+        << ", \"triad_gbps\": {";
+
+    for (size_t l = 0; l < machine.levels.size(); l++) {
+        out << (l ? ", " : "") << "\"" << machine.levels[l].name << "\": {\"bytes\": " << machine.levels[l].bytes
+            << ", \"gbps\": [" << machine.levels[l].single/1e9 << ", " << machine.levels[l].all/1e9 << "]}";
+    }
+    out << "}, \"peak_gflops\": {";
+
+    bool firstIsa = true;
+    Kernels::Isa isas[] = {Kernels::ISA_SCALAR, Kernels::ISA_SSE4, Kernels::ISA_AVX2, Kernels::ISA_AVX512};
+    for (Kernels::Isa isa : isas) {
+        if (!machine.peaks[isa].supported)
+            continue;
+        out << (firstIsa ? "" : ", ") << "\"" << Kernels::isaName(isa) << "\": ["
+            << machine.peaks[isa].single/1e9 << ", " << machine.peaks[isa].all/1e9 << "]";
+        firstIsa = false;
+    }
+    out << "}},\n  \"results\": [";
+
+    bool firstRecord = true;
+    for (size_t r = 0; r < records.size(); r++) {
+        Benchmark::Record const &record = records[r];
+        if (!record.skipped.empty())
+            continue;
+
+        Point point = place(record, machine);
+        out << (firstRecord ? "\n" : ",\n") << "    {\"input\": " << record.input
+            << ", \"layer\": \"" << record.layer << "\", \"type\": \"" << record.type
+            << "\", \"engine\": \"" << record.engine << "\""
+            << ", \"flops\": " << record.flops << ", \"bytes\": " << record.bytes
+            << ", \"intensity\": " << point.intensity
+            << ", \"gflops\": " << point.attained/1e9
+            << ", \"peak_gflops\": " << point.peak/1e9
+            << ", \"level\": \"" << point.level.name << "\""
+            << ", \"bandwidth_gbps\": " << point.level.all/1e9
+            << ", \"roof_gflops\": " << point.roof/1e9
+            << ", \"fraction\": " << point.attained/point.roof
+            << ", \"bound\": \"" << (point.computeBound ? "compute" : "memory") << "\"}";
+        firstRecord = false;
+    }
+
+    out << "\n  ]\n}\n";
+}
+
+int main(int argc, char* argv[])
+{
+    double streamMb;
+    Benchmark::Options options = parseOptions(argc, argv, streamMb);
+    Network network = Network::vgg16();
+    vector<Benchmark::Record> records;
+
+    cout << "cpu " << Autotuner::cpuModel() << ", isa " << Kernels::active().name
+         << ", " << omp_get_max_threads() << " threads, TSC " << Timer::tscHz()/1e9 << " GHz" << endl;
+
+    Machine machine = measureMachine(streamMb);
+    printMachine(machine);
+
+    cout << endl << "input  layer    engine        FLOP/B    GFLOP/s      roof  of roof  bound by" << endl;
+
+    for (size_t i = 0; i < options.inputs.size(); i++) {
+        int inputSize = options.inputs[i];
+        vector<LayerShape> shapes = network.shapesFor(inputSize, inputSize, 3);
+        vector<LayerSpec> const &layers = network.getLayers();
+
+        for (size_t l = 0; l < layers.size(); l++) {
+            if (layers[l].name.find(options.layerFilter) == string::npos)
+                continue;
+
+            size_t first = records.size();
+            Benchmark::runLayer(inputSize, layers[l], shapes[l], l == 0, options.settings, records);
+            for (size_t r = first; r < records.size(); r++)
+                printPoint(records[r], records[r].skipped.empty() ? place(records[r], machine) : Point());
+        }
+    }
+
+    if (!options.json.empty()) {
+        ofstream out(options.json.c_str());
+        if (!out) {
+            cerr << "roofline: cannot write " << options.json << endl;
+            return 1;
+        }
+        writeJson(out, machine, records);
+        cout << "wrote " << options.json << endl;
+    }
+
+    return 0;
+}
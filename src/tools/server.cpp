@@ -0,0 +1,128 @@
+//Runs the dynamic-batching inference server until SIGINT/SIGTERM, then prints
+//how many requests it batched, refused and failed. tools/loadgen drives it.
+//--shm also serves a shared-memory ring of that name for co-located clients.
+//
+//  make tools && ./tools/server [--socket /tmp/fastcode-server.sock] [--network tiny|vgg16|mobilenet]
+//                               [--input 64] [--batch 8] [--delay-us 2000] [--queue 64]
+//                               [--resize 256] [--shm NAME] [--slots 16] [--tune]
+//                               [--weights double|fp16|bf16]
+#include <csignal>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include "Autotuner.h"
+#include "Model.h"
+#include "Network.h"
+#include "Server.h"
+#include "ShmRing.h"
+#include "Stats.h"
+
+using namespace std;
+
+static void usage()
+{
+    cerr << "usage: server [--socket PATH] [--network tiny|vgg16|mobilenet] [--input N] [--batch N]\n"
+         << "              [--delay-us US] [--queue N] [--outbox N] [--resize N] [--shm NAME]\n"
+         << "              [--slots N] [--tune] [--weights double|fp16|bf16]" << endl;
+    exit(2);
+}
+
+int main(int argc, char* argv[])
+{
+    Server::Settings settings = Server::defaults();
+    string networkName = "tiny", weights = "double";
+    int input = 64;
+    bool tune = false;
+    string shm;
+    int slots = 16;
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (arg == "--tune") {
+            tune = true;
+        } else if (!hasValue) {
+            usage();
+        } else if (arg == "--socket") {
+            settings.socketPath = argv[++i];
+        } else if (arg == "--network") {
+            networkName = argv[++i];
+        } else if (arg == "--input") {
+            input = atoi(argv[++i]);
+        } else if (arg == "--batch") {
+            settings.maxBatch = atoi(argv[++i]);
+        } else if (arg == "--delay-us") {
+            settings.maxDelayUs = atoi(argv[++i]);
+        } else if (arg == "--queue") {
+            settings.queueDepth = atoi(argv[++i]);
+        } else if (arg == "--outbox") {
+            settings.outboxDepth = atoi(argv[++i]);
+        } else if (arg == "--resize") {
+            settings.resizeTo = atoi(argv[++i]);
+        } else if (arg == "--shm") {
+            shm = argv[++i];
+        } else if (arg == "--weights") {
+            weights = argv[++i];
+        } else if (arg == "--slots") {
+            slots = atoi(argv[++i]);
+        } else {
+            usage();
+        }
+    }
+
+    if (input < 1)
+        usage();
+
+    //every thread inherits the mask, so only sigwait below sees the signals
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    try {
+        LayerShape shape = {input, input, 3};
+        Model model(Network::byName(networkName), shape);
+        model.setWeightFormat(Model::weightFormatFromName(weights));
+        if (tune) {
+            Autotuner autotuner;
+            model.tune(autotuner);
+        }
+
+        Server server(model, settings);
+        server.start();
+        cerr << "serving " << networkName << " (" << input << "x" << input << "x3 -> " << model.outputSize()
+             << ") on " << settings.socketPath << ", batches of " << settings.maxBatch << " within "
+             << settings.maxDelayUs << " us, queue " << settings.queueDepth << ", " << weights << " weights ("
+             << model.weightBytes()/1048576 << " MiB)" << endl;
+
+        ShmRingServer* ring = NULL;
+        if (!shm.empty()) {
+            ring = new ShmRingServer(model, shm, slots, settings.maxBatch);
+            ring->start();
+            cerr << "serving a ring of " << slots << " slots as /dev/shm/" << shm << endl;
+        }
+
+        int received;
+        sigwait(&signals, &received);
+        server.stop();
+
+        if (ring) {
+            ring->stop();
+            cerr << ring->getRequests() << " ring requests in " << ring->getBatches() << " batches" << endl;
+            delete ring;
+        }
+
+        Server::Counters counters = server.counters();
+        cerr << counters.requests << " requests, " << counters.rejected << " refused, " << counters.failed
+             << " failed, " << counters.batches << " batches of "
+             << (counters.batches ? (double)counters.batchedRequests/counters.batches : 0.0) << " on average, "
+             << counters.dropped << " slow clients dropped" << endl;
+        Stats::writeText(cerr);
+        return 0;
+    } catch (exception const &error) {
+        cerr << "server: " << error.what() << endl;
+        return 1;
+    }
+}
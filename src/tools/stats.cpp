@@ -0,0 +1,71 @@
+//Sidecar reader for the Stats shared page: maps /dev/shm/fastcode-stats-<pid>
+//(or a FASTCODE_STATS_SHM name) read-only and prints the same text the
+//FASTCODE_STATS_SOCKET endpoint serves, once or every --interval seconds.
+//
+//  make tools && ./tools/stats 1234 [--interval 5]
+//              ./tools/stats /my-stats-page
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <string>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "Stats.h"
+
+using namespace std;
+
+static void usage()
+{
+    cerr << "usage: stats PID|SHM_NAME [--interval SECONDS]" << endl;
+    exit(2);
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc != 2 && argc != 4)
+        usage();
+
+    string name = argv[1];
+    if (name.find_first_not_of("0123456789") == string::npos)
+        name = "/fastcode-stats-" + name;
+
+    double interval = 0;
+    if (argc == 4) {
+        if (string(argv[2]) != "--interval")
+            usage();
+        interval = atof(argv[3]);
+    }
+
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        cerr << "stats: no shared page " << name << endl;
+        return 1;
+    }
+
+    void* memory = mmap(NULL, sizeof(Stats::Page), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED) {
+        cerr << "stats: cannot map " << name << endl;
+        return 1;
+    }
+
+    Stats::Page const &page = *(Stats::Page const*) memory;
+    if (memcmp(page.magic, Stats::PAGE_MAGIC, sizeof(Stats::PAGE_MAGIC)) != 0
+        || page.version != Stats::PAGE_VERSION || page.bytes != (int)sizeof(Stats::Page)) {
+        cerr << "stats: " << name << " is not a version " << Stats::PAGE_VERSION << " stats page" << endl;
+        return 1;
+    }
+
+    for (;;) {
+        Stats::writeText(cout, page);
+        cout.flush();
+        if (interval <= 0)
+            break;
+        usleep((useconds_t)(interval*1e6));
+        cout << "\n";
+    }
+
+    munmap(memory, sizeof(Stats::Page));
+    return 0;
+}
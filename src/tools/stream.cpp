@@ -0,0 +1,127 @@
+//Streaming throughput of one Model run whole per frame against the same Model
+//split into LayerPipeline stages on separate core groups; prints the
+//partition, per-stage load and frames/sec of both.
+//
+//  make tools && ./tools/stream [--network tiny|vgg16|mobilenet] [--input 64] [--stages 4]
+//                               [--frames 32] [--depth 4] [--measured] [--tune]
+#include <algorithm>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Autotuner.h"
+#include "LayerPipeline.h"
+#include "Model.h"
+#include "Network.h"
+#include "Timer.h"
+
+using namespace std;
+
+static void usage()
+{
+    cerr << "usage: stream [--network tiny|vgg16|mobilenet] [--input N] [--stages N] [--frames N]\n"
+         << "              [--depth N] [--measured] [--tune]" << endl;
+    exit(2);
+}
+
+int main(int argc, char* argv[])
+{
+    string networkName = "tiny";
+    int input = 64, stages = 4, frames = 32, depth = 4;
+    bool measured = false, tune = false;
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (arg == "--measured") {
+            measured = true;
+        } else if (arg == "--tune") {
+            tune = true;
+        } else if (!hasValue) {
+            usage();
+        } else if (arg == "--network") {
+            networkName = argv[++i];
+        } else if (arg == "--input") {
+            input = atoi(argv[++i]);
+        } else if (arg == "--stages") {
+            stages = atoi(argv[++i]);
+        } else if (arg == "--frames") {
+            frames = atoi(argv[++i]);
+        } else if (arg == "--depth") {
+            depth = atoi(argv[++i]);
+        } else {
+            usage();
+        }
+    }
+
+    if (input < 1 || stages < 1 || frames < 1 || depth < 1)
+        usage();
+
+    try {
+        LayerShape shape = {input, input, 3};
+        Model model(Network::byName(networkName), shape);
+        if (tune) {
+            Autotuner autotuner;
+            model.tune(autotuner);
+        }
+
+        vector<double> planes(model.inputSize()), scores(model.outputSize());
+        for (size_t i = 0; i < planes.size(); i++)
+            planes[i] = rand() % 256;
+
+        //whole model per frame, OpenMP over every core
+        model.forward(planes.data(), scores.data());
+        unsigned long long begin = Timer::rdtsc();
+        for (int f = 0; f < frames; f++)
+            model.forward(planes.data(), scores.data());
+        double sequential = Timer::seconds(Timer::rdtsc() - begin);
+
+        vector<double> costs = measured ? LayerPipeline::measureLayers(model, 3) : LayerPipeline::layerFlops(model);
+        LayerPipeline pipeline(model, costs, stages, depth);
+        pipeline.start();
+
+        begin = Timer::rdtsc();
+        thread producer([&]() {
+            for (int f = 0; f < frames; f++)
+                pipeline.push(planes.data());
+            pipeline.close();
+        });
+        int received = 0;
+        while (pipeline.pop(scores.data()))
+            received++;
+        producer.join();
+        double streamed = Timer::seconds(Timer::rdtsc() - begin);
+
+        vector<LayerSpec> const &layers = model.getNetwork().getLayers();
+        double total = 0;
+        for (size_t l = 0; l < costs.size(); l++)
+            total += costs[l];
+
+        cout << networkName << " " << input << "x" << input << ", " << received << " frames, costs by "
+             << (measured ? "measured time" : "FLOPs") << endl;
+        cout << left << setw(7) << "stage" << setw(24) << "layers" << setw(10) << "cpus" << right
+             << setw(8) << "cost%" << setw(9) << "busy%" << setw(10) << "starved%" << endl;
+        vector<LayerPipeline::Stage> report = pipeline.getStages();
+        for (size_t s = 0; s < report.size(); s++) {
+            LayerPipeline::Stage const &stage = report[s];
+            string range = layers[stage.first].name + ".." + layers[stage.end - 1].name;
+            string cpus = to_string(stage.cpus.front());
+            if (stage.cpus.size() > 1)
+                cpus += "-" + to_string(stage.cpus.back());
+            cout << left << setw(7) << s << setw(24) << range << setw(10) << cpus << right << fixed << setprecision(1)
+                 << setw(8) << 100*stage.cost/total
+                 << setw(9) << 100*stage.busySeconds/streamed
+                 << setw(10) << 100*stage.starvedSeconds/streamed << endl;
+        }
+        cout << setprecision(2) << "whole model: " << frames/sequential << " frames/s, "
+             << "layer pipeline: " << received/streamed << " frames/s ("
+             << sequential/streamed << "x)" << endl;
+        return 0;
+    } catch (exception const &error) {
+        cerr << "stream: " << error.what() << endl;
+        return 1;
+    }
+}